@@ -15,7 +15,11 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 #include <stdlib.h>
+#include <string.h>
 #include "providerinterface.h"
+#include "xen_stats.h"
+#include "xen_probes.h"
+#include "xen_frozen.h"
 
 #include "ProxyHelper.h"
 
@@ -24,6 +28,8 @@
 const XenProviderInstanceFT* Xen_HostPool_Load_Instance_Provider();
 const XenProviderInstanceFT* Xen_Services_Load_Instance_Provider();
 const XenProviderInstanceFT* Xen_MetricService_Load_Instance_Provider();
+const XenProviderInstanceFT* Xen_MetricAlertRule_Load_Instance_Provider();
+const XenProviderInstanceFT* Xen_ProviderStatistics_Load_Instance_Provider();
 const XenProviderInstanceFT* Xen_Job_Load_Instance_Provider();
 const XenProviderInstanceFT* Xen_ComputerSystem_Load_Instance_Provider();
 const XenProviderInstanceFT* Xen_Processor_Load_Instance_Provider();
@@ -108,6 +114,8 @@ xen_instance_provider g_instance_providers[] =  {
     {"Xen_KVPSettingData", Xen_KVP_Load_Instance_Provider},
 
     {"Xen_MetricService", Xen_MetricService_Load_Instance_Provider},
+    {"Xen_MetricAlertRule", Xen_MetricAlertRule_Load_Instance_Provider},
+    {"Xen_ProviderStatistics", Xen_ProviderStatistics_Load_Instance_Provider},
     {"Xen_HostProcessorUtilization", Xen_HostComputerSystem_Load_Instance_Provider},
     {"Xen_HostNetworkPortReceiveThroughput", Xen_HostNetworkPort_Load_Instance_Provider},
     {"Xen_HostNetworkPortTransmitThroughput", Xen_HostNetworkPort_Load_Instance_Provider},
@@ -236,6 +244,193 @@ const XenProviderInstanceFT* prov_pxy_load_xen_instance_provider(
     }
     return ft;
 }
+/* The classes whose instances are all constants, nothing about them comes
+   from xapi. They're served from xen_frozen, see prov_pxy_frozen() */
+typedef struct _frozen_class{
+    char *classname;
+    char *provider; /* the provider it is registered to, keep in sync with the schema */
+} xen_frozen_class_entry;
+
+static const xen_frozen_class_entry g_frozen_classes[] = {
+    {"Xen_VirtualizationCapabilities", "Xen_ProviderCommon"},
+};
+#define PXY_MAX_FROZEN_INSTANCES 16
+/*****************************************************************************
+ * Builds the instances of a frozen class in a namespace with the provider's
+ * own functions, without a session, and freezes them
+ *****************************************************************************/
+static const xen_frozen_class *_pxy_freeze(
+    const CMPIBroker *broker,
+    const XenProviderInstanceFT* ft,
+    const char *ns,
+    const char *classname
+    )
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    CMPIInstance *instances[PXY_MAX_FROZEN_INSTANCES];
+    provider_resource_list resources;
+    provider_resource prov_res;
+    const xen_frozen_class *cls = NULL;
+    int count = 0, i;
+    CMPIrc rc;
+
+    memset(&resources, 0, sizeof(resources));
+    resources.broker = broker;
+    resources.classname = xen_utils_intern(classname);
+    if(ft->xen_resource_list_enum(NULL, &resources) != CMPI_RC_OK) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Could not list the instances of %s", classname));
+        return NULL;
+    }
+    while(1) {
+        memset(&prov_res, 0, sizeof(prov_res));
+        prov_res.broker = broker;
+        prov_res.classname = resources.classname;
+        rc = ft->xen_resource_record_getnext(&resources, NULL, &prov_res);
+        if(rc == CMPI_RC_ERR_NOT_FOUND)
+            break;
+        resources.current_resource++;
+        if(rc == CMPI_RC_OK && count == PXY_MAX_FROZEN_INSTANCES) {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Too many instances of %s to freeze", classname));
+            rc = CMPI_RC_ERR_FAILED;
+        }
+        else if(rc == CMPI_RC_OK) {
+            CMPIObjectPath *op = CMNewObjectPath(broker, ns, classname, &status);
+            CMPIInstance *inst = NULL;
+            if(status.rc == CMPI_RC_OK && !CMIsNullObject(op)) {
+                inst = CMNewInstance(broker, op, &status);
+                CMRelease(op); /* the instance has a copy of its own */
+            }
+            if(status.rc == CMPI_RC_OK && !CMIsNullObject(inst) &&
+               ft->xen_resource_set_properties(&prov_res, inst) == CMPI_RC_OK)
+                instances[count++] = inst;
+            else {
+                if(!CMIsNullObject(inst))
+                    CMRelease(inst);
+                rc = CMPI_RC_ERR_FAILED;
+            }
+        }
+        ft->xen_resource_record_cleanup(&prov_res);
+        if(rc != CMPI_RC_OK)
+            goto Exit; /* no instance may be missing */
+    }
+    cls = xen_frozen_add(ns, classname, instances, count);
+
+Exit:
+    /* xen_frozen keeps copies, these were only the templates. Nothing
+       reclaims them when freezing at load, outside of any request. */
+    for(i=0; i<count; i++)
+        CMRelease(instances[i]);
+    ft->xen_resource_list_cleanup(&resources);
+    return cls;
+}
+/*****************************************************************************
+ * The frozen instances of a class, built the first time they are needed in a
+ * namespace. Returns NULL if the class isn't one of g_frozen_classes, or its
+ * instances couldn't be built, in which case the caller serves it as usual.
+ *
+ * @param in broker - CMPI services factory broker
+ * @param in ft - xen backend provider function table
+ * @param in ns - CIM namespace
+ * @param in classname - CIM classname
+ * @return the frozen instances, NULL if there are none
+ *****************************************************************************/
+const xen_frozen_class *prov_pxy_frozen(
+    const CMPIBroker *broker,
+    const XenProviderInstanceFT* ft,
+    const char *ns,
+    const char *classname
+    )
+{
+    const xen_frozen_class *cls;
+    int i;
+
+    if(ns == NULL || classname == NULL)
+        return NULL;
+    for (i=0; i<sizeof(g_frozen_classes)/sizeof(g_frozen_classes[0]); i++) {
+        if(strcmp(g_frozen_classes[i].classname, classname) == 0)
+            break;
+    }
+    if(i == sizeof(g_frozen_classes)/sizeof(g_frozen_classes[0]))
+        return NULL;
+    if((cls = xen_frozen_find(ns, classname)) != NULL)
+        return cls;
+    if(ft == NULL && (ft = prov_pxy_load_xen_instance_provider(broker, classname)) == NULL)
+        return NULL;
+    return _pxy_freeze(broker, ft, ns, classname);
+}
+/*****************************************************************************
+ * Freezes the g_frozen_classes registered to a provider in a namespace, so
+ * that the first request for them doesn't have to. The classes of other
+ * providers are left to be frozen on first use, if they're ever asked for.
+ *
+ * @param in broker - CMPI services factory broker
+ * @param in ns - CIM namespace
+ * @param in provider - name of the provider being initialized
+ *****************************************************************************/
+void prov_pxy_freeze_all(
+    const CMPIBroker *broker,
+    const char *ns,
+    const char *provider
+    )
+{
+    int i;
+    for (i=0; i<sizeof(g_frozen_classes)/sizeof(g_frozen_classes[0]); i++) {
+        if(strcmp(g_frozen_classes[i].provider, provider) == 0)
+            prov_pxy_frozen(broker, NULL, ns, g_frozen_classes[i].classname);
+    }
+}
+/*****************************************************************************
+ * A resource list and what the proxy needs to page through it. The providers
+ * only get to see the provider_resource_list at the start.
+ *****************************************************************************/
+#define PXY_DEFAULT_PAGE_SIZE 256
+
+typedef struct {
+    provider_resource_list resources;
+    bool end;                           /* the provider has no more resources */
+} pxy_resource_list;
+
+/*****************************************************************************
+ * How many objects a paging provider fetches at a time, XEN_CIM_ENUM_PAGE_SIZE.
+ *****************************************************************************/
+static int _pxy_page_size()
+{
+    char *size = getenv("XEN_CIM_ENUM_PAGE_SIZE");
+    if (size && *size && atoi(size) >= 0)
+        return atoi(size);
+    return PXY_DEFAULT_PAGE_SIZE;
+}
+/*****************************************************************************
+ * Allocates a provider resource (or resource list) from the CIM operation's
+ * arena if there is one, from the heap otherwise. A resource is allocated
+ * in the frame of its mark, a resource list for the rest of the call.
+ *****************************************************************************/
+static void *_pxy_alloc(
+    xen_utils_arena *arena,
+    const xen_utils_arena_mark *mark,
+    size_t size)
+{
+    if (arena && mark)
+        return xen_utils_arena_alloc_for(arena, mark, size);
+    if (arena)
+        return xen_utils_arena_alloc(arena, size);
+    return calloc(1, size);
+}
+/*****************************************************************************
+ * Gives back a provider resource and all the scratch memory the provider
+ * allocated for it from the arena since. Only the last resource allocated
+ * is given back right away: one released out of order, while a resource or
+ * a resource list allocated after it is still in use, stays in the arena
+ * until the end of the call.
+ *****************************************************************************/
+static void _pxy_resource_free(
+    provider_resource *prov_res)
+{
+    if (prov_res->arena)
+        xen_utils_arena_rewind(prov_res->arena, prov_res->arena_mark);
+    else
+        free(prov_res);
+}
 /*****************************************************************************
  * Enumerates all xen objects identified by the CIM classname 
  *
@@ -244,6 +439,7 @@ const XenProviderInstanceFT* prov_pxy_load_xen_instance_provider(
  * @param in classnem - CIM classname identifying the xen object
  * @param in ctx - caller's context
  * @param in properties - properties that the caller is interested in
+ * @param in query - conditions on the resources from an ExecQuery, can be NULL
  * @param out res-list - xen resource list
  * @return CMPIrc error codes
  *****************************************************************************/
@@ -254,10 +450,12 @@ CMPIrc prov_pxy_begin(
     void *ctx, 
     bool refs_only,
     const char **properties,
+    const xen_query *query,
     void **res_list
     )
 {
     CMPIrc rc = CMPI_RC_OK;
+    pxy_resource_list *pxy_list = NULL;
     provider_resource_list *resources = NULL;
     xen_utils_session *session = NULL;
     (void)properties;
@@ -267,41 +465,82 @@ CMPIrc prov_pxy_begin(
         return CMPI_RC_ERR_FAILED;
     }
 
+    uint64_t start = xen_stats_now();
     if(!xen_utils_validate_session(&session, ctx)) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
             ("--- Unable to establish connection with Xen"));
         return CMPI_RC_ERR_FAILED;
     }
-    resources = (provider_resource_list *)calloc(1, sizeof(provider_resource_list));
-    if(resources == NULL) {
+    xen_stats_phase_end(xen_stats_phase_session, start);
+    xen_utils_arena *arena = ((struct xen_call_context *)ctx)->arena;
+    pxy_list = (pxy_resource_list *)_pxy_alloc(arena, NULL, sizeof(pxy_resource_list));
+    if(pxy_list == NULL) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Could not allocate memory for resources"));
         return CMPI_RC_ERR_FAILED;
     }
+    resources = &pxy_list->resources;
     resources->broker = broker;
-    resources->classname = classname;
+    resources->classname = xen_utils_intern(classname);
     resources->session = session;
     resources->ref_only = refs_only;
+    resources->arena = arena;
+    resources->query = query;
+    if(ft->xen_resource_list_next_page)
+        resources->page_size = _pxy_page_size();
+    resources->position[0] = '\0';
 
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Begin enumerating %s", classname));
 
     /* Make Xen call to populate the resources list */
+    XEN_PROBE1(enum__entry, resources->classname);
+    start = xen_stats_now();
     rc = ft->xen_resource_list_enum(session, resources);
+    xen_stats_phase_end(xen_stats_phase_list_enum, start);
+    XEN_PROBE2(enum__return, resources->classname, rc);
     if(rc != CMPI_RC_OK)  {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Error Did not get xen resource list"));       
         goto Error;
     }
-    *res_list = (void *)resources;
+    *res_list = (void *)pxy_list;
     return rc;
 
 Error:
     xen_utils_trace_error(session->xen, __FILE__, __LINE__);
     ft->xen_resource_list_cleanup(resources);
     xen_utils_cleanup_session(session);
-    if(resources)
-        free(resources);
+    if(!resources->arena)
+        free(pxy_list);
 
     return CMPI_RC_ERR_FAILED;
 }
+/*****************************************************************************
+ * Moves a paging provider on to its next page, if it has one
+ *
+ * @return true if there's a new page to get resources from
+ *****************************************************************************/
+static bool _pxy_next_page(
+    const XenProviderInstanceFT* ft,
+    pxy_resource_list *pxy_list)
+{
+    provider_resource_list *resources = &pxy_list->resources;
+    if(ft->xen_resource_list_next_page == NULL || resources->position[0] == '\0')
+        return false;
+
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Next page of %s from %s", resources->classname,
+                                           resources->position));
+    resources->current_resource = 0;
+    uint64_t start = xen_stats_now();
+    CMPIrc rc = ft->xen_resource_list_next_page(resources->session, resources);
+    xen_stats_phase_end(xen_stats_phase_list_enum, start);
+    if(rc != CMPI_RC_OK) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error getting the next page of %s",
+                                                resources->classname));
+        xen_utils_trace_error(resources->session->xen, __FILE__, __LINE__);
+        resources->position[0] = '\0';
+        return false;
+    }
+    return true;
+}
 /*****************************************************************************
  * Cleansup the xen resource list
  *
@@ -316,9 +555,12 @@ void prov_pxy_end(
     provider_resource_list *resources = (provider_resource_list *)res_list;
     if(resources) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("End enumerating %s", resources->classname));
+        uint64_t start = xen_stats_now();
         ft->xen_resource_list_cleanup(resources);
         xen_utils_cleanup_session(resources->session);
-        free(resources);
+        if(!resources->arena)
+            free(resources); /* and the pxy_resource_list it starts */
+        xen_stats_phase_end(xen_stats_phase_cleanup, start);
     }
 }
 /*****************************************************************************
@@ -338,6 +580,7 @@ CMPIrc prov_pxy_getnext(
     )
 {
     CMPIrc rc = CMPI_RC_OK;
+    pxy_resource_list *pxy_list = (pxy_resource_list *)res_list;
     provider_resource_list *resources_list = (provider_resource_list *)res_list;
     (void)properties;
     if(resources_list == NULL || res == NULL) {
@@ -345,14 +588,21 @@ CMPIrc prov_pxy_getnext(
                      ("Error getnext:resource_list or res is NULL"));
         return CMPI_RC_ERR_FAILED;
     }
+    if(pxy_list->end)
+        return CMPI_RC_ERR_NOT_FOUND;
 
     /* Get the current resource record. */
     RESET_XEN_ERROR(resources_list->session->xen);
-    provider_resource *prov_res = calloc(1, sizeof(provider_resource));
+    xen_utils_arena_mark mark = {NULL, 0};
+    if(resources_list->arena)
+        mark = xen_utils_arena_get_mark(resources_list->arena);
+    provider_resource *prov_res = _pxy_alloc(resources_list->arena, &mark, sizeof(provider_resource));
     if(prov_res == NULL) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Error calloc failed"));
         return CMPI_RC_ERR_FAILED;
     }
+    prov_res->arena = resources_list->arena;
+    prov_res->arena_mark = mark;
 
     /* Copy over the broker and other useful data to the provider's resource */
     prov_res->broker = resources_list->broker;
@@ -360,14 +610,22 @@ CMPIrc prov_pxy_getnext(
     prov_res->session = resources_list->session;
     prov_res->ref_only = resources_list->ref_only;
     prov_res->cleanupsession = false;
+    XEN_PROBE2(getnext__entry, prov_res->classname, resources_list->current_resource);
+    uint64_t start = xen_stats_now();
     rc = ft->xen_resource_record_getnext(resources_list, resources_list->session, prov_res);
+    while(rc == CMPI_RC_ERR_NOT_FOUND && _pxy_next_page(ft, pxy_list))
+        rc = ft->xen_resource_record_getnext(resources_list, resources_list->session, prov_res);
+    xen_stats_phase_end(xen_stats_phase_getnext, start);
+    XEN_PROBE2(getnext__return, prov_res->classname, rc);
     if(rc != CMPI_RC_OK) {
       if(rc != CMPI_RC_ERR_NOT_FOUND) {
             _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error getnext OK not received "));
 	    resources_list->current_resource++; /*Failure to retrieve this record - continue anyway */
       }
+      else
+            pxy_list->end = true;
         ft->xen_resource_record_cleanup(prov_res);
-        free(prov_res);
+        _pxy_resource_free(prov_res);
         return rc;
     }
     resources_list->current_resource++; /*increment the resource index for the next round */
@@ -426,29 +684,43 @@ CMPIrc prov_pxy_get(
         return CMPI_RC_ERR_FAILED;
     }
 
+    uint64_t start = xen_stats_now();
     if(!xen_utils_validate_session(&session, caller_id)) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Unable to establish connection with Xen"));
         return CMPI_RC_ERR_FAILED;
     }
+    xen_stats_phase_end(xen_stats_phase_session, start);
 
-    provider_resource *prov_res = calloc(1, sizeof(provider_resource));
+    xen_utils_arena_mark mark = {NULL, 0};
+    if(caller_id->arena)
+        mark = xen_utils_arena_get_mark(caller_id->arena);
+    provider_resource *prov_res = _pxy_alloc(caller_id->arena, &mark, sizeof(provider_resource));
     if(prov_res == NULL) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Out of memory"));
         return CMPI_RC_ERR_FAILED;
     }
 
+    prov_res->arena = caller_id->arena;
+    prov_res->arena_mark = mark;
     prov_res->broker = broker;
-    prov_res->classname = CMGetCharPtr(cn);
+    prov_res->classname = xen_utils_intern(CMGetCharPtr(cn));
     prov_res->session = session;
     prov_res->cleanupsession = true;
 
+    XEN_PROBE2(get__entry, prov_res->classname, res_uuid);
+    start = xen_stats_now();
     rc = ft->xen_resource_record_get_from_id(res_uuid, session, prov_res);
+    xen_stats_phase_end(xen_stats_phase_get, start);
+    XEN_PROBE2(get__return, prov_res->classname, rc);
     if(rc != CMPI_RC_OK)
     {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Error get(): get_xen_resource_record_from_id failed"));
+        /* Tell a resource that isn't there from xapi failing */
+        if(rc == CMPI_RC_ERR_FAILED && xen_utils_error_is_not_found(session->xen))
+            rc = CMPI_RC_ERR_NOT_FOUND;
         ft->xen_resource_record_cleanup(prov_res);
 	xen_utils_cleanup_session(session);
-        free(prov_res);
+        _pxy_resource_free(prov_res);
         return rc;
     }
     *res = (void *)prov_res;
@@ -482,7 +754,14 @@ CMPIrc prov_pxy_setproperties(
 
     const char **keys = ft->xen_resource_get_keys(resource->broker, resource->classname);
     CMSetPropertyFilter(inst, properties, keys);
-    return ft->xen_resource_set_properties(resource, inst);
+    XEN_PROBE1(setproperties__entry, resource->classname);
+    uint64_t start = xen_stats_now();
+    CMPIrc rc = ft->xen_resource_set_properties(resource, inst);
+    xen_stats_phase_end(xen_stats_phase_set_properties, start);
+    XEN_PROBE2(setproperties__return, resource->classname, rc);
+    if(rc == CMPI_RC_OK)
+        xen_stats_instance();
+    return rc;
 }
 /*****************************************************************************
  * Release a xen resource record
@@ -497,11 +776,12 @@ void prov_pxy_release(
 {
     provider_resource *prov_res = (provider_resource *)res;
     if(prov_res)  {
+        uint64_t start = xen_stats_now();
         ft->xen_resource_record_cleanup(prov_res);
         if(prov_res->cleanupsession)
             xen_utils_cleanup_session(prov_res->session);
-        if(prov_res)
-            free(prov_res);
+        _pxy_resource_free(prov_res);
+        xen_stats_phase_end(xen_stats_phase_cleanup, start);
     }
 }
 /*****************************************************************************
@@ -1,6 +1,19 @@
 CMPIrc prov_pxy_init();
 CMPIrc prov_pxy_uninit();
 
+const xen_frozen_class *prov_pxy_frozen(
+    const CMPIBroker *broker,
+    const XenProviderInstanceFT* ft,
+    const char *ns,
+    const char *classname
+    );
+
+void prov_pxy_freeze_all(
+    const CMPIBroker *broker,
+    const char *ns,
+    const char *provider
+    );
+
 CMPIrc prov_pxy_begin(
     const CMPIBroker *broker,
     const XenProviderInstanceFT* ft,
@@ -8,6 +21,7 @@ CMPIrc prov_pxy_begin(
     void *ctx, 
     bool refs_only,
     const char **properties,
+    const xen_query *query,
     void **res_list
     );
 
@@ -25,6 +25,8 @@
 #include "cmpitrace.h"
 #include "cmpiutil.h"
 #include "providerinterface.h"
+#include "xen_stats.h"
+#include "xen_frozen.h"
 
 #include "ProxyHelper.h"
 #include "Xen_Job.h"
@@ -85,7 +87,7 @@ static int op2inst(
         key = CMGetKeyAt(op, i, &keyname, &status);
         if (status.rc != CMPI_RC_OK) {
 	  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: failed to retrieve key at position %d/%d", i, numkeys));
-	  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("CMGetKeyAt failed with '%s'",status.msg)); 
+	  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("CMGetKeyAt failed with '%s'", status.msg ? CMGetCharPtr(status.msg) : "")); 
             goto exit;
 	}
         status = CMSetProperty(*inst, CMGetCharPtr(keyname), &(key.value), key.type);
@@ -107,9 +109,10 @@ static int op2inst(
  * @param in ft - xen provider's function table
  * @param in properties - array of properties that caller cares about
  * @param out res - xen resource identified by the CIM reference
- * @return int 0 on error, 1 on success
+ * @return CMPIrc error codes, CMPI_RC_ERR_NOT_FOUND if there is no such
+ *         resource
  *****************************************************************************/
-static int getres4op(
+static CMPIrc getres4op(
     CMPIObjectPath* op, 
     struct xen_call_context *caller_ctx,
     const XenProviderInstanceFT *ft,
@@ -121,10 +124,10 @@ static int getres4op(
     void* resId = NULL;
     *res = NULL;
     CMPIInstance* inst;
-    int rc = 0;
 
     if (!op2inst(op, &inst)){
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: cannot convert op2inst"));
+        status.rc = CMPI_RC_ERR_FAILED;
         goto exit;
     }
 
@@ -141,16 +144,15 @@ static int getres4op(
       _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: cannot get object by ID"));
         goto exit;
     }
-    rc = 1;
 
     exit:
     if (resId)
         prov_pxy_releaseid(ft, resId);
-    if(rc == 0 && *res != NULL) {
+    if(status.rc != CMPI_RC_OK && *res != NULL) {
         prov_pxy_release(ft, *res);
         *res = NULL;
     }
-    return rc;
+    return status.rc;
 }
 /*****************************************************************************
  * CMPI interace function.
@@ -176,6 +178,65 @@ CMPIStatus XenCommonCleanup(
             "CMPILIFY unload() failed");
     return status;
 }
+/*****************************************************************************
+ * enum_call() for a class whose instances are frozen: they are cloned, there
+ * is no session or provider involved.
+ *
+ * @param out result - results containing enumeration
+ * @param in frozen - the frozen instances of the class
+ * @param in ns - namespace of the enumeration
+ * @param in properties - properties that caller cares about, if CIM instance enum
+ * @param in refs_only - references or instanes
+ * @param out found - number of instances returned
+ * @return CMPIStatus error codes
+ *****************************************************************************/
+static CMPIStatus enum_frozen(
+    const CMPIResult* rslt,
+    const xen_frozen_class *frozen,
+    const char* ns,
+    const char** properties,
+    bool refs_only,
+    unsigned int *found
+    )
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    int count = xen_frozen_count(frozen);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        const CMPIInstance *frozen_inst = xen_frozen_get(frozen, i);
+        if (refs_only) {
+            /* Return the CMPIObjectPath for the instance. */
+            CMPIObjectPath *op = CMGetObjectPath(frozen_inst, &status);
+            if ((status.rc != CMPI_RC_OK) || CMIsNullObject(op)) {
+                CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+                break;
+            }
+            status = CMSetNameSpace(op, ns);
+            if (status.rc == CMPI_RC_OK)
+                status = CMReturnObjectPath(rslt, op);
+        }
+        else {
+            /* Return a copy of the instance. */
+            CMPIInstance *inst = xen_frozen_clone(frozen_inst, properties, NULL);
+            if (inst == NULL) {
+                CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+                break;
+            }
+            status = CMReturnInstance(rslt, inst);
+            CMRelease(inst);
+        }
+        if (status.rc != CMPI_RC_OK) {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, 
+                         ("Returning frozen instance failed with %d", status.rc));
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            break;
+        }
+        xen_stats_instance();
+        (*found)++;
+    }
+    return status;
+}
 /*****************************************************************************
  * Common code to enumerate both CIM references and CIM instances
  *
@@ -186,6 +247,9 @@ CMPIStatus XenCommonCleanup(
  * @param in properties - properties that caller cares about, if CIM instance enum
  * @param in refs_only - references or instanes
  * @return CMPIStatus error codes
+ *
+ * The classes whose instances are all constants are served from their
+ * frozen instances (see xen_frozen.h), without a session.
  *****************************************************************************/
 CMPIStatus enum_call(
     CMPIInstanceMI* mi, 
@@ -203,12 +267,23 @@ CMPIStatus enum_call(
     unsigned int found = 0;
     CMPIObjectPath* op;
     CMPIInstance* inst;
+    CMPIrc rc;
+    struct xen_call_context *ctx = NULL;
 
     _SBLIM_ENTER("CMPILIFYInstance_enumInstanceNames");
     CMPIString *cn = CMGetClassName(ref, &status);
     char *classname = CMGetCharPtr(cn);
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, refs_only ? xen_stats_op_enum_instance_names :
+                         xen_stats_op_enum_instances, classname, NULL);
+    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
+
+    const xen_frozen_class *frozen = prov_pxy_frozen(_BROKER, NULL, ns, classname);
+    if (frozen) {
+        status = enum_frozen(rslt, frozen, ns, properties, refs_only, &found);
+        goto done;
+    }
 
-    struct xen_call_context *ctx = NULL;
     if (!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)) {
         goto exit;
     }
@@ -219,14 +294,14 @@ CMPIStatus enum_call(
     }
 
     /* Get list of resources. */
-    if (prov_pxy_begin(_BROKER, ft, classname, ctx, refs_only, NULL, &resList) != CMPI_RC_OK) {
+    rc = prov_pxy_begin(_BROKER, ft, classname, ctx, refs_only, NULL, NULL, &resList);
+    if (rc != CMPI_RC_OK) {
         CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED, 
             "CMPILIFY begin() failed");
         goto exit;
     }
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("enumerate resource"));
     /* Enumerate resources and return CMPIObjectPath for each. */
-    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
     while (1) {
         /* Create new CMPIObjectPath for next resource. */
         op = CMNewObjectPath(_BROKER, ns, classname, &status);
@@ -244,7 +319,6 @@ CMPIStatus enum_call(
                          ("ERROR: CMNewInstance  failed with %d", status.rc));
             break;
         }
-	CMPIrc rc = CMPI_RC_OK;
 	rc = prov_pxy_getnext(ft, resList, NULL, &res);
         /* Get the next resource using the resource provider's getNext(). */
         if (rc != CMPI_RC_OK) {
@@ -316,6 +390,7 @@ CMPIStatus enum_call(
     } /* while() */
     prov_pxy_end(ft, resList);
 
+    done:
     /* Check if enumeration finished OK. */
     if (found) {
         if ((status.rc == CMPI_RC_OK) || (status.rc == CMPI_RC_ERR_NOT_FOUND)) {
@@ -328,6 +403,7 @@ CMPIStatus enum_call(
     if (ctx)
         xen_utils_free_call_context(ctx);
 
+    xen_stats_call_end(&stats, status.rc);
     _SBLIM_RETURNSTATUS(status);
 
 }
@@ -366,6 +442,9 @@ CMPIStatus XenCommonEnumInstances(
  * @param in ref - CIM reference to the CIM object being acquired (classname and keys)
  * @param in properties - properties that caller cares about, if CIM instance enum
  * @return CMPIStatus error codes
+ *
+ * An instance of a class whose instances are all constants is a copy of the
+ * frozen one (see xen_frozen.h), there's no session involved.
  *****************************************************************************/
 CMPIStatus XenCommonGetInstance(
     CMPIInstanceMI* mi, 
@@ -377,8 +456,35 @@ CMPIStatus XenCommonGetInstance(
     CMPIStatus status = {CMPI_RC_OK, NULL};
     void* res = NULL;
     CMPIInstance* inst;
+    struct xen_call_context *ctx = NULL;
     _SBLIM_ENTER("CMPILIFYInstance_getInstance");
     CMPIString *cn = CMGetClassName(ref, &status);
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_get_instance, CMGetCharPtr(cn), NULL);
+
+    const xen_frozen_class *frozen = prov_pxy_frozen(_BROKER, NULL,
+        CMGetCharPtr(CMGetNameSpace(ref, NULL)), CMGetCharPtr(cn));
+    if (frozen) {
+        const CMPIInstance *frozen_inst = xen_frozen_lookup(frozen, ref);
+        if (frozen_inst == NULL) {
+            CMSetStatus(&status, CMPI_RC_ERR_NOT_FOUND);
+            goto exit;
+        }
+        inst = xen_frozen_clone(frozen_inst, properties, NULL);
+        if (inst == NULL) {
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            goto exit;
+        }
+        status = CMReturnInstance(rslt, inst);
+        CMRelease(inst);
+        if (status.rc != CMPI_RC_OK) {
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            goto exit;
+        }
+        xen_stats_instance();
+        CMReturnDone(rslt);
+        goto exit;
+    }
 
 
     /* Create new CMPIInstance for resource. */
@@ -397,7 +503,6 @@ CMPIStatus XenCommonGetInstance(
         }
     }
 
-    struct xen_call_context *ctx = NULL;
     if (!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, 
                      ("xen_utils_get_call_context failed"));
@@ -410,7 +515,7 @@ CMPIStatus XenCommonGetInstance(
         goto exit;
     }
     /* Get the target resource. */ 
-    if (!getres4op((CMPIObjectPath*)ref, ctx, ft, properties, &res)) {
+    if (getres4op((CMPIObjectPath*)ref, ctx, ft, properties, &res) != CMPI_RC_OK) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, 
                      ("getres4op failed"));
         CMSetStatus(&status, CMPI_RC_ERR_NOT_FOUND);
@@ -440,6 +545,7 @@ CMPIStatus XenCommonGetInstance(
     if (ctx)
         xen_utils_free_call_context(ctx);
 
+    xen_stats_call_end(&stats, status.rc);
     _SBLIM_RETURNSTATUS(status);
 }
 /*****************************************************************************
@@ -469,6 +575,8 @@ CMPIStatus XenCommonCreateInstance(
     CMPIString *cn = CMGetClassName(ref, &status);
 
     _SBLIM_ENTER("CMPILIFYInstance_createInstance");
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_create_instance, CMGetCharPtr(cn), NULL);
 
     const XenProviderInstanceFT *ft = prov_pxy_load_xen_instance_provider(_BROKER, CMGetCharPtr(cn));
     if((ft == NULL) || ft->xen_resource_add == NULL) {
@@ -482,7 +590,7 @@ CMPIStatus XenCommonCreateInstance(
     }
 
     /* Check if target resource already exists. */
-    if (getres4op((CMPIObjectPath*)ref, ctx, ft, NULL, &res)) {
+    if (getres4op((CMPIObjectPath*)ref, ctx, ft, NULL, &res) == CMPI_RC_OK) {
         prov_pxy_release(ft, res);
         CMSetStatus(&status, CMPI_RC_ERR_ALREADY_EXISTS);
         goto exit;
@@ -522,6 +630,7 @@ CMPIStatus XenCommonCreateInstance(
         prov_pxy_releaseid(ft, resId);
     if (ctx) xen_utils_free_call_context(ctx);
 
+    xen_stats_call_end(&stats, status.rc);
     _SBLIM_RETURNSTATUS(status);
 }
 /*****************************************************************************
@@ -552,6 +661,8 @@ CMPIStatus XenCommonModifyInstance(
     CMPIString *cn = CMGetClassName(ref, &status);
 
     _SBLIM_ENTER("CMPILIFYInstance_modifyInstance");
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_modify_instance, CMGetCharPtr(cn), NULL);
 
     const XenProviderInstanceFT *ft = prov_pxy_load_xen_instance_provider(_BROKER, CMGetCharPtr(cn));
     if(ft == NULL || ft->xen_resource_modify == NULL) {
@@ -564,7 +675,7 @@ CMPIStatus XenCommonModifyInstance(
     }
 
     /* Get the target resource. */
-    if (!getres4op((CMPIObjectPath*)ref, ctx, ft, NULL, &res)) {
+    if (getres4op((CMPIObjectPath*)ref, ctx, ft, NULL, &res) != CMPI_RC_OK) {
         CMSetStatus(&status, CMPI_RC_ERR_NOT_FOUND);
         goto exit;
     }
@@ -608,6 +719,7 @@ exit:
         prov_pxy_releaseid(ft, resId);
     if (ctx)
         xen_utils_free_call_context(ctx);
+    xen_stats_call_end(&stats, status.rc);
     _SBLIM_RETURNSTATUS(status);
 }
 /*****************************************************************************
@@ -634,6 +746,8 @@ CMPIStatus XenCommonDeleteInstance(
     CMPIString *cn = CMGetClassName(ref, &status);
 
     _SBLIM_ENTER("CMPILIFYInstance_deleteInstance");
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_delete_instance, CMGetCharPtr(cn), NULL);
 
     const XenProviderInstanceFT *ft = prov_pxy_load_xen_instance_provider(_BROKER, CMGetCharPtr(cn));
     if(ft == NULL || ft->xen_resource_delete == NULL) {
@@ -645,7 +759,7 @@ CMPIStatus XenCommonDeleteInstance(
         goto exit;
     }
     /* Get the target resource. */
-    if (!getres4op((CMPIObjectPath*)ref, ctx, ft, NULL, &res)) {
+    if (getres4op((CMPIObjectPath*)ref, ctx, ft, NULL, &res) != CMPI_RC_OK) {
         CMSetStatus(&status, CMPI_RC_ERR_NOT_FOUND);
         goto exit;
     }
@@ -679,12 +793,114 @@ exit:
     if (resId) prov_pxy_releaseid(ft, resId);
     if (ctx) xen_utils_free_call_context(ctx);
 
+    xen_stats_call_end(&stats, status.rc);
     _SBLIM_RETURNSTATUS(status);
 }
+/*****************************************************************************
+ * Returns the instance built from a resource if it matches the query
+ *
+ * @param in ft - xen provider's function table
+ * @param in rslt - where matching instances go
+ * @param in op - CIM reference for the new instance (namespace and classname)
+ * @param in res - xen resource, released
+ * @param in expr - the query
+ * @param out found - incremented if the instance matched
+ * @return CMPIStatus error codes
+ *****************************************************************************/
+static CMPIStatus return_if_match(
+    const XenProviderInstanceFT *ft,
+    const CMPIResult* rslt,
+    const CMPIObjectPath* op,
+    void* res,
+    CMPISelectExp* expr,
+    unsigned int *found)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    CMPIBoolean match;
+
+    /* Create new CMPIInstance for resource. */
+    CMPIInstance *inst = CMNewInstance(_BROKER, op, &status);
+    if ((status.rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
+        prov_pxy_release(ft, res);
+        CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Failing to create new CMPIInstance for resource"));
+        return status;
+    }
+    /* Set CMPIInstance properties from resource data. */
+    status.rc = prov_pxy_setproperties(ft, inst, res, NULL);
+    prov_pxy_release(ft, res);
+    if (status.rc != CMPI_RC_OK) {
+        CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
+            "setproperties() failed");
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Set Properties failed"));
+        return status;
+    }
+    /* Evaluate the select expression against this CMPIInstance. */
+    match = CMEvaluateSelExp(expr, inst, &status);
+    if (status.rc != CMPI_RC_OK) {
+        CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("CMPI RC Errror matching expression"));
+        return status;
+    }
+    /* Return the CMPIInstance for the resource if it match the query. */
+    if (match) {
+        status = CMReturnInstance(rslt, inst);
+        if (status.rc != CMPI_RC_OK) {
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("error returning instance"));
+            return status;
+        }
+        (*found)++;
+    }
+    return status;
+}
+/*****************************************************************************
+ * return_if_match() for a frozen instance
+ *****************************************************************************/
+static CMPIStatus return_frozen_if_match(
+    const CMPIResult* rslt,
+    const CMPIInstance* frozen_inst,
+    CMPISelectExp* expr,
+    unsigned int *found)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    CMPIBoolean match;
+
+    /* Evaluate the select expression against the frozen instance. */
+    match = CMEvaluateSelExp(expr, frozen_inst, &status);
+    if (status.rc != CMPI_RC_OK) {
+        CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("CMPI RC Errror matching expression"));
+        return status;
+    }
+    /* Return a copy of it if it matches the query. */
+    if (match) {
+        CMPIInstance *inst = xen_frozen_clone(frozen_inst, NULL, NULL);
+        if (inst == NULL) {
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            return status;
+        }
+        status = CMReturnInstance(rslt, inst);
+        CMRelease(inst);
+        if (status.rc != CMPI_RC_OK) {
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("error returning instance"));
+            return status;
+        }
+        xen_stats_instance();
+        (*found)++;
+    }
+    return status;
+}
 /*****************************************************************************
  * CMPI interface function
  * Query based CIM instance enumeration (WQL queries supported)
  *
+ * The conditions every result has to meet are pushed down: an equality on
+ * the key property gets that one resource, as GetInstance would, and the
+ * rest are handed to the provider's enumeration, which may use them to
+ * skip resources. The whole query is evaluated on what comes back.
+ *
  * @param in mi - CMPI instance function inteface
  * @param in caller_ctx - caller's context
  * @param out result - result containing instance
@@ -709,12 +925,14 @@ CMPIStatus XenCommonExecQuery(
     unsigned int found = 0;
     CMPISelectExp* expr;
     CMPIObjectPath* op;
-    CMPIInstance* inst;
-    CMPIBoolean match;
+    xen_query *pushdown = NULL;
+    struct xen_call_context *ctx = NULL;
     CMPIString *cn = CMGetClassName(ref, &status);
     char *classname = CMGetCharPtr(cn);
 
     _SBLIM_ENTER("CMPILIFYInstance_execQuery");
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_exec_query, classname, NULL);
 
     const XenProviderInstanceFT *ft = prov_pxy_load_xen_instance_provider(_BROKER, CMGetCharPtr(cn));
     if(ft == NULL) {
@@ -728,18 +946,53 @@ CMPIStatus XenCommonExecQuery(
         CMSetStatus(&status, CMPI_RC_ERR_INVALID_QUERY);
         goto exit;
     }
-    struct xen_call_context *ctx = NULL;
+    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
+
+    /* The frozen instances of a constant class are matched as they are */
+    const xen_frozen_class *frozen = prov_pxy_frozen(_BROKER, ft, ns, classname);
+    if (frozen) {
+        int i;
+        for (i = 0; i < xen_frozen_count(frozen); i++) {
+            status = return_frozen_if_match(rslt, xen_frozen_get(frozen, i), expr, &found);
+            if (status.rc != CMPI_RC_OK)
+                break;
+        }
+        goto done;
+    }
+
     if (!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)) {
         goto exit;
     }
+    pushdown = xen_query_analyse(query);
+
+    /* A query on the key selects one resource at most, get just that one */
+    const char *key_prop = ft->xen_resource_get_key_property(_BROKER, classname);
+    const char *key = xen_query_get(pushdown, key_prop);
+    if (key) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Query on %s = '%s', getting it", key_prop, key));
+        op = CMNewObjectPath(_BROKER, ns, classname, &status);
+        if ((status.rc != CMPI_RC_OK) || CMIsNullObject(op)) {
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            goto exit;
+        }
+        CMAddKey(op, key_prop, (CMPIValue *)key, CMPI_chars);
+        /* there is nothing to return if there's no such resource, but
+           xapi failing is an error, not an empty result */
+        CMPIrc rc = getres4op(op, ctx, ft, NULL, &res);
+        if (rc == CMPI_RC_OK)
+            status = return_if_match(ft, rslt, op, res, expr, &found);
+        else if (rc != CMPI_RC_ERR_NOT_FOUND)
+            CMSetStatusWithChars(_BROKER, &status, rc, "get() failed");
+        goto done;
+    }
+
     /* Get list of resources. */
-    if (prov_pxy_begin(_BROKER, ft, classname, ctx, NULL, false, &resList) != CMPI_RC_OK) {
+    if (prov_pxy_begin(_BROKER, ft, classname, ctx, false, NULL, pushdown, &resList) != CMPI_RC_OK) {
         CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
             "begin() failed");
         goto exit;
     }
     /* Enumerate resources and return CMPIObjectPath for each. */
-    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
     while (1) {
         /* Create new CMPIObjectPath for next resource. */
         op = CMNewObjectPath(_BROKER, ns, classname, &status);
@@ -748,13 +1001,6 @@ CMPIStatus XenCommonExecQuery(
 	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Failing to create new object path"));
             break;
         }
-        /* Create new CMPIInstance for resource. */
-        inst = CMNewInstance(_BROKER, op, &status);
-        if ((status.rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
-            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Failing to create new CMPIInstance for resource"));
-            break;
-        }
 
 	CMPIrc rc = CMPI_RC_OK;
 	rc = prov_pxy_getnext(ft, resList, NULL, &res);
@@ -774,35 +1020,13 @@ CMPIStatus XenCommonExecQuery(
 	    continue; /* Continue to next object in resource list */
 	}
 
-        /* Set CMPIInstance properties from resource data. */
-        status.rc = prov_pxy_setproperties(ft, inst, res, NULL);
-        prov_pxy_release(ft, res);
-        if (status.rc != CMPI_RC_OK) {
-            CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
-                "setproperties() failed");
-	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Set Properties failed"));
-            break;
-        }
-        /* Evaluate the select expression against this CMPIInstance. */
-        match = CMEvaluateSelExp(expr, inst, &status);
-        if (status.rc != CMPI_RC_OK) {
-            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("CMPI RC Errror matching expression"));
+        status = return_if_match(ft, rslt, op, res, expr, &found);
+        if (status.rc != CMPI_RC_OK)
             break;
-        }
-        /* Return the CMPIInstance for the resource if it match the query. */
-        if (match) {
-            status = CMReturnInstance(rslt, inst);
-            if (status.rc != CMPI_RC_OK) {
-                CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-		_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("error returning instance"));
-                break;
-            }
-            found++;
-        }
     } /* while() */
     prov_pxy_end(ft, resList);
 
+    done:
     /* Check if enumeration finished OK. */
     if (found) {
         if ((status.rc == CMPI_RC_OK) || (status.rc == CMPI_RC_ERR_NOT_FOUND)) {
@@ -812,8 +1036,10 @@ CMPIStatus XenCommonExecQuery(
     }
 
     exit:
+    xen_query_free(pushdown);
     if (ctx)
         xen_utils_free_call_context(ctx);
+    xen_stats_call_end(&stats, status.rc);
     _SBLIM_RETURNSTATUS(status);
 }
 /*****************************************************************************
@@ -832,6 +1058,10 @@ static void InstanceInitialize(
     _SBLIM_TRACE(2, ("--- self=\"%s\"", self->ft->miName));
 
     prov_pxy_init();
+    /* Build the constant instances of this provider's classes now rather
+       than on the first request, other namespaces get theirs when first
+       asked for them */
+    prov_pxy_freeze_all(_BROKER, DEFAULT_NS, "Xen_ProviderCommon");
 
     _SBLIM_RETURN();
 }
@@ -926,9 +1156,12 @@ static CMPIStatus XenCommonInvokeMethod(
     char *classname = CMGetCharPtr(cn);
 
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("XenCommonInvokeMethod for %s", classname));
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_invoke_method, classname, methodname);
     const XenProviderMethodFT *ft = prov_pxy_load_xen_method_provider(_BROKER_M, classname);
     if(ft)
         status = ft->xen_resource_invoke_method(self, _BROKER_M, cmpi_context, results, ref, methodname, argsin, argsout);
+    xen_stats_call_end(&stats, status.rc);
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("XenCommonInvokeMethod returned %d", status.rc));
 
     return status;
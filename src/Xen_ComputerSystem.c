@@ -28,6 +28,7 @@
 #include "provider_common.h"
 #include "providerinterface.h"
 #include "xen_utils.h"
+#include "xen_hosts.h"
 
 typedef struct _computer_system_resource {
     xen_vm vm;
@@ -112,6 +113,21 @@ static const char **xen_resource_get_keys(
     else
         return rasd_keys;
 }
+/* The domains a class is made of, when enumerated or looked up */
+static enum domain_choice _domain_choice(
+    const char *classname
+    )
+{
+    if (strcmp(classname, tmpl_cn) == 0)
+        return templates_only;
+    else if (strcmp(classname, snpt_cn) == 0)
+        return snapshots_only;
+    else if ((strcmp(classname, mem_rasd_cn) == 0) || 
+             (strcmp(classname, proc_rasd_cn) == 0))
+        return all;
+    return vms_only;
+}
+
 /*****************************************************************************
  * Function to enumerate provider specific resource
  *
@@ -126,18 +142,32 @@ static CMPIrc xen_resource_list_enum(
     provider_resource_list *resources 
     )
 {
-    enum domain_choice choice = vms_only;
-
-    if (strcmp(resources->classname, tmpl_cn) == 0)
-        choice = templates_only;
-    else if (strcmp(resources->classname, snpt_cn) == 0)
-        choice = snapshots_only;
-    else if ((strcmp(resources->classname, mem_rasd_cn) == 0) || 
-             (strcmp(resources->classname, proc_rasd_cn) == 0))
-        choice = all;
+    enum domain_choice choice = _domain_choice(resources->classname);
+
+    /* Push the conditions of an ExecQuery that xapi can check down to it:
+       ElementName is the name_label of the VM for all but the RASDs, and
+       the EnabledState of a Xen_ComputerSystem follows its power state */
+    const char *name_label = NULL;
+    int power_state = -1;
+    if (resources->query) {
+        if ((strcmp(resources->classname, mem_rasd_cn) != 0) && 
+            (strcmp(resources->classname, proc_rasd_cn) != 0))
+            name_label = xen_query_get(resources->query, "ElementName");
+        const char *enabled_state = xen_query_get(resources->query, "EnabledState");
+        if (enabled_state && 
+            xen_utils_class_is_subclass_of(resources->broker, resources->classname, vm_cn)) {
+            switch (atoi(enabled_state)) {
+            case DMTF_EnabledDefault_Disabled: power_state = XEN_VM_POWER_STATE_HALTED; break;
+            case DMTF_EnabledDefault_Quiesce: power_state = XEN_VM_POWER_STATE_PAUSED; break;
+            case DMTF_EnabledDefault_Enabled: power_state = XEN_VM_POWER_STATE_RUNNING; break;
+            case DMTF_EnabledDefault_Enabled_but_Offline: power_state = XEN_VM_POWER_STATE_SUSPENDED; break;
+            default: break; /* unknown, leave it to the query */
+            }
+        }
+    }
 
     xen_domain_resources *domain_set = NULL;
-    if (!xen_utils_get_domain_resources(session, &domain_set, choice))
+    if (!xen_utils_get_domain_resources_where(session, &domain_set, choice, name_label, power_state))
         return CMPI_RC_ERR_FAILED;
     resources->ctx = domain_set; 
     return CMPI_RC_OK;
@@ -195,7 +225,7 @@ static CMPIrc xen_resource_record_getnext(
     if (rc == -1)
         return CMPI_RC_ERR_FAILED;
 
-    computer_system_resource *ctx = calloc(1, sizeof(computer_system_resource));
+    computer_system_resource *ctx = PROV_RES_ALLOC(prov_res, computer_system_resource);
     ctx->vm = vm;
     ctx->vm_rec = vm_rec;
     prov_res->ctx = ctx;
@@ -216,7 +246,7 @@ static CMPIrc xen_resource_record_cleanup(
         xen_utils_free_domain_resource(NULL, ctx->vm_rec);
         if(ctx->free_handle)
             xen_vm_free(ctx->vm);
-        free(ctx);
+        PROV_RES_FREE(prov_res, ctx);
     }
     return CMPI_RC_OK;
 }
@@ -251,9 +281,17 @@ static CMPIrc xen_resource_record_get_from_id(
     }
     if (!xen_vm_get_record(session->xen, &vm_rec, vm)) {
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        xen_vm_free(vm);
         return CMPI_RC_ERR_FAILED;
     }
-    computer_system_resource *ctx = calloc(1, sizeof(computer_system_resource));
+    /* A template or a snapshot isn't a Xen_ComputerSystem, nor the other
+       way round, whatever its uuid: only what the class enumerates is in it */
+    if (!xen_utils_domain_is_choice(vm_rec, _domain_choice(prov_res->classname))) {
+        xen_vm_record_free(vm_rec);
+        xen_vm_free(vm);
+        return CMPI_RC_ERR_NOT_FOUND;
+    }
+    computer_system_resource *ctx = PROV_RES_ALLOC(prov_res, computer_system_resource);
     ctx->vm = vm;
     ctx->vm_rec = vm_rec;
     ctx->free_handle = true;
@@ -455,17 +493,17 @@ static CMPIrc computer_system_set_properties(
 
     _set_available_operations(resource->broker, vm_rec, inst, "AvailableRequestedStates");
     if (vm_rec->resident_on) {
-        xen_host_record *host_rec = NULL;
         if (vm_rec->resident_on->is_record)
-            host_rec = vm_rec->resident_on->u.record;
-        else
-            xen_host_get_record(session->xen, &host_rec, vm_rec->resident_on->u.handle);
-        if(host_rec) {
-            CMSetProperty(inst, "Host", (CMPIValue *)host_rec->uuid, CMPI_chars);
-            if (!vm_rec->resident_on->is_record)
-                xen_host_record_free(host_rec);
+            CMSetProperty(inst, "Host", (CMPIValue *)vm_rec->resident_on->u.record->uuid, CMPI_chars);
+        else {
+            /* the same few hosts for all the VMs, from the host directory */
+            xen_host_directory *hosts = NULL;
+            const xen_host_entry *host = xen_host_directory_lookup(session, &hosts, 
+                                                                   vm_rec->resident_on->u.handle);
+            if (host)
+                CMSetProperty(inst, "Host", (CMPIValue *)host->uuid, CMPI_chars);
+            xen_host_directory_release(hosts);
         }
-        RESET_XEN_ERROR(resource->session->xen);
     }
 
     char *owner_name = NULL, *owner_contact = NULL, *vm_roles = NULL;
@@ -19,14 +19,20 @@
 // Description:
 // ============================================================================
 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
 
 /* Include the required CMPI data types, function headers, and macros */
 #include "cmpidt.h"
 #include "cmpift.h"
 #include "cmpimacs.h"
 #include "xen_utils.h"
+#include "xen_probes.h"
+#include "dmtf.h"
 
 // ----------------------------------------------------------------------------
 // COMMON GLOBAL VARIABLES
@@ -59,6 +65,389 @@ static CMPI_THREAD_TYPE indicationThreadId = 0;
 static char * _NAMESPACE = "root/cimv2";
 //static char * _CLASSNAME = "Xen_ComputerSystem";
 
+// ----------------------------------------------------------------------------
+// INDICATION COALESCING
+// xapi emits a burst of VM modification events for a single state change
+// (power_state, metrics, allowed_operations etc). Rather than deliver an
+// indication per event, events are collected in a pending table for a short
+// window, successive events on the same VM are merged and the surviving
+// indications are delivered as a batch by a separate delivery thread.
+// ----------------------------------------------------------------------------
+
+/* Default coalescing window in milliseconds. Can be overridden by setting
+   XEN_CIM_INDICATION_WINDOW_MS in the CIMOM's environment (0 delivers each
+   batch of xen events as soon as it arrives, still merged). */
+#define DEFAULT_COALESCE_WINDOW_MS 250
+#define COALESCE_BUCKETS 256
+
+typedef struct _tracked_vm {
+    char *uuid;
+    char *ref;
+    enum xen_event_operation operation;  /* merged operation, while pending */
+    char *name_label;                    /* last delivered state */
+    int enabled_state;
+    struct _tracked_vm *next;            /* hash bucket chain */
+    struct _tracked_vm *next_in_order;   /* arrival order, for delivery */
+} tracked_vm;
+
+typedef struct {
+    tracked_vm *buckets[COALESCE_BUCKETS];
+    tracked_vm *order_head;
+    tracked_vm *order_tail;
+    int count;
+    struct timeval first_event_time;     /* when the oldest pending event arrived */
+} tracked_vm_table;
+
+static int coalesceWindow = DEFAULT_COALESCE_WINDOW_MS;
+
+/* Events waiting to be delivered, shared between the event and delivery threads */
+static tracked_vm_table *pendingEvents = NULL;
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingCond = PTHREAD_COND_INITIALIZER;
+
+/* State last delivered for each VM, used only by the delivery thread */
+static tracked_vm_table *deliveredState = NULL;
+
+/* Handle to the asynchronous indication delivery thread. Started and joined
+   with filterLock held, so a new one is never started while the old one is
+   still on its way out. */
+static CMPI_THREAD_TYPE deliveryThreadId = 0;
+static int deliveryRunning = 0;
+static pthread_mutex_t filterLock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int _hash_uuid(const char *uuid)
+{
+    unsigned int hash = 5381;
+    while (*uuid)
+        hash = ((hash << 5) + hash) + (unsigned char)*uuid++;
+    return hash % COALESCE_BUCKETS;
+}
+
+static tracked_vm *_table_find(tracked_vm_table *table, const char *uuid)
+{
+    tracked_vm *vm = table->buckets[_hash_uuid(uuid)];
+    while (vm && strcmp(vm->uuid, uuid) != 0)
+        vm = vm->next;
+    return vm;
+}
+
+static tracked_vm *_table_add(tracked_vm_table *table, const char *uuid, const char *ref)
+{
+    unsigned int bucket = _hash_uuid(uuid);
+    tracked_vm *vm = calloc(1, sizeof(tracked_vm));
+    if (vm == NULL)
+        return NULL;
+    vm->uuid = strdup(uuid);
+    vm->ref = ref ? strdup(ref) : NULL;
+    vm->next = table->buckets[bucket];
+    table->buckets[bucket] = vm;
+    if (table->order_tail)
+        table->order_tail->next_in_order = vm;
+    else
+        table->order_head = vm;
+    table->order_tail = vm;
+    table->count++;
+    return vm;
+}
+
+static void _tracked_vm_free(tracked_vm *vm)
+{
+    if (vm->uuid) free(vm->uuid);
+    if (vm->ref) free(vm->ref);
+    if (vm->name_label) free(vm->name_label);
+    free(vm);
+}
+
+/* Remove an entry from the hash chains. The arrival order list is only used
+   on the pending table, which is never pruned, so it is not touched here. */
+static void _table_remove(tracked_vm_table *table, const char *uuid)
+{
+    tracked_vm **link = &table->buckets[_hash_uuid(uuid)];
+    while (*link) {
+        if (strcmp((*link)->uuid, uuid) == 0) {
+            tracked_vm *vm = *link;
+            *link = vm->next;
+            _tracked_vm_free(vm);
+            table->count--;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+static void _table_free(tracked_vm_table *table)
+{
+    int i;
+    if (table == NULL)
+        return;
+    for (i = 0; i < COALESCE_BUCKETS; i++) {
+        tracked_vm *vm = table->buckets[i];
+        while (vm) {
+            tracked_vm *next = vm->next;
+            _tracked_vm_free(vm);
+            vm = next;
+        }
+    }
+    free(table);
+}
+
+/* ----------------------------------------------------------------------------
+ * Merge a new xen event into the pending table. Must be called with the
+ * pendingLock held. Returns 1 if the event was queued or merged.
+ * Successive operations on the same object are reduced as follows:
+ *   ADD+MOD -> ADD, MOD+MOD -> MOD, MOD+DEL -> DEL, DEL+ADD -> MOD,
+ *   ADD+DEL -> nothing (the VM came and went within the window).
+ * ---------------------------------------------------------------------------*/
+static int _coalesce_event(struct xen_event_record *event)
+{
+    if (event->obj_uuid == NULL)
+        return 0;
+    if (pendingEvents == NULL) {
+        pendingEvents = calloc(1, sizeof(tracked_vm_table));
+        if (pendingEvents == NULL)
+            return 0;
+    }
+    tracked_vm *vm = _table_find(pendingEvents, event->obj_uuid);
+    if (vm == NULL) {
+        if (pendingEvents->count == 0)
+            gettimeofday(&pendingEvents->first_event_time, NULL);
+        vm = _table_add(pendingEvents, event->obj_uuid, event->ref);
+        if (vm == NULL)
+            return 0;
+        vm->operation = event->operation;
+        return 1;
+    }
+
+    if (vm->operation == XEN_EVENT_OPERATION_ADD) {
+        if (event->operation == XEN_EVENT_OPERATION_DEL)
+            vm->operation = -1; /* dropped at delivery time */
+    }
+    else if (vm->operation == XEN_EVENT_OPERATION_DEL) {
+        if (event->operation == XEN_EVENT_OPERATION_ADD)
+            vm->operation = XEN_EVENT_OPERATION_MOD;
+    }
+    else if (vm->operation == XEN_EVENT_OPERATION_MOD) {
+        if (event->operation == XEN_EVENT_OPERATION_DEL)
+            vm->operation = XEN_EVENT_OPERATION_DEL;
+    }
+    else {
+        /* previously dropped (ADD+DEL), a new event revives it */
+        vm->operation = event->operation;
+    }
+    return 1;
+}
+
+static int _vm_enabled_state(enum xen_vm_power_state power_state)
+{
+    switch (power_state) {
+        case XEN_VM_POWER_STATE_HALTED:
+            return DMTF_EnabledDefault_Disabled;
+        case XEN_VM_POWER_STATE_PAUSED:
+            return DMTF_EnabledDefault_Quiesce;
+        case XEN_VM_POWER_STATE_RUNNING:
+            return DMTF_EnabledDefault_Enabled;
+        case XEN_VM_POWER_STATE_SUSPENDED:
+            return DMTF_EnabledDefault_Enabled_but_Offline;
+        default:
+            return DMTF_EnabledState_Unknown;
+    }
+}
+
+static CMPIInstance *_new_vm_instance(
+    const char *uuid,
+    const char *name_label,
+    int enabled_state,
+    bool has_state)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    CMPIInstance *inst = _CMNewInstance(_BROKER, _NAMESPACE, "Xen_ComputerSystem", &status);
+    if (status.rc != CMPI_RC_OK)
+        return NULL;
+    CMSetProperty(inst, "Name", (CMPIValue *)uuid, CMPI_chars);
+    CMSetProperty(inst, "CreationClassName", (CMPIValue *)"Xen_ComputerSystem", CMPI_chars);
+    if (has_state) {
+        if (name_label)
+            CMSetProperty(inst, "ElementName", (CMPIValue *)name_label, CMPI_chars);
+        CMSetProperty(inst, "EnabledState", (CMPIValue *)&enabled_state, CMPI_uint16);
+    }
+    return inst;
+}
+
+/* ----------------------------------------------------------------------------
+ * Turn one coalesced entry into an indication and deliver it.
+ * The delivered state table is used to fill in PreviousInstance and to drop
+ * modifications that did not change anything the indication carries.
+ * ---------------------------------------------------------------------------*/
+static void _deliver_coalesced_event(
+    const CMPIContext *cmpi_context,
+    xen_utils_session *session,
+    tracked_vm *pending)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    CMPIInstance *indication = NULL;
+    CMPIInstance *source = NULL, *previous = NULL;
+    xen_vm_record *vm_rec = NULL;
+    int enabled_state = 0;
+    char *classname = NULL;
+
+    if (deliveredState == NULL)
+        deliveredState = calloc(1, sizeof(tracked_vm_table));
+    if (deliveredState == NULL)
+        return;
+    tracked_vm *last = _table_find(deliveredState, pending->uuid);
+
+    if (pending->operation == XEN_EVENT_OPERATION_DEL) {
+        source = _new_vm_instance(pending->uuid, 
+                                  last ? last->name_label : NULL,
+                                  last ? last->enabled_state : 0,
+                                  last != NULL);
+        classname = "Xen_ComputerSystemDeletion";
+    }
+    else if ((pending->operation == XEN_EVENT_OPERATION_ADD) ||
+             (pending->operation == XEN_EVENT_OPERATION_MOD)) {
+        /* One record fetch per VM per window, however many events were merged */
+        if (session == NULL || pending->ref == NULL ||
+            !xen_vm_get_record(session->xen, &vm_rec, (xen_vm)pending->ref)) {
+            /* The VM may have been destroyed since, the deletion event will follow */
+            if (session)
+                RESET_XEN_ERROR(session->xen);
+            return;
+        }
+        enabled_state = _vm_enabled_state(vm_rec->power_state);
+
+        if (pending->operation == XEN_EVENT_OPERATION_MOD && last &&
+            last->enabled_state == enabled_state &&
+            ((last->name_label == NULL && vm_rec->name_label == NULL) ||
+             (last->name_label && vm_rec->name_label &&
+              strcmp(last->name_label, vm_rec->name_label) == 0))) {
+            /* No-op modification as far as the indication is concerned */
+            xen_vm_record_free(vm_rec);
+            return;
+        }
+
+        source = _new_vm_instance(pending->uuid, vm_rec->name_label, enabled_state, true);
+        if (pending->operation == XEN_EVENT_OPERATION_MOD) {
+            classname = "Xen_ComputerSystemModification";
+            if (last)
+                previous = _new_vm_instance(pending->uuid, last->name_label, 
+                                            last->enabled_state, true);
+        }
+        else
+            classname = "Xen_ComputerSystemCreation";
+    }
+    else
+        return; /* ADD and DEL within the same window */
+
+    if (source == NULL)
+        goto exit;
+    indication = _CMNewInstance(_BROKER, _NAMESPACE, classname, &status);
+    if (status.rc != CMPI_RC_OK)
+        goto exit;
+    CMSetProperty(indication, "SourceInstance", (CMPIValue *)&source, CMPI_instance);
+    if (previous)
+        CMSetProperty(indication, "PreviousInstance", (CMPIValue *)&previous, CMPI_instance);
+
+    /* Deliver the indication to all subscribers. */
+    /* THIS CALL WILL HANG IF DNS CANNOT RESOLVE THE CLIENT'S SYSTEMNAME OR 
+       IF THE SFCB INDICATION PROVIDER IS IN THE SAME PROCESS GROUP AS XEN-CIM */
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- Delivering %s for %s", classname, pending->uuid));
+    XEN_PROBE2(indication__deliver, classname, pending->uuid);
+    status = CBDeliverIndication(_BROKER, cmpi_context, _NAMESPACE, indication);
+    XEN_PROBE2(indication__delivered, classname, status.rc);
+    if (status.rc != CMPI_RC_OK) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Failed to deliver indication"));
+        goto exit;
+    }
+
+    /* Remember what was delivered, for the next PreviousInstance */
+    if (pending->operation == XEN_EVENT_OPERATION_DEL)
+        _table_remove(deliveredState, pending->uuid);
+    else {
+        if (last == NULL)
+            last = _table_add(deliveredState, pending->uuid, NULL);
+        if (last) {
+            if (last->name_label)
+                free(last->name_label);
+            last->name_label = vm_rec->name_label ? strdup(vm_rec->name_label) : NULL;
+            last->enabled_state = enabled_state;
+        }
+    }
+
+    exit:
+    if (vm_rec)
+        xen_vm_record_free(vm_rec);
+}
+
+// ----------------------------------------------------------------------------
+// _deliveryThread()
+// Runtime thread that waits out the coalescing window and delivers the
+// pending indications as a batch.
+// ----------------------------------------------------------------------------
+CMPI_THREAD_RETURN _deliveryThread( void * parameters )
+{
+    CMPIContext * cmpi_context = (CMPIContext *)parameters; /* Delivery thread context */
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    xen_utils_session *session = NULL;
+    struct xen_call_context *ctx = NULL;
+
+    _SBLIM_ENTER("_deliveryThread");
+    CBAttachThread(_BROKER, cmpi_context);
+
+    /* This thread needs its own session, the event thread's one is blocked in
+       xen_event_next most of the time */
+    if (xen_utils_get_call_context(cmpi_context, &ctx, &status)) {
+        xen_utils_xen_init2(&session, ctx);
+    }
+
+    pthread_mutex_lock(&pendingLock);
+    while (deliveryRunning) {
+        if (pendingEvents == NULL || pendingEvents->count == 0) {
+            pthread_cond_wait(&pendingCond, &pendingLock);
+            continue;
+        }
+
+        /* Wait out the rest of the window, measured from the oldest pending event */
+        struct timespec deadline;
+        long usec = pendingEvents->first_event_time.tv_usec + (coalesceWindow * 1000L);
+        deadline.tv_sec = pendingEvents->first_event_time.tv_sec + (usec / 1000000);
+        deadline.tv_nsec = (usec % 1000000) * 1000;
+        int rc = 0;
+        while (deliveryRunning && rc != ETIMEDOUT && coalesceWindow > 0)
+            rc = pthread_cond_timedwait(&pendingCond, &pendingLock, &deadline);
+        if (!deliveryRunning)
+            break;
+
+        /* Take the whole batch, the event thread starts a new one */
+        tracked_vm_table *batch = pendingEvents;
+        pendingEvents = NULL;
+        pthread_mutex_unlock(&pendingLock);
+
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- Delivering a batch of %d coalesced events", batch->count));
+        if (enabled && session && !xen_utils_validate_session(&session, ctx)) {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Unable to establish connection with Xen"));
+        }
+        tracked_vm *vm;
+        for (vm = batch->order_head; enabled && vm; vm = vm->next_in_order)
+            _deliver_coalesced_event(cmpi_context, session, vm);
+        _table_free(batch);
+
+        pthread_mutex_lock(&pendingLock);
+    }
+    _table_free(pendingEvents);
+    pendingEvents = NULL;
+    pthread_mutex_unlock(&pendingLock);
+
+    _table_free(deliveredState);
+    deliveredState = NULL;
+    if (session)
+        xen_utils_xen_close2(session);
+    if (ctx)
+        xen_utils_free_call_context(ctx);
+
+    CBDetachThread(_BROKER, cmpi_context);
+    _SBLIM_RETURN(NULL);
+}
+
 // ----------------------------------------------------------------------------
 // _indicationThread()
 // Runtime thread to periodically poll to generate indications.
@@ -67,7 +456,6 @@ CMPI_THREAD_RETURN _indicationThread( void * parameters )
 {
     CMPIContext * cmpi_context = (CMPIContext *)parameters; /* Indication thread context */
     CMPIStatus status = {CMPI_RC_OK, NULL}; /* Return status of CIM operations */
-    CMPIInstance * indication;          /* CIM instance for each new indication */
     struct xen_string_set *classes = NULL;
     xen_utils_session *session = NULL;
 
@@ -93,8 +481,8 @@ CMPI_THREAD_RETURN _indicationThread( void * parameters )
     }
 
     /* Register with xen all the events we are interested in */
-    classes = xen_string_set_alloc(0);
-    //classes->contents[0] = "VM";
+    classes = xen_string_set_alloc(1);
+    classes->contents[0] = strdup("vm");
     if(!xen_event_register(session->xen, classes))
     {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Xen Event registration failed ......"));
@@ -125,62 +513,29 @@ CMPI_THREAD_RETURN _indicationThread( void * parameters )
 
         if(events)
         {
-            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Xen returned %d events of interest......", events->size));
-            int i=0;
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Xen returned %d events of interest......", (int)events->size));
+            int i=0, queued=0;
+
+            /* Hand the events over to the delivery thread, merging them with
+               anything already pending for the same VM. No tracing while the
+               lock is held, tracing hits cancellation points. */
+            pthread_mutex_lock(&pendingLock);
             for(i=0; i<events->size; i++)
             {
-
-                CMPIInstance *affected_vm = _CMNewInstance(_BROKER, _NAMESPACE, "Xen_ComputerSystem", &status);
-                CMSetProperty(affected_vm, "Name", events->contents[i]->obj_uuid, CMPI_chars);
-
-                if(events->contents[i]->operation == XEN_EVENT_OPERATION_ADD)
-                {
-                    /* InstCreation: If no matching old instance then this is a brand new instance. */
-                    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- New instance!"));
-                    indication = _CMNewInstance(_BROKER, _NAMESPACE, "Xen_ComputerSystemCreation", &status);
-                    if(status.rc != CMPI_RC_OK) goto exit;
-
-                    /* Set the indication properties. */
-                    CMSetProperty(indication, "SourceInstance",(CMPIValue *)affected_vm, CMPI_instance);
-                }
-                else if(events->contents[i]->operation == XEN_EVENT_OPERATION_MOD)
-                {
-                    /* InstModification: Check if old instance has different property values. */
-                    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- Modified instance!"));
-                    indication = _CMNewInstance(_BROKER, _NAMESPACE, "Xen_ComputerSystemModification", &status);
-                    if(status.rc != CMPI_RC_OK) goto exit;
-
-                    /* Set the indication properties. */
-                    CMSetProperty(indication, "SourceInstance",(CMPIValue *)affected_vm, CMPI_instance);
-                    //CMSetProperty(indication, "PreviousInstance",(CMPIValue *)&(oldinstancedata.value.inst), CMPI_instance);
-                }
-                else if(events->contents[i]->operation == XEN_EVENT_OPERATION_DEL)
-                {
-                    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- Deleted instance!"));
-                    indication = _CMNewInstance(_BROKER, _NAMESPACE, "Xen_ComputerSystemDeletion", &status);
-                    if(status.rc != CMPI_RC_OK) goto exit;
-
-                    /* Set the indication properties. */
-                    CMSetProperty(indication, "SourceInstance",(CMPIValue *)affected_vm, CMPI_instance);
-                }
-                else
-                {
-                    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- Not sure what event operation %d this is!", events->contents[i]->operation));
-                    continue; // continue to the next event in the loop
-                }
-
-                /* Deliver the indication to all subscribers. */
-                /* THIS CALL WILL HANG IF DNS CANNOT RESOLVE THE CLIENT'S SYSTEMNAME OR 
-                   IF THE SFCB INDICATION PROVIDER IS IN THE SAME PROCESS GROUP AS XEN-CIM */
-                _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- Delivering indication"));
-                status = CBDeliverIndication(_BROKER, cmpi_context, _NAMESPACE, indication);
-                if(status.rc != CMPI_RC_OK)
-                {
-                    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Failed to deliver indication"));
-                    goto exit;
-                }
-
+                struct xen_event_record *event = events->contents[i];
+                if(event->class && strcasecmp(event->class, "vm") != 0)
+                    continue;
+                if((event->operation != XEN_EVENT_OPERATION_ADD) &&
+                   (event->operation != XEN_EVENT_OPERATION_MOD) &&
+                   (event->operation != XEN_EVENT_OPERATION_DEL))
+                    continue;
+                queued += _coalesce_event(event);
             }
+            if(queued)
+                pthread_cond_signal(&pendingCond);
+            pthread_mutex_unlock(&pendingLock);
+
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- Queued %d of %d events for delivery", queued, (int)events->size));
             xen_event_record_set_free(events);
         }
         else
@@ -327,6 +682,7 @@ static CMPIStatus ActivateFilter(
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- namespace=\"%s\"", nameSpace));
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- classname=\"%s\"", classname));
 
+    pthread_mutex_lock(&filterLock);
     numActiveFilters++;
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- numActiveFilters=%d", numActiveFilters));
 
@@ -342,6 +698,16 @@ static CMPIStatus ActivateFilter(
         indicationThreadId = _BROKER->xft->newThread(_indicationThread, indicationContext, 0);
     }
 
+    /* ... and the thread delivering the coalesced indications */
+    if(deliveryThreadId == 0)
+    {
+        CMPIContext * deliveryContext = CBPrepareAttachThread(_BROKER, context);
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,("--- Starting up indication delivery thread (window=%dms)", coalesceWindow));
+        deliveryRunning = 1;
+        deliveryThreadId = _BROKER->xft->newThread(_deliveryThread, deliveryContext, 0);
+    }
+    pthread_mutex_unlock(&filterLock);
+
     _SBLIM_RETURNSTATUS(status);
 }
 
@@ -371,6 +737,7 @@ static CMPIStatus DeActivateFilter(
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- namespace=\"%s\"", nameSpace));
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- classname=\"%s\"", classname));
 
+    pthread_mutex_lock(&filterLock);
     if(numActiveFilters == 0)
     {
         //      deactivated = CMPI_false;
@@ -388,7 +755,21 @@ static CMPIStatus DeActivateFilter(
         _BROKER->xft->cancelThread(indicationThreadId);
         indicationThreadId = 0;
     }
+    if((numActiveFilters == 0) && deliveryThreadId != 0)
+    {
+        /* The delivery thread is never cancelled, it may be holding the
+           pending table lock. Ask it to finish instead. */
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,("--- Shutting down indication delivery thread"));
+        pthread_mutex_lock(&pendingLock);
+        deliveryRunning = 0;
+        pthread_cond_signal(&pendingCond);
+        pthread_mutex_unlock(&pendingLock);
+        /* wait for it to be gone before the next ActivateFilter starts another */
+        _BROKER->xft->joinThread(deliveryThreadId, NULL);
+        deliveryThreadId = 0;
+    }
     exit:
+    pthread_mutex_unlock(&filterLock);
     _SBLIM_RETURNSTATUS(status);
 }
 
@@ -436,7 +817,16 @@ static void IndicationInitialize(
 {
     _SBLIM_ENTER("IndicationInitialize");
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- self=\"%s\"", self->ft->miName));
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- context=\"%d\"", context));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- context=\"%p\"", (void *)context));
+
+    char *window = getenv("XEN_CIM_INDICATION_WINDOW_MS");
+    if(window && *window)
+    {
+        coalesceWindow = atoi(window);
+        if(coalesceWindow < 0)
+            coalesceWindow = DEFAULT_COALESCE_WINDOW_MS;
+    }
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- indication coalescing window=%dms", coalesceWindow));
 
     _SBLIM_RETURN();
 }
@@ -19,12 +19,19 @@
 
 #include "RASDs.h"
 #include "Xen_Disk.h"
+#include "xen_topology.h"
 
 #define XAPI_NULL_REF "OpaqueRef:NULL"
 
+typedef struct {
+    xen_vbd_set *vbd_set;
+    xen_storage_topology *storage;  /* the SRs, for the RASD class */
+}vbd_list;
+
 typedef struct {
     xen_vbd vbd;
     xen_vbd_record *vbd_rec;
+    xen_storage_topology *storage;  /* owned by the list, NULL if there's none */
 }vbd_res;
 
 static const char *disk_cn = "Xen_Disk";
@@ -87,10 +94,18 @@ static CMPIrc xen_resource_list_enum(
     provider_resource_list *resources
     )
 {
-    xen_vbd_set *vbd_set = NULL;
-    if (!xen_vbd_get_all(session->xen, &vbd_set))
+    vbd_list *list = calloc(1, sizeof(vbd_list));
+    if (list == NULL)
+        return CMPI_RC_ERR_FAILED;
+    resources->ctx = list;
+    if (!xen_vbd_get_all(session->xen, &list->vbd_set))
         return CMPI_RC_ERR_FAILED;
-    resources->ctx = vbd_set;
+    /* The RASDs carry the uuid of their VDI's SR, get all the SRs at once */
+    if (xen_utils_class_is_subclass_of(resources->broker, rasd_cn, resources->classname)) {
+        list->storage = xen_storage_topology_new(session, false);
+        if (list->storage == NULL)
+            RESET_XEN_ERROR(session->xen);
+    }
     return CMPI_RC_OK;
 }
 /*******************************************************************
@@ -106,8 +121,13 @@ static CMPIrc xen_resource_list_cleanup(
     provider_resource_list *resources
     )
 {
-    if (resources && resources->ctx)
-        xen_vbd_set_free((xen_vbd_set *)resources->ctx);
+    if (resources && resources->ctx) {
+        vbd_list *list = resources->ctx;
+        if (list->vbd_set)
+            xen_vbd_set_free(list->vbd_set);
+        xen_storage_topology_free(list->storage);
+        free(list);
+    }
     return CMPI_RC_OK;
 }
 /*****************************************************************************
@@ -124,7 +144,10 @@ static CMPIrc xen_resource_record_getnext(
     provider_resource *prov_res
     )
 {
-    xen_vbd_set *vbd_set = resources_list->ctx;
+    vbd_list *list = resources_list->ctx;
+    xen_vbd_set *vbd_set = list ? list->vbd_set : NULL;
+    if (vbd_set == NULL)
+        return CMPI_RC_ERR_NOT_FOUND;
     while (resources_list->current_resource <= vbd_set->size) {
         if (vbd_set == NULL || resources_list->current_resource == vbd_set->size)
             return CMPI_RC_ERR_NOT_FOUND;
@@ -145,9 +168,10 @@ static CMPIrc xen_resource_record_getnext(
             resources_list->current_resource++; /* Just increment the resource count to get to the next one */
         }
         else {
-            vbd_res *ctx = calloc(sizeof(vbd_res), 1);
+            vbd_res *ctx = PROV_RES_ALLOC(prov_res, vbd_res);
             ctx->vbd = vbd_set->contents[resources_list->current_resource];
             ctx->vbd_rec = vbd_rec;
+            ctx->storage = list->storage;
             prov_res->ctx = ctx;
             vbd_set->contents[resources_list->current_resource] = NULL; /* do not delete this */
             break;
@@ -169,7 +193,7 @@ static CMPIrc xen_resource_record_cleanup(
         vbd_res *ctx = prov_res->ctx;
         xen_vbd_free(ctx->vbd);
         xen_vbd_record_free(ctx->vbd_rec);
-        free(ctx);
+        PROV_RES_FREE(prov_res, ctx);
     }
     return CMPI_RC_OK;
 }
@@ -204,9 +228,10 @@ static CMPIrc xen_resource_record_get_from_id(
         return CMPI_RC_ERR_NOT_FOUND;
     }
     else {
-        vbd_res *ctx = calloc(sizeof(vbd_res), 1);
+        vbd_res *ctx = PROV_RES_ALLOC(prov_res, vbd_res);
         ctx->vbd = vbd;
         ctx->vbd_rec = vbd_rec;
+        ctx->storage = NULL;
         prov_res->ctx = ctx;
         return CMPI_RC_OK;
     }
@@ -406,13 +431,14 @@ CMPIrc disk_metrics_set_properties(
 CMPIrc rasd_set_properties(
     const CMPIBroker *broker,
     xen_utils_session *session, 
+    xen_storage_topology *storage,
     xen_vbd_record* vbd_rec,
     xen_vm_record* vm_rec,
     xen_vdi_record *vdi_rec,
     CMPIInstance *inst
     )
 {
-    disk_rasd_from_vbd(broker, session, inst, vm_rec, vbd_rec, vdi_rec);
+    disk_rasd_from_vbd(broker, session, storage, inst, vm_rec, vbd_rec, vdi_rec);
     return CMPI_RC_OK;
 }
 
@@ -447,7 +473,7 @@ CMPIrc xen_resource_set_properties(
     if (vdi_opt && vdi_opt->is_record)
         vdi_rec = vdi_opt->u.record;
     else if (vbd_rec && (strcmp(vbd_rec->vdi->u.handle, "") != 0) && (strcmp(vbd_rec->vdi->u.handle, XAPI_NULL_REF) != 0)) {
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VBD Ref: '%s'", vbd_rec->vdi->u.handle));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VBD Ref: '%s'", (char *)vbd_rec->vdi->u.handle));
 
         if (!xen_vdi_get_record(resource->session->xen, &vdi_rec, vbd_rec->vdi->u.handle)) {
         /* This can happen if the VDI handle is NULL (such as in an empty CD), just trace it and move on */
@@ -463,7 +489,7 @@ CMPIrc xen_resource_set_properties(
         xen_utils_class_is_subclass_of(resource->broker, disk_drive_cn, resource->classname))
         rc = disk_set_properties(resource, vm_rec, vdi_rec, inst); /* devcice class */
     else if (xen_utils_class_is_subclass_of(resource->broker, rasd_cn, resource->classname))
-        rc = rasd_set_properties(resource->broker, resource->session, vbd_rec, vm_rec, vdi_rec, inst); /* rasd class */
+        rc = rasd_set_properties(resource->broker, resource->session, ctx->storage, vbd_rec, vm_rec, vdi_rec, inst); /* rasd class */
     else
         rc = disk_metrics_set_properties(resource->broker, resource, vm_rec, vdi_rec, inst); /* metrics class */
 
@@ -15,11 +15,36 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <Xen_Disk.h>
+#include "xen_topology.h"
 #include "providerinterface.h"
 
+/******************************************************************************
+ * Enumerations go through the VDIs an SR at a time, the SRs in the order of
+ * their refs and the VDIs of each SR in the order of theirs, so that the
+ * position ("<SR ref>/<VDI ref>" of the first VDI of the next page) can be
+ * looked up with a binary search. The VDI records are fetched in bulk once,
+ * sorted by SR and ref, and the pages are slices of them. A query on the
+ * PoolID (or SystemName) only looks at that SR.
+ *****************************************************************************/
+typedef struct {
+    int first;                          /* the VDIs of an SR in vdi_map */
+    int end;
+}local_sr_vdis;
+
+typedef struct {
+    xen_storage_topology *storage;      /* the SRs in scope, by ref */
+    xen_vdi_xen_vdi_record_map *vdi_map; /* all the VDI records, by SR then ref */
+    local_sr_vdis *sr_vdis;             /* for each SR in storage */
+    int sr_index;                       /* the SR of the page */
+    int page_first;                     /* the page, in vdi_map */
+    int page_count;
+}local_vdi_cursor;
+
 typedef struct {
     xen_vdi vdi;
     xen_vdi_record *vdi_rec;
+    xen_sr_record *sr_rec;          /* NULL to look it up */
+    bool owns_sr_rec;
 }local_vdi_resource;
 
 static const char *keys[] = {"SystemName",
@@ -45,6 +70,115 @@ static const char **xen_resource_get_keys(
 {
     return keys;
 }
+/* The SR a VDI record is on, "" for none */
+static const char *_vdi_sr(
+    xen_vdi_record *vdi_rec
+    )
+{
+    if (vdi_rec == NULL || vdi_rec->sr == NULL || vdi_rec->sr->is_record || vdi_rec->sr->u.handle == NULL)
+        return "";
+    return (char *)vdi_rec->sr->u.handle;
+}
+
+static int _compare_vdis(const void *a, const void *b)
+{
+    const xen_vdi_xen_vdi_record_map_contents *va = a, *vb = b;
+    int rc = strcmp(_vdi_sr(va->val), _vdi_sr(vb->val));
+    return rc ? rc : strcmp((char *)va->key, (char *)vb->key);
+}
+
+/* Gets the records of all the VDIs, sorts them by SR and ref and notes
+   where the VDIs of each SR in scope are. VDIs on other SRs are left out. */
+static int _get_vdis(
+    xen_utils_session *session,
+    local_vdi_cursor *cursor
+    )
+{
+    xen_storage_topology *storage = cursor->storage;
+    int i, j = 0;
+
+    if (!xen_vdi_get_all_records(session->xen, &cursor->vdi_map))
+        return 0;
+    qsort(cursor->vdi_map->contents, cursor->vdi_map->size,
+          sizeof(cursor->vdi_map->contents[0]), _compare_vdis);
+
+    if ((cursor->sr_vdis = calloc(storage->sr_count + 1, sizeof(local_sr_vdis))) == NULL)
+        return 0;
+    for (i = 0; i < storage->sr_count; i++) {
+        const char *sr = (char *)storage->srs[i].sr;
+        while (j < (int)cursor->vdi_map->size && strcmp(_vdi_sr(cursor->vdi_map->contents[j].val), sr) < 0)
+            j++;
+        cursor->sr_vdis[i].first = j;
+        while (j < (int)cursor->vdi_map->size && strcmp(_vdi_sr(cursor->vdi_map->contents[j].val), sr) == 0)
+            j++;
+        cursor->sr_vdis[i].end = j;
+    }
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("%d VDIs, %d SRs", (int)cursor->vdi_map->size,
+                                           storage->sr_count));
+    return 1;
+}
+
+/* Moves the page on to the VDIs from the position on, at most page_size of
+   them and all from one SR, and moves the position on to the VDI after */
+static CMPIrc _fetch_page(
+    xen_utils_session *session,
+    provider_resource_list *resources
+    )
+{
+    local_vdi_cursor *cursor = resources->ctx;
+    xen_storage_topology *storage = cursor->storage;
+    xen_vdi_xen_vdi_record_map *vdi_map = cursor->vdi_map;
+    char sr_ref[XEN_POSITION_LEN];
+    char *vdi_ref = NULL;
+    int i, first = 0, end = 0, count = 0, high;
+
+    strcpy(sr_ref, resources->position);
+    if ((vdi_ref = strchr(sr_ref, '/')) != NULL)
+        *vdi_ref++ = '\0';
+
+    for (i = 0; i < storage->sr_count; i++)
+        if (strcmp((char *)storage->srs[i].sr, sr_ref) >= 0)
+            break;
+    if (i < storage->sr_count && strcmp((char *)storage->srs[i].sr, sr_ref) != 0)
+        vdi_ref = NULL; /* that SR is gone, start at the beginning of the next */
+
+    for (; i < storage->sr_count; i++, vdi_ref = NULL) {
+        /* the first VDI of the SR at or after the position; the records of
+           the pages before have been handed out, their keys are still there */
+        first = cursor->sr_vdis[i].first;
+        end = high = cursor->sr_vdis[i].end;
+        while (vdi_ref && *vdi_ref && first < high) {
+            int mid = (first + high) / 2;
+            if (strcmp((char *)vdi_map->contents[mid].key, vdi_ref) < 0)
+                first = mid + 1;
+            else
+                high = mid;
+        }
+        if (first < end)
+            break;
+    }
+    if (i == storage->sr_count) {
+        cursor->page_count = 0;
+        resources->position[0] = '\0';
+        return CMPI_RC_OK;
+    }
+
+    count = end - first;
+    if (resources->page_size && count > resources->page_size)
+        count = resources->page_size;
+    cursor->sr_index = i;
+    cursor->page_first = first;
+    cursor->page_count = count;
+    if (first + count < end)
+        snprintf(resources->position, XEN_POSITION_LEN, "%s/%s", (char *)storage->srs[i].sr,
+                 (char *)vdi_map->contents[first + count].key);
+    else if (i + 1 < storage->sr_count)
+        snprintf(resources->position, XEN_POSITION_LEN, "%s/", (char *)storage->srs[i + 1].sr);
+    else
+        resources->position[0] = '\0';
+    return CMPI_RC_OK;
+}
+
 /********************************************************
  * Function to enumerate provider specific resource
  *
@@ -59,11 +193,45 @@ static CMPIrc xen_resource_list_enum(
     provider_resource_list *resources
     )
 {
-    xen_vdi_set *vdi_set = NULL;
-    if (!xen_vdi_get_all(session->xen, &vdi_set))
+    local_vdi_cursor *cursor = calloc(1, sizeof(local_vdi_cursor));
+    if (cursor == NULL)
         return CMPI_RC_ERR_FAILED;
-    resources->ctx = vdi_set;
-    return CMPI_RC_OK;
+    resources->ctx = cursor;
+
+    /* An ExecQuery on the pool only needs that SR */
+    const char *pool_id = xen_query_get(resources->query, "PoolID");
+    if (pool_id == NULL)
+        pool_id = xen_query_get(resources->query, "SystemName");
+    if (pool_id) {
+        cursor->storage = xen_storage_topology_new_for_sr(session, pool_id, false);
+        if (cursor->storage == NULL) {
+            /* there's no such SR, so no VDIs either */
+            RESET_XEN_ERROR(session->xen);
+            resources->position[0] = '\0';
+            return CMPI_RC_OK;
+        }
+    }
+    else if ((cursor->storage = xen_storage_topology_new(session, false)) == NULL)
+        return CMPI_RC_ERR_FAILED;
+    if (!_get_vdis(session, cursor)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        return CMPI_RC_ERR_FAILED;
+    }
+    return _fetch_page(session, resources);
+}
+/******************************************************************************
+ * Function to get the next page of a xen resource
+ *
+ * @param session - handle to a xen_utils_session object
+ * @param resources - pointer to the provider_resource_list
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_list_next_page(
+    xen_utils_session *session, 
+    provider_resource_list *resources
+    )
+{
+    return _fetch_page(session, resources);
 }
 
 /*******************************************************************
@@ -79,8 +247,14 @@ static CMPIrc xen_resource_list_cleanup(
     provider_resource_list *resources
     )
 {
-    if (resources && resources->ctx)
-        xen_vdi_set_free((xen_vdi_set *)resources->ctx);
+    if (resources && resources->ctx) {
+        local_vdi_cursor *cursor = resources->ctx;
+        if (cursor->vdi_map)
+            xen_vdi_xen_vdi_record_map_free(cursor->vdi_map);
+        free(cursor->sr_vdis);
+        xen_storage_topology_free(cursor->storage);
+        free(cursor);
+    }
     return CMPI_RC_OK;
 }
 
@@ -98,19 +272,24 @@ static CMPIrc xen_resource_record_getnext(
     provider_resource *prov_res /* in , out */
     )
 {
-    xen_vdi_set *vdi_set = (xen_vdi_set *)resources_list->ctx;
-    if (vdi_set == NULL || resources_list->current_resource == vdi_set->size) {
+    local_vdi_cursor *cursor = resources_list->ctx;
+    if (cursor == NULL || cursor->vdi_map == NULL ||
+        resources_list->current_resource >= cursor->page_count)
         return CMPI_RC_ERR_NOT_FOUND;
-    }
-    xen_vdi_record *vdi_rec = NULL;
-    if (!xen_vdi_get_record(session->xen, &vdi_rec, vdi_set->contents[resources_list->current_resource])) {
-        xen_utils_trace_error(resources_list->session->xen, __FILE__, __LINE__);
+
+    int i = cursor->page_first + resources_list->current_resource;
+    xen_vdi_record *vdi_rec = cursor->vdi_map->contents[i].val;
+    xen_vdi vdi = strdup((char *)cursor->vdi_map->contents[i].key);
+    if (vdi_rec == NULL || vdi == NULL) {
+        free(vdi);
         return CMPI_RC_ERR_FAILED;
     }
-    local_vdi_resource *ctx = calloc(sizeof(local_vdi_resource), 1);
-    ctx->vdi = vdi_set->contents[resources_list->current_resource];
+    local_vdi_resource *ctx = PROV_RES_ALLOC(prov_res, local_vdi_resource);
+    ctx->vdi = vdi;
     ctx->vdi_rec = vdi_rec;
-    vdi_set->contents[resources_list->current_resource] = NULL; /* do not delete this*/
+    ctx->sr_rec = cursor->storage->srs[cursor->sr_index].rec; /* owned by the list */
+    ctx->owns_sr_rec = false;
+    cursor->vdi_map->contents[i].val = NULL; /* do not delete this*/
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -126,11 +305,13 @@ static CMPIrc xen_resource_record_cleanup(
 {
     local_vdi_resource *ctx = prov_res->ctx;
     if (ctx) {
+        if(ctx->sr_rec && ctx->owns_sr_rec)
+            xen_sr_record_free(ctx->sr_rec);
         if(ctx->vdi_rec)
             xen_vdi_record_free(ctx->vdi_rec);
         if(ctx->vdi)
             xen_vdi_free(ctx->vdi);
-        free(ctx);
+        PROV_RES_FREE(prov_res, ctx);
     }
     return CMPI_RC_OK;
 }
@@ -159,9 +340,11 @@ static CMPIrc xen_resource_record_get_from_id(
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
         return CMPI_RC_ERR_NOT_FOUND;
     }
-    local_vdi_resource *ctx = calloc(sizeof(local_vdi_resource), 1);
+    local_vdi_resource *ctx = PROV_RES_ALLOC(prov_res, local_vdi_resource);
     ctx->vdi = vdi;
     ctx->vdi_rec = vdi_rec;
+    ctx->sr_rec = NULL;
+    ctx->owns_sr_rec = false;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -181,12 +364,16 @@ static CMPIrc xen_resource_set_properties(
     /* get SR from vdi */
     local_vdi_resource *ctx = (local_vdi_resource *)resource->ctx;
     xen_vdi_record* vdi_rec = ctx->vdi_rec;
-    xen_sr_record *sr_rec = NULL;
+    xen_sr_record *sr_rec = ctx->sr_rec;
 
     if (vdi_rec->sr->is_record)
         sr_rec = vdi_rec->sr->u.record;
-    else
-        xen_sr_get_record(resource->session->xen, &sr_rec, vdi_rec->sr->u.handle);
+    else if (sr_rec == NULL) {
+        if (xen_sr_get_record(resource->session->xen, &sr_rec, vdi_rec->sr->u.handle)) {
+            ctx->sr_rec = sr_rec;
+            ctx->owns_sr_rec = true;
+        }
+    }
 
     if(!sr_rec) {
         return CMPI_RC_ERR_FAILED;
@@ -200,6 +387,7 @@ static CMPIrc xen_resource_set_properties(
     CMSetProperty(inst, "CreationClassName",(CMPIValue *)"Xen_DiskImage", CMPI_chars);
     CMSetProperty(inst, "SystemCreationClassName",(CMPIValue *)"Xen_StoragePool", CMPI_chars);
     CMSetProperty(inst, "SystemName",(CMPIValue *)sr_rec->uuid, CMPI_chars);
+    CMSetProperty(inst, "PoolID",(CMPIValue *)sr_rec->uuid, CMPI_chars);
 
     /* Rest of the properties */
     Access access = Access_Read_Write_Supported;
@@ -290,15 +478,12 @@ static CMPIrc xen_resource_set_properties(
     //CMSetProperty(inst, "TimeOfLastStateChange",(CMPIValue *)&date_time, CMPI_dateTime);
     //CMSetProperty(inst, "TotalPowerOnHours",(CMPIValue *)&<value>, CMPI_uint64);
 
-    if (!vdi_rec->sr->is_record)
-        xen_sr_record_free(sr_rec);
-
     return CMPI_RC_OK;
 
 }
 
 /* Setup the function table for the instance provider */
-XenInstanceMIStub(Xen_DiskImage)
+XenPagedInstanceMIStub(Xen_DiskImage)
 
 /******************************************************************************
 * disk_image_create_ref
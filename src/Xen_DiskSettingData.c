@@ -49,8 +49,8 @@ static int _get_sr(
             success = false;
         if (srs->size != 1) {
             char error_msg[XEN_UTILS_ERROR_BUF_LEN];
-            sprintf(error_msg, "SR set for %s returned %d, expecting just 1\n", sr_info, srs->size);
-            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, (error_msg));
+            sprintf(error_msg, "SR set for %s returned %d, expecting just 1\n", sr_info, (int)srs->size);
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s", error_msg));
             xen_sr_set_free(srs);
             success = false;
         }
@@ -321,6 +321,7 @@ int disk_rasd_to_vbd(
 int disk_rasd_from_vbd(
     const CMPIBroker* broker,
     xen_utils_session *session,
+    xen_storage_topology *storage, /* optional, where to find the SR */
     CMPIInstance *inst,
     xen_vm_record *vm_rec,
     xen_vbd_record *vbd_rec,
@@ -328,7 +329,8 @@ int disk_rasd_from_vbd(
     )
 {
     char buf[MAX_INSTANCEID_LEN];
-    xen_sr_record *sr_rec = NULL;
+    xen_sr_record *sr_rec = NULL, *alloced_sr_rec = NULL;
+    xen_storage_sr *sr = NULL;
     unsigned long long physical_utilization = 1, limit = 1, virtual_quantity = 1;
     DMTF_ResourceType rasd_type = DMTF_ResourceType_Storage_Extent;
     uint64_t block_size = 1;
@@ -351,9 +353,11 @@ int disk_rasd_from_vbd(
         limit = vdi_rec->virtual_size;
         virtual_quantity = vdi_rec->virtual_size;
         if (vdi_rec->sr->is_record)
-            sr_rec = vdi_rec->sr->u.handle;
-        else
-            xen_sr_get_record(session->xen, &sr_rec, vdi_rec->sr->u.handle);
+            sr_rec = vdi_rec->sr->u.record;
+        else if ((sr = xen_storage_topology_find(storage, vdi_rec->sr->u.handle)) != NULL)
+            sr_rec = sr->rec;
+        else if (xen_sr_get_record(session->xen, &sr_rec, vdi_rec->sr->u.handle))
+            alloced_sr_rec = sr_rec;
     }
 
     if (vbd_rec->mode == XEN_VBD_MODE_RW)
@@ -393,7 +397,9 @@ int disk_rasd_from_vbd(
         CMSetProperty(inst, "ElementName",(CMPIValue *)vdi_rec->name_label, CMPI_chars);
         CMSetProperty(inst, "Description",(CMPIValue *)vdi_rec->name_description, CMPI_chars);
         /* HostResource requires string in WBEM URI Format */
-        CMPIObjectPath *disk_ref = disk_image_create_ref(broker, DEFAULT_NS, session, sr_rec->uuid, vdi_rec->uuid);
+        CMPIObjectPath *disk_ref = NULL;
+        if (sr_rec)
+            disk_ref = disk_image_create_ref(broker, DEFAULT_NS, session, sr_rec->uuid, vdi_rec->uuid);
         if (disk_ref) {
             /* conver objectpath to string form */
             char *disks_uri = xen_utils_CMPIObjectPath_to_WBEM_URI(broker, disk_ref);
@@ -435,8 +441,8 @@ int disk_rasd_from_vbd(
     //CMSetProperty(inst, "Weight",(CMPIValue *)&<value>, CMPI_uint32);
 
     /* Free time */
-    if (sr_rec && vdi_rec && !vdi_rec->sr->is_record)
-        xen_sr_record_free(sr_rec);
+    if (alloced_sr_rec)
+        xen_sr_record_free(alloced_sr_rec);
 
     return CMPI_RC_OK;
 }
@@ -18,9 +18,31 @@
 #include "Xen_HostComputerSystem.h"
 #include "Xen_Job.h"
 
+/*
+ * What the classes served here know of a host, taken once per request: the
+ * host and metrics records, and the numbers derived from them. Hosts are
+ * enumerated from a snapshot of all the hosts with their metrics, fetched
+ * with one get_all_records each, rather than a host and a metrics call per
+ * host for every class.
+ */
 typedef struct {
     xen_host host;
     xen_host_record *host_rec;
+    xen_host_metrics_record *metrics_rec;   /* NULL if there's none, or the class doesn't need it */
+    uint64_t memory_total;
+    uint64_t memory_free;
+    uint64_t memory_reserved;
+    uint64_t cpu_count;
+} local_host_entry;
+
+typedef struct {
+    int host_count;
+    local_host_entry *hosts;
+} local_host_snapshot;
+
+typedef struct {
+    local_host_entry *entry;                /* in the list's snapshot or our own */
+    local_host_snapshot *snapshot;          /* of this one host, NULL if it's the list's */
 } local_host_resource;
 
 static const char * host_cn = "Xen_HostComputerSystem";         
@@ -64,6 +86,150 @@ static const char **xen_resource_get_keys(
     else
         return ac_keys;
 }
+static bool _needs_metrics(
+    const CMPIBroker *broker,
+    const char *classname
+    )
+{
+    /* the processor pool and the capabilities are made of the host record alone */
+    return !(xen_utils_class_is_subclass_of(broker, proc_pool_cn, classname) ||
+             xen_utils_class_is_subclass_of(broker, proc_alloc_cap_cn, classname) ||
+             xen_utils_class_is_subclass_of(broker, host_cap_cn, classname));
+}
+
+static void _free_snapshot(local_host_snapshot *snapshot)
+{
+    int i;
+    for (i = 0; i < snapshot->host_count; i++) {
+        local_host_entry *entry = &snapshot->hosts[i];
+        if (entry->metrics_rec)
+            xen_host_metrics_record_free(entry->metrics_rec);
+        if (entry->host_rec)
+            xen_host_record_free(entry->host_rec);
+        if (entry->host)
+            xen_host_free(entry->host);
+    }
+    free(snapshot->hosts);
+    free(snapshot);
+}
+
+/* Works out the numbers the classes show, once per host */
+static void _set_totals(local_host_entry *entry)
+{
+    if (entry->metrics_rec) {
+        entry->memory_total = entry->metrics_rec->memory_total;
+        entry->memory_free = entry->metrics_rec->memory_free;
+        entry->memory_reserved = entry->memory_total - entry->memory_free;
+    }
+    if (entry->host_rec->host_cpus)
+        entry->cpu_count = entry->host_rec->host_cpus->size;
+}
+
+/* A snapshot of all the hosts, with their metrics if 'metrics' is set */
+static local_host_snapshot *_take_snapshot(
+    xen_utils_session *session,
+    bool metrics
+    )
+{
+    xen_host_xen_host_record_map *host_map = NULL;
+    xen_host_metrics_xen_host_metrics_record_map *metrics_map = NULL;
+    local_host_snapshot *snapshot = NULL;
+    size_t i;
+
+    if (!xen_host_get_all_records(session->xen, &host_map)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        goto Exit;
+    }
+    if (metrics && !xen_host_metrics_get_all_records(session->xen, &metrics_map)) {
+        /* the hosts are still there, without their metrics */
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        RESET_XEN_ERROR(session->xen);
+        metrics_map = NULL;
+    }
+    if (metrics_map)
+        qsort(metrics_map->contents, metrics_map->size, sizeof(metrics_map->contents[0]), xen_utils_compare_refs);
+
+    if ((snapshot = calloc(1, sizeof(local_host_snapshot))) == NULL ||
+        (snapshot->hosts = calloc(host_map->size + 1, sizeof(local_host_entry))) == NULL)
+        goto Error;
+    for (i = 0; i < host_map->size; i++) {
+        local_host_entry *entry = &snapshot->hosts[snapshot->host_count];
+        if (host_map->contents[i].val == NULL)
+            continue;
+        entry->host = host_map->contents[i].key;
+        host_map->contents[i].key = NULL;
+        entry->host_rec = host_map->contents[i].val;
+        host_map->contents[i].val = NULL;
+
+        xen_host_metrics_record_opt *metrics_opt = entry->host_rec->metrics;
+        if (metrics_map && metrics_opt && !metrics_opt->is_record) {
+            int found = xen_utils_find_ref(metrics_map->contents, metrics_map->size,
+                                            sizeof(metrics_map->contents[0]),
+                                            (char *)metrics_opt->u.handle);
+            if (found >= 0) {
+                entry->metrics_rec = metrics_map->contents[found].val;
+                metrics_map->contents[found].val = NULL;
+            }
+        }
+        _set_totals(entry);
+        snapshot->host_count++;
+    }
+    goto Exit;
+
+Error:
+    if (snapshot)
+        _free_snapshot(snapshot);
+    snapshot = NULL;
+Exit:
+    if (metrics_map)
+        xen_host_metrics_xen_host_metrics_record_map_free(metrics_map);
+    if (host_map)
+        xen_host_xen_host_record_map_free(host_map);
+    return snapshot;
+}
+
+/* A snapshot of the one host with the uuid */
+static local_host_snapshot *_take_host_snapshot(
+    xen_utils_session *session,
+    const char *uuid,
+    bool metrics
+    )
+{
+    local_host_snapshot *snapshot = NULL;
+    local_host_entry *entry;
+
+    if ((snapshot = calloc(1, sizeof(local_host_snapshot))) == NULL ||
+        (snapshot->hosts = calloc(1, sizeof(local_host_entry))) == NULL)
+        goto Error;
+    entry = &snapshot->hosts[0];
+    snapshot->host_count = 1;
+    if (!xen_host_get_by_uuid(session->xen, &entry->host, (char *)uuid) ||
+        !xen_host_get_record(session->xen, &entry->host_rec, entry->host)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        goto Error;
+    }
+    xen_host_metrics_record_opt *metrics_opt = entry->host_rec->metrics;
+    if (metrics && metrics_opt) {
+        if (metrics_opt->is_record) {
+            entry->metrics_rec = metrics_opt->u.record;
+            metrics_opt->u.record = NULL;
+        }
+        else if (!xen_host_metrics_get_record(session->xen, &entry->metrics_rec, metrics_opt->u.handle)) {
+            /* the host is still there, without its metrics */
+            xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+            RESET_XEN_ERROR(session->xen);
+            entry->metrics_rec = NULL;
+        }
+    }
+    _set_totals(entry);
+    return snapshot;
+
+Error:
+    if (snapshot)
+        _free_snapshot(snapshot);
+    return NULL;
+}
+
 /********************************************************
  * Function to enumerate provider specific resource
  *
@@ -78,10 +244,11 @@ static CMPIrc xen_resource_list_enum(
     provider_resource_list *resources
     )
 {
-    xen_host_set *host_set = NULL;
-    if (!xen_host_get_all(session->xen, &host_set))
+    local_host_snapshot *snapshot = _take_snapshot(session,
+        _needs_metrics(resources->broker, resources->classname));
+    if (snapshot == NULL)
         return CMPI_RC_ERR_FAILED;
-    resources->ctx = host_set;
+    resources->ctx = snapshot;
     return CMPI_RC_OK;
 }
 /*******************************************************************
@@ -98,7 +265,7 @@ static CMPIrc xen_resource_list_cleanup(
     )
 {
     if (resources && resources->ctx)
-        xen_host_set_free((xen_host_set *)resources->ctx);
+        _free_snapshot((local_host_snapshot *)resources->ctx);
     return CMPI_RC_OK;
 }
 /*****************************************************************************
@@ -115,25 +282,15 @@ static CMPIrc xen_resource_record_getnext(
     provider_resource *prov_res /* in , out */
     )
 {
-    xen_host_set *host_set = (xen_host_set *)resources_list->ctx;
-    if (host_set == NULL || resources_list->current_resource == host_set->size)
+    local_host_snapshot *snapshot = (local_host_snapshot *)resources_list->ctx;
+    if (snapshot == NULL || resources_list->current_resource == snapshot->host_count)
         return CMPI_RC_ERR_NOT_FOUND;
 
-    xen_host_record *host_rec = NULL;
-    if (!xen_host_get_record(
-        session->xen,
-        &host_rec,
-        host_set->contents[resources_list->current_resource]
-        )) {
-        xen_utils_trace_error(resources_list->session->xen, __FILE__, __LINE__);
-        return CMPI_RC_ERR_FAILED;
-    }
-    local_host_resource *ctx = calloc(sizeof(local_host_resource), 1);
+    local_host_resource *ctx = PROV_RES_ALLOC(prov_res, local_host_resource);
     if (ctx == NULL)
         return CMPI_RC_ERR_FAILED;
-    ctx->host = host_set->contents[resources_list->current_resource];
-    ctx->host_rec = host_rec;
-    host_set->contents[resources_list->current_resource] = NULL; /* do not delete this*/
+    ctx->entry = &snapshot->hosts[resources_list->current_resource];
+    ctx->snapshot = NULL;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -149,11 +306,9 @@ static CMPIrc xen_resource_record_cleanup(
 {
     local_host_resource *ctx = prov_res->ctx;
     if (ctx) {
-        if (ctx->host_rec)
-            xen_host_record_free(ctx->host_rec);
-        if (ctx->host)
-            xen_host_free(ctx->host);
-        free(ctx);
+        if (ctx->snapshot)
+            _free_snapshot(ctx->snapshot);
+        PROV_RES_FREE(prov_res, ctx);
     }
     return CMPI_RC_OK;
 }
@@ -172,8 +327,7 @@ static CMPIrc xen_resource_record_get_from_id(
     provider_resource *prov_res /* in , out */
     )
 {
-    xen_host host = NULL;
-    xen_host_record *host_rec = NULL;
+    local_host_snapshot *snapshot = NULL;
     char buf[MAX_INSTANCEID_LEN];
 
     if (xen_utils_class_is_subclass_of(prov_res->broker, host_cn, prov_res->classname))
@@ -183,16 +337,16 @@ static CMPIrc xen_resource_record_get_from_id(
         /* Key property is of the form 'Xen:UUID' */
         _CMPIStrncpySystemNameFromID(buf, res_uuid, sizeof(buf)-1);
 
-    if (!xen_host_get_by_uuid(session->xen, &host, buf) || 
-        !xen_host_get_record(session->xen, &host_rec, host)) {
-        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+    snapshot = _take_host_snapshot(session, buf, _needs_metrics(prov_res->broker, prov_res->classname));
+    if (snapshot == NULL)
         return CMPI_RC_ERR_NOT_FOUND;
-    }
-    local_host_resource *ctx = calloc(sizeof(local_host_resource), 1);
-    if (ctx == NULL)
+    local_host_resource *ctx = PROV_RES_ALLOC(prov_res, local_host_resource);
+    if (ctx == NULL) {
+        _free_snapshot(snapshot);
         return CMPI_RC_ERR_FAILED;
-    ctx->host = host;
-    ctx->host_rec = host_rec;
+    }
+    ctx->entry = &snapshot->hosts[0];
+    ctx->snapshot = snapshot;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -258,20 +412,12 @@ static CMPIrc host_set_properties(
     CMPIInstance *inst
     )
 {
-    local_host_resource *ctx = (local_host_resource *)resource->ctx;
+    local_host_entry *ctx = ((local_host_resource *)resource->ctx)->entry;
 
     /* Key properties to be filled in */
     CMSetProperty(inst, "Name",(CMPIValue *)ctx->host_rec->uuid, CMPI_chars);
     CMSetProperty(inst, "CreationClassName",(CMPIValue *)"Xen_HostComputerSystem", CMPI_chars);
 
-    xen_host_metrics metrics = NULL;
-    xen_host_get_metrics(resource->session->xen, &metrics, ctx->host);
-    xen_host_metrics_record *metrics_rec = NULL;
-    if (metrics) {
-        xen_host_metrics_get_record(resource->session->xen, &metrics_rec, metrics);
-        xen_host_metrics_free(metrics);
-    }
-
     /* Populate the instance's properties with the backend data */
     _set_allowed_operations(resource->broker, ctx->host_rec, inst, "AvailableRequestedStates");
 
@@ -378,8 +524,8 @@ static CMPIrc host_set_properties(
     //CMPIArray *arr = CMNewArray(resource->broker, 1, CMPI_chars, NULL);
     //CMSetArrayElementAt(arr, 0, (CMPIValue *)<value>, CMPI_chars);
     //CMSetProperty(inst, "StatusDescriptions",(CMPIValue *)&arr, CMPI_charsA);
-    if (metrics_rec && (metrics_rec->last_updated != 0)) {
-        CMPIDateTime *install_time = xen_utils_time_t_to_CMPIDateTime(resource->broker, metrics_rec->last_updated);
+    if (ctx->metrics_rec && (ctx->metrics_rec->last_updated != 0)) {
+        CMPIDateTime *install_time = xen_utils_time_t_to_CMPIDateTime(resource->broker, ctx->metrics_rec->last_updated);
         CMSetProperty(inst, "TimeOfLastStateChange",(CMPIValue *)&install_time, CMPI_dateTime);
     }
 
@@ -389,9 +535,6 @@ static CMPIrc host_set_properties(
     struct tm tmnow;
     localtime_r(&now, &tmnow);
     CMSetProperty(inst, "TimeOffset", (CMPIValue *)&tmnow.tm_gmtoff, CMPI_sint32);
-
-    if (metrics_rec)
-        xen_host_metrics_record_free(metrics_rec);
     return CMPI_RC_OK;
 }
 
@@ -401,19 +544,13 @@ static CMPIrc hostmemory_set_properties(
     )
 {
     char buf[MAX_INSTANCEID_LEN];
-    local_host_resource *ctx = resource->ctx;
+    local_host_entry *ctx = ((local_host_resource *)resource->ctx)->entry;
     _CMPICreateNewDeviceInstanceID(buf, sizeof(buf), ctx->host_rec->uuid, "Memory");
     CMSetProperty(inst, "DeviceID",(CMPIValue *)buf, CMPI_chars);
     CMSetProperty(inst, "CreationClassName",(CMPIValue *)"Xen_HostMemory", CMPI_chars);
     CMSetProperty(inst, "SystemCreationClassName",(CMPIValue *)"Xen_HostComputerSystem", CMPI_chars);
     CMSetProperty(inst, "SystemName",(CMPIValue *)ctx->host_rec->uuid, CMPI_chars);
 
-    xen_host_metrics_record *metrics_rec = NULL;
-    if (ctx->host_rec->metrics->is_record)
-        metrics_rec = ctx->host_rec->metrics->u.record;
-    else
-        xen_host_metrics_get_record(resource->session->xen, &metrics_rec, ctx->host_rec->metrics->u.handle);
-
     /* Populate the instance's properties with the backend data */
 
     //CMSetProperty(inst, "Access",(CMPIValue *)&<value>, CMPI_uint16);
@@ -427,7 +564,7 @@ static CMPIrc hostmemory_set_properties(
     uint64_t blockSize = 1;
     CMSetProperty(inst, "BlockSize",(CMPIValue *)&blockSize, CMPI_uint64);
     CMSetProperty(inst, "Caption",(CMPIValue *)"Xen Host Memory", CMPI_chars);
-    CMSetProperty(inst, "ConsumableBlocks",(CMPIValue *)&metrics_rec->memory_free, CMPI_uint64);
+    CMSetProperty(inst, "ConsumableBlocks",(CMPIValue *)&ctx->memory_free, CMPI_uint64);
     //CMSetProperty(inst, "CorrectableError",(CMPIValue *)&<value>, CMPI_boolean);
     //CMSetProperty(inst, "DataOrganization",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "DataRedundancy",(CMPIValue *)&<value>, CMPI_uint16);
@@ -436,7 +573,7 @@ static CMPIrc hostmemory_set_properties(
     CMSetProperty(inst, "ElementName",(CMPIValue *)ctx->host_rec->name_label, CMPI_chars);
     //CMSetProperty(inst, "EnabledDefault",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "EnabledState",(CMPIValue *)&<value>, CMPI_uint16);
-    CMSetProperty(inst, "EndingAddress",(CMPIValue *)&metrics_rec->memory_total, CMPI_uint64);
+    CMSetProperty(inst, "EndingAddress",(CMPIValue *)&ctx->memory_total, CMPI_uint64);
     //CMSetProperty(inst, "ErrorAccess",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "ErrorAddress",(CMPIValue *)&<value>, CMPI_uint64);
     //CMSetProperty(inst, "ErrorCleared",(CMPIValue *)&<value>, CMPI_boolean);
@@ -467,7 +604,7 @@ static CMPIrc hostmemory_set_properties(
     //CMSetProperty(inst, "NameFormat",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "NameNamespace",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "NoSinglePointOfFailure",(CMPIValue *)&<value>, CMPI_boolean);
-    CMSetProperty(inst, "NumberOfBlocks",(CMPIValue *)&metrics_rec->memory_total, CMPI_uint64);
+    CMSetProperty(inst, "NumberOfBlocks",(CMPIValue *)&ctx->memory_total, CMPI_uint64);
     //CMPIArray *arr = CMNewArray(_BROKER, 1, CMPI_uint16, NULL);
     //CMSetArrayElementAt(arr, 0, (CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "OperationalStatus",(CMPIValue *)&arr, CMPI_uint16A);
@@ -502,9 +639,6 @@ static CMPIrc hostmemory_set_properties(
     //CMSetProperty(inst, "TotalPowerOnHours",(CMPIValue *)&<value>, CMPI_uint64);
     //CMSetProperty(inst, "Volatile",(CMPIValue *)&<value>, CMPI_boolean);
 
-    if (!ctx->host_rec->metrics->is_record)
-        xen_host_metrics_record_free(metrics_rec);
-
     return CMPI_RC_OK;
 }
 
@@ -513,15 +647,9 @@ static CMPIrc memorypool_set_properties(
     CMPIInstance *inst
     )
 {
-    local_host_resource *ctx = resource->ctx;
+    local_host_entry *ctx = ((local_host_resource *)resource->ctx)->entry;
     char buf[MAX_INSTANCEID_LEN];
     int prop_val_32;
-    xen_host_metrics_record *host_metrics_rec = NULL;
-
-    if (ctx->host_rec->metrics->is_record)
-        host_metrics_rec = ctx->host_rec->metrics->u.record;
-    else
-        xen_host_metrics_get_record(resource->session->xen, &host_metrics_rec, ctx->host_rec->metrics->u.handle);
 
     _CMPICreateNewDeviceInstanceID(buf, MAX_INSTANCEID_LEN, ctx->host_rec->uuid, "MemoryPool");
     CMSetProperty(inst, "InstanceID", (CMPIValue *)buf, CMPI_chars);
@@ -532,7 +660,7 @@ static CMPIrc memorypool_set_properties(
     CMSetProperty(inst, "ResourceSubType", (CMPIValue *) "Xen Memory", CMPI_chars);
     CMSetProperty(inst, "AllocationUnits", (CMPIValue *)"Bytes", CMPI_chars);
 
-    CMSetProperty(inst, "Capacity",(CMPIValue *)&(host_metrics_rec->memory_total), CMPI_uint64);
+    CMSetProperty(inst, "Capacity",(CMPIValue *)&ctx->memory_total, CMPI_uint64);
     CMSetProperty(inst, "Caption", (CMPIValue *)"Xen Virtual Memory Pool", CMPI_chars);
     CMSetProperty(inst, "Description", (CMPIValue *)"Xen Virtual Memory Pool", CMPI_chars);
     CMSetProperty(inst, "ElementName", (CMPIValue *)ctx->host_rec->name_label, CMPI_chars);
@@ -551,13 +679,9 @@ static CMPIrc memorypool_set_properties(
     //CMSetProperty(inst, "Status", (CMPIValue *)status, CMPI_chars);
     // CMSetProperty(inst, "StatusDescriptions", (CMPIValue *)status_descs, CMPI_chars);
 
-    int64_t reserved = host_metrics_rec->memory_total - host_metrics_rec->memory_free;
-    CMSetProperty(inst, "Reserved", (CMPIValue *)&reserved, CMPI_uint64);
+    CMSetProperty(inst, "Reserved", (CMPIValue *)&ctx->memory_reserved, CMPI_uint64);
     // CMSetProperty(inst, "Unreservable", (CMPIValue *)unreservable, CMPI_uint16);
 
-    if (!ctx->host_rec->metrics->is_record)
-        xen_host_metrics_record_free(host_metrics_rec);
-
     return CMPI_RC_OK;
 }
 
@@ -566,7 +690,7 @@ CMPIrc memory_allocation_cap_set_properties(
     CMPIInstance *inst)
 {
     char buf[MAX_INSTANCEID_LEN];
-    local_host_resource *ctx = resource->ctx;
+    local_host_entry *ctx = ((local_host_resource *)resource->ctx)->entry;
 
     /* Populate the instance's properties with the backend data */
     CMSetProperty(inst, "Caption",(CMPIValue *)"Xen Memory Allocation Capabilities", CMPI_chars);
@@ -599,7 +723,8 @@ static CMPIrc processorpool_set_properties(
     uint64_t prop_val_64;
     int prop_val_32;
     char buf[MAX_INSTANCEID_LEN];
-    xen_host_record *host_rec = ((local_host_resource *)resource->ctx)->host_rec;
+    local_host_entry *ctx = ((local_host_resource *)resource->ctx)->entry;
+    xen_host_record *host_rec = ctx->host_rec;
 
     _CMPICreateNewDeviceInstanceID(buf, MAX_INSTANCEID_LEN, host_rec->uuid, "ProcessorPool");
     CMSetProperty(inst, "InstanceID", (CMPIValue *)buf, CMPI_chars);
@@ -613,8 +738,7 @@ static CMPIrc processorpool_set_properties(
     CMSetProperty(inst, "AllocationUnits", (CMPIValue *)"count", CMPI_chars);
 
     /* Capacity is the number of items in xen_host_cpu_set. */
-    prop_val_64 = host_rec->host_cpus->size;
-    CMSetProperty(inst, "Capacity", (CMPIValue *)&prop_val_64, CMPI_uint64);
+    CMSetProperty(inst, "Capacity", (CMPIValue *)&ctx->cpu_count, CMPI_uint64);
     CMSetProperty(inst, "Caption", (CMPIValue *)"Xen Virtual Processor Pool", CMPI_chars);
     CMSetProperty(inst, "Description", (CMPIValue *)host_rec->name_description, CMPI_chars);
     CMSetProperty(inst, "ElementName", (CMPIValue *)host_rec->name_label, CMPI_chars);
@@ -648,7 +772,7 @@ static CMPIrc processor_alloc_capabilities_set_properties(
     CMPIInstance *inst)
 {
     char buf[MAX_INSTANCEID_LEN];
-    xen_host_record *host_rec = ((local_host_resource *)resource->ctx)->host_rec;
+    xen_host_record *host_rec = ((local_host_resource *)resource->ctx)->entry->host_rec;
 
     /* Populate the instance's properties with the backend data */
     CMSetProperty(inst, "Caption",(CMPIValue *)"Xen Processor Allocation Capabilities", CMPI_chars);
@@ -678,7 +802,7 @@ static CMPIrc hostcomputer_capabilities_set_properties(
     CMPIInstance *inst
     )
 {
-    xen_host_record *host_rec = ((local_host_resource *)resource->ctx)->host_rec;
+    xen_host_record *host_rec = ((local_host_resource *)resource->ctx)->entry->host_rec;
     if(host_rec == NULL)
         return CMPI_RC_ERR_FAILED;
 
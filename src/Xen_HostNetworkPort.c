@@ -18,6 +18,7 @@
 #include <cmpitrace.h>
 #include "providerinterface.h"
 #include "RASDs.h"
+#include "xen_topology.h"
 
 static const char *hnp_cn = "Xen_HostNetworkPort";    
 static const char *rasd_cn = "Xen_HostNetworkPortSettingData";    
@@ -33,8 +34,9 @@ static const char *rasd_key_property = "InstanceID";
 static const char *metrics_key_property = "InstanceID";
 
 typedef struct {
-    xen_pif pif;
-    xen_pif_record *pif_rec;
+    xen_net_pif *pif;
+    xen_net_topology *topo;     /* the topology of just this PIF for a get, NULL
+                                   when it belongs to the resource list */
 } local_pif_resource;
 /*********************************************************
  ************ Provider Specific functions **************** 
@@ -83,42 +85,13 @@ static CMPIrc xen_resource_list_enum(
     provider_resource_list *resources
     )
 {
-    xen_pif_set *pif_set = NULL, *all_pifs = NULL;
-    if (!xen_pif_get_all(session->xen, &all_pifs))
+    /* all the PIFs with their hosts, metrics, networks and bonds in a few calls */
+    xen_net_topology *topo = xen_net_topology_new(session);
+    if (topo == NULL)
         return CMPI_RC_ERR_FAILED;
-
-    /* Filter out physical NICS that are part of a BOND */
-    /* SCVMM team needs this for some reason */
-    int i = 0;
-    if (all_pifs) {
-        for (i=0; i<all_pifs->size; i++) {
-            xen_bond bond = NULL;
-            RESET_XEN_ERROR(session->xen);
-            if (xen_pif_get_bond_slave_of(session->xen, &bond, all_pifs->contents[i]) && bond) {
-                char *uuid = NULL;
-                xen_bond_get_uuid(session->xen, &uuid, bond);
-                xen_bond_free(bond);
-                if(uuid) {
-                    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("PIF is bond slave of %s", uuid));
-                    free(uuid);
-                    continue;
-                }
-            }
-            /* Include only NICs that are not part of the bond */
-            ADD_DEVICE_TO_LIST(pif_set, all_pifs->contents[i], xen_pif);
-        }
-        xen_pif_set_free(all_pifs);
-    }
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Enumerated %d PIFs", pif_set->size));
-    resources->ctx = pif_set;
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Enumerated %d PIFs", topo->pif_count));
+    resources->ctx = topo;
     return CMPI_RC_OK;
-
-    Exit:
-    if (all_pifs)
-        xen_pif_set_free(all_pifs);
-    if (pif_set)
-        xen_pif_set_free(pif_set);
-    return CMPI_RC_ERR_FAILED;
 }
 /*******************************************************************
  * Function to cleanup provider specific resource, this function is
@@ -134,7 +107,7 @@ static CMPIrc xen_resource_list_cleanup(
     )
 {
     if (resources->ctx)
-        xen_pif_set_free((xen_pif_set *)resources->ctx);
+        xen_net_topology_free((xen_net_topology *)resources->ctx);
     return CMPI_RC_OK;
 }
 /*****************************************************************************
@@ -151,24 +124,25 @@ static CMPIrc xen_resource_record_getnext(
     provider_resource *prov_res /* in , out */
     )
 {
-    xen_pif_set *pif_set = (xen_pif_set *)resources_list->ctx;
-    if (pif_set == NULL || resources_list->current_resource == pif_set->size)
+    xen_net_topology *topo = (xen_net_topology *)resources_list->ctx;
+    if (topo == NULL)
         return CMPI_RC_ERR_NOT_FOUND;
 
-    xen_pif_record *pif_rec = NULL;
-    if (!xen_pif_get_record(session->xen, 
-                            &pif_rec, 
-                            pif_set->contents[resources_list->current_resource]
-        )) {
-        xen_utils_trace_error(resources_list->session->xen, __FILE__, __LINE__);
-        return CMPI_RC_ERR_FAILED;
+    /* Filter out physical NICS that are part of a BOND */
+    /* SCVMM team needs this for some reason */
+    while (resources_list->current_resource < topo->pif_count &&
+           topo->pifs[resources_list->current_resource].bond_master) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("PIF %s is a bond slave",
+                     topo->pifs[resources_list->current_resource].rec->uuid));
+        resources_list->current_resource++;
     }
+    if (resources_list->current_resource == topo->pif_count)
+        return CMPI_RC_ERR_NOT_FOUND;
+
     local_pif_resource *ctx = calloc(sizeof(local_pif_resource), 1);
     if (ctx == NULL)
         return CMPI_RC_ERR_FAILED;
-    ctx->pif = pif_set->contents[resources_list->current_resource];
-    ctx->pif_rec = pif_rec;
-    pif_set->contents[resources_list->current_resource] = NULL; /* do not delete this*/
+    ctx->pif = &topo->pifs[resources_list->current_resource];
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -182,10 +156,7 @@ static CMPIrc xen_resource_record_cleanup(provider_resource *prov_res)
 {
     if (prov_res->ctx) {
         local_pif_resource *ctx = prov_res->ctx;
-        if (ctx->pif_rec)
-            xen_pif_record_free(ctx->pif_rec);
-        if (ctx->pif)
-            xen_pif_free(ctx->pif);
+        xen_net_topology_free(ctx->topo);
         free(ctx);
     }
     return CMPI_RC_OK;
@@ -209,18 +180,19 @@ static CMPIrc xen_resource_record_get_from_id(
     _CMPIStrncpyDeviceNameFromID(buf, res_uuid, sizeof(buf));
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("hostnetwork port %s", buf));
     //_CMPIStrncpySystemNameFromID(buf, res_uuid, sizeof(buf));
-    xen_pif pif;
-    xen_pif_record *pif_rec = NULL;
-    if (!xen_pif_get_by_uuid(session->xen, &pif, buf) || 
-        !xen_pif_get_record(session->xen, &pif_rec, pif)) {
-        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+    xen_net_topology *topo = xen_net_topology_new_for_pif(session, buf);
+    xen_net_pif *pif = xen_net_topology_find_uuid(topo, buf);
+    if (pif == NULL) {
+        xen_net_topology_free(topo);
         return CMPI_RC_ERR_NOT_FOUND;
     }
     local_pif_resource *ctx = calloc(sizeof(local_pif_resource), 1);
-    if (ctx == NULL)
+    if (ctx == NULL) {
+        xen_net_topology_free(topo);
         return CMPI_RC_ERR_FAILED;
+    }
     ctx->pif = pif;
-    ctx->pif_rec = pif_rec;
+    ctx->topo = topo;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -234,30 +206,17 @@ static CMPIrc xen_resource_record_get_from_id(
 *************************************************************************/
 static CMPIrc network_port_set_properties(provider_resource* resource, CMPIInstance *inst)
 {
-    xen_pif_record *pif_rec = ((local_pif_resource *)resource->ctx)->pif_rec;
-    xen_host_record *host_rec = NULL;
-    xen_pif_metrics_record *metrics_rec = NULL;
+    xen_net_pif *pif = ((local_pif_resource *)resource->ctx)->pif;
+    xen_pif_record *pif_rec = pif->rec;
+    xen_host_record *host_rec = pif->host_rec;
+    xen_pif_metrics_record *metrics_rec = pif->metrics;
     char buf[MAX_INSTANCEID_LEN];
     char *host_uuid = "NoHost";
-    char *host_name = "NoHost";
     CMPIArray *arr = NULL;
     DMTF_CommunicationStatus comm_status = DMTF_CommunicationStatus_Communication_OK;
 
-    if (pif_rec->host->is_record)
-        host_rec = pif_rec->host->u.record;
-    else
-        xen_host_get_record(resource->session->xen, &host_rec, pif_rec->host->u.handle);
-
-    if (host_rec) {
+    if (host_rec)
         host_uuid = host_rec->uuid;
-        host_name = host_rec->hostname;
-    }
-
-    if (pif_rec->metrics->is_record)
-        metrics_rec = pif_rec->metrics->u.record;
-    else
-        xen_pif_metrics_get_record(resource->session->xen, &metrics_rec, pif_rec->metrics->u.handle);
-    RESET_XEN_ERROR(resource->session->xen); /* reset errors */
 
     _CMPICreateNewDeviceInstanceID(buf, MAX_INSTANCEID_LEN, host_uuid, pif_rec->uuid);
     CMSetProperty(inst, "DeviceID",(CMPIValue *)buf, CMPI_chars);
@@ -348,13 +307,6 @@ static CMPIrc network_port_set_properties(provider_resource* resource, CMPIInsta
     //CMSetProperty(inst, "TotalPowerOnHours",(CMPIValue *)&<value>, CMPI_uint64);
     //CMSetProperty(inst, "TransitioningToState",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "UsageRestriction",(CMPIValue *)&<value>, CMPI_uint16);
-    // 
-    if (metrics_rec && !pif_rec->metrics->is_record) {
-        xen_pif_metrics_record_free(metrics_rec);
-    }
-    if (host_rec && !pif_rec->host->is_record) {
-        xen_host_record_free(host_rec);
-    }
     return CMPI_RC_OK;
 }
 static CMPIrc rasd_set_properties(
@@ -362,23 +314,13 @@ static CMPIrc rasd_set_properties(
     CMPIInstance *inst
     )
 {
-    xen_pif_record *pif_rec = ((local_pif_resource *)resource->ctx)->pif_rec;
-    xen_network_record *net_rec = NULL;
-    xen_host_record *host_rec = NULL;
+    xen_net_pif *pif = ((local_pif_resource *)resource->ctx)->pif;
+    xen_pif_record *pif_rec = pif->rec;
+    xen_network_record *net_rec = pif->network;
+    xen_host_record *host_rec = pif->host_rec;
     char *host_uuid = "NoHost";
     char buf[MAX_INSTANCEID_LEN];
 
-    if (pif_rec->network) {
-        if (pif_rec->network->is_record)
-            net_rec = pif_rec->network->u.record;
-        else
-            xen_network_get_record(resource->session->xen, &net_rec, pif_rec->network->u.handle);
-    }
-    if (pif_rec->host->is_record)
-        host_rec = pif_rec->host->u.record;
-    else
-        xen_host_get_record(resource->session->xen, &host_rec, pif_rec->host->u.handle);
-
     if (host_rec)
         host_uuid = host_rec->uuid;
 
@@ -424,18 +366,9 @@ static CMPIrc rasd_set_properties(
     //CMSetProperty(inst, "MappingBehavior",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "OtherEndpointMode",(CMPIValue *)<value>, CMPI_chars);
     //CMSetProperty(inst, "OtherResourceType",(CMPIValue *)<value>, CMPI_chars);
-    if (pif_rec->bond_slave_of) {
-        if (pif_rec->bond_slave_of->is_record)
-            CMSetProperty(inst, "Parent",(CMPIValue *)pif_rec->bond_slave_of->u.record->uuid, CMPI_chars);
-        else {
-            char *master_uuid = NULL;
-            if (xen_pif_get_uuid(resource->session->xen, &master_uuid, pif_rec->bond_slave_of->u.handle)) {
-                CMSetProperty(inst, "Parent",(CMPIValue *)master_uuid, CMPI_chars);
-                free(master_uuid);
-            }
-        }
-    }
-    CMSetProperty(inst, "PoolID",(CMPIValue *)host_rec->uuid, CMPI_chars);
+    if (pif->bond_master)
+        CMSetProperty(inst, "Parent",(CMPIValue *)pif->bond_master->rec->uuid, CMPI_chars);
+    CMSetProperty(inst, "PoolID",(CMPIValue *)host_uuid, CMPI_chars);
     //CMSetProperty(inst, "Reservation",(CMPIValue *)&<value>, CMPI_uint64);
     //CMSetProperty(inst, "ResourceSubType",(CMPIValue *)<value>, CMPI_chars);
     int res_type = DMTF_ResourceType_Ethernet_Adapter;
@@ -448,13 +381,6 @@ static CMPIrc rasd_set_properties(
     if (net_rec)
         CMSetProperty(inst, "VirtualSwitch",(CMPIValue *)net_rec->uuid, CMPI_chars);
     //CMSetProperty(inst, "Weight",(CMPIValue *)&<value>, CMPI_uint32);
-
-    if (net_rec && !pif_rec->network->is_record) {
-        xen_network_record_free(net_rec);
-    }
-    if (host_rec && !pif_rec->host->is_record) {
-        xen_host_record_free(host_rec);
-    }
     return CMPI_RC_OK;
 }
 
@@ -464,26 +390,14 @@ static CMPIrc metrics_set_properties(
     CMPIInstance *inst
     )
 {
-    xen_pif_record *pif_rec = ((local_pif_resource *)resource->ctx)->pif_rec;
-    xen_host_record *host_rec = NULL;
+    xen_net_pif *pif = ((local_pif_resource *)resource->ctx)->pif;
+    xen_pif_record *pif_rec = pif->rec;
+    xen_host_record *host_rec = pif->host_rec;
     char buf[MAX_INSTANCEID_LEN];
     char *host_uuid = "NoHost";
-    xen_host host = NULL;
-    CMPIrc statusrc = CMPI_RC_OK;
-
-    if (pif_rec->host->is_record) {
-        host_rec = pif_rec->host->u.record;
-        xen_host_get_by_uuid(resource->session->xen, &host, host_rec->uuid);
-    }
-    else {
-        host = pif_rec->host->u.handle;
-        xen_host_get_record(resource->session->xen, &host_rec, pif_rec->host->u.handle);
-    }
 
-    if (!host_rec) {
-        statusrc = CMPI_RC_ERR_INVALID_PARAMETER;
-        goto exit;
-    }
+    if (!host_rec)
+        return CMPI_RC_ERR_INVALID_PARAMETER;
 
     host_uuid = host_rec->uuid;
 
@@ -508,7 +422,8 @@ static CMPIrc metrics_set_properties(
     else
         snprintf(buf, MAX_INSTANCEID_LEN, "pif_%s_tx", pif_rec->device);
     CMSetProperty(inst, "Description",(CMPIValue *)buf, CMPI_chars);
-    xen_host_query_data_source(resource->session->xen, &io_kbps, host, buf);
+    if (!xen_host_query_data_source(resource->session->xen, &io_kbps, pif->host, buf))
+        RESET_XEN_ERROR(resource->session->xen);
     snprintf(buf, MAX_INSTANCEID_LEN, "%f", io_kbps);
     CMSetProperty(inst, "MetricValue", (CMPIValue *)buf, CMPI_chars);
 
@@ -516,15 +431,7 @@ static CMPIrc metrics_set_properties(
     CMSetProperty(inst, "TimeStamp",(CMPIValue *)&date_time, CMPI_dateTime);
     bool vol=true;
     CMSetProperty(inst, "Volatile",(CMPIValue *)&vol, CMPI_boolean);
-    // 
-
-exit:
-    if (host_rec && !pif_rec->host->is_record)
-        xen_host_record_free(host_rec);
-    if (host && pif_rec->host->is_record)
-        xen_host_free(host);
-
-    return statusrc;
+    return CMPI_RC_OK;
 }
 
 static CMPIrc xen_resource_set_properties(
@@ -557,6 +464,8 @@ XenInstanceMIStub(Xen_HostNetworkPort)
  * @param in nic_rads - the RASD to convert to convert to a PIF record 
  * @param in/out pif_rec_set - the pif record set to add the new record to
  * @param out bonded_set - if the pif set represents a set of bonded PIFs or not
+ * @param in/out net_topo - network topology the PIF records are taken from, built
+ *        if NULL and left for the caller to free; NULL to not keep one
  * @param in/out status - CMPI status of the opeartion
  *
  * @returns true if success, false if failed
@@ -567,11 +476,12 @@ XenInstanceMIStub(Xen_HostNetworkPort)
     CMPIInstance *nic_rasd,
     xen_pif_record_set **pif_rec_set,
     bool *bonded_set,
+    xen_net_topology **net_topo,
     CMPIStatus *status)
 {
     CMPIData arr, prop;
     char *devices = NULL;
-    xen_pif_set *all_pifs = NULL;
+    xen_net_topology *topo = net_topo ? *net_topo : NULL;
     int64_t vlan_id = -1;
     int i=0;
     char buf[100];
@@ -674,44 +584,37 @@ XenInstanceMIStub(Xen_HostNetworkPort)
     }
     else if (device_list) {
         /* the RASD specified a list of pifs to look for based on connection (eth1, eth2 etc) data */
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Looking for pifs specified by the %d devices", device_list->size));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Looking for pifs specified by the %d devices", (int)device_list->size));
 
-        if (!xen_pif_get_all(session->xen, &all_pifs))
+        if (topo == NULL && (topo = xen_net_topology_new(session)) == NULL)
             goto Exit;
 
         /* more than one ehternet interface has been specified */
         if (device_list->size > 1)
             *bonded_set = true;
 
-        /* Check to see if we can find a PIF with the device name specified, if so, 
-         * get its pif record (which includes host etc) and update the record with 
+        /* Check to see if we can find a PIF with the device name specified on any host,
+         * if so, take its pif record (which includes host etc) and update the record with 
          * any data (VLAN) passed in the RASD 
          */
-        i=all_pifs->size;
-        while (i>0) {
-            xen_pif_record *pif_rec = NULL;
-            bool added_to_piflist = false;
-            if (xen_pif_get_record(session->xen, &pif_rec, all_pifs->contents[i-1])) {
-                int i;
-                if (pif_rec->device) {
-                    for (i=0; i<device_list->size; i++) {
-                        if ((strcmp(pif_rec->device, device_list->contents[i]) == 0) &&
-                            pif_rec->vlan == -1) { 
-                            /* Dont include ones that have a VLAN id already, they cant be used to create a new VLAN */
-                            /* modify the appropriate members of the pif record here */
-                            pif_rec->vlan = vlan_id;
-                            ADD_DEVICE_TO_LIST((*pif_rec_set), pif_rec, xen_pif_record);
-                            added_to_piflist = true;
-                            break;
-                        }
+        for (i=0; i<topo->pif_count; i++) {
+            xen_net_pif *pif = &topo->pifs[i];
+            int j;
+            /* Dont include ones that have a VLAN id already, they cant be used to create a new VLAN */
+            if (pif->rec->device == NULL || pif->rec->vlan != -1)
+                continue;
+            for (j=0; j<device_list->size; j++) {
+                if (strcmp(pif->rec->device, device_list->contents[j]) == 0) {
+                    /* modify the appropriate members of the pif record here,
+                       unless an earlier RASD in the same call already took it */
+                    xen_pif_record *pif_rec = xen_net_topology_take_record(topo, pif);
+                    if (pif_rec) {
+                        pif_rec->vlan = vlan_id;
+                        ADD_DEVICE_TO_LIST((*pif_rec_set), pif_rec, xen_pif_record);
                     }
+                    break;
                 }
-                if (!added_to_piflist)
-                    xen_pif_record_free(pif_rec);
             }
-            else
-                goto Exit;
-            i--;
         }
     }
     if (*pif_rec_set == NULL) {
@@ -727,8 +630,10 @@ XenInstanceMIStub(Xen_HostNetworkPort)
     Exit:
     if (pif_uuid)
         free(pif_uuid);
-    if (all_pifs)
-        xen_pif_set_free(all_pifs);
+    if (net_topo)
+        *net_topo = topo;
+    else
+        xen_net_topology_free(topo);
     if (device_list)
         xen_string_set_free(device_list);
     xen_utils_set_status(broker, status, statusrc, error_msg, session->xen);
@@ -742,6 +647,8 @@ XenInstanceMIStub(Xen_HostNetworkPort)
  * @param in setting_data - raw CMPI data that represents the RASD array
  * @param in/out pif_rec_set - the pif record set to add the new record to
  * @param out bonded_set - if the pif set represents a set of bonded PIFs or not
+ * @param in/out topo - network topology the PIF records are taken from, built
+ *        if NULL and left for the caller to free; NULL to not keep one
  * @param in/out status - CMPI status of the opeartion
  *
  * @returns true if success, false if failed
@@ -752,6 +659,7 @@ bool host_network_port_rasd_parse(
     CMPIData *setting_data,
     xen_pif_record_set **pif_rec_set,
     bool *bonded_set,
+    xen_net_topology **topo,
     CMPIStatus *status
     )
 {
@@ -777,7 +685,7 @@ bool host_network_port_rasd_parse(
     if (xen_utils_class_is_subclass_of(broker, settingclassname, "CIM_EthernetPortAllocationSettingData") && 
         ((resourceType == DMTF_ResourceType_Ethernet_Connection) ||
         (resourceType == DMTF_ResourceType_Ethernet_Adapter))) {
-        if (network_rasd_to_pif_set(broker, session, instance, pif_rec_set, bonded_set, status) && pif_rec_set)
+        if (network_rasd_to_pif_set(broker, session, instance, pif_rec_set, bonded_set, topo, status) && pif_rec_set)
             statusrc = CMPI_RC_OK;
     }
     else {
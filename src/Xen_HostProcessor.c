@@ -18,6 +18,7 @@
 
 #include "Xen_Processor.h"
 #include "providerinterface.h"
+#include "xen_rrd.h"
 
 static const char *hp_cn = "Xen_HostProcessor";
 static const char *hp_keys[] = {"CreationClassName","SystemCreationClassName","DeviceID","SystemName"};
@@ -322,15 +323,27 @@ static CMPIrc processor_metric_set_properties(
     CMSetProperty(inst, "ElementName",(CMPIValue *)host_rec->uuid, CMPI_chars);
     CMSetProperty(inst, "MeasuredElementName",(CMPIValue *)host_rec->name_label, CMPI_chars);
 
+    /* all the cpus of the host come from one rrd_updates snapshot, querying
+       the data source of each is the fallback */
     xen_host host = NULL;
     double load_percentage = 0.0;
-    xen_host_get_by_uuid(resource->session->xen, &host, host_rec->uuid);
+    if(!cpu_rec->host->is_record)
+        host = cpu_rec->host->u.handle;
+    else if(!xen_host_get_by_uuid(resource->session->xen, &host, host_rec->uuid))
+        RESET_XEN_ERROR(resource->session->xen);
     if(host) {
-
         snprintf(buf, MAX_INSTANCEID_LEN, "cpu%" PRId64, cpu_rec->number);
-        xen_host_query_data_source(resource->session->xen, &load_percentage, host, buf);
+        xen_cpu_utilisation *cpus = xen_rrd_get_cpu_utilisation(resource->session, host, host_rec->uuid);
+        load_percentage = xen_rrd_cpu_load(cpus, (int)cpu_rec->number, -1.0);
+        if(load_percentage < 0) {
+            load_percentage = 0.0;
+            if(!xen_host_query_data_source(resource->session->xen, &load_percentage, host, buf))
+                RESET_XEN_ERROR(resource->session->xen);
+        }
+        xen_rrd_cpu_utilisation_free(cpus);
         CMSetProperty(inst, "Description",(CMPIValue *)buf, CMPI_chars);
-        xen_host_free(host);
+        if(cpu_rec->host->is_record)
+            xen_host_free(host);
     }
     snprintf(buf, MAX_INSTANCEID_LEN, "%f", (load_percentage*100));
     CMSetProperty(inst, "MetricValue",(CMPIValue *)buf, CMPI_chars);
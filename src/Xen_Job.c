@@ -290,17 +290,25 @@ static CMPIrc xen_resource_set_properties(
     CMPIUint16 jobstate = 0, errorcode = 0, percentcomplete=0;
     char buf[MAX_INSTANCEID_LEN];
     xen_task_record *task_rec = (xen_task_record *)resource->ctx;
-    char *jobstatestr = xen_utils_get_from_string_string_map(task_rec->other_config, "CIMJobState");
+
+    /* Most of the job's state lives in the task's other_config, index it
+       once rather than scanning it for every property */
+    xen_utils_string_map_index *other_config = xen_utils_string_map_index_new(task_rec->other_config);
+    if (other_config == NULL)
+        return CMPI_RC_ERR_FAILED;
+    task_rec->other_config = NULL;
+
+    char *jobstatestr = xen_utils_string_map_index_get(other_config, "CIMJobState");
     if (jobstatestr)
         jobstate = atoi(jobstatestr);
-    char *errorcodestr = xen_utils_get_from_string_string_map(task_rec->other_config, "ErrorCode");
+    char *errorcodestr = xen_utils_string_map_index_get(other_config, "ErrorCode");
     if (errorcodestr)
         errorcode = atoi(errorcodestr);
-    char *percentcompletestr = xen_utils_get_from_string_string_map(task_rec->other_config, "PercentComplete");
+    char *percentcompletestr = xen_utils_string_map_index_get(other_config, "PercentComplete");
     if (percentcompletestr)
         percentcomplete = atoi(percentcompletestr);
-    char *errordesc = xen_utils_get_from_string_string_map(task_rec->other_config, "ErrorDescription");
-    char *desc = xen_utils_get_from_string_string_map(task_rec->other_config, "Description");
+    char *errordesc = xen_utils_string_map_index_get(other_config, "ErrorDescription");
+    char *desc = xen_utils_string_map_index_get(other_config, "Description");
 
     CMSetProperty(inst, "Caption",(CMPIValue *)"Xen Task", CMPI_chars);
     //CMSetProperty(inst, "CommunicationStatus",(CMPIValue *)&<value>, CMPI_uint16);
@@ -358,26 +366,26 @@ static CMPIrc xen_resource_set_properties(
 
     /* The Xen_ConnectToDiskImageJob has extra properties, set them here */
     if(xen_utils_class_is_subclass_of(resource->broker, resource->classname, "Xen_ConnectToDiskImageJob")) {
-        char *target_uri = xen_utils_get_from_string_string_map(task_rec->other_config, "TargetURI");
+        char *target_uri = xen_utils_string_map_index_get(other_config, "TargetURI");
         if(target_uri)
             CMSetProperty(inst, "TargetURI",(CMPIValue *)target_uri, CMPI_chars);
-        char *server_cert = xen_utils_get_from_string_string_map(task_rec->other_config, "SSLCertificate");
+        char *server_cert = xen_utils_string_map_index_get(other_config, "SSLCertificate");
         if(server_cert)
             CMSetProperty(inst, "SSLCertificate",(CMPIValue *)server_cert, CMPI_chars);
-        char *connect_handle = xen_utils_get_from_string_string_map(task_rec->other_config, "ConnectionHandle");
+        char *connect_handle = xen_utils_string_map_index_get(other_config, "ConnectionHandle");
         if(connect_handle)
             CMSetProperty(inst, "ConnectionHandle",(CMPIValue *)connect_handle, CMPI_chars);
-        char *user = xen_utils_get_from_string_string_map(task_rec->other_config, "Username");
+        char *user = xen_utils_string_map_index_get(other_config, "Username");
         if(user)
             CMSetProperty(inst, "Username",(CMPIValue *)user, CMPI_chars);
-        char *pass = xen_utils_get_from_string_string_map(task_rec->other_config, "Password");
+        char *pass = xen_utils_string_map_index_get(other_config, "Password");
         if(pass)
             CMSetProperty(inst, "Password",(CMPIValue *)pass, CMPI_chars);
 
     }
     else if(xen_utils_class_is_subclass_of(resource->broker, resource->classname, "Xen_VirtualSystemModifyResourcesJob")) {
         /* VSMS jobs could have added resources in a job, we need to update the job object with the object paths of the resources */
-        char *affected_resources = xen_utils_get_from_string_string_map(task_rec->other_config, "AffectedResources");
+        char *affected_resources = xen_utils_string_map_index_get(other_config, "AffectedResources");
         if(affected_resources) {
             xen_string_set *obj_paths =xen_utils_copy_to_string_set(affected_resources, ";");
             if(obj_paths) {
@@ -390,13 +398,13 @@ static CMPIrc xen_resource_set_properties(
     }
     else if(xen_utils_class_is_subclass_of(resource->broker, resource->classname, "Xen_VirtualSystemCreateJob")) {
         /* Create jobs could have the resulting system in a job, we need to update the job object with the object paths of the new system */
-        char *resulting_system = xen_utils_get_from_string_string_map(task_rec->other_config, "ResultingSystem");
+        char *resulting_system = xen_utils_string_map_index_get(other_config, "ResultingSystem");
         if(resulting_system)
             CMSetProperty(inst, "ResultingSystem", (CMPIValue *)resulting_system, CMPI_chars);
     }
     else if(xen_utils_class_is_subclass_of(resource->broker, resource->classname, "Xen_StartSnapshotForestExportJob")) {
         /* Create jobs could have the resulting system in a job, we need to update the job object with the object paths of the new system */
-        char *diskuris = xen_utils_get_from_string_string_map(task_rec->other_config, "DiskImageURIs");
+        char *diskuris = xen_utils_string_map_index_get(other_config, "DiskImageURIs");
         if(diskuris){
             xen_string_set *disk_uri_set = xen_utils_copy_to_string_set(diskuris, ",");
             if(disk_uri_set && disk_uri_set->size > 0) {
@@ -408,7 +416,7 @@ static CMPIrc xen_resource_set_properties(
             }
             xen_string_set_free(disk_uri_set);
         }
-        char *ssl_certs = xen_utils_get_from_string_string_map(task_rec->other_config, "SSLCertificates");
+        char *ssl_certs = xen_utils_string_map_index_get(other_config, "SSLCertificates");
         if(ssl_certs) {
             xen_string_set *cert_set = xen_utils_copy_to_string_set(ssl_certs, ",");
             if(cert_set && cert_set->size > 0) {
@@ -421,17 +429,18 @@ static CMPIrc xen_resource_set_properties(
             xen_string_set_free(cert_set);
         }
 
-        char *metadata_uri = xen_utils_get_from_string_string_map(task_rec->other_config, "MetadataURI");
+        char *metadata_uri = xen_utils_string_map_index_get(other_config, "MetadataURI");
         if(metadata_uri)
             CMSetProperty(inst, "MetadataURI", (CMPIValue *)metadata_uri, CMPI_chars);
 
-        char *handle = xen_utils_get_from_string_string_map(task_rec->other_config, "ExportConnectionHandle");
+        char *handle = xen_utils_string_map_index_get(other_config, "ExportConnectionHandle");
         if(handle)
             CMSetProperty(inst, "ExportConnectionHandle", (CMPIValue *)handle, CMPI_chars);
     }
     else if(xen_utils_class_is_subclass_of(resource->broker, resource->classname, "Xen_EndSnapshotForestExportJob")) {
     }
 
+    task_rec->other_config = xen_utils_string_map_index_release(other_config);
     return CMPI_RC_OK;
 }
 
@@ -29,6 +29,7 @@
 #include "cmpitrace.h"
 #include "Xen_Job.h"
 #include "xen_utils.h"
+#include "xen_probes.h"
 
 /* Async methods */
 static CMPI_THREAD_RETURN job_worker_thread_func(void *unused);
@@ -84,6 +85,8 @@ int _workitem_enqueue (
             lastitem = lastitem->next;
         lastitem->next = item;
     }
+    /* once unlocked, the worker may run the job and free it */
+    XEN_PROBE2(job__enqueue, job->uuid, job->job_name);
     pthread_mutex_unlock(&g_workitem_list_mutex);
 
     pthread_mutex_lock(&g_cond_mutex);
@@ -124,6 +127,7 @@ int _workitem_dequeue (
         }
         else{
              // found something on the queue, time to return
+            XEN_PROBE2(job__dequeue, (*job)->uuid, (*job)->job_name);
             _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,("Async worker Found a job to work on EXECUTING JOB...... "));
             break;
         }
@@ -239,6 +243,7 @@ static CMPI_THREAD_RETURN job_worker_thread_func(void *unused)
                 if (xen_utils_validate_session(&session, call_ctx)) {
                     job->session = session;
                     callback_func(job);
+                    XEN_PROBE2(job__complete, job->uuid, job->job_name);
                     xen_utils_cleanup_session(session);
                 } else {
                     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("ERROR: couldnt get xen session"));
@@ -355,6 +360,7 @@ void job_change_state(
 {
     xen_task_record *task_rec = NULL;
 
+    XEN_PROBE4(job__state, job->uuid, (int)state, percent_complete, error_code);
     /* reset any prior errors */
     RESET_XEN_ERROR(session->xen);
     if(!xen_task_get_record(session->xen, &task_rec, job->task_handle))
@@ -363,25 +369,31 @@ void job_change_state(
     /* update the xen task record - that's where we persist the task information 
        The only RW property on the xen_task object is the other-config field.
        So, use that to persist all information we care about */
+    xen_utils_string_map_index *other_config = xen_utils_string_map_index_new(task_rec->other_config);
+    if (other_config == NULL)
+        goto Exit;
+    task_rec->other_config = NULL;
+
     char buf[100];
     snprintf(buf, sizeof(buf)/sizeof(buf[0]), "%d", percent_complete);
-    xen_utils_add_to_string_string_map("PercentComplete", buf, &task_rec->other_config);
+    xen_utils_string_map_index_set(other_config, "PercentComplete", buf);
     snprintf(buf, sizeof(buf)/sizeof(buf[0]), "%d", state);
-    xen_utils_add_to_string_string_map("CIMJobState", buf, &task_rec->other_config);
+    xen_utils_string_map_index_set(other_config, "CIMJobState", buf);
     snprintf(buf, sizeof(buf)/sizeof(buf[0]), "%d", error_code);
-    xen_utils_add_to_string_string_map("ErrorCode", buf, &task_rec->other_config);
+    xen_utils_string_map_index_set(other_config, "ErrorCode", buf);
     if(description) {
         if(error_code != 0) {
             /* this is an error - set the error description and clear the description */
-            xen_utils_add_to_string_string_map("Description", "", &task_rec->other_config);
-            xen_utils_add_to_string_string_map("ErrorDescription", description, &task_rec->other_config);
+            xen_utils_string_map_index_set(other_config, "Description", "");
+            xen_utils_string_map_index_set(other_config, "ErrorDescription", description);
         }
         else {
             /* this is just a job update - clear the error description and set the description */
-            xen_utils_add_to_string_string_map("Description", description, &task_rec->other_config);
-            xen_utils_add_to_string_string_map("ErrorDescription", "", &task_rec->other_config);
+            xen_utils_string_map_index_set(other_config, "Description", description);
+            xen_utils_string_map_index_set(other_config, "ErrorDescription", "");
         }
     }
+    task_rec->other_config = xen_utils_string_map_index_release(other_config);
     xen_task_set_other_config(session->xen, job->task_handle, task_rec->other_config);
 Exit:
     if(!session->xen->ok)
@@ -20,6 +20,7 @@
 #include "RASDs.h"
 #include "Xen_KVP.h"
 #include "xen_utils.h"
+#include "xen_hosts.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -71,120 +72,167 @@ static const char **xen_resource_get_keys(
     return keys;
 }
 /******************************************************************************
- * Function to enumerate a xen resource
- *
- * @param session - handle to a xen_utils_session object
- * @param resources - pointer to the provider_resource_list
- * @return CMPIrc error codes
+ * Enumerations fetch the KVP stores of a few VMs at a time. The position is
+ * the ref of the first VM of the next page, which currentdomain of the
+ * domain set already points at.
  *****************************************************************************/
-static CMPIrc xen_resource_list_enum(
-       xen_utils_session *session, 
-       provider_resource_list *resources
+typedef struct _kvp_cursor {
+  xen_domain_resources *domain_set;  /* all the VMs */
+  kvp_set *page;                     /* the KVPs of the VMs in the current page */
+} kvp_cursor;
+
+/* Appends the KVPs of the VM to set, if it is enabled for KVP and running */
+static void _append_vm_kvps(
+       xen_utils_session *session,
+       xen_vm resource_handle,
+       kvp_set *set
 )
 {
-  enum domain_choice choice = vms_only;
-  xen_domain_resources *domain_set = NULL;
+  xen_vm_record *resource_rec = NULL;
 
-  if(!xen_utils_get_domain_resources(session, &domain_set, choice))
-    return CMPI_RC_ERR_FAILED;
+  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Current resource handle = %s", (char *)resource_handle));
+
+  if(!xen_vm_get_record(session->xen, &resource_rec, resource_handle)) {
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
+		 ("--- xen_vm_get_record failed: \"%s\" \"%s\"",
+		  session->xen->error_description[0], (char *)resource_handle));
+    char *error = xen_utils_get_xen_error(session->xen);
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s", error));
+    RESET_XEN_ERROR(session->xen);
+    if (error)
+      free(error);
+    return;
+  }
 
-  xen_vm resource_handle;
-  xen_vm_record *resource_rec = NULL;
+  char *res = xen_utils_get_from_string_string_map(resource_rec->other_config, "kvp_enabled");
+  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("result = %s", res));
+  if(res) {
+    /* Result is not NULL - therefore the VM is counted as being 'enabled' for KVP */
+    xen_host_record_opt *host = resource_rec->resident_on;
 
-  kvp_set *complete_set;
-  
-  initialise_kvp_set(&complete_set);
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VM is resident on host '%s'", (char *)host->u.handle));
 
-  for(domain_set->currentdomain=0; domain_set->currentdomain < domain_set->numdomains; domain_set->currentdomain++){
+    if (host->u.handle){
+      /* the host's address from the host directory, shared by all the VMs */
+      xen_host_directory *hosts = NULL;
+      const xen_host_entry *host_entry = xen_host_directory_lookup(session, &hosts, host->u.handle);
+      char *address = host_entry ? host_entry->address : NULL;
 
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Current Domain: %d", domain_set->currentdomain));
+      if(!address)
+      {
+	_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Host address not found"));
+      } else {
+	/* Make remote call for store */
+	char *plugin = "services/plugin/xscim";
+	char *xenref = (char *)((session->xen)->session_id);
+	/* Add overhead of 15 characters */
 
-    resource_handle = domain_set->domains->contents[domain_set->currentdomain];
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Current resource handle = %s", resource_handle));
-    
-    if(!xen_vm_get_record(session->xen, &resource_rec, resource_handle)) {
-      _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
-		   ("--- xen_vm_get_record failed: \"%s\" \"%s\"",
-		    session->xen->error_description[0], resource_handle));
-      char *error = xen_utils_get_xen_error(session->xen);
-      _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s", error));
-      RESET_XEN_ERROR(session->xen);
-      if (error)
-	free(error);
-      continue;
-    }
+	int len = sizeof(char) * (25 + strlen(plugin) + strlen(address) + strlen(resource_rec->uuid) + strlen(xenref));
 
-    char *res = xen_utils_get_from_string_string_map(resource_rec->other_config, "kvp_enabled");
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("result = %s", res));
-    if(res) {
-      /* Result is not NULL - therefore the VM is counted as being 'enabled' for KVP */
-      
-      xen_host_record_opt *host = resource_rec->resident_on;
+	char *url = (char *)malloc(len);
 
-      _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VM is resident on host '%s'",host->u.handle));
+	sprintf(url, "http://%s/%s/vm/%s?session_id=%s", address, plugin, resource_rec->uuid, xenref);
 
-      if (host->u.handle){
+	_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Fetch store from URL '%s'", url));
 
-	char *address = NULL;
-	
-	if(!xen_host_get_address(session->xen, &address, host->u.handle))
-	{
-	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Host address not found"));
+	kvp_set *vm_set;
+	Xen_KVP_RC rc = xen_utils_get_kvp_store(url, (char *)resource_rec->uuid, &vm_set);
+	if (rc != Xen_KVP_RC_OK) {
+	  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Unable to retrieve KVP store for VM %s",
+						 resource_rec->uuid));
+	  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Continuing on to the next domain"));
 	} else {
-	  /* Make remote call for store */
-	  char *plugin = "services/plugin/xscim";
-	  char *xenref = (char *)((session->xen)->session_id);
-	  /* Add overhead of 15 characters */
-
-	  int len = sizeof(char) * (25 + strlen(plugin) + strlen(address) + strlen(resource_rec->uuid) + strlen(xenref));
-
-	  char *url = (char *)malloc(len);
-
-	  sprintf(url, "http://%s/%s/vm/%s?session_id=%s", address, plugin, resource_rec->uuid, xenref);
-	  
-	  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Fetch store from URL '%s'", url));
-	  
-	  kvp_set *set;
-	  Xen_KVP_RC rc = xen_utils_get_kvp_store(url, (char *)resource_rec->uuid,&set);
-	  if (rc != Xen_KVP_RC_OK) {
-	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Unable to retrieve KVP store for VM %s",
-						   resource_rec->uuid));
-	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Continuing on to the next domain"));
-	  } else {
-          _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("sets so far %d", set->size));
+	  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("sets so far %d", (int)vm_set->size));
 
 	  /* Append the contents of the returned set */
-	  xen_utils_append_kvp_set(complete_set, set);
+	  xen_utils_append_kvp_set(set, vm_set);
 
-	  
-	  if (set)
-	    xen_utils_free_kvpset(set);	  
-	  	  
-	  if(url)
-	    free(url);
-
-	  /* Free the host address */
-	  if (address)
-	    free(address);
-
-	  }
-	
+	  if (vm_set)
+	    xen_utils_free_kvpset(vm_set);
 	}
-      } else {
-	/* VM is not started, and so may not be resident on any host. */
+	free(url);
       }
-      
+      xen_host_directory_release(hosts);
+    } else {
+      /* VM is not started, and so may not be resident on any host. */
     }
-    
-    xen_vm_record_free(resource_rec);
   }
-  xen_utils_free_domain_resources(domain_set);
 
-  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("all in %d keys", complete_set->size));
-    /* Return the set of KVPs */
-    resources->ctx = complete_set;
+  xen_vm_record_free(resource_rec);
+}
 
-    return CMPI_RC_OK;
+/* Replaces the page with the KVPs of the VMs from the position on, until
+   there are page_size of them, and moves the position on to the VM after.
+   The page picks up at currentdomain, where the last one stopped. */
+static CMPIrc _fetch_page(
+       xen_utils_session *session,
+       provider_resource_list *resources
+)
+{
+  kvp_cursor *cursor = resources->ctx;
+  xen_domain_resources *domain_set = cursor->domain_set;
+
+  if (cursor->page)
+    xen_utils_free_kvpset(cursor->page);
+  cursor->page = NULL;
+  if (!initialise_kvp_set(&cursor->page))
+    return CMPI_RC_ERR_FAILED;
+
+  for(; domain_set->currentdomain < domain_set->numdomains; domain_set->currentdomain++){
+    if (resources->page_size && cursor->page->size >= resources->page_size)
+      break;
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Current Domain: %d", domain_set->currentdomain));
+    _append_vm_kvps(session, domain_set->domains->contents[domain_set->currentdomain], cursor->page);
+  }
+
+  if (domain_set->currentdomain < domain_set->numdomains)
+    snprintf(resources->position, XEN_POSITION_LEN, "%s",
+             (char *)domain_set->domains->contents[domain_set->currentdomain]);
+  else
+    resources->position[0] = '\0';
+
+  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("%d keys in the page", cursor->page->size));
+  return CMPI_RC_OK;
+}
+
+/******************************************************************************
+ * Function to enumerate a xen resource
+ *
+ * @param session - handle to a xen_utils_session object
+ * @param resources - pointer to the provider_resource_list
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_list_enum(
+       xen_utils_session *session, 
+       provider_resource_list *resources
+)
+{
+  enum domain_choice choice = vms_only;
+  kvp_cursor *cursor = calloc(1, sizeof(kvp_cursor));
+
+  if (cursor == NULL)
+    return CMPI_RC_ERR_FAILED;
+  resources->ctx = cursor;
+  if(!xen_utils_get_domain_resources(session, &cursor->domain_set, choice))
+    return CMPI_RC_ERR_FAILED;
+
+  cursor->domain_set->currentdomain = 0;
+
+  return _fetch_page(session, resources);
+}
+/******************************************************************************
+ * Function to get the next page of a xen resource
+ *
+ * @param session - handle to a xen_utils_session object
+ * @param resources - pointer to the provider_resource_list
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_list_next_page(
+       xen_utils_session *session, 
+       provider_resource_list *resources
+)
+{
+  return _fetch_page(session, resources);
 }
 /******************************************************************************
  * Function to cleanup provider specific resource, this function is
@@ -200,8 +248,14 @@ static CMPIrc xen_resource_list_cleanup(
 )
 {
       _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Entering xen_resource_list_cleanup"));
-      kvp_set *set = resources->ctx;
-      xen_utils_free_kvpset(set);
+      kvp_cursor *cursor = resources->ctx;
+      if (cursor) {
+        if (cursor->page)
+          xen_utils_free_kvpset(cursor->page);
+        if (cursor->domain_set)
+          xen_utils_free_domain_resources(cursor->domain_set);
+        free(cursor);
+      }
  
       return CMPI_RC_OK;
 }
@@ -222,8 +276,9 @@ static CMPIrc xen_resource_record_getnext(
 
     kvp *kvp_cpy;
   _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("getnext"));
-    kvp_set *kvp_set = resources_list->ctx;
-    if (kvp_set == NULL || resources_list->current_resource == kvp_set->size)
+    kvp_cursor *cursor = resources_list->ctx;
+    kvp_set *kvp_set = cursor ? cursor->page : NULL;
+    if (kvp_set == NULL || resources_list->current_resource >= kvp_set->size)
         return CMPI_RC_ERR_NOT_FOUND;
 
     kvp *kvp = &kvp_set->contents[resources_list->current_resource];
@@ -534,7 +589,7 @@ static CMPIrc xen_resource_set_properties(provider_resource *resource, CMPIInsta
 }
 
 /* Setup the function table for the instance provider */
-XenInstanceMIStub(Xen_KVP)
+XenPagedInstanceMIStub(Xen_KVP)
 
 
 
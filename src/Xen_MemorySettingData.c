@@ -237,7 +237,8 @@ int memory_rasd_modify(
             /* Change it in one go, otherwise the memory checks in Xen go crazy */
             _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, 
                          ("--- Changing VM memory settings for %s (smin:%lld, smax:%lld, dmin:%lld, dmax:%lld)", 
-                         vm_rec->uuid, static_min, static_max, dynamic_min, dynamic_max));
+                         vm_rec->uuid, (long long)static_min, (long long)static_max,
+                         (long long)dynamic_min, (long long)dynamic_max));
             rc = xen_vm_set_memory_limits(session->xen, vm, static_min, static_max, dynamic_min, dynamic_max);
 
             /* This could fail depending on whether we are talking to Xen 5.6. or below */
@@ -16,15 +16,29 @@
 #include "Xen_Disk.h"
 #include "providerinterface.h"
 
+#define XAPI_NULL_REF "OpaqueRef:NULL"
+
+/* The SR a suspend image is on, looked up once for all the images on it */
+typedef struct {
+    xen_sr sr;
+    char *uuid;
+    char *name_label;
+} local_mem_state_sr;
+
+/* The suspended VMs and their suspend images, two calls however big the pool */
 typedef struct {
-    xen_vdi_set *vdi_set;
-    xen_vm_set *vm_set;
-}local_mem_state_list;
+    xen_vm_xen_vm_record_map *vms;      /* those with power_state == Suspended */
+    xen_vdi_xen_vdi_record_map *vdis;   /* those with type == suspend */
+    int *vdi_index;                     /* of the image of each VM in vdis, -1 if none */
+    local_mem_state_sr **srs;
+    int sr_count;
+} local_mem_state_list;
 
 typedef struct {
-    xen_vdi vdi;
+    char *vm_uuid;
     xen_vdi_record *vdi_rec;
-    xen_vm vm;
+    local_mem_state_sr *sr;             /* NULL if it couldn't be looked up */
+    bool owned;                         /* false if all of it belongs to the list */
 } local_mem_state_resource;
 
 //static const char * classname = "Xen_MemoryState";    
@@ -62,59 +76,71 @@ static CMPIrc xen_resource_list_enum(
     provider_resource_list *resources
     )
 {
-    xen_vm_set *vm_set = NULL;
-    int i;
+    local_mem_state_list *ctx = calloc(1, sizeof(local_mem_state_list));
+    if (ctx == NULL)
+        return CMPI_RC_ERR_FAILED;
+    resources->ctx = ctx;
 
-    xen_vm_set *all_vms = NULL;
-    xen_vdi_set *vdi_set = NULL;
-    if (!xen_vm_get_all(session->xen, &all_vms)) {
+    /* only the suspended VMs have a memory image; the bindings have no
+       get_all_records_where, so get all the records once and keep those
+       rather than ask every VM for its suspend VDI */
+    if (!xen_vm_get_all_records(session->xen, &ctx->vms)) {
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
         return CMPI_RC_ERR_FAILED;
     }
-    for (i=0; i<all_vms->size; i++) {
-        xen_vdi vdi = NULL;
-        if (xen_vm_get_suspend_vdi(session->xen, 
-                                   &vdi, 
-                                   all_vms->contents[i]) 
-            && vdi) 
-        {
-            /* BUGBUG: For some reason, I get a NULL VDI for VMs 
-             * that dont have a suspend VDI and the call succeeds */
-            /* verify if this a NULL VDI by getting its UUID */
-            char *uuid = NULL;
-            if(xen_vdi_get_uuid(session->xen, &uuid, vdi)) {
-                free(uuid);
-                ADD_DEVICE_TO_LIST(vdi_set, vdi, xen_vdi);
-                ADD_DEVICE_TO_LIST(vm_set, all_vms->contents[i], xen_vm);
-            }
-            else {
-                xen_vdi_free(vdi);
-            }
+    size_t i, j, n;
+    for (i = 0, n = 0; i < ctx->vms->size; i++) {
+        if (ctx->vms->contents[i].val->power_state == XEN_VM_POWER_STATE_SUSPENDED) {
+            ctx->vms->contents[n++] = ctx->vms->contents[i];
+            continue;
         }
-        RESET_XEN_ERROR(session->xen); /* reset error for next iternation */
+        xen_vm_free(ctx->vms->contents[i].key);
+        xen_vm_record_free(ctx->vms->contents[i].val);
     }
+    ctx->vms->size = n;
+    if (ctx->vms->size == 0)
+        return CMPI_RC_OK;
 
-    /* create a local resource */
-    local_mem_state_list *ctx = calloc(sizeof(local_mem_state_list), 1);
-    if (ctx == NULL)
+    if (!xen_vdi_get_all_records(session->xen, &ctx->vdis)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        return CMPI_RC_ERR_FAILED;
+    }
+    for (i = 0, n = 0; i < ctx->vdis->size; i++) {
+        if (ctx->vdis->contents[i].val->type == XEN_VDI_TYPE_SUSPEND) {
+            ctx->vdis->contents[n++] = ctx->vdis->contents[i];
+            continue;
+        }
+        xen_vdi_free(ctx->vdis->contents[i].key);
+        xen_vdi_record_free(ctx->vdis->contents[i].val);
+    }
+    ctx->vdis->size = n;
+    if ((ctx->vdi_index = malloc(sizeof(int) * ctx->vms->size)) == NULL)
         return CMPI_RC_ERR_FAILED;
 
-    ctx->vdi_set = vdi_set;
-    ctx->vm_set = vm_set;
-    resources->ctx = ctx;
-    xen_vm_set_free(all_vms);
-
+    for (i = 0; i < ctx->vms->size; i++) {
+        xen_vdi_record_opt *suspend_vdi = ctx->vms->contents[i].val->suspend_vdi;
+        ctx->vdi_index[i] = -1;
+        if (suspend_vdi == NULL || suspend_vdi->is_record || suspend_vdi->u.handle == NULL ||
+            strcmp((char *)suspend_vdi->u.handle, XAPI_NULL_REF) == 0)
+            continue;
+        for (j = 0; j < ctx->vdis->size; j++) {
+            if (strcmp((char *)ctx->vdis->contents[j].key, (char *)suspend_vdi->u.handle) == 0) {
+                ctx->vdi_index[i] = j;
+                break;
+            }
+        }
+    }
     return CMPI_RC_OK;
+}
 
-Exit:
-    if (all_vms)
-        xen_vm_set_free(all_vms);
-    if (vm_set)
-        xen_vm_set_free(vm_set);
-    if (vdi_set)
-        xen_vdi_set_free(vdi_set);
-    return CMPI_RC_ERR_FAILED;
+static void _free_sr(local_mem_state_sr *sr)
+{
+    if (sr->sr)
+        xen_sr_free(sr->sr);
+    free(sr->uuid);
+    free(sr->name_label);
 }
+
 /*******************************************************************
  * Function to cleanup provider specific resource, this function is
  * called at various places in Xen_ProviderGeneric.c
@@ -130,14 +156,67 @@ static CMPIrc xen_resource_list_cleanup(
 {
     local_mem_state_list *ctx = (local_mem_state_list *)resources->ctx;
     if(ctx) {
-        if (ctx->vdi_set)
-            xen_vdi_set_free(ctx->vdi_set);
-        if (ctx->vm_set)
-            xen_vm_set_free(ctx->vm_set);
+        if (ctx->vms)
+            xen_vm_xen_vm_record_map_free(ctx->vms);
+        if (ctx->vdis)
+            xen_vdi_xen_vdi_record_map_free(ctx->vdis);
+        int i;
+        for (i = 0; i < ctx->sr_count; i++) {
+            _free_sr(ctx->srs[i]);
+            free(ctx->srs[i]);
+        }
+        free(ctx->srs);
+        free(ctx->vdi_index);
         free(ctx);
     }
     return CMPI_RC_OK;
 }
+
+/* Look up the uuid and name of an SR */
+static int _get_sr(
+    xen_utils_session *session,
+    xen_sr sr,
+    local_mem_state_sr *result)
+{
+    memset(result, 0, sizeof(local_mem_state_sr));
+    if (!xen_sr_get_uuid(session->xen, &result->uuid, sr) ||
+        !xen_sr_get_name_label(session->xen, &result->name_label, sr)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        RESET_XEN_ERROR(session->xen);
+        free(result->uuid);
+        result->uuid = NULL;
+        return 0;
+    }
+    result->sr = strdup((char *)sr);
+    return 1;
+}
+
+/* The SR of a suspend image, shared by all the images on it */
+static local_mem_state_sr *_list_get_sr(
+    xen_utils_session *session,
+    local_mem_state_list *list,
+    xen_sr_record_opt *sr_opt)
+{
+    int i;
+    if (sr_opt == NULL || sr_opt->is_record || sr_opt->u.handle == NULL)
+        return NULL;
+    for (i = 0; i < list->sr_count; i++)
+        if (strcmp((char *)list->srs[i]->sr, (char *)sr_opt->u.handle) == 0)
+            return list->srs[i];
+
+    local_mem_state_sr **srs = realloc(list->srs, sizeof(local_mem_state_sr *) * (list->sr_count + 1));
+    if (srs == NULL)
+        return NULL;
+    list->srs = srs;
+    local_mem_state_sr *sr = malloc(sizeof(local_mem_state_sr));
+    if (sr == NULL || !_get_sr(session, sr_opt->u.handle, sr)) {
+        free(sr);
+        return NULL;
+    }
+    srs[list->sr_count++] = sr;
+    return sr;
+}
+
 /*****************************************************************************
  * Function to get the next provider specific resource in the resource list
  *
@@ -153,25 +232,23 @@ static CMPIrc xen_resource_record_getnext(
     )
 {
     local_mem_state_list *list = (local_mem_state_list *)resources_list->ctx;
-    if (list->vdi_set == NULL || resources_list->current_resource == list->vdi_set->size)
+    if (list->vms == NULL)
+        return CMPI_RC_ERR_NOT_FOUND;
+    /* skip the suspended VMs without an image */
+    while (resources_list->current_resource < list->vms->size &&
+           list->vdi_index[resources_list->current_resource] < 0)
+        resources_list->current_resource++;
+    if (resources_list->current_resource == list->vms->size)
         return CMPI_RC_ERR_NOT_FOUND;
 
-    xen_vdi_record *vdi_rec = NULL;
-    if (!xen_vdi_get_record(session->xen, 
-                            &vdi_rec, 
-                            list->vdi_set->contents[resources_list->current_resource])) 
-    {
-        xen_utils_trace_error(resources_list->session->xen, __FILE__, __LINE__);
-        return CMPI_RC_ERR_FAILED;
-    }
-    local_mem_state_resource *ctx = calloc(sizeof(local_mem_state_resource), 1);
+    local_mem_state_resource *ctx = PROV_RES_ALLOC(prov_res, local_mem_state_resource);
     if(ctx == NULL)
         return CMPI_RC_ERR_FAILED;
-    ctx->vdi = list->vdi_set->contents[resources_list->current_resource];
-    ctx->vm  = list->vm_set->contents[resources_list->current_resource];
-    ctx->vdi_rec = vdi_rec;
-    list->vdi_set->contents[resources_list->current_resource] = NULL; /* do not delete this*/
-    list->vm_set->contents[resources_list->current_resource] = NULL;  /* do not delete this*/
+    int vdi = list->vdi_index[resources_list->current_resource];
+    ctx->vm_uuid = list->vms->contents[resources_list->current_resource].val->uuid;
+    ctx->vdi_rec = list->vdis->contents[vdi].val;
+    ctx->sr = _list_get_sr(session, list, ctx->vdi_rec->sr);
+    ctx->owned = false;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -187,14 +264,16 @@ static CMPIrc xen_resource_record_cleanup(
 {
     local_mem_state_resource *ctx = (local_mem_state_resource *)prov_res->ctx;
     if(ctx) {
-        if (ctx->vdi_rec)
-            xen_vdi_record_free(ctx->vdi_rec);
-        if (ctx->vdi)
-            xen_vdi_free(ctx->vdi);
-        if (ctx->vm) {
-            xen_vm_free(ctx->vm);
+        if (ctx->owned) {
+            if (ctx->vdi_rec)
+                xen_vdi_record_free(ctx->vdi_rec);
+            free(ctx->vm_uuid);
+            if (ctx->sr) {
+                _free_sr(ctx->sr);
+                free(ctx->sr);
+            }
         }
-        free(ctx);
+        PROV_RES_FREE(prov_res, ctx);
     }
 
     return CMPI_RC_OK;
@@ -216,26 +295,40 @@ static CMPIrc xen_resource_record_get_from_id(
 {
     char buf[MAX_INSTANCEID_LEN];
     _CMPIStrncpyDeviceNameFromID(buf, res_uuid, sizeof(buf));
-    xen_vdi vdi;
+    xen_vdi vdi = NULL;
     xen_vdi_record *vdi_rec = NULL;
     if (!xen_vdi_get_by_uuid(session->xen, &vdi, buf) || 
         !xen_vdi_get_record(session->xen, &vdi_rec, vdi)) {
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        if (vdi)
+            xen_vdi_free(vdi);
         return CMPI_RC_ERR_NOT_FOUND;
     }
+    xen_vdi_free(vdi);
     _CMPIStrncpySystemNameFromID(buf, res_uuid, sizeof(buf));
     xen_vm vm = NULL;
     if (!xen_vm_get_by_uuid(session->xen, &vm, buf)) {
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        xen_vdi_record_free(vdi_rec);
         return CMPI_RC_ERR_NOT_FOUND;
     }
-    local_mem_state_resource *ctx = calloc(sizeof(local_mem_state_resource), 1);
-    if(ctx == NULL)
+    xen_vm_free(vm);
+    local_mem_state_resource *ctx = PROV_RES_ALLOC(prov_res, local_mem_state_resource);
+    if(ctx == NULL) {
+        xen_vdi_record_free(vdi_rec);
         return CMPI_RC_ERR_FAILED;
+    }
 
-    ctx->vm = vm;
-    ctx->vdi = vdi;
+    ctx->owned = true;
+    ctx->vm_uuid = strdup(buf);
     ctx->vdi_rec = vdi_rec;
+    ctx->sr = NULL;
+    if (vdi_rec->sr && !vdi_rec->sr->is_record &&
+        (ctx->sr = calloc(1, sizeof(local_mem_state_sr))) &&
+        !_get_sr(session, vdi_rec->sr->u.handle, ctx->sr)) {
+        free(ctx->sr);
+        ctx->sr = NULL;
+    }
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -251,13 +344,12 @@ static CMPIrc xen_resource_set_properties(
     provider_resource *resource, 
     CMPIInstance *inst)
 {
-    xen_vdi_record *vdi_rec = ((local_mem_state_resource *)resource->ctx)->vdi_rec;
-    xen_vm vm = ((local_mem_state_resource *)resource->ctx)->vm;
+    local_mem_state_resource *ctx = (local_mem_state_resource *)resource->ctx;
+    xen_vdi_record *vdi_rec = ctx->vdi_rec;
     char buf[MAX_INSTANCEID_LEN];
-    char * uuid = NULL;
+    char *uuid = ctx->vm_uuid;
 
     /* Key Properties */
-    xen_vm_get_uuid(resource->session->xen, &uuid, vm);
     _CMPICreateNewDeviceInstanceID(buf, sizeof(buf), uuid, vdi_rec->uuid);
     CMSetProperty(inst, "DeviceID",(CMPIValue *)buf, CMPI_chars);
     CMSetProperty(inst, "CreationClassName",(CMPIValue *)"Xen_MemoryState", CMPI_chars);
@@ -377,8 +469,14 @@ static CMPIrc xen_resource_set_properties(
     //CMSetProperty(inst, "TransitioningToState",(CMPIValue *)&<value>, CMPI_uint16);
     //CMSetProperty(inst, "Usage",(CMPIValue *)&<value>, CMPI_uint16);
 
-    if (uuid)
-        free(uuid);
+
+    /* Where the image is and how much space it takes there */
+    long long image_size = vdi_rec->physical_utilisation;
+    CMSetProperty(inst, "SuspendImageSize",(CMPIValue *)&image_size, CMPI_uint64);
+    if (ctx->sr) {
+        CMSetProperty(inst, "StoragePoolID",(CMPIValue *)ctx->sr->uuid, CMPI_chars);
+        CMSetProperty(inst, "StoragePoolName",(CMPIValue *)ctx->sr->name_label, CMPI_chars);
+    }
     return CMPI_RC_OK;
 }
 
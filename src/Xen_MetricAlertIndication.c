@@ -0,0 +1,791 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+// ============================================================================
+// Indication provider generating Xen_MetricAlert (CIM_AlertIndication)
+// indications when the RRD data sources of hosts and VMs match the
+// Xen_MetricAlertRule instances configured for the pool.
+// ============================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <curl/curl.h>
+#include <curl/easy.h>
+
+/* Include the required CMPI data types, function headers, and macros */
+#include "cmpidt.h"
+#include "cmpift.h"
+#include "cmpimacs.h"
+#include "xen_utils.h"
+#include "xen_hosts.h"
+#include "xen_probes.h"
+#include "xen_rrd.h"
+#include "xen_transport.h"
+#include "provider_common.h"
+#include "Xen_MetricAlert.h"
+
+// ----------------------------------------------------------------------------
+// COMMON GLOBAL VARIABLES
+// ----------------------------------------------------------------------------
+
+/* Handle to the CIM broker. Initialized when the provider lib is loaded. */
+static const CMPIBroker *_BROKER;
+
+/* Include utility functions */
+#include "cmpiutil.h"
+
+/* Include _SBLIM_TRACE() logging support */
+#include "cmpitrace.h"
+
+/* Flag to globally enable/disable indications */
+static int enabled = 1;
+
+/* Number of seconds between rule evaluations. Can be overridden by setting
+   XEN_CIM_ALERT_INTERVAL in the CIMOM's environment. */
+#define DEFAULT_ALERT_INTERVAL 30
+static int pollingInterval = DEFAULT_ALERT_INTERVAL;
+
+/* Number of active indication filters (i.e. # registered subscriptions) */
+static int numActiveFilters = 0;
+
+/* Handle to the asynchronous alert evaluation thread. It runs while
+   alertRunning is set and waits for the next cycle on alertCond, so that
+   the last DeActivateFilter can wake it up and join it. Activation and
+   deactivation are serialized by filterLock. */
+static CMPI_THREAD_TYPE alertThreadId = 0;
+static int alertRunning = 0;
+static pthread_mutex_t alertLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t alertCond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t filterLock = PTHREAD_MUTEX_INITIALIZER;
+
+static char * _NAMESPACE = "root/cimv2";
+
+// ----------------------------------------------------------------------------
+// ALERT STATE
+// The alert state of every (rule, system, data source) triple is kept across
+// evaluation cycles. This is what provides the hysteresis (an alert is only
+// cleared once the value crosses back over the rule's ClearThreshold), the
+// de-duplication (an alert is delivered on the transition only) and the
+// previous sample needed by rate-of-change rules.
+// ----------------------------------------------------------------------------
+#define ALERT_STATE_BUCKETS 4096
+#define ALERT_STATE_MAX_IDLE_CYCLES 10
+
+typedef struct _alert_state {
+    char *key;                  /* rule name|system uuid|data source */
+    bool in_alarm;
+    bool have_sample;
+    double last_value;
+    time_t last_time;
+    int last_cycle;             /* evaluation cycle this was last seen in */
+    struct _alert_state *next;
+} alert_state;
+
+static alert_state *alertStates[ALERT_STATE_BUCKETS];
+static int evaluationCycle = 0;
+
+static unsigned int _hash_key(const char *key)
+{
+    unsigned int hash = 5381;
+    while (*key)
+        hash = ((hash << 5) + hash) + (unsigned char)*key++;
+    return hash % ALERT_STATE_BUCKETS;
+}
+
+static alert_state *_get_alert_state(
+    const char *rule,
+    const char *uuid,
+    const char *data_source)
+{
+    char key[MAX_INSTANCEID_LEN*3];
+    snprintf(key, sizeof(key), "%s|%s|%s", rule, uuid, data_source);
+    unsigned int bucket = _hash_key(key);
+    alert_state *state = alertStates[bucket];
+    while (state && strcmp(state->key, key) != 0)
+        state = state->next;
+    if (state == NULL) {
+        state = calloc(1, sizeof(alert_state));
+        if (state == NULL)
+            return NULL;
+        state->key = strdup(key);
+        state->next = alertStates[bucket];
+        alertStates[bucket] = state;
+    }
+    state->last_cycle = evaluationCycle;
+    return state;
+}
+
+/* Forget the state of VMs, data sources and rules that have gone away */
+static void _prune_alert_states(bool all)
+{
+    int i;
+    for (i = 0; i < ALERT_STATE_BUCKETS; i++) {
+        alert_state **link = &alertStates[i];
+        while (*link) {
+            alert_state *state = *link;
+            if (all || (evaluationCycle - state->last_cycle > ALERT_STATE_MAX_IDLE_CYCLES)) {
+                *link = state->next;
+                free(state->key);
+                free(state);
+            }
+            else
+                link = &state->next;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// HOSTS
+// rrd_updates has to be fetched from each host, it returns the host's data
+// sources along with those of every VM resident on it. The end time of the
+// last update is remembered per host so that each cycle only fetches and
+// evaluates rows that have not been seen yet.
+// ----------------------------------------------------------------------------
+typedef struct _alert_host {
+    char uuid[UUID_LEN+1];
+    char *address;
+    time_t last_update;         /* timestamp of the last row evaluated */
+    int last_cycle;
+    struct _alert_host *next;
+} alert_host;
+
+static alert_host *alertHosts = NULL;
+
+/* Refresh the list of hosts from the shared host directory, which is
+   only fetched again once it has expired */
+static int _refresh_hosts(
+    xen_utils_session *session)
+{
+    xen_host_directory *dir = xen_host_directory_get(session);
+    int i;
+
+    if (dir == NULL)
+        return 0;
+    for (i = 0; i < xen_host_directory_count(dir); i++) {
+        const xen_host_entry *entry = xen_host_directory_entry(dir, i);
+        if (entry->uuid == NULL || entry->address == NULL)
+            continue;
+        alert_host *host = alertHosts;
+        while (host && strcmp(host->uuid, entry->uuid) != 0)
+            host = host->next;
+        if (host == NULL) {
+            if ((host = calloc(1, sizeof(alert_host))) == NULL)
+                continue;
+            strncpy(host->uuid, entry->uuid, UUID_LEN);
+            host->last_update = time(NULL) - pollingInterval;
+            host->next = alertHosts;
+            alertHosts = host;
+        }
+        if (host->address == NULL || strcmp(host->address, entry->address) != 0) {
+            char *address = strdup(entry->address);
+            if (address) {
+                free(host->address);
+                host->address = address;
+            }
+        }
+        if (host->address)
+            host->last_cycle = evaluationCycle;
+    }
+    xen_host_directory_release(dir);
+
+    /* drop hosts that have left the pool */
+    alert_host **link = &alertHosts;
+    while (*link) {
+        alert_host *host = *link;
+        if (host->last_cycle != evaluationCycle) {
+            *link = host->next;
+            free(host->address);
+            free(host);
+        }
+        else
+            link = &host->next;
+    }
+    return 1;
+}
+
+static void _free_hosts()
+{
+    while (alertHosts) {
+        alert_host *next = alertHosts->next;
+        free(alertHosts->address);
+        free(alertHosts);
+        alertHosts = next;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// RRD UPDATES
+// ----------------------------------------------------------------------------
+
+/* A legend column that at least one rule applies to */
+typedef struct _alert_column {
+    int index;                  /* column in the data rows */
+    bool host;
+    char *uuid;
+    char *data_source;
+    int rule_count;
+    metric_alert_rule **rules;
+} alert_column;
+
+/* Parse a legend entry of the form AVERAGE:vm:<uuid>:<data source> */
+static int _parse_legend_entry(char *entry, bool *host, char **uuid, char **data_source)
+{
+    char *cf = entry;
+    char *type = strchr(cf, ':');
+    if (type == NULL)
+        return 0;
+    *type++ = '\0';
+    char *id = strchr(type, ':');
+    if (id == NULL)
+        return 0;
+    *id++ = '\0';
+    char *ds = strchr(id, ':');
+    if (ds == NULL)
+        return 0;
+    *ds++ = '\0';
+    if (strcmp(cf, "AVERAGE") != 0)
+        return 0;
+    *host = (strcmp(type, "host") == 0);
+    *uuid = id;
+    *data_source = ds;
+    return 1;
+}
+
+// ----------------------------------------------------------------------------
+// Build and deliver a Xen_MetricAlert indication
+// ----------------------------------------------------------------------------
+static void _deliver_alert(
+    const CMPIContext *cmpi_context,
+    metric_alert_rule *rule,
+    alert_column *col,
+    time_t t,
+    double value,
+    bool raised)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    char buf[MAX_INSTANCEID_LEN*3];
+    const char *system_cn = col->host ? "Xen_HostComputerSystem" : "Xen_ComputerSystem";
+
+    CMPIInstance *indication = _CMNewInstance(_BROKER, _NAMESPACE, "Xen_MetricAlert", &status);
+    if (status.rc != CMPI_RC_OK)
+        return;
+
+    snprintf(buf, sizeof(buf), "Xen:%s:%s:%s:%ld", rule->name, col->uuid, col->data_source, (long)t);
+    CMSetProperty(indication, "IndicationIdentifier", (CMPIValue *)buf, CMPI_chars);
+    CMPIDateTime *date_time = xen_utils_time_t_to_CMPIDateTime(_BROKER, t);
+    CMSetProperty(indication, "IndicationTime", (CMPIValue *)&date_time, CMPI_dateTime);
+
+    CMPIUint16 alert_type = 3; /* Quality of Service Alert */
+    CMPIUint16 severity = raised ? rule->severity : 2; /* Information, when cleared */
+    CMPIUint16 probable_cause = 1; /* Other */
+    CMPIUint16 element_format = 2; /* CIMObjectPath */
+    CMSetProperty(indication, "AlertType", (CMPIValue *)&alert_type, CMPI_uint16);
+    CMSetProperty(indication, "PerceivedSeverity", (CMPIValue *)&severity, CMPI_uint16);
+    CMSetProperty(indication, "ProbableCause", (CMPIValue *)&probable_cause, CMPI_uint16);
+    CMSetProperty(indication, "ProbableCauseDescription",
+                  (CMPIValue *)(raised ? "Threshold crossed" : "Threshold cleared"), CMPI_chars);
+
+    snprintf(buf, sizeof(buf), "%s:%s.CreationClassName=\"%s\",Name=\"%s\"",
+             _NAMESPACE, system_cn, system_cn, col->uuid);
+    CMSetProperty(indication, "AlertingManagedElement", (CMPIValue *)buf, CMPI_chars);
+    CMSetProperty(indication, "AlertingElementFormat", (CMPIValue *)&element_format, CMPI_uint16);
+    CMSetProperty(indication, "SystemName", (CMPIValue *)col->uuid, CMPI_chars);
+    CMSetProperty(indication, "SystemCreationClassName", (CMPIValue *)system_cn, CMPI_chars);
+
+    snprintf(buf, sizeof(buf), "%s %s %s %g (%s%s)", col->data_source,
+             raised ? "crossed" : "is back within",
+             (rule->comparison == Xen_MetricAlertRule_Comparison_Below) ? "lower threshold" : "upper threshold",
+             raised ? rule->threshold : rule->clear_threshold,
+             (rule->rule_type == Xen_MetricAlertRule_RuleType_Rate_Of_Change) ? "rate of change, " : "",
+             rule->name);
+    CMSetProperty(indication, "Description", (CMPIValue *)buf, CMPI_chars);
+
+    _CMPICreateNewDeviceInstanceID(buf, sizeof(buf), ALERT_RULE_ID_PREFIX, rule->name);
+    CMSetProperty(indication, "RuleID", (CMPIValue *)buf, CMPI_chars);
+    CMSetProperty(indication, "DataSource", (CMPIValue *)col->data_source, CMPI_chars);
+    CMSetProperty(indication, "MetricValue", (CMPIValue *)&value, CMPI_real64);
+    CMSetProperty(indication, "Threshold", (CMPIValue *)&rule->threshold, CMPI_real64);
+
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- %s alert %s for %s:%s value %g",
+                 raised ? "Raising" : "Clearing", rule->name, col->uuid, col->data_source, value));
+    XEN_PROBE2(indication__deliver, "Xen_MetricAlert", col->uuid);
+    status = CBDeliverIndication(_BROKER, cmpi_context, _NAMESPACE, indication);
+    XEN_PROBE2(indication__delivered, "Xen_MetricAlert", status.rc);
+    if (status.rc != CMPI_RC_OK)
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Failed to deliver alert indication"));
+}
+
+/* Evaluate one new sample of a data source against one rule */
+static void _evaluate_sample(
+    const CMPIContext *cmpi_context,
+    metric_alert_rule *rule,
+    alert_column *col,
+    time_t t,
+    double value)
+{
+    alert_state *state = _get_alert_state(rule->name, col->uuid, col->data_source);
+    if (state == NULL)
+        return;
+
+    double metric = value;
+    if (rule->rule_type == Xen_MetricAlertRule_RuleType_Rate_Of_Change) {
+        if (!state->have_sample || t <= state->last_time) {
+            state->have_sample = true;
+            state->last_value = value;
+            state->last_time = t;
+            return;
+        }
+        metric = (value - state->last_value) / (double)(t - state->last_time);
+    }
+    state->have_sample = true;
+    state->last_value = value;
+    state->last_time = t;
+
+    bool below = (rule->comparison == Xen_MetricAlertRule_Comparison_Below);
+    if (!state->in_alarm) {
+        if (below ? (metric < rule->threshold) : (metric > rule->threshold)) {
+            state->in_alarm = true;
+            _deliver_alert(cmpi_context, rule, col, t, metric, true);
+        }
+    }
+    else {
+        if (below ? (metric >= rule->clear_threshold) : (metric <= rule->clear_threshold)) {
+            state->in_alarm = false;
+            _deliver_alert(cmpi_context, rule, col, t, metric, false);
+        }
+    }
+}
+
+/******************************************************************************
+ * _evaluate_rrd_updates
+ *
+ * Walk the Xport XML returned by rrd_updates. The legend is matched against
+ * the rules once, after which only the columns that rules apply to are
+ * looked at in each new row.
+ *
+ * @param in cmpi_context - context to deliver indications in
+ * @param in rules - the configured alert rules
+ * @param in host - the host the updates came from
+ * @param in xml - Xport XML, modified in place
+ *****************************************************************************/
+static void _evaluate_rrd_updates(
+    const CMPIContext *cmpi_context,
+    metric_alert_rule_set *rules,
+    alert_host *host,
+    char *xml)
+{
+    char *pos = xml, *entry, *text;
+    alert_column *cols = NULL;
+    int col_count = 0, col_alloc = 0, index = 0, i, j;
+
+    char *legend_end = strstr(pos, "</legend>");
+    if (legend_end == NULL)
+        return;
+    while ((entry = xen_rrd_next_element(&pos, "entry", legend_end))) {
+        bool is_host = false;
+        char *uuid = NULL, *data_source = NULL;
+        int this_index = index++;
+        if (!_parse_legend_entry(entry, &is_host, &uuid, &data_source))
+            continue;
+        for (i = 0; i < rules->size; i++) {
+            if (!metric_alert_rule_matches(rules->contents[i], is_host, uuid, data_source))
+                continue;
+            if (col_count == 0 || cols[col_count-1].index != this_index) {
+                if (col_count == col_alloc) {
+                    col_alloc = col_alloc ? col_alloc * 2 : 64;
+                    alert_column *tmp = realloc(cols, col_alloc * sizeof(alert_column));
+                    if (tmp == NULL)
+                        goto Exit;
+                    cols = tmp;
+                }
+                alert_column *col = &cols[col_count++];
+                col->index = this_index;
+                col->host = is_host;
+                col->uuid = uuid;
+                col->data_source = data_source;
+                col->rule_count = 0;
+                col->rules = calloc(rules->size, sizeof(metric_alert_rule *));
+                if (col->rules == NULL) {
+                    col_count--;
+                    goto Exit;
+                }
+            }
+            alert_column *col = &cols[col_count-1];
+            col->rules[col->rule_count++] = rules->contents[i];
+        }
+    }
+    if (col_count == 0)
+        goto Exit; /* nothing on this host is covered by a rule */
+
+    /* rows come newest first, evaluate them oldest first */
+    char *data = strstr(legend_end, "<data>");
+    if (data == NULL)
+        goto Exit;
+    int row_count = 0, row_alloc = 0;
+    char **rows = NULL;
+    pos = data;
+    while ((text = xen_rrd_next_element(&pos, "row", NULL))) {
+        if (row_count == row_alloc) {
+            row_alloc = row_alloc ? row_alloc * 2 : 16;
+            char **tmp = realloc(rows, row_alloc * sizeof(char *));
+            if (tmp == NULL)
+                break;
+            rows = tmp;
+        }
+        rows[row_count++] = text;
+    }
+
+    time_t newest = host->last_update;
+    double *values = calloc(index, sizeof(double));
+    bool *valid = calloc(index, sizeof(bool));
+    for (i = row_count - 1; values && valid && i >= 0; i--) {
+        char *row = rows[i];
+        char *t_str = xen_rrd_next_element(&row, "t", NULL);
+        if (t_str == NULL)
+            continue;
+        time_t t = (time_t)strtol(t_str, NULL, 10);
+        if (t <= host->last_update)
+            continue; /* already evaluated in a previous cycle */
+        if (t > newest)
+            newest = t;
+
+        /* pick out the values of the columns we care about */
+        int c = 0, next_col = 0;
+        memset(valid, 0, index * sizeof(bool));
+        while (next_col < col_count && (text = xen_rrd_next_element(&row, "v", NULL))) {
+            if (c == cols[next_col].index) {
+                char *end = NULL;
+                values[c] = strtod(text, &end);
+                valid[c] = (end != text) && (values[c] == values[c]); /* skip NaN */
+                next_col++;
+            }
+            c++;
+        }
+        for (j = 0; j < col_count; j++) {
+            int k;
+            if (!valid[cols[j].index])
+                continue;
+            for (k = 0; k < cols[j].rule_count; k++)
+                _evaluate_sample(cmpi_context, cols[j].rules[k], &cols[j], t, values[cols[j].index]);
+        }
+    }
+    host->last_update = newest;
+    if (values)
+        free(values);
+    if (valid)
+        free(valid);
+    if (rows)
+        free(rows);
+
+    Exit:
+    for (i = 0; i < col_count; i++)
+        free(cols[i].rules);
+    if (cols)
+        free(cols);
+}
+
+/* Waits out the polling interval, returns false if the thread is to stop */
+static bool _wait_next_cycle()
+{
+    struct timeval now;
+    struct timespec deadline;
+    int rc = 0;
+    bool running;
+
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + pollingInterval;
+    deadline.tv_nsec = now.tv_usec * 1000;
+    pthread_mutex_lock(&alertLock);
+    while (alertRunning && rc != ETIMEDOUT)
+        rc = pthread_cond_timedwait(&alertCond, &alertLock, &deadline);
+    running = alertRunning;
+    pthread_mutex_unlock(&alertLock);
+    return running;
+}
+
+// ----------------------------------------------------------------------------
+// _alertThread()
+// Runtime thread to periodically evaluate the alert rules.
+// ----------------------------------------------------------------------------
+CMPI_THREAD_RETURN _alertThread( void * parameters )
+{
+    CMPIContext * cmpi_context = (CMPIContext *)parameters; /* Indication thread context */
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    xen_utils_session *session = NULL;
+    struct xen_call_context *ctx = NULL;
+    CURL *curl = NULL;
+
+    _SBLIM_ENTER("_alertThread");
+
+    /* Register this thread to the CMPI runtime. */
+    CBAttachThread(_BROKER, cmpi_context);
+
+    if(!xen_utils_get_call_context(cmpi_context, &ctx, &status))
+        goto exit;
+    xen_utils_xen_init2(&session, ctx);
+    curl = curl_easy_init(); /* reused across hosts and cycles */
+    if(curl == NULL)
+        goto exit;
+
+    while(_wait_next_cycle())
+    {
+        if(!enabled)
+            continue;
+        if(!xen_utils_validate_session(&session, ctx))
+        {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Unable to establish connection with Xen"));
+            continue;
+        }
+
+        evaluationCycle++;
+        metric_alert_rule_set *rules = NULL;
+        if(!metric_alert_rules_get_all(session, &rules))
+        {
+            xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+            RESET_XEN_ERROR(session->xen);
+            continue;
+        }
+        if(rules->size > 0 && _refresh_hosts(session))
+        {
+            alert_host *host;
+            for(host = alertHosts; host; host = host->next)
+            {
+                char *xml = xen_rrd_get_updates(curl, session, host->address, host->last_update);
+                if(xml)
+                {
+                    _evaluate_rrd_updates(cmpi_context, rules, host, xml);
+                    free(xml);
+                }
+            }
+        }
+        RESET_XEN_ERROR(session->xen);
+        metric_alert_rule_set_free(rules);
+        _prune_alert_states(false);
+    }
+
+    exit:
+    /* Un-Register this thread from the CMPI runtime. */
+    CBDetachThread(_BROKER, cmpi_context);
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- No more active filters, stopping the alert thread"));
+
+    if(curl)
+        curl_easy_cleanup(curl);
+    if(session)
+        xen_utils_xen_close2(session);
+    if(ctx)
+        xen_utils_free_call_context(ctx);
+    _free_hosts();
+    _prune_alert_states(true);
+    _SBLIM_RETURN(NULL);
+}
+
+// ============================================================================
+// CMPI INDICATION PROVIDER FUNCTION TABLE
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// IndicationCleanup()
+// Perform any necessary cleanup immediately before this provider is unloaded.
+// ----------------------------------------------------------------------------
+static CMPIStatus IndicationCleanup(
+    CMPIIndicationMI * self,          /* [in] Handle to this provider (i.e. 'self'). */
+    const CMPIContext * context,      /* [in] Additional context info, if any. */
+    CMPIBoolean terminating)
+{
+    CMPIStatus status = { CMPI_RC_OK, NULL};    /* Return status of CIM operations. */
+
+    _SBLIM_ENTER("IndicationCleanup");
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- self=\"%s\"", self->ft->miName));
+    _SBLIM_RETURNSTATUS(status);
+}
+
+// ----------------------------------------------------------------------------
+// AuthorizeFilter()
+// Check whether the requested filter is valid/permitted.
+// ----------------------------------------------------------------------------
+static CMPIStatus AuthorizeFilter(
+    CMPIIndicationMI * self,    /* [in] Handle to this provider (i.e. 'self') */
+    const CMPIContext * context,      /* [in] Additional context info, if any */
+    const CMPISelectExp * filter,     /* [in] Indication filter query */
+    const char * eventtype,     /* [in] Target indication class(es) of filter. */
+    const CMPIObjectPath * reference, /* [in] Namespace and classname of monitored class */
+    const char * owner )        /* [in] Name of principle requesting the filter */
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL}; /* Return status of authorization */
+
+    _SBLIM_ENTER("AuthorizeFilter");
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- self=\"%s\"", self->ft->miName));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- filter=\"%s\"", CMGetCharPtr(CMGetSelExpString(filter, NULL))));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- eventtype=\"%s\"", eventtype));
+
+    /* Check that the filter indication class is supported. */
+    if(strcmp(eventtype, "Xen_MetricAlert") != 0)
+        status.rc = CMPI_RC_ERR_ACCESS_DENIED;
+
+    _SBLIM_RETURNSTATUS(status);
+}
+
+// ----------------------------------------------------------------------------
+// MustPoll()
+// Specify if the CIMOM should generate indications instead, by polling the
+// instance data for any changes.
+// ----------------------------------------------------------------------------
+static CMPIStatus MustPoll(
+    CMPIIndicationMI * self,        /* [in] Handle to this provider (i.e. 'self') */
+    const CMPIContext * context,          /* [in] Additional context info, if any */
+    const CMPISelectExp * filter,         /* [in] Indication filter query */
+    const char * eventtype,         /* [in] Filter target class(es) */
+    const CMPIObjectPath * reference )     /* [in] Namespace and classname of monitored class */
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};      /* Return status of CIM operations */
+
+    _SBLIM_ENTER("MustPoll");
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- self=\"%s\"", self->ft->miName));
+
+    /* Polling not required for this indication provider */
+    status.rc = CMPI_RC_ERR_NOT_SUPPORTED;
+    _SBLIM_RETURNSTATUS(status);
+}
+
+// ----------------------------------------------------------------------------
+// ActivateFilter()
+// Add another subscriber and start evaluating alert rules.
+// ----------------------------------------------------------------------------
+static CMPIStatus ActivateFilter(
+    CMPIIndicationMI * self,        /* [in] Handle to this provider (i.e. 'self') */
+    const CMPIContext * context,          /* [in] Additional context info, if any */
+    const CMPISelectExp * filter,         /* [in] Indication filter query */
+    const char * eventtype,         /* [in] Filter target class(es) */
+    const CMPIObjectPath * reference,     /* [in] Namespace and classname of monitored class */
+    const CMPIBoolean first )             /* [in] Is this the first filter for this eventtype? */
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL}; /* Return status of CIM operations */
+
+    _SBLIM_ENTER("ActivateFilter");
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- self=\"%s\"", self->ft->miName));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- eventtype=\"%s\"", eventtype));
+
+    pthread_mutex_lock(&filterLock);
+    numActiveFilters++;
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- numActiveFilters=%d", numActiveFilters));
+
+    /* Startup the alert evaluation thread if it isn't already running */
+    if(alertThreadId == 0)
+    {
+        CMPIContext * alertContext = CBPrepareAttachThread(_BROKER, context);
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,("--- Starting up alert thread (interval=%ds)", pollingInterval));
+        alertRunning = 1;
+        alertThreadId = _BROKER->xft->newThread(_alertThread, alertContext, 0);
+    }
+    pthread_mutex_unlock(&filterLock);
+
+    _SBLIM_RETURNSTATUS(status);
+}
+
+// ----------------------------------------------------------------------------
+// DeActivateFilter()
+// Remove a subscriber and if necessary stop evaluating alert rules.
+// ----------------------------------------------------------------------------
+static CMPIStatus DeActivateFilter(
+    CMPIIndicationMI * self,        /* [in] Handle to this provider (i.e. 'self') */
+    const CMPIContext * context,          /* [in] Additional context info, if any */
+    const CMPISelectExp * filter,         /* [in] Indication filter query */
+    const char * eventtype,         /* [in] Filter target class(es) */
+    const CMPIObjectPath * reference,     /* [in] Namespace and classname of monitored class */
+    CMPIBoolean last )              /* [in] Is this the last filter for this eventtype? */
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL}; /* Return status of CIM operations */
+
+    _SBLIM_ENTER("DeActivateFilter");
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- self=\"%s\"", self->ft->miName));
+
+    pthread_mutex_lock(&filterLock);
+    if(numActiveFilters == 0)
+    {
+        CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED, "No active filters");
+        goto exit;
+    }
+
+    numActiveFilters--;
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG,("--- numActiveFilters=%d", numActiveFilters));
+
+    /* Stop the alert thread and wait for it to be gone before the next
+       ActivateFilter starts another */
+    if((numActiveFilters == 0) && alertThreadId != 0)
+    {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,("--- Shutting down alert thread"));
+        pthread_mutex_lock(&alertLock);
+        alertRunning = 0;
+        pthread_cond_signal(&alertCond);
+        pthread_mutex_unlock(&alertLock);
+        _BROKER->xft->joinThread(alertThreadId, NULL);
+        alertThreadId = 0;
+    }
+
+    exit:
+    pthread_mutex_unlock(&filterLock);
+    _SBLIM_RETURNSTATUS(status);
+}
+
+// ----------------------------------------------------------------------------
+// EnableIndications()
+// ----------------------------------------------------------------------------
+static CMPIStatus EnableIndications(
+    CMPIIndicationMI * self,
+    const CMPIContext *context )
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL}; /* Return status of CIM operations */
+    _SBLIM_ENTER("EnableIndications");
+    enabled = 1;
+    _SBLIM_RETURNSTATUS(status);
+}
+
+// ----------------------------------------------------------------------------
+// DisableIndications()
+// ----------------------------------------------------------------------------
+static CMPIStatus DisableIndications(
+    CMPIIndicationMI * self,
+    const CMPIContext *context )
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL}; /* Return status of CIM operations */
+    _SBLIM_ENTER("DisableIndications");
+    enabled = 0;
+    _SBLIM_RETURNSTATUS(status);
+}
+
+// ----------------------------------------------------------------------------
+// IndicationInitialize()
+// Perform any necessary initialization immediately after this provider is
+// first loaded.
+// ----------------------------------------------------------------------------
+static void IndicationInitialize(
+    const CMPIIndicationMI * self,          /* [in] Handle to this provider (i.e. 'self'). */
+    const CMPIContext * context)          /* [in] Additional context info, if any. */
+{
+    _SBLIM_ENTER("IndicationInitialize");
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- self=\"%s\"", self->ft->miName));
+
+    char *interval = getenv("XEN_CIM_ALERT_INTERVAL");
+    if(interval && atoi(interval) > 0)
+        pollingInterval = atoi(interval);
+
+    _SBLIM_RETURN();
+}
+
+CMIndicationMIStub( , Xen_MetricAlertIndication, _BROKER, IndicationInitialize(&mi, ctx));
@@ -0,0 +1,662 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "Xen_MetricAlert.h"
+#include "providerinterface.h"
+
+static const char *classname = "Xen_MetricAlertRule";
+static const char *keys[] = {"InstanceID"};
+static const char *key_property = "InstanceID";
+
+/* Serializes the changes to the rules, a replace is a remove and an add
+   that nothing else may come in between */
+static pthread_mutex_t rulesLock = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+ * Helper functions to persist alert rules in the pool's other_config
+ *****************************************************************************/
+static int _get_pool(
+    xen_utils_session *session,
+    xen_pool *pool)
+{
+    xen_pool_set *pool_set = NULL;
+    if (!xen_pool_get_all(session->xen, &pool_set) ||
+        (pool_set == NULL) || (pool_set->size == 0)) {
+        if (pool_set)
+            xen_pool_set_free(pool_set);
+        return 0;
+    }
+    *pool = pool_set->contents[0];
+    pool_set->contents[0] = NULL;
+    xen_pool_set_free(pool_set);
+    return 1;
+}
+
+/*
+ * Parse a rule from its flattened other_config form
+ * DataSource=cpu*;SystemType=0;RuleType=0;Comparison=0;Threshold=0.9;...
+ */
+metric_alert_rule *metric_alert_rule_from_string(
+    const char *name,
+    const char *str)
+{
+    char *val;
+    metric_alert_rule *rule = NULL;
+    xen_utils_string_map_index *map = NULL;
+    xen_string_string_map *rule_map = xen_utils_convert_string_to_string_map(str, ";");
+    if (rule_map == NULL)
+        return NULL;
+    /* every field of the rule is looked up by name */
+    if ((map = xen_utils_string_map_index_new(rule_map)) == NULL) {
+        xen_string_string_map_free(rule_map);
+        return NULL;
+    }
+
+    val = xen_utils_string_map_index_get(map, "DataSource");
+    if (val == NULL)
+        goto Exit; /* a rule without a data source is of no use */
+    rule = calloc(1, sizeof(metric_alert_rule));
+    if (rule == NULL)
+        goto Exit;
+    rule->name = strdup(name);
+    rule->data_source = strdup(val);
+    rule->enabled = true;
+    rule->severity = 4; /* Degraded/Warning */
+    if ((val = xen_utils_string_map_index_get(map, "System")))
+        rule->system = strdup(val);
+    if ((val = xen_utils_string_map_index_get(map, "SystemType")))
+        rule->system_type = atoi(val);
+    if ((val = xen_utils_string_map_index_get(map, "RuleType")))
+        rule->rule_type = atoi(val);
+    if ((val = xen_utils_string_map_index_get(map, "Comparison")))
+        rule->comparison = atoi(val);
+    if ((val = xen_utils_string_map_index_get(map, "Threshold")))
+        rule->threshold = strtod(val, NULL);
+    if ((val = xen_utils_string_map_index_get(map, "ClearThreshold")))
+        rule->clear_threshold = strtod(val, NULL);
+    else
+        rule->clear_threshold = rule->threshold;
+    if ((val = xen_utils_string_map_index_get(map, "PerceivedSeverity")))
+        rule->severity = atoi(val);
+    if ((val = xen_utils_string_map_index_get(map, "Enabled")))
+        rule->enabled = (strcmp(val, "true") == 0);
+
+    Exit:
+    xen_utils_string_map_index_free(map);
+    return rule;
+}
+
+/*
+ * Flatten a rule for storage in other_config. Caller frees the string.
+ */
+char *metric_alert_rule_to_string(
+    metric_alert_rule *rule)
+{
+    char buf[1024];
+    int len = snprintf(buf, sizeof(buf),
+                       "DataSource=%s;SystemType=%d;RuleType=%d;Comparison=%d;"
+                       "Threshold=%g;ClearThreshold=%g;PerceivedSeverity=%d;Enabled=%s",
+                       rule->data_source, rule->system_type, rule->rule_type,
+                       rule->comparison, rule->threshold, rule->clear_threshold,
+                       rule->severity, rule->enabled ? "true" : "false");
+    if (rule->system && len < sizeof(buf))
+        snprintf(buf+len, sizeof(buf)-len, ";System=%s", rule->system);
+    return strdup(buf);
+}
+
+void metric_alert_rule_free(
+    metric_alert_rule *rule)
+{
+    if (rule == NULL)
+        return;
+    if (rule->name)
+        free(rule->name);
+    if (rule->data_source)
+        free(rule->data_source);
+    if (rule->system)
+        free(rule->system);
+    free(rule);
+}
+
+void metric_alert_rule_set_free(
+    metric_alert_rule_set *rules)
+{
+    int i;
+    if (rules == NULL)
+        return;
+    for (i = 0; i < rules->size; i++)
+        metric_alert_rule_free(rules->contents[i]);
+    free(rules);
+}
+
+/******************************************************************************
+ * metric_alert_rules_get_all
+ *
+ * Read all the alert rules stored in the pool's other_config. This is a
+ * single round trip to xapi however many rules are configured.
+ *
+ * @param in session - validated xen session handle
+ * @param out rules - set of rules, caller frees with metric_alert_rule_set_free
+ * @returns 1 on success, 0 on failure
+ *****************************************************************************/
+int metric_alert_rules_get_all(
+    xen_utils_session *session,
+    metric_alert_rule_set **rules)
+{
+    xen_pool pool = NULL;
+    xen_string_string_map *other_config = NULL;
+    int i, count = 0, prefix_len = strlen(ALERT_RULE_KEY_PREFIX);
+
+    if (!_get_pool(session, &pool))
+        return 0;
+    if (!xen_pool_get_other_config(session->xen, &other_config, pool)) {
+        xen_pool_free(pool);
+        return 0;
+    }
+    xen_pool_free(pool);
+
+    for (i = 0; other_config && i < other_config->size; i++)
+        if (strncmp(other_config->contents[i].key, ALERT_RULE_KEY_PREFIX, prefix_len) == 0)
+            count++;
+
+    *rules = calloc(1, sizeof(metric_alert_rule_set) + count * sizeof(metric_alert_rule *));
+    if (*rules == NULL) {
+        xen_string_string_map_free(other_config);
+        return 0;
+    }
+    for (i = 0; other_config && i < other_config->size; i++) {
+        if (strncmp(other_config->contents[i].key, ALERT_RULE_KEY_PREFIX, prefix_len) == 0) {
+            metric_alert_rule *rule = metric_alert_rule_from_string(
+                other_config->contents[i].key + prefix_len, other_config->contents[i].val);
+            if (rule)
+                (*rules)->contents[(*rules)->size++] = rule;
+        }
+    }
+    if (other_config)
+        xen_string_string_map_free(other_config);
+    return 1;
+}
+
+/*
+ * Check if a rule applies to the RRD data source of a host or VM.
+ * A '*' in the rule's data source matches any sequence of characters
+ * (for instance 'cpu*' matches 'cpu0', 'cpu1' and 'vbd_*_write_latency'
+ * matches the write latency of every disk).
+ */
+bool metric_alert_rule_matches(
+    metric_alert_rule *rule,
+    bool host,
+    const char *uuid,
+    const char *data_source)
+{
+    if (!rule->enabled)
+        return false;
+    if (host != (rule->system_type == Xen_MetricAlertRule_SystemType_Host))
+        return false;
+    if (rule->system && strcmp(rule->system, uuid) != 0)
+        return false;
+
+    char *wildcard = strchr(rule->data_source, '*');
+    if (wildcard == NULL)
+        return (strcmp(rule->data_source, data_source) == 0);
+
+    int prefix_len = wildcard - rule->data_source;
+    int suffix_len = strlen(wildcard + 1);
+    int len = strlen(data_source);
+    return ((len >= prefix_len + suffix_len) &&
+            (strncmp(rule->data_source, data_source, prefix_len) == 0) &&
+            (strcmp(wildcard + 1, data_source + len - suffix_len) == 0));
+}
+
+/* Build the other_config key for a rule */
+static void _rule_key(
+    char *buf,
+    int buf_len,
+    const char *name)
+{
+    snprintf(buf, buf_len, "%s%s", ALERT_RULE_KEY_PREFIX, name);
+}
+
+/* Get the rule name out of the InstanceID of the form Xen:AlertRule/<name> */
+static int _rule_name_from_id(
+    char *buf,
+    int buf_len,
+    const char *inst_id)
+{
+    return (_CMPIStrncpyDeviceNameFromID(buf, inst_id, buf_len) != NULL);
+}
+
+/* The rules are stored as Key=Value;... so their strings can't have either separator */
+static bool _is_valid_field(
+    const char *str)
+{
+    return str && !strchr(str, ';') && !strchr(str, '=');
+}
+
+/* Create a rule from the properties of a Xen_MetricAlertRule CIM instance */
+static metric_alert_rule *_rule_from_instance(
+    const CMPIInstance *inst)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    char name[MAX_INSTANCEID_LEN];
+    metric_alert_rule *rule = NULL;
+
+    CMPIData data = CMGetProperty(inst, "InstanceID", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data)) {
+        if (!_rule_name_from_id(name, sizeof(name), CMGetCharPtr(data.value.string)))
+            return NULL;
+    }
+    else {
+        /* No InstanceID, name the rule after its ElementName */
+        data = CMGetProperty(inst, "ElementName", &status);
+        if ((status.rc != CMPI_RC_OK) || CMIsNullValue(data))
+            return NULL;
+        strncpy(name, CMGetCharPtr(data.value.string), sizeof(name)-1);
+        name[sizeof(name)-1] = '\0';
+    }
+    if (!_is_valid_field(name))
+        return NULL;
+
+    data = CMGetProperty(inst, "DataSource", &status);
+    if ((status.rc != CMPI_RC_OK) || CMIsNullValue(data) ||
+        !_is_valid_field(CMGetCharPtr(data.value.string)))
+        return NULL;
+
+    rule = calloc(1, sizeof(metric_alert_rule));
+    if (rule == NULL)
+        return NULL;
+    rule->name = strdup(name);
+    rule->data_source = strdup(CMGetCharPtr(data.value.string));
+    rule->enabled = true;
+    rule->severity = 4;
+
+    data = CMGetProperty(inst, "System", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data)) {
+        if (!_is_valid_field(CMGetCharPtr(data.value.string))) {
+            metric_alert_rule_free(rule);
+            return NULL;
+        }
+        rule->system = strdup(CMGetCharPtr(data.value.string));
+    }
+    data = CMGetProperty(inst, "SystemType", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data))
+        rule->system_type = data.value.uint16;
+    data = CMGetProperty(inst, "RuleType", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data))
+        rule->rule_type = data.value.uint16;
+    data = CMGetProperty(inst, "Comparison", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data))
+        rule->comparison = data.value.uint16;
+    data = CMGetProperty(inst, "Threshold", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data))
+        rule->threshold = data.value.real64;
+    rule->clear_threshold = rule->threshold;
+    data = CMGetProperty(inst, "ClearThreshold", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data))
+        rule->clear_threshold = data.value.real64;
+    data = CMGetProperty(inst, "PerceivedSeverity", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data))
+        rule->severity = data.value.uint16;
+    data = CMGetProperty(inst, "Enabled", &status);
+    if ((status.rc == CMPI_RC_OK) && !CMIsNullValue(data))
+        rule->enabled = data.value.boolean;
+
+    return rule;
+}
+
+/* Write the rule to the pool's other_config, replacing any existing version */
+static CMPIrc _store_rule(
+    xen_utils_session *session,
+    metric_alert_rule *rule,
+    bool replace)
+{
+    xen_pool pool = NULL;
+    char key[MAX_INSTANCEID_LEN+sizeof(ALERT_RULE_KEY_PREFIX)];
+    CMPIrc rc = CMPI_RC_OK;
+
+    if (!_get_pool(session, &pool)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        return CMPI_RC_ERR_FAILED;
+    }
+    _rule_key(key, sizeof(key), rule->name);
+    char *val = metric_alert_rule_to_string(rule);
+    char *old_val = NULL;
+    pthread_mutex_lock(&rulesLock);
+    if (replace) {
+        /* keep the stored rule, to put it back if the new one can't be added */
+        xen_string_string_map *other_config = NULL;
+        if (!xen_pool_get_other_config(session->xen, &other_config, pool)) {
+            xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+            rc = CMPI_RC_ERR_FAILED;
+            goto Exit;
+        }
+        int i;
+        for (i = 0; other_config && i < other_config->size; i++) {
+            if (strcmp(other_config->contents[i].key, key) == 0) {
+                old_val = strdup(other_config->contents[i].val);
+                break;
+            }
+        }
+        if (other_config)
+            xen_string_string_map_free(other_config);
+        xen_pool_remove_from_other_config(session->xen, pool, key);
+        RESET_XEN_ERROR(session->xen);
+    }
+    if (!xen_pool_add_to_other_config(session->xen, pool, key, val)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        rc = replace ? CMPI_RC_ERR_FAILED : CMPI_RC_ERR_ALREADY_EXISTS;
+        if (old_val) {
+            RESET_XEN_ERROR(session->xen);
+            if (!xen_pool_add_to_other_config(session->xen, pool, key, old_val))
+                xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        }
+    }
+
+    Exit:
+    pthread_mutex_unlock(&rulesLock);
+    free(old_val);
+    free(val);
+    xen_pool_free(pool);
+    return rc;
+}
+
+/*********************************************************
+ ************ Provider Specific functions ****************
+ ******************************************************* */
+static const char *xen_resource_get_key_property(
+    const CMPIBroker *broker,
+    const char *classnamestr
+    )
+{
+    return key_property;
+}
+static const char **xen_resource_get_keys(
+    const CMPIBroker *broker,
+    const char *classnamestr
+    )
+{
+    return keys;
+}
+/********************************************************
+ * Function to enumerate provider specific resource
+ *
+ * @param session - handle to a xen_utils_session object
+ * @param resources - pointer to the provider_resource_list
+ *   object, the provider specific resource defined above
+ *   is a member of this struct
+ * @return CMPIrc error codes
+ ********************************************************/
+static CMPIrc xen_resource_list_enum(
+    xen_utils_session *session,
+    provider_resource_list *resources
+    )
+{
+    metric_alert_rule_set *rules = NULL;
+    if (!metric_alert_rules_get_all(session, &rules))
+        return CMPI_RC_ERR_FAILED;
+    resources->ctx = rules;
+    return CMPI_RC_OK;
+}
+/*******************************************************************
+ * Function to cleanup provider specific resource
+ *
+ * @param resources - handle to the provider_resource_list to be
+ *    be cleaned up. Clean up the provider specific part of the
+ *    resource.
+ * @return CMPIrc error codes
+ *******************************************************************/
+static CMPIrc xen_resource_list_cleanup(
+    provider_resource_list *resources
+    )
+{
+    if (resources->ctx)
+        metric_alert_rule_set_free((metric_alert_rule_set *)resources->ctx);
+    return CMPI_RC_OK;
+}
+
+/*****************************************************************************
+ * Function to get the next provider specific resource in the resource list
+ *
+ * @param resources_list - handle to the provide_resource_list object
+ * @param session - handle to the xen_utils_session object
+ * @param prov_res - handle to the next provider_resource to be filled in.
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_record_getnext(
+    provider_resource_list *resources_list,/* in */
+    xen_utils_session *session,/* in */
+    provider_resource *prov_res /* in , out */
+    )
+{
+    metric_alert_rule_set *rules = (metric_alert_rule_set *)resources_list->ctx;
+    if (rules == NULL || resources_list->current_resource == rules->size)
+        return CMPI_RC_ERR_NOT_FOUND;
+
+    /* hand the rule over to the resource, it gets freed with it */
+    prov_res->ctx = rules->contents[resources_list->current_resource];
+    rules->contents[resources_list->current_resource] = NULL;
+    return CMPI_RC_OK;
+}
+
+/*****************************************************************************
+ * Function to cleanup the resource
+ *
+ * @param - provider_resource to be freed
+ * @return CMPIrc error codes
+****************************************************************************/
+static CMPIrc xen_resource_record_cleanup(provider_resource *prov_res)
+{
+    if (prov_res->ctx)
+        metric_alert_rule_free((metric_alert_rule *)prov_res->ctx);
+    return CMPI_RC_OK;
+}
+
+/*****************************************************************************
+ * Function to get a provider specific resource identified by an id
+ *
+ * @param res_uuid - resource identifier for the provider specific resource
+ * @param session - handle to the xen_utils_session object
+ * @param prov_res - provide_resource object to be filled in with the provider
+ *                   specific resource
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_record_get_from_id(
+    char *res_uuid, /* in */
+    xen_utils_session *session, /* in */
+    provider_resource *prov_res /* in , out */
+    )
+{
+    xen_pool pool = NULL;
+    char name[MAX_INSTANCEID_LEN];
+    char key[MAX_INSTANCEID_LEN+sizeof(ALERT_RULE_KEY_PREFIX)];
+    xen_string_string_map *other_config = NULL;
+    CMPIrc rc = CMPI_RC_ERR_NOT_FOUND;
+
+    if (!_rule_name_from_id(name, sizeof(name), res_uuid))
+        return CMPI_RC_ERR_INVALID_PARAMETER;
+    if (!_get_pool(session, &pool) ||
+        !xen_pool_get_other_config(session->xen, &other_config, pool)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        if (pool)
+            xen_pool_free(pool);
+        return CMPI_RC_ERR_FAILED;
+    }
+    _rule_key(key, sizeof(key), name);
+    char *val = xen_utils_get_from_string_string_map(other_config, key);
+    if (val) {
+        prov_res->ctx = metric_alert_rule_from_string(name, val);
+        if (prov_res->ctx)
+            rc = CMPI_RC_OK;
+    }
+    xen_string_string_map_free(other_config);
+    xen_pool_free(pool);
+    return rc;
+}
+/*****************************************************************************
+ * Create a new alert rule from the Xen_MetricAlertRule instance passed in.
+ *
+ * @param broker - CMPI broker services
+ * @param session - handle to the xen_utils_session object
+ * @param res_id - the new CIM instance
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_add(
+    const CMPIBroker *broker,
+    xen_utils_session *session,
+    const void *res_id
+    )
+{
+    metric_alert_rule *rule = _rule_from_instance((const CMPIInstance *)res_id);
+    if (rule == NULL)
+        return CMPI_RC_ERR_INVALID_PARAMETER;
+    CMPIrc rc = _store_rule(session, rule, false);
+    metric_alert_rule_free(rule);
+    return rc;
+}
+/*****************************************************************************
+ * Delete the alert rule identified by inst_id.
+ *
+ * @param session - handle to the xen_utils_session object
+ * @param inst_id - resource identifier for the provider specific resource
+ * @return CMPIrc error codes
+****************************************************************************/
+static CMPIrc xen_resource_delete(
+    const CMPIBroker *broker,
+    xen_utils_session *session,
+    const char *inst_id
+    )
+{
+    xen_pool pool = NULL;
+    char name[MAX_INSTANCEID_LEN];
+    char key[MAX_INSTANCEID_LEN+sizeof(ALERT_RULE_KEY_PREFIX)];
+    CMPIrc rc = CMPI_RC_OK;
+
+    if (!_rule_name_from_id(name, sizeof(name), inst_id))
+        return CMPI_RC_ERR_INVALID_PARAMETER;
+    _rule_key(key, sizeof(key), name);
+    if (!_get_pool(session, &pool)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        return CMPI_RC_ERR_FAILED;
+    }
+    pthread_mutex_lock(&rulesLock);
+    if (!xen_pool_remove_from_other_config(session->xen, pool, key)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        rc = CMPI_RC_ERR_FAILED;
+    }
+    pthread_mutex_unlock(&rulesLock);
+    if (pool)
+        xen_pool_free(pool);
+    return rc;
+}
+
+/*****************************************************************************
+ * Modify the alert rule identified by inst_id.
+ *
+ * @param res_id - pointer to a CMPIInstance that represents the CIM object
+ *                 being modified
+ * @param modified_res - resource created by xen_resource_extract
+ * @param properties - list of properties to be used while modifying
+ * @param session - handle to the xen_utils_session object
+ * @param inst_id - resource identifier for the provider specific resource
+ * @return CMPIrc error codes
+*****************************************************************************/
+static CMPIrc xen_resource_modify(
+    const CMPIBroker *broker,
+    const void *res_id,
+    const void *modified_res,
+    const char **properties,
+    CMPIStatus status,
+    char *inst_id,
+    xen_utils_session *session
+    )
+{
+    provider_resource *prov_res = (provider_resource *)modified_res;
+    if (prov_res == NULL || prov_res->ctx == NULL)
+        return CMPI_RC_ERR_INVALID_PARAMETER;
+    return _store_rule(session, (metric_alert_rule *)prov_res->ctx, true);
+}
+/************************************************************************
+ * Function to extract resources
+ *
+ * @param res - provider specific resource to get values from
+ * @param inst - CIM object whose properties are being set
+ * @param properties - list of properties to be used while modifying
+ * @return CMPIrc return values
+*************************************************************************/
+static CMPIrc xen_resource_extract(
+    void **res,
+    const CMPIInstance *inst,
+    const char **properties
+    )
+{
+    (void)properties;
+    metric_alert_rule *rule = _rule_from_instance(inst);
+    if (rule == NULL)
+        return CMPI_RC_ERR_INVALID_PARAMETER;
+    provider_resource *prov_res = calloc(1, sizeof(provider_resource));
+    if (prov_res == NULL) {
+        metric_alert_rule_free(rule);
+        return CMPI_RC_ERR_FAILED;
+    }
+    prov_res->classname = classname;
+    prov_res->ctx = rule;
+    *res = prov_res;
+    return CMPI_RC_OK;
+}
+/************************************************************************
+ * Function that sets the properties of a CIM object with values from the
+ * provider specific resource.
+ *
+ * @param resource - provider specific resource to get values from
+ * @param inst - CIM object whose properties are being set
+ * @return CMPIrc return values
+*************************************************************************/
+static CMPIrc xen_resource_set_properties(
+    provider_resource *resource,
+    CMPIInstance *inst)
+{
+    char buf[MAX_INSTANCEID_LEN];
+    metric_alert_rule *rule = (metric_alert_rule *)resource->ctx;
+    CMPIUint16 system_type = rule->system_type;
+    CMPIUint16 rule_type = rule->rule_type;
+    CMPIUint16 comparison = rule->comparison;
+    CMPIUint16 severity = rule->severity;
+    CMPIBoolean enabled = rule->enabled;
+
+    _CMPICreateNewDeviceInstanceID(buf, sizeof(buf), ALERT_RULE_ID_PREFIX, rule->name);
+    CMSetProperty(inst, "InstanceID",(CMPIValue *)buf, CMPI_chars);
+    CMSetProperty(inst, "ElementName",(CMPIValue *)rule->name, CMPI_chars);
+    if (resource->ref_only)
+        return CMPI_RC_OK;
+
+    CMSetProperty(inst, "Caption",(CMPIValue *)"Metric Alert Rule", CMPI_chars);
+    CMSetProperty(inst, "DataSource",(CMPIValue *)rule->data_source, CMPI_chars);
+    if (rule->system)
+        CMSetProperty(inst, "System",(CMPIValue *)rule->system, CMPI_chars);
+    CMSetProperty(inst, "SystemType",(CMPIValue *)&system_type, CMPI_uint16);
+    CMSetProperty(inst, "RuleType",(CMPIValue *)&rule_type, CMPI_uint16);
+    CMSetProperty(inst, "Comparison",(CMPIValue *)&comparison, CMPI_uint16);
+    CMSetProperty(inst, "Threshold",(CMPIValue *)&rule->threshold, CMPI_real64);
+    CMSetProperty(inst, "ClearThreshold",(CMPIValue *)&rule->clear_threshold, CMPI_real64);
+    CMSetProperty(inst, "PerceivedSeverity",(CMPIValue *)&severity, CMPI_uint16);
+    CMSetProperty(inst, "Enabled",(CMPIValue *)&enabled, CMPI_boolean);
+    return CMPI_RC_OK;
+}
+
+/* Setup the function table for the instance provider */
+XenFullInstanceMIStub(Xen_MetricAlertRule)
@@ -20,6 +20,8 @@
 #include "Xen_MetricService.h"
 #include "providerinterface.h"
 #include "xen_utils.h"
+#include "xen_transport.h"
+#include "xen_hosts.h"
 
 static const char * classname = "Xen_MetricService";    
 static const char *keys[] = {"SystemName","SystemCreationClassName","CreationClassName","Name"}; 
@@ -394,8 +396,10 @@ static int get_performance_metrics_for_system(
 {
     char *class_name = NULL, *uuid = NULL;
     bool host_metrics = false;
-    int http_code = 0;
+    long http_code = 0;
     xen_host host = NULL;
+    xen_host_directory *hosts = NULL;
+    const xen_host_entry *host_entry = NULL;
     char *host_ip = NULL;
     time_t starttime, endtime;
     char *status_msg = "ERROR: Unknown error";
@@ -421,7 +425,7 @@ static int get_performance_metrics_for_system(
     if (strcmp(class_name, "Xen_HostComputerSystem") == 0) {
         /* host metrics need to be collected from the host themselves */
         host_metrics = true;
-        if (!xen_host_get_by_uuid(session->xen, &host, uuid)) {
+        if ((host_entry = xen_host_directory_lookup_uuid(session, &hosts, uuid)) == NULL) {
             goto Exit;
         }
     }
@@ -454,8 +458,10 @@ static int get_performance_metrics_for_system(
         xen_vm_free(vm);
     }
 
-    /* Get the host's IP address to use in the URL */
-    if (!xen_host_get_address(session->xen, &host_ip, host))
+    /* Get the host's IP address to use in the URL, from the host directory */
+    if (host_entry == NULL && (host_entry = xen_host_directory_lookup(session, &hosts, host)) == NULL)
+        goto Exit;
+    if (host_entry->address == NULL || (host_ip = strdup(host_entry->address)) == NULL)
         goto Exit;
 
     if(duration == 0) {
@@ -481,18 +487,18 @@ static int get_performance_metrics_for_system(
 
         /* create unique urls for specific metrics */
         char *metrics_url = _create_curl_url(host_ip, host_metrics, uuid, session->xen, starttime, endtime, resolution);
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Getting metrics (from %ld to %ld) for URL %s", starttime, endtime, metrics_url));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Getting metrics (from %llu to %llu) for URL %s",
+            starttime ? (unsigned long long)CMGetBinaryFormat(starttime, NULL) : 0ULL,
+            endtime ? (unsigned long long)CMGetBinaryFormat(endtime, NULL) : 0ULL, metrics_url));
 
         /* perform curl transaction and get HTTP response */
         curl_easy_setopt(curl, CURLOPT_URL, metrics_url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _write_data);  /* use callback above */
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);            /* use our datastructure for callback handling */
         curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, resp);       /* handle 3XX redirects */
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);      /* Dont verify server's SSL cert */
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);      /* Dont check the host's cert */
 
-        res = curl_easy_perform(curl);
-        curl_easy_getinfo(curl, CURLINFO_HTTP_CODE, &http_code);
+        /* the response goes to our datastructure, through the callback above */
+        res = xen_transport_perform(curl, "GET", metrics_url, NULL, 0, _write_data, resp, &http_code);
         if (http_code == 200 && res != CURLE_ABORTED_BY_CALLBACK) {
             *metrics_xml_out = resp->data; /* caller will free this */
         }
@@ -511,9 +517,9 @@ static int get_performance_metrics_for_system(
         rc = Xen_MetricService_GetPerformanceMetricsForSystem_Completed_with_No_Error;
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Got Metrics successfully"));
     } else {
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP Error %d, Curl error %d", http_code, res));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP Error %ld, Curl error %d", http_code, res));
         snprintf(msg, sizeof(msg)/sizeof(msg[0]), 
-                 "ERROR: HTTP error %d accessing metrics. Metrics may not be available for the time duration specified.",
+                 "ERROR: HTTP error %ld accessing metrics. Metrics may not be available for the time duration specified.",
                  http_code);
         status_msg = msg;
     }
@@ -521,6 +527,7 @@ static int get_performance_metrics_for_system(
     Exit:
     if (host)
         xen_host_free(host);
+    xen_host_directory_release(hosts);
     if (host_ip != NULL)
         free(host_ip);
     xen_utils_set_status(broker, status, statusrc, status_msg, session->xen);
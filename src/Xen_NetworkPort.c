@@ -17,9 +17,30 @@
 #include "providerinterface.h"
 #include "RASDs.h"
 
+/* The VM of a VIF as far as the network port needs it */
+typedef struct {
+    char *vm;                           /* ref */
+    char *uuid;
+    xen_string_string_map *networks;    /* from the guest metrics, NULL if there are none */
+} local_vif_vm;
+
+/* The VMs and VIF metrics of all the VIFs, fetched in bulk once per
+   enumeration rather than for every VIF */
+typedef struct {
+    int vm_count;
+    local_vif_vm *vms;                  /* by VM ref */
+    xen_vif_metrics_xen_vif_metrics_record_map *vif_metrics_map; /* by ref, NULL if it couldn't be fetched */
+} local_vif_join;
+
+typedef struct {
+    xen_vif_set *vif_set;
+    local_vif_join *join;               /* for the network port classes */
+}local_vif_list;
+
 typedef struct {
     xen_vif vif;
     xen_vif_record * vif_rec;
+    local_vif_join *join;               /* owned by the list, NULL if there's none */
 }local_vif_resource;
 
 static const char *np_cn = "Xen_NetworkPort";
@@ -66,7 +87,7 @@ static void _set_network_port_rasd_properties(
     );
 static char *_get_ip_address(
     xen_vif_record *vif_rec,
-    xen_vm_guest_metrics_record *metrics_rec
+    xen_string_string_map *networks
     );
 /********************************************************
  * Provider export functions 
@@ -114,19 +135,123 @@ static const char **xen_resource_get_keys(
  *   is a member of this struct
  * @return CMPIrc error codes
  ********************************************************/
+static void _free_join(local_vif_join *join)
+{
+    int i;
+    if (join == NULL)
+        return;
+    for (i = 0; i < join->vm_count; i++) {
+        free(join->vms[i].vm);
+        free(join->vms[i].uuid);
+        if (join->vms[i].networks)
+            xen_string_string_map_free(join->vms[i].networks);
+    }
+    free(join->vms);
+    if (join->vif_metrics_map)
+        xen_vif_metrics_xen_vif_metrics_record_map_free(join->vif_metrics_map);
+    free(join);
+}
+
+/*
+ * Joins every VM to the networks its guest reports, with one call for
+ * the VM records and one for the guest metrics records, and gets the VIF
+ * metrics records with a third. Only the VMs' refs, uuids and networks
+ * are kept, the rest of their records goes once they are joined.
+ * Returns NULL if the VMs couldn't be fetched.
+ */
+static local_vif_join *_join_vms(xen_utils_session *session)
+{
+    xen_vm_xen_vm_record_map *vm_map = NULL;
+    xen_vm_guest_metrics_xen_vm_guest_metrics_record_map *guest_metrics_map = NULL;
+    local_vif_join *join = NULL;
+    size_t i;
+
+    if (!xen_vm_get_all_records(session->xen, &vm_map)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        return NULL;
+    }
+    if ((join = calloc(1, sizeof(local_vif_join))) == NULL ||
+        (join->vms = calloc(vm_map->size + 1, sizeof(local_vif_vm))) == NULL)
+        goto Error;
+
+    /* without them the VMs just have no IP addresses */
+    if (xen_vm_guest_metrics_get_all_records(session->xen, &guest_metrics_map))
+        qsort(guest_metrics_map->contents, guest_metrics_map->size,
+              sizeof(guest_metrics_map->contents[0]), xen_utils_compare_refs);
+    else {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        RESET_XEN_ERROR(session->xen);
+    }
+
+    for (i = 0; i < vm_map->size; i++) {
+        xen_vm_record *vm_rec = vm_map->contents[i].val;
+        local_vif_vm *vm = &join->vms[join->vm_count];
+        if (vm_rec == NULL || vm_rec->uuid == NULL)
+            continue;
+        vm->vm = (char *)vm_map->contents[i].key;
+        vm_map->contents[i].key = NULL;
+        vm->uuid = vm_rec->uuid;
+        vm_rec->uuid = NULL;
+        if (guest_metrics_map && vm_rec->guest_metrics && !vm_rec->guest_metrics->is_record) {
+            int found = xen_utils_find_ref(guest_metrics_map->contents, guest_metrics_map->size,
+                                            sizeof(guest_metrics_map->contents[0]),
+                                            (char *)vm_rec->guest_metrics->u.handle);
+            if (found >= 0 && guest_metrics_map->contents[found].val) {
+                vm->networks = guest_metrics_map->contents[found].val->networks;
+                guest_metrics_map->contents[found].val->networks = NULL;
+            }
+        }
+        join->vm_count++;
+    }
+    qsort(join->vms, join->vm_count, sizeof(local_vif_vm), xen_utils_compare_refs);
+
+    /* without them the ports just have no speed */
+    if (xen_vif_metrics_get_all_records(session->xen, &join->vif_metrics_map))
+        qsort(join->vif_metrics_map->contents, join->vif_metrics_map->size,
+              sizeof(join->vif_metrics_map->contents[0]), xen_utils_compare_refs);
+    else {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        RESET_XEN_ERROR(session->xen);
+        join->vif_metrics_map = NULL;
+    }
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Joined %d VMs to their guest networks", join->vm_count));
+    goto Exit;
+
+Error:
+    _free_join(join);
+    join = NULL;
+Exit:
+    if (vm_map)
+        xen_vm_xen_vm_record_map_free(vm_map);
+    if (guest_metrics_map)
+        xen_vm_guest_metrics_xen_vm_guest_metrics_record_map_free(guest_metrics_map);
+    return join;
+}
+
 static CMPIrc xen_resource_list_enum(
     xen_utils_session *session, 
     provider_resource_list *resources)
 {
-    xen_vif_set *vif_set = NULL;
-    if (!xen_vif_get_all(session->xen, &vif_set)) {
+    local_vif_list *list = calloc(1, sizeof(local_vif_list));
+    if (list == NULL)
+        return CMPI_RC_ERR_FAILED;
+    resources->ctx = list;
+    if (!xen_vif_get_all(session->xen, &list->vif_set)) {
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
-        free(resources);
         return CMPI_RC_ERR_FAILED;
     }
 
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Enumerated %d network ports", vif_set->size));
-    resources->ctx = vif_set;
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Enumerated %d network ports", (int)list->vif_set->size));
+    /* The network ports carry their VM's uuid, the IP addresses its guest
+       reports and their speed, get them for all the VIFs at once. The
+       ports fall back to fetching their own if it can't be done. */
+    if (list->vif_set->size &&
+        (xen_utils_class_is_subclass_of(resources->broker, np_cn, resources->classname) ||
+         xen_utils_class_is_subclass_of(resources->broker, vsp_cn, resources->classname))) {
+        list->join = _join_vms(session);
+        if (list->join == NULL)
+            RESET_XEN_ERROR(session->xen);
+    }
     return CMPI_RC_OK;
 }
 /*******************************************************************
@@ -142,8 +267,13 @@ static CMPIrc xen_resource_list_cleanup(
     provider_resource_list *resources
     )
 {
-    if (resources && resources->ctx)
-        xen_vif_set_free((xen_vif_set *)resources->ctx);
+    if (resources && resources->ctx) {
+        local_vif_list *list = resources->ctx;
+        if (list->vif_set)
+            xen_vif_set_free(list->vif_set);
+        _free_join(list->join);
+        free(list);
+    }
     return CMPI_RC_OK;
 }
 /*****************************************************************************
@@ -161,7 +291,8 @@ static CMPIrc xen_resource_record_getnext(
     )
 {
     xen_vif_record *vif_rec = NULL;
-    xen_vif_set *vif_set = (xen_vif_set *)resources_list->ctx;
+    local_vif_list *list = resources_list->ctx;
+    xen_vif_set *vif_set = list ? list->vif_set : NULL;
     if (vif_set == NULL || resources_list->current_resource == vif_set->size)
         return CMPI_RC_ERR_NOT_FOUND;
 
@@ -172,11 +303,12 @@ static CMPIrc xen_resource_record_getnext(
         return CMPI_RC_ERR_FAILED;
     }
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Getting next network port"));
-    local_vif_resource *ctx = calloc(sizeof(local_vif_resource), 1);
+    local_vif_resource *ctx = PROV_RES_ALLOC(prov_res, local_vif_resource);
     if (ctx == NULL)
         return CMPI_RC_ERR_FAILED;
     ctx->vif = vif_set->contents[resources_list->current_resource];
     ctx->vif_rec = vif_rec;
+    ctx->join = list->join;
     vif_set->contents[resources_list->current_resource]  = NULL;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
@@ -195,7 +327,7 @@ static CMPIrc xen_resource_record_cleanup(provider_resource *prov_res)
             xen_vif_record_free(ctx->vif_rec);
         if (ctx->vif)
             xen_vif_free(ctx->vif);
-        free(ctx);
+        PROV_RES_FREE(prov_res, ctx);
     }
     return CMPI_RC_OK;
 }
@@ -235,11 +367,12 @@ static CMPIrc xen_resource_record_get_from_id(
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
         return CMPI_RC_ERR_FAILED;
     }
-    local_vif_resource *ctx = calloc(sizeof(local_vif_resource), 1);
+    local_vif_resource *ctx = PROV_RES_ALLOC(prov_res, local_vif_resource);
     if (ctx == NULL)
         return CMPI_RC_ERR_FAILED;
     ctx->vif_rec = vif_rec;
     ctx->vif = vif;
+    ctx->join = NULL;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -278,14 +411,14 @@ static CMPIrc xen_resource_set_properties(
 
 static char *_get_ip_address(
     xen_vif_record *vif_rec,
-    xen_vm_guest_metrics_record *metrics_rec
+    xen_string_string_map *networks
     )
 {
     char key[100];
     char *ip_address = NULL;
-    if (vif_rec && metrics_rec) {
+    if (vif_rec && networks) {
         snprintf(key, sizeof(key)/sizeof(key[0]), "%s/ip", vif_rec->device);
-        ip_address = xen_utils_get_from_string_string_map(metrics_rec->networks, key);
+        ip_address = xen_utils_get_from_string_string_map(networks, key);
     }
     return ip_address;
 }
@@ -301,28 +434,52 @@ static void _set_network_port_properties(
     xen_vif_metrics_record *vif_metrics_rec = NULL;
     xen_vm_guest_metrics metrics = NULL;
     xen_vm_guest_metrics_record *metrics_rec = NULL;
+    xen_string_string_map *networks = NULL;
+    local_vif_join *join = ((local_vif_resource *)resource->ctx)->join;
+    local_vif_vm *vm = NULL;
 
     uint64_t bandwidth = 0;
     char buf[MAX_INSTANCEID_LEN];
 
-    if (!xen_vm_get_uuid(resource->session->xen, &dom_uuid, vif_rec->vm->u.handle)) {
-        xen_utils_trace_error(resource->session->xen, __FILE__, __LINE__);
-        return;
+    if (join && !vif_rec->vm->is_record) {
+        int found = xen_utils_find_ref(join->vms, join->vm_count, sizeof(local_vif_vm),
+                                        (char *)vif_rec->vm->u.handle);
+        if (found >= 0)
+            vm = &join->vms[found];
+    }
+    if (vm) {
+        /* all there is to know is in the join, it belongs to the list */
+        dom_uuid = vm->uuid;
+        networks = vm->networks;
+        if (join->vif_metrics_map && vif_rec->metrics && !vif_rec->metrics->is_record) {
+            int found = xen_utils_find_ref(join->vif_metrics_map->contents, join->vif_metrics_map->size,
+                                            sizeof(join->vif_metrics_map->contents[0]),
+                                            (char *)vif_rec->metrics->u.handle);
+            if (found >= 0)
+                vif_metrics_rec = join->vif_metrics_map->contents[found].val;
+        }
+    }
+    else {
+        if (!xen_vm_get_uuid(resource->session->xen, &dom_uuid, vif_rec->vm->u.handle)) {
+            xen_utils_trace_error(resource->session->xen, __FILE__, __LINE__);
+            return;
+        }
+        if (xen_vif_get_metrics(resource->session->xen, &vif_metrics, ((local_vif_resource *)resource->ctx)->vif)
+            && vif_metrics)
+            xen_vif_metrics_get_record(resource->session->xen, &vif_metrics_rec, vif_metrics);
+        RESET_XEN_ERROR(resource->session->xen);
+
+        if (xen_vm_get_guest_metrics(resource->session->xen, &metrics, vif_rec->vm->u.handle) && metrics)
+            xen_vm_guest_metrics_get_record(resource->session->xen, &metrics_rec, metrics);
+        RESET_XEN_ERROR(resource->session->xen);
+        if (metrics_rec)
+            networks = metrics_rec->networks;
     }
     if (vif_rec->network->is_record)
         net_rec = vif_rec->network->u.record;
     else
         xen_network_get_record(resource->session->xen, &net_rec, vif_rec->network->u.handle);
 
-    if (xen_vif_get_metrics(resource->session->xen, &vif_metrics, ((local_vif_resource *)resource->ctx)->vif)
-        && vif_metrics)
-        xen_vif_metrics_get_record(resource->session->xen, &vif_metrics_rec, vif_metrics);
-    RESET_XEN_ERROR(resource->session->xen);
-
-    if (xen_vm_get_guest_metrics(resource->session->xen, &metrics, vif_rec->vm->u.handle) && metrics)
-        xen_vm_guest_metrics_get_record(resource->session->xen, &metrics_rec, metrics);
-    RESET_XEN_ERROR(resource->session->xen);
-
     /* Set the CMPIInstance properties from the resource data. */
     CMSetProperty(inst, "AdditionalAvailablility", (CMPIValue *)"Automatic", CMPI_chars);
     bool autoSense = false;
@@ -343,7 +500,7 @@ static void _set_network_port_properties(
         CMSetProperty(inst, "ElementName", (CMPIValue *)net_rec->name_description, CMPI_chars);
     }
 
-    char *ip_address = _get_ip_address(vif_rec, metrics_rec);
+    char *ip_address = _get_ip_address(vif_rec, networks);
     if (ip_address && (*ip_address != '\0') ) {
         CMPIArray *ar = CMNewArray(resource->broker, 1, CMPI_string, NULL);
         CMPIString *val = CMNewString(resource->broker, ip_address, NULL);
@@ -445,13 +602,13 @@ static void _set_network_port_properties(
     //CMSetProperty(inst, "TimeOfLastStateChange", (CMPIValue *) &time, CMPI_dateTime);
     //CMSetProperty(inst, "TotalPowerOnHours", (CMPIValue *) &power_on_hrs, CMPI_uint64);
     //CMSetProperty(inst, "NICConfigInfo",(CMPIValue *)resource->vif[vifnum].params, CMPI_chars);
-    if (dom_uuid)
+    if (dom_uuid && vm == NULL)
         free(dom_uuid);
     if (net_rec && !vif_rec->network->is_record)
         xen_network_record_free(net_rec);
     if (vif_metrics)
         xen_vif_metrics_free(vif_metrics);
-    if (vif_metrics_rec)
+    if (vif_metrics_rec && vm == NULL)
         xen_vif_metrics_record_free(vif_metrics_rec);
     if (metrics)
         xen_vm_guest_metrics_free(metrics);
@@ -15,10 +15,38 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <assert.h>
 #include "providerinterface.h"
+#include "xen_rrd.h"
+
+#define XAPI_NULL_REF "OpaqueRef:NULL"
+
+/* A host the vcpus of some VMs are running on, and its physical cpus as they are needed */
+typedef struct _local_host_context {
+    int refcount;
+    xen_host host;
+    xen_host_record *host_rec;
+    xen_host_cpu_record **cpu_recs;   /* indexed like host_rec->host_cpus */
+    bool *free_cpu_rec;
+} local_host_context;
+
+/* Everything the vcpus of a VM have in common, fetched once for all of them
+   and freed with the last one */
+typedef struct _local_vm_context {
+    int refcount;
+    xen_vm vm;
+    xen_vm_record *vm_rec;
+    bool metrics_fetched;
+    xen_vm_metrics_record *metrics_rec; /* has the utilisation of each vcpu, can be NULL */
+    bool host_fetched;
+    local_host_context *host;           /* where the VM is running, can be NULL */
+    bool utilisation_fetched;
+    xen_cpu_utilisation *utilisation;   /* of all the vcpus, can be NULL */
+} local_vm_context;
 
 typedef struct _local_vcpu_resource{
     unsigned int vcpu_id;
-    char domain_uuid[XENID_LEN+1];
+    const char *domain_uuid;    /* the VM record's uuid, or uuid_copy for a get */
+    char *uuid_copy;
+    local_vm_context *vm_ctx;   /* holds a reference, NULL until it's needed for a get */
 } local_vcpu_resource;
 
 typedef struct _local_vcpu_list {
@@ -44,15 +72,203 @@ static CMPIrc _processor_set_properties(
 static CMPIrc _processor_metric_set_properties(
     const CMPIBroker *broker,
     provider_resource *resource, 
-    xen_vm_record *vm_rec,
-    xen_vm_metrics_record *metrics_rec,
+    local_vm_context *vm_ctx,
     CMPIInstance *inst);
 
+/******************************************************************************
+ * The shared host and VM contexts
+ *****************************************************************************/
+static local_host_context *_host_context_new(
+    xen_utils_session *session,
+    xen_host host)
+{
+    xen_host_record *host_rec = NULL;
+    if (!xen_host_get_record(session->xen, &host_rec, host)) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
+            ("xen_host_get_record failed with %s", 
+             session->xen->error_description[0]));
+        RESET_XEN_ERROR(session->xen);
+        return NULL;
+    }
+    local_host_context *host_ctx = calloc(1, sizeof(local_host_context));
+    size_t cpus = host_rec->host_cpus ? host_rec->host_cpus->size : 0;
+    if (host_ctx == NULL ||
+        (host_ctx->cpu_recs = calloc(cpus + 1, sizeof(xen_host_cpu_record *))) == NULL ||
+        (host_ctx->free_cpu_rec = calloc(cpus + 1, sizeof(bool))) == NULL) {
+        if (host_ctx) {
+            free(host_ctx->cpu_recs);
+            free(host_ctx);
+        }
+        xen_host_record_free(host_rec);
+        return NULL;
+    }
+    host_ctx->refcount = 1;
+    host_ctx->host = strdup((char *)host);
+    host_ctx->host_rec = host_rec;
+    return host_ctx;
+}
+
+static void _host_context_release(
+    local_host_context *host_ctx)
+{
+    if (host_ctx == NULL || --host_ctx->refcount > 0)
+        return;
+    size_t i;
+    for (i = 0; host_ctx->host_rec->host_cpus && i < host_ctx->host_rec->host_cpus->size; i++)
+        if (host_ctx->free_cpu_rec[i])
+            xen_host_cpu_record_free(host_ctx->cpu_recs[i]);
+    free(host_ctx->cpu_recs);
+    free(host_ctx->free_cpu_rec);
+    free(host_ctx->host);
+    xen_host_record_free(host_ctx->host_rec);
+    free(host_ctx);
+}
+
+/* The record of the host's n'th cpu, fetched the first time it's asked for */
+static xen_host_cpu_record *_host_context_cpu(
+    xen_utils_session *session,
+    local_host_context *host_ctx,
+    unsigned int n)
+{
+    xen_host_cpu_record_opt_set *cpus = host_ctx->host_rec->host_cpus;
+    if (cpus == NULL || n >= cpus->size)
+        return NULL;
+    if (host_ctx->cpu_recs[n] == NULL) {
+        xen_host_cpu_record_opt *cpu_opt = cpus->contents[n];
+        if (cpu_opt->is_record)
+            host_ctx->cpu_recs[n] = cpu_opt->u.record;
+        else if (xen_host_cpu_get_record(session->xen, &host_ctx->cpu_recs[n], cpu_opt->u.handle))
+            host_ctx->free_cpu_rec[n] = true;
+        else
+            RESET_XEN_ERROR(session->xen);
+    }
+    return host_ctx->cpu_recs[n];
+}
+
+/* Takes over vm and vm_rec */
+static local_vm_context *_vm_context_new(
+    xen_vm vm,
+    xen_vm_record *vm_rec)
+{
+    local_vm_context *vm_ctx = calloc(1, sizeof(local_vm_context));
+    if (vm_ctx == NULL) {
+        xen_vm_free(vm);
+        xen_vm_record_free(vm_rec);
+        return NULL;
+    }
+    vm_ctx->refcount = 1;
+    vm_ctx->vm = vm;
+    vm_ctx->vm_rec = vm_rec;
+    return vm_ctx;
+}
+
+static void _vm_context_release(
+    local_vm_context *vm_ctx)
+{
+    if (vm_ctx == NULL || --vm_ctx->refcount > 0)
+        return;
+    _host_context_release(vm_ctx->host);
+    xen_rrd_cpu_utilisation_free(vm_ctx->utilisation);
+    if (vm_ctx->metrics_rec)
+        xen_vm_metrics_record_free(vm_ctx->metrics_rec);
+    xen_vm_record_free(vm_ctx->vm_rec);
+    xen_vm_free(vm_ctx->vm);
+    free(vm_ctx);
+}
+
+static xen_vm_metrics_record *_vm_context_metrics(
+    xen_utils_session *session,
+    local_vm_context *vm_ctx)
+{
+    xen_vm_metrics_record_opt *metrics = vm_ctx->vm_rec->metrics;
+    if (metrics && metrics->is_record)
+        return metrics->u.record; /* came with the VM record */
+    if (!vm_ctx->metrics_fetched) {
+        vm_ctx->metrics_fetched = true;
+        if (metrics == NULL ||
+            !xen_vm_metrics_get_record(session->xen, &vm_ctx->metrics_rec, metrics->u.handle)) {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
+                ("Could not get the metrics of %s", vm_ctx->vm_rec->name_label));
+            RESET_XEN_ERROR(session->xen);
+        }
+    }
+    return vm_ctx->metrics_rec;
+}
+
+/* The utilisation of the VM's vcpus, from the rrd_updates of the host it's running on */
+static xen_cpu_utilisation *_vm_context_utilisation(
+    xen_utils_session *session,
+    local_vm_context *vm_ctx)
+{
+    if (!vm_ctx->utilisation_fetched) {
+        vm_ctx->utilisation_fetched = true;
+        xen_host_record_opt *host = vm_ctx->vm_rec->resident_on;
+        if (host && !host->is_record && host->u.handle &&
+            strcmp(host->u.handle, XAPI_NULL_REF) != 0)
+            vm_ctx->utilisation = xen_rrd_get_cpu_utilisation(session, host->u.handle,
+                                                              vm_ctx->vm_rec->uuid);
+    }
+    return vm_ctx->utilisation;
+}
+
+static local_host_context *_vm_context_host(
+    xen_utils_session *session,
+    local_vm_context *vm_ctx)
+{
+    if (!vm_ctx->host_fetched) {
+        vm_ctx->host_fetched = true;
+        xen_host_record_opt *host = vm_ctx->vm_rec->resident_on;
+        if (host && !host->is_record && host->u.handle &&
+            strcmp(host->u.handle, XAPI_NULL_REF) != 0)
+            vm_ctx->host = _host_context_new(session, host->u.handle);
+    }
+    return vm_ctx->host;
+}
+
+/* Shares the context of the VM's host with the other VMs in hosts running there */
+static void _vm_context_share_host(
+    xen_utils_session *session,
+    local_vm_context *vm_ctx,
+    local_host_context ***hosts,
+    int *host_count)
+{
+    xen_host_record_opt *host = vm_ctx->vm_rec->resident_on;
+    int i;
+
+    vm_ctx->host_fetched = true;
+    if (host == NULL || host->is_record || host->u.handle == NULL ||
+        strcmp(host->u.handle, XAPI_NULL_REF) == 0)
+        return;
+    for (i = 0; i < *host_count; i++) {
+        if (strcmp((*hosts)[i]->host, host->u.handle) == 0) {
+            vm_ctx->host = (*hosts)[i];
+            vm_ctx->host->refcount++;
+            return;
+        }
+    }
+    if ((vm_ctx->host = _host_context_new(session, host->u.handle)) == NULL)
+        return;
+    local_host_context **more = realloc(*hosts, sizeof(local_host_context *) * (*host_count + 1));
+    if (more) {
+        *hosts = more;
+        more[(*host_count)++] = vm_ctx->host;
+        vm_ctx->host->refcount++;
+    }
+}
+
+/* The resource list holds a reference to each VM until it is past the VM's last vcpu */
+static bool _is_last_vcpu(
+    local_vcpu_resource *vcpu)
+{
+    return vcpu->vcpu_id + 1 == vcpu->vm_ctx->vm_rec->vcpus_max;
+}
+
 static void _free_vcpu_resource(
     local_vcpu_resource* vcpu)
 {
     if(vcpu) {
-        free(vcpu->domain_uuid);
+        _vm_context_release(vcpu->vm_ctx);
+        free(vcpu->uuid_copy);
         free(vcpu);
     }
 }
@@ -92,47 +308,84 @@ static CMPIrc xen_resource_list_enum(
     xen_utils_session *session, 
     provider_resource_list *resources)
 {
-    xen_vm_set *vms = NULL;
-    xen_vm_metrics vm_metrics = NULL;
-    xen_vm_record *vm_rec = NULL;
-    xen_vm vm = NULL;
+    xen_vm_xen_vm_record_map *vm_map = NULL;
+    xen_vm_metrics_xen_vm_metrics_record_map *metrics_map = NULL;
     int64_t vcpus_total = 0;
     int64_t vcpus_number = 0;
     int64_t vcpu_ndx = 0;
     local_vcpu_resource *vcpu_list = NULL;
+    local_host_context **hosts = NULL;
+    int host_count = 0, i;
+    size_t vm_ndx;
+    bool want_hosts = xen_utils_class_is_subclass_of(resources->broker, proc_cn, resources->classname);
 
-    xen_domain_resources *dom_resources = NULL;
-    if(!xen_utils_get_domain_resources(session, &dom_resources, vms_only) ||
-       dom_resources == NULL ||
-       dom_resources->domains == NULL) {
+    /*
+    * All the VM records come in one call, and for the processors (whose
+    * load is in the VM metrics) all the VM metrics records in another,
+    * joined here by ref. The VM record is kept for all the vcpus of the VM,
+    * along with its metrics and host, which are shared by the VMs running
+    * there.
+    */
+    if (!xen_vm_get_all_records(session->xen, &vm_map)) {
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
-        free(resources);
         return CMPI_RC_ERR_FAILED;
     }
+    if (want_hosts && !xen_vm_metrics_get_all_records(session->xen, &metrics_map)) {
+        /* the vcpus fetch their VM's metrics one at a time instead */
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        RESET_XEN_ERROR(session->xen);
+        metrics_map = NULL;
+    }
+    if (metrics_map)
+        qsort(metrics_map->contents, metrics_map->size, sizeof(metrics_map->contents[0]), xen_utils_compare_refs);
 
-    /*
-    * Iterate through domains and get their processor resources
-    */
-    while(xen_utils_get_next_domain_resource(session, dom_resources, &vm, &vm_rec) && vm_rec != NULL) 
+    for (vm_ndx = 0; vm_ndx < vm_map->size; vm_ndx++)
     {
+        xen_vm_record *vm_rec = vm_map->contents[vm_ndx].val;
+        if (vm_rec == NULL || !xen_utils_domain_is_choice(vm_rec, vms_only))
+            continue;
         vcpus_number = vm_rec->vcpus_max;
-        vcpus_total += vcpus_number;
-        vcpu_list = (local_vcpu_resource *)realloc(vcpu_list, sizeof(local_vcpu_resource)*vcpus_total);
-        if(vcpu_list == NULL) {
+        if (vcpus_number <= 0)
+            continue;
+        local_vcpu_resource *more = (local_vcpu_resource *)realloc(vcpu_list,
+            sizeof(local_vcpu_resource)*(vcpus_total + vcpus_number));
+        if(more == NULL) {
             _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Not enough memory"));
-            return CMPI_RC_ERR_FAILED;
+            goto Error;
         }
-        int i;
+        vcpu_list = more;
+        local_vm_context *vm_ctx = _vm_context_new(vm_map->contents[vm_ndx].key, vm_rec);
+        vm_map->contents[vm_ndx].key = NULL;
+        vm_map->contents[vm_ndx].val = NULL;
+        if (vm_ctx == NULL)
+            goto Error;
+        xen_vm_metrics_record_opt *metrics_opt = vm_rec->metrics;
+        if (metrics_map && metrics_opt && !metrics_opt->is_record) {
+            int found = xen_utils_find_ref(metrics_map->contents, metrics_map->size,
+                                            sizeof(metrics_map->contents[0]),
+                                            (char *)metrics_opt->u.handle);
+            if (found >= 0) {
+                vm_ctx->metrics_rec = metrics_map->contents[found].val;
+                metrics_map->contents[found].val = NULL;
+            }
+            vm_ctx->metrics_fetched = true;
+        }
+        if (want_hosts)
+            _vm_context_share_host(session, vm_ctx, &hosts, &host_count);
+        vcpus_total += vcpus_number;
         for (i = 0; i < vcpus_number; i++,vcpu_ndx++) {
             local_vcpu_resource *vcpu = &vcpu_list[vcpu_ndx];
             vcpu->vcpu_id = i;
-            strncpy(vcpu->domain_uuid, vm_rec->uuid, XENID_LEN);
-            vcpu->domain_uuid[XENID_LEN] = '\0';
+            vcpu->domain_uuid = vm_ctx->vm_rec->uuid;
+            vcpu->uuid_copy = NULL;
+            vcpu->vm_ctx = vm_ctx;
         }
-        xen_utils_free_domain_resource(vm, vm_rec);
-        vm_rec = NULL;
     }
-    xen_utils_free_domain_resources(dom_resources);
+    xen_vm_xen_vm_record_map_free(vm_map);
+    vm_map = NULL;
+    if (metrics_map)
+        xen_vm_metrics_xen_vm_metrics_record_map_free(metrics_map);
+    metrics_map = NULL;
 
     local_vcpu_list* ctx = calloc(1, sizeof(local_vcpu_list ));
     if(ctx == NULL)
@@ -140,17 +393,26 @@ static CMPIrc xen_resource_list_enum(
     ctx->total_vcpus = vcpus_total;
     ctx->vcpus = vcpu_list;
 
+    /* the VMs have the references to their hosts now */
+    for (i = 0; i < host_count; i++)
+        _host_context_release(hosts[i]);
+    free(hosts);
+
     /* Set cur_vcpu to beginning of resource list. */
     resources->ctx = ctx;
     return CMPI_RC_OK;
 
 Error:
-    if(vm_rec)
-        xen_vm_record_free(vm_rec);
-    if(vm_metrics)
-        xen_vm_metrics_free(vm_metrics);
-    if(vms)
-        xen_vm_set_free(vms);
+    if(vm_map)
+        xen_vm_xen_vm_record_map_free(vm_map);
+    if(metrics_map)
+        xen_vm_metrics_xen_vm_metrics_record_map_free(metrics_map);
+    for (vcpu_ndx = 0; vcpu_ndx < vcpus_total; vcpu_ndx++)
+        if (_is_last_vcpu(&vcpu_list[vcpu_ndx]))
+            _vm_context_release(vcpu_list[vcpu_ndx].vm_ctx);
+    for (i = 0; i < host_count; i++)
+        _host_context_release(hosts[i]);
+    free(hosts);
     if(vcpu_list)
         free(vcpu_list);
     return CMPI_RC_ERR_FAILED;
@@ -170,8 +432,14 @@ static CMPIrc xen_resource_list_cleanup(
 {
     local_vcpu_list *ctx = (local_vcpu_list *)resources->ctx;
     if (ctx) {
-        if(ctx->vcpus)
+        if(ctx->vcpus) {
+            /* let go of the VMs the enumeration didn't get to the end of */
+            int64_t i;
+            for (i = resources->current_resource; i < ctx->total_vcpus; i++)
+                if (_is_last_vcpu(&ctx->vcpus[i]))
+                    _vm_context_release(ctx->vcpus[i].vm_ctx);
             free(ctx->vcpus);
+        }
         free(ctx);
     }
     return CMPI_RC_OK;
@@ -193,15 +461,19 @@ static CMPIrc xen_resource_record_getnext(
     local_vcpu_list *ctx = (local_vcpu_list *)resources_list->ctx;
     if (ctx == NULL || (resources_list->current_resource >= ctx->total_vcpus))
         return CMPI_RC_ERR_NOT_FOUND;
-    local_vcpu_resource *vcpu_list = ctx->vcpus;
-    prov_res->ctx = malloc(sizeof(local_vcpu_resource));
-    if(prov_res->ctx) { 
-        memcpy(prov_res->ctx,&vcpu_list[resources_list->current_resource],sizeof(local_vcpu_resource));
-        return CMPI_RC_OK;
+    local_vcpu_resource *vcpu = &ctx->vcpus[resources_list->current_resource];
+    local_vcpu_resource *copy = malloc(sizeof(local_vcpu_resource));
+    if(copy) {
+        memcpy(copy, vcpu, sizeof(local_vcpu_resource));
+        copy->vm_ctx->refcount++;
     }
-    else {
+    /* this is the list's last use of the VM either way */
+    if (_is_last_vcpu(vcpu))
+        _vm_context_release(vcpu->vm_ctx);
+    if (copy == NULL)
         return CMPI_RC_ERROR;
-    }
+    prov_res->ctx = copy;
+    return CMPI_RC_OK;
 }
 /*****************************************************************************
  * Function to cleanup the resource
@@ -213,10 +485,8 @@ static CMPIrc xen_resource_record_cleanup(
     provider_resource *prov_res
     )
 {
-  /* We only need to free the local_vcpu_resource datastructure */
-  local_vcpu_resource *vcpu = (local_vcpu_resource *) prov_res->ctx;
-  if (vcpu)
-    free(vcpu);
+  /* and its reference to the VM context */
+  _free_vcpu_resource((local_vcpu_resource *) prov_res->ctx);
 
     return CMPI_RC_OK;
 }
@@ -243,7 +513,13 @@ static CMPIrc xen_resource_record_get_from_id(
         return CMPI_RC_ERR_FAILED;
     }
     local_vcpu_resource *vcpu = calloc(1, sizeof(local_vcpu_resource));
-    strncpy(vcpu->domain_uuid, buf, XENID_LEN);
+    if (vcpu == NULL)
+        return CMPI_RC_ERR_FAILED;
+    if ((vcpu->uuid_copy = strdup(buf)) == NULL) {
+        free(vcpu);
+        return CMPI_RC_ERR_FAILED;
+    }
+    vcpu->domain_uuid = vcpu->uuid_copy;
     vcpu->vcpu_id = atoi(p + 4);
     prov_res->ctx = vcpu;
     return CMPI_RC_OK;
@@ -260,80 +536,38 @@ static CMPIrc xen_resource_set_properties(
     provider_resource *prov_res, 
     CMPIInstance *inst)
 {
-
-    xen_vm_record *vm_rec = NULL;
-    xen_vm vm = NULL;
-    xen_vm_metrics vm_metrics = NULL;
-    xen_host_record *host_rec = NULL;
-    xen_host_cpu_record* cpu_rec = NULL;
-    bool free_cpu_rec = false;
-    xen_vm_metrics_record *metrics_rec = NULL;
-
     local_vcpu_resource *resource = prov_res->ctx;
-    if (!xen_vm_get_by_uuid(prov_res->session->xen, &vm, resource->domain_uuid)) {
-        xen_utils_trace_error(prov_res->session->xen, __FILE__, __LINE__);
-        return CMPI_RC_ERR_FAILED;
-    }
-    if (!xen_vm_get_record(prov_res->session->xen, &vm_rec, vm)) {
-        xen_utils_trace_error(prov_res->session->xen, __FILE__, __LINE__);
-        return CMPI_RC_ERR_FAILED;
-    }
-    if (xen_vm_get_metrics(prov_res->session->xen, &vm_metrics, vm)) {
-        if (!xen_vm_metrics_get_record(prov_res->session->xen, &metrics_rec, vm_metrics)) {
-            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
-                ("xen_vm_metrics_get_record failed for %s with %s",
-                vm_rec->name_label, prov_res->session->xen->error_description[0]));
-            RESET_XEN_ERROR(prov_res->session->xen);
+    local_vm_context *vm_ctx = resource->vm_ctx;
+
+    if (vm_ctx == NULL) {
+        /* a vcpu on its own, from a get */
+        xen_vm vm = NULL;
+        xen_vm_record *vm_rec = NULL;
+        if (!xen_vm_get_by_uuid(prov_res->session->xen, &vm, (char *)resource->domain_uuid)) {
+            xen_utils_trace_error(prov_res->session->xen, __FILE__, __LINE__);
+            return CMPI_RC_ERR_FAILED;
+        }
+        if (!xen_vm_get_record(prov_res->session->xen, &vm_rec, vm)) {
+            xen_utils_trace_error(prov_res->session->xen, __FILE__, __LINE__);
+            xen_vm_free(vm);
+            return CMPI_RC_ERR_FAILED;
         }
-        xen_vm_metrics_free(vm_metrics);
+        if ((vm_ctx = _vm_context_new(vm, vm_rec)) == NULL)
+            return CMPI_RC_ERR_FAILED;
+        resource->vm_ctx = vm_ctx;
     }
-    else
-        RESET_XEN_ERROR(prov_res->session->xen);
 
     /* Depending on which class this provider is handling set properties differently */
     if (xen_utils_class_is_subclass_of(prov_res->broker, proc_cn, prov_res->classname)) {
-        xen_host host = NULL;
-        if (xen_vm_get_resident_on(prov_res->session->xen, &host, vm)) {
-            if (!xen_host_get_record(prov_res->session->xen, &host_rec, host)) {
-                _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
-                    ("xen_host_get_record failed with %s", 
-                     prov_res->session->xen->error_description[0]));
-                RESET_XEN_ERROR(prov_res->session->xen);
-            }
-            else {
-                if (host_rec->host_cpus->size >= resource->vcpu_id) {
-                    xen_host_cpu_record_opt *cpu_opt = host_rec->host_cpus->contents[resource->vcpu_id];
-                    if (cpu_opt->is_record)
-                        cpu_rec = host_rec->host_cpus->contents[resource->vcpu_id]->u.record;
-                    else {
-                        xen_host_cpu_get_record(prov_res->session->xen, &cpu_rec, cpu_opt->u.handle);
-                        free_cpu_rec = true;
-                    }
-                }
-            }
-            xen_host_free(host);
-        }
-        else {
-            RESET_XEN_ERROR(prov_res->session->xen);
-            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
-                ("xen_vm_get_resident_on failed with %s", 
-                 prov_res->session->xen->error_description[0]));
-        }
-        _processor_set_properties(prov_res, vm_rec, metrics_rec, cpu_rec, inst);
+        xen_host_cpu_record *cpu_rec = NULL;
+        xen_vm_metrics_record *metrics_rec = _vm_context_metrics(prov_res->session, vm_ctx);
+        local_host_context *host_ctx = _vm_context_host(prov_res->session, vm_ctx);
+        if (host_ctx)
+            cpu_rec = _host_context_cpu(prov_res->session, host_ctx, resource->vcpu_id);
+        _processor_set_properties(prov_res, vm_ctx->vm_rec, metrics_rec, cpu_rec, inst);
     }
     else
-        _processor_metric_set_properties(prov_res->broker, prov_res, vm_rec, metrics_rec, inst);
-
-    if (vm)
-        xen_vm_free(vm);
-    if (free_cpu_rec)
-        xen_host_cpu_record_free(cpu_rec);
-    if (metrics_rec)
-        xen_vm_metrics_record_free(metrics_rec);
-    if (host_rec)
-        xen_host_record_free(host_rec);
-    if (vm_rec)
-        xen_vm_record_free(vm_rec);
+        _processor_metric_set_properties(prov_res->broker, prov_res, vm_ctx, inst);
 
     return CMPI_RC_OK;
 }
@@ -427,10 +661,10 @@ static CMPIrc _processor_set_properties(
 static CMPIrc _processor_metric_set_properties(
     const CMPIBroker *broker,
     provider_resource *resource, 
-    xen_vm_record *vm_rec,
-    xen_vm_metrics_record *metrics_rec,
+    local_vm_context *vm_ctx,
     CMPIInstance *inst)
 {
+    xen_vm_record *vm_rec = vm_ctx->vm_rec;
     char buf[MAX_INSTANCEID_LEN];
     char vcpu_id[20];
     local_vcpu_resource *vcpu = resource->ctx;
@@ -450,15 +684,17 @@ static CMPIrc _processor_metric_set_properties(
     //CMSetProperty(inst, "Generation",(CMPIValue *)&<value>, CMPI_uint64);
     CMSetProperty(inst, "MeasuredElementName",(CMPIValue *)vm_rec->name_label, CMPI_chars);
 
-    double load_percentage = 0.0;
-    xen_vm vm = NULL;
-    xen_vm_get_by_uuid(resource->session->xen, &vm, vm_rec->uuid);
-    if (vm) {
-        snprintf(buf, MAX_INSTANCEID_LEN, "cpu%d", vcpu->vcpu_id);
-        xen_vm_query_data_source(resource->session->xen, &load_percentage, vm, buf);
-        CMSetProperty(inst, "Description",(CMPIValue *)buf, CMPI_chars);
-        xen_vm_free(vm);
+    /* the vcpus of the VM share a snapshot, querying the data source of
+       each is the fallback */
+    double load_percentage = xen_rrd_cpu_load(_vm_context_utilisation(resource->session, vm_ctx),
+                                              vcpu->vcpu_id, -1.0);
+    snprintf(buf, MAX_INSTANCEID_LEN, "cpu%d", vcpu->vcpu_id);
+    if (load_percentage < 0) {
+        load_percentage = 0.0;
+        if (!xen_vm_query_data_source(resource->session->xen, &load_percentage, vm_ctx->vm, buf))
+            RESET_XEN_ERROR(resource->session->xen);
     }
+    CMSetProperty(inst, "Description",(CMPIValue *)buf, CMPI_chars);
     snprintf(buf, MAX_INSTANCEID_LEN, "%f", (load_percentage*100));
     CMSetProperty(inst, "MetricValue",(CMPIValue *)buf, CMPI_chars);
     CMPIDateTime *date_time = xen_utils_CMPIDateTime_now(broker);
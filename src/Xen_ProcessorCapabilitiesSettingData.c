@@ -103,7 +103,7 @@ static CMPIrc populate_resource(
     resource->ctx = ctx;
     Exit:
     if (!session->xen->ok)
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, (session->xen->error_description[0]));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s", session->xen->error_description[0]));
     if (host_rec)
         xen_host_record_free(host_rec);
     return rc;
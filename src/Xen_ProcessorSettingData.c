@@ -19,6 +19,7 @@
 #include "cmpitrace.h"
 #include <stdlib.h>
 #include "xen_utils.h"
+#include "xen_hosts.h"
 #include "provider_common.h"
 #include "RASDs.h"
 /*******************************************************************************
@@ -153,11 +154,14 @@ int proc_rasd_from_vm_rec(
     CMSetProperty(inst, "AutomaticAllocation", (CMPIValue *)&int_prop_val, CMPI_boolean);
     CMSetProperty(inst, "AutomaticDeallocation", (CMPIValue *)&int_prop_val, CMPI_boolean);
 
-    xen_host_record* host_rec = xen_utils_get_domain_host(session, vm_rec);
-    if(host_rec) {
-        CMSetProperty(inst, "PoolID", (CMPIValue *)host_rec->uuid, CMPI_chars);
-        xen_utils_free_domain_host(vm_rec, host_rec);
-    }
+    /* the host is looked up in the host directory, shared by all the VMs */
+    xen_host_directory *hosts = NULL;
+    const xen_host_entry *host = NULL;
+    if (vm_rec->resident_on && !vm_rec->resident_on->is_record)
+        host = xen_host_directory_lookup(session, &hosts, vm_rec->resident_on->u.handle);
+    if (host)
+        CMSetProperty(inst, "PoolID", (CMPIValue *)host->uuid, CMPI_chars);
+    xen_host_directory_release(hosts);
 
     int64_prop_val = vm_rec->vcpus_at_startup;
     CMSetProperty(inst, "Reservation", (CMPIValue *)&int64_prop_val, CMPI_uint64);
@@ -223,7 +227,7 @@ int proc_rasd_modify(
 
         // Make sure we don't do anything if an update is not required.
         if (vm_rec->vcpus_max != max_vcpus) {
-            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Updating vcpus_max to %lld", vm_rec->vcpus_max));
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Updating vcpus_max to %lld", (long long)vm_rec->vcpus_max));
             rc = xen_vm_set_vcpus_max(session->xen, vm, vm_rec->vcpus_max);
         }
 
@@ -233,7 +237,7 @@ int proc_rasd_modify(
 
         // Make sure we don't do anything if an update is not required.
         if (vm_rec->vcpus_at_startup != startup_vcpus) {
-            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Updating vcpus_at_startup to %lld", vm_rec->vcpus_at_startup));
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Updating vcpus_at_startup to %lld", (long long)vm_rec->vcpus_at_startup));
             rc = xen_vm_set_vcpus_at_startup(session->xen, vm, vm_rec->vcpus_at_startup);
         }
 
@@ -336,6 +336,9 @@ static CMPIrc get(const void *res_id,
     if(rc != CMPI_RC_OK)
     {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("Error get(): get_xen_resource_record_from_id failed"));
+        /* Tell a resource that isn't there from xapi failing */
+        if(rc == CMPI_RC_ERR_FAILED && xen_utils_error_is_not_found(session->xen))
+            rc = CMPI_RC_ERR_NOT_FOUND;
         cleanup_xen_resource_record(prov_res);
         free(prov_res);
         return rc;
@@ -0,0 +1,273 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <string.h>
+#include "providerinterface.h"
+#include "xen_stats.h"
+
+static const char *keys[] = {"InstanceID"};
+static const char *key_property = "InstanceID";
+
+#define STATISTICS_ID_PREFIX "Statistics"
+
+/* A snapshot of the merged statistics, and the record we are on */
+typedef struct {
+    xen_stats_record_set *set;
+    xen_stats_record *record;
+    bool free_set;               /* the set belongs to the resource, not the list */
+} local_statistics_resource;
+
+/* InstanceIDs are of the form Xen:Statistics/<class>/<operation>[/<method>] */
+static void _record_id(
+    char *buf,
+    size_t buf_len,
+    const xen_stats_record *record)
+{
+    char name[MAX_INSTANCEID_LEN];
+    snprintf(name, sizeof(name), "%s/%s%s%s", record->classname,
+             xen_stats_op_name(record->op),
+             record->method ? "/" : "", record->method ? record->method : "");
+    _CMPICreateNewDeviceInstanceID(buf, buf_len, STATISTICS_ID_PREFIX, name);
+}
+
+/* Converts nanoseconds to the microseconds reported in the class */
+#define USECS(__ns) ((CMPIUint64)((__ns) / 1000))
+
+/*********************************************************
+ ************ Provider Specific functions ****************
+ ******************************************************* */
+static const char *xen_resource_get_key_property(
+    const CMPIBroker *broker,
+    const char *classname
+    )
+{
+    return key_property;
+}
+static const char **xen_resource_get_keys(
+    const CMPIBroker *broker,
+    const char *classname
+    )
+{
+    return keys;
+}
+/********************************************************
+ * Function to enumerate provider specific resource
+ *
+ * @param session - handle to a xen_utils_session object
+ * @param resources - pointer to the provider_resource_list
+ *   object, the provider specific resource defined above
+ *   is a member of this struct
+ * @return CMPIrc error codes
+ ********************************************************/
+static CMPIrc xen_resource_list_enum(
+    xen_utils_session *session,
+    provider_resource_list *resources
+    )
+{
+    xen_stats_record_set *set = NULL;
+    if (!xen_stats_get_all(&set))
+        return CMPI_RC_ERR_FAILED;
+    resources->ctx = set;
+    return CMPI_RC_OK;
+}
+/*******************************************************************
+ * Function to cleanup provider specific resource
+ *
+ * @param resources - handle to the provider_resource_list to be
+ *    be cleaned up. Clean up the provider specific part of the
+ *    resource.
+ * @return CMPIrc error codes
+ *******************************************************************/
+static CMPIrc xen_resource_list_cleanup(
+    provider_resource_list *resources
+    )
+{
+    if (resources->ctx)
+        xen_stats_record_set_free((xen_stats_record_set *)resources->ctx);
+    return CMPI_RC_OK;
+}
+/*****************************************************************************
+ * Function to get the next provider specific resource in the resource list
+ *
+ * @param resources_list - handle to the provide_resource_list object
+ * @param session - handle to the xen_utils_session object
+ * @param prov_res - handle to the next provider_resource to be filled in.
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_record_getnext(
+    provider_resource_list *resources_list,/* in */
+    xen_utils_session *session,/* in */
+    provider_resource *prov_res /* in , out */
+    )
+{
+    xen_stats_record_set *set = (xen_stats_record_set *)resources_list->ctx;
+    if (set == NULL || resources_list->current_resource >= set->size)
+        return CMPI_RC_ERR_NOT_FOUND;
+
+    local_statistics_resource *ctx = PROV_RES_ALLOC(prov_res, local_statistics_resource);
+    if (ctx == NULL)
+        return CMPI_RC_ERR_FAILED;
+    ctx->set = set;
+    ctx->record = &set->contents[resources_list->current_resource];
+    prov_res->ctx = ctx;
+    return CMPI_RC_OK;
+}
+/*****************************************************************************
+ * Function to cleanup the resource
+ *
+ * @param - provider_resource to be freed
+ * @return CMPIrc error codes
+****************************************************************************/
+static CMPIrc xen_resource_record_cleanup(
+    provider_resource *prov_res
+    )
+{
+    local_statistics_resource *ctx = (local_statistics_resource *)prov_res->ctx;
+    if (ctx) {
+        if (ctx->free_set)
+            xen_stats_record_set_free(ctx->set);
+        PROV_RES_FREE(prov_res, ctx);
+    }
+    return CMPI_RC_OK;
+}
+/*****************************************************************************
+ * Function to get a provider specific resource identified by an id
+ *
+ * @param res_uuid - resource identifier for the provider specific resource
+ * @param session - handle to the xen_utils_session object
+ * @param prov_res - provide_resource object to be filled in with the provider
+ *                   specific resource
+ * @return CMPIrc error codes
+ *****************************************************************************/
+static CMPIrc xen_resource_record_get_from_id(
+    char *res_uuid, /* in */
+    xen_utils_session *session, /* in */
+    provider_resource *prov_res /* in , out */
+    )
+{
+    char buf[MAX_INSTANCEID_LEN];
+    xen_stats_record_set *set = NULL;
+    size_t i;
+
+    if (!xen_stats_get_all(&set))
+        return CMPI_RC_ERR_FAILED;
+    for (i = 0; i < set->size; i++) {
+        _record_id(buf, sizeof(buf), &set->contents[i]);
+        if (strcmp(buf, res_uuid) == 0) {
+            local_statistics_resource *ctx = PROV_RES_ALLOC(prov_res, local_statistics_resource);
+            if (ctx == NULL)
+                break;
+            ctx->set = set;
+            ctx->record = &set->contents[i];
+            ctx->free_set = true;
+            prov_res->ctx = ctx;
+            return CMPI_RC_OK;
+        }
+    }
+    xen_stats_record_set_free(set);
+    return CMPI_RC_ERR_NOT_FOUND;
+}
+/************************************************************************
+ * Function that sets the properties of a CIM object with values from the
+ * provider specific resource.
+ *
+ * @param resource - provider specific resource to get values from
+ * @param inst - CIM object whose properties are being set
+ * @return CMPIrc return values
+*************************************************************************/
+static CMPIrc xen_resource_set_properties(
+    provider_resource *resource,
+    CMPIInstance *inst)
+{
+    char buf[MAX_INSTANCEID_LEN];
+    local_statistics_resource *ctx = (local_statistics_resource *)resource->ctx;
+    xen_stats_record *record = ctx->record;
+    CMPIUint64 val;
+    int i, buckets = 0;
+
+    _record_id(buf, sizeof(buf), record);
+    CMSetProperty(inst, "InstanceID",(CMPIValue *)buf, CMPI_chars);
+    if (resource->ref_only)
+        return CMPI_RC_OK;
+
+    CMSetProperty(inst, "ElementName",(CMPIValue *)(buf + strlen("Xen:")), CMPI_chars);
+    CMSetProperty(inst, "Caption",(CMPIValue *)"Xen Provider Statistics", CMPI_chars);
+    CMSetProperty(inst, "ClassName",(CMPIValue *)record->classname, CMPI_chars);
+    CMSetProperty(inst, "Operation",(CMPIValue *)xen_stats_op_name(record->op), CMPI_chars);
+    if (record->method)
+        CMSetProperty(inst, "MethodName",(CMPIValue *)record->method, CMPI_chars);
+
+    CMPIDateTime *start_time = xen_utils_time_t_to_CMPIDateTime(resource->broker, ctx->set->start_time);
+    if (start_time)
+        CMSetProperty(inst, "StartStatisticTime",(CMPIValue *)&start_time, CMPI_dateTime);
+    CMPIDateTime *now = CMNewDateTime(resource->broker, NULL);
+    if (now)
+        CMSetProperty(inst, "StatisticTime",(CMPIValue *)&now, CMPI_dateTime);
+
+    CMSetProperty(inst, "Calls",(CMPIValue *)&record->calls, CMPI_uint64);
+    CMSetProperty(inst, "Errors",(CMPIValue *)&record->errors, CMPI_uint64);
+    CMSetProperty(inst, "Instances",(CMPIValue *)&record->instances, CMPI_uint64);
+    CMSetProperty(inst, "XenAPICalls",(CMPIValue *)&record->rpcs, CMPI_uint64);
+    CMSetProperty(inst, "XenAPIBytesSent",(CMPIValue *)&record->rpc_bytes_sent, CMPI_uint64);
+    CMSetProperty(inst, "XenAPIBytesReceived",(CMPIValue *)&record->rpc_bytes_received, CMPI_uint64);
+    val = USECS(record->rpc_ns);
+    CMSetProperty(inst, "XenAPITime",(CMPIValue *)&val, CMPI_uint64);
+    val = USECS(record->total_ns);
+    CMSetProperty(inst, "TotalTime",(CMPIValue *)&val, CMPI_uint64);
+    val = record->calls ? USECS(record->total_ns / record->calls) : 0;
+    CMSetProperty(inst, "MeanLatency",(CMPIValue *)&val, CMPI_uint64);
+    val = xen_stats_percentile(record, 50);
+    CMSetProperty(inst, "MedianLatency",(CMPIValue *)&val, CMPI_uint64);
+    val = xen_stats_percentile(record, 90);
+    CMSetProperty(inst, "Latency90thPercentile",(CMPIValue *)&val, CMPI_uint64);
+    val = xen_stats_percentile(record, 99);
+    CMSetProperty(inst, "Latency99thPercentile",(CMPIValue *)&val, CMPI_uint64);
+    val = USECS(record->max_ns);
+    CMSetProperty(inst, "MaxLatency",(CMPIValue *)&val, CMPI_uint64);
+
+    /* time spent in each phase of the provider interface */
+    CMPIArray *phase_names = CMNewArray(resource->broker, xen_stats_phase_count, CMPI_string, NULL);
+    CMPIArray *phase_times = CMNewArray(resource->broker, xen_stats_phase_count, CMPI_uint64, NULL);
+    for (i = 0; i < xen_stats_phase_count; i++) {
+        val = USECS(record->phase_ns[i]);
+        CMSetArrayElementAt(phase_names, i, (CMPIValue *)xen_stats_phase_name(i), CMPI_chars);
+        CMSetArrayElementAt(phase_times, i, (CMPIValue *)&val, CMPI_uint64);
+    }
+    CMSetProperty(inst, "PhaseNames",(CMPIValue *)&phase_names, CMPI_stringA);
+    CMSetProperty(inst, "PhaseTimes",(CMPIValue *)&phase_times, CMPI_uint64A);
+
+    /* only the buckets that have been hit */
+    for (i = 0; i < XEN_STATS_HIST_BUCKETS; i++)
+        if (record->histogram[i])
+            buckets++;
+    CMPIArray *bounds = CMNewArray(resource->broker, buckets, CMPI_uint64, NULL);
+    CMPIArray *counts = CMNewArray(resource->broker, buckets, CMPI_uint64, NULL);
+    for (i = 0, buckets = 0; i < XEN_STATS_HIST_BUCKETS; i++) {
+        if (record->histogram[i] == 0)
+            continue;
+        val = xen_stats_bucket_upper_bound(i);
+        CMSetArrayElementAt(bounds, buckets, (CMPIValue *)&val, CMPI_uint64);
+        CMSetArrayElementAt(counts, buckets, (CMPIValue *)&record->histogram[i], CMPI_uint64);
+        buckets++;
+    }
+    CMSetProperty(inst, "LatencyHistogramBounds",(CMPIValue *)&bounds, CMPI_uint64A);
+    CMSetProperty(inst, "LatencyHistogramCounts",(CMPIValue *)&counts, CMPI_uint64A);
+    return CMPI_RC_OK;
+}
+
+/* Setup the function table for the instance provider */
+XenInstanceMIStub(Xen_ProviderStatistics)
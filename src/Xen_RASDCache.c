@@ -0,0 +1,518 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+/*
+ * Cache of parsed RASD templates.
+ *
+ * DefineSystem and AddResourceSettings callers tend to send the same disk and
+ * network RASD strings over and over again (every VM built from the same
+ * 'template'), differing only in the name of the device. Parsing the embedded
+ * instance and converting it to xen records (which includes an SR or network
+ * lookup) is by far the most expensive part of handling those RASDs, so the
+ * converted records are kept here keyed by the RASD text, minus the few
+ * properties that vary from device to device.
+ */
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include "Xen_RASDCache.h"
+#include "cmpiutil.h"
+
+#define RASD_CACHE_BUCKETS 64
+
+typedef struct _rasd_cache_entry {
+    char *text;
+    char *pool;
+    unsigned long hash;
+    bool strict_checks;
+    time_t taken;                           /* when the RASD was parsed */
+    rasd_cache_devices devices;             /* per-device properties are NULL */
+    struct _rasd_cache_entry *hash_next;
+    struct _rasd_cache_entry *lru_prev;     /* most recently used is at the head */
+    struct _rasd_cache_entry *lru_next;
+} rasd_cache_entry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static rasd_cache_entry *cache_buckets[RASD_CACHE_BUCKETS];
+static rasd_cache_entry *lru_head = NULL;
+static rasd_cache_entry *lru_tail = NULL;
+static int cache_count = 0;
+static int cache_size = -1;                 /* -1 until read from the environment */
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+/* RASD properties that are left out of the key and applied on a hit */
+static const char *override_properties[] = {"ElementName", "InstanceID", "Address"};
+#define NUM_OVERRIDE_PROPERTIES (sizeof(override_properties)/sizeof(override_properties[0]))
+
+static int _cache_get_size()
+{
+    pthread_mutex_lock(&cache_lock);
+    if (cache_size < 0) {
+        cache_size = RASD_CACHE_DEFAULT_SIZE;
+        char *size = getenv("XEN_CIM_RASD_CACHE_SIZE");
+        if (size && *size) {
+            cache_size = atoi(size);
+            if (cache_size < 0)
+                cache_size = RASD_CACHE_DEFAULT_SIZE;
+        }
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- RASD template cache size=%d", cache_size));
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return cache_size;
+}
+
+/******************************************************************************
+ * Key generation
+ *****************************************************************************/
+static unsigned long _hash(const char *str, const char *pool, bool strict_checks)
+{
+    unsigned long hash = 5381;
+    int c;
+    while ((c = (unsigned char)*str++))
+        hash = ((hash << 5) + hash) + c;
+    while ((c = (unsigned char)*pool++))
+        hash = ((hash << 5) + hash) + c;
+    return strict_checks ? ~hash : hash;
+}
+
+/* Skips over a quoted string (as the lexer sees it) starting at in */
+static const char *_skip_quoted(const char *in)
+{
+    char quote = *in++;
+    while (*in && *in != quote) {
+        if (*in == '\\' && *(in+1))
+            in++;
+        in++;
+    }
+    return *in ? in+1 : in;
+}
+
+static char **_override_value(rasd_cache_key *key, int prop)
+{
+    switch (prop) {
+    case 0: return &key->element_name;
+    case 1: return &key->instance_id;
+    default: return &key->address;
+    }
+}
+
+/******************************************************************************
+ * rasd_cache_key_init
+ *
+ * Builds the cache key of an embedded RASD string. Runs of whitespace are
+ * collapsed and the values of the override properties are moved out of the
+ * key text.
+ *
+ * Returns false if the cache is disabled or the RASD cannot be cached.
+ *****************************************************************************/
+bool rasd_cache_key_init(
+    const char *rasd_str,
+    const char *pool,
+    bool strict_checks,
+    rasd_cache_key *key)
+{
+    memset(key, 0, sizeof(*key));
+    if (rasd_str == NULL || pool == NULL || _cache_get_size() == 0)
+        return false;
+
+    /* fixup any escaped-XML style string sequences, as the parser would */
+    char *ascii_str = XmlToAsciiStr(rasd_str);
+    if (ascii_str == NULL)
+        return false;
+    char *out = key->text = malloc(strlen(ascii_str) + 1);
+    if (out == NULL) {
+        free(ascii_str);
+        return false;
+    }
+    const char *in = ascii_str;
+
+    while (*in) {
+        if (isspace((unsigned char)*in)) {
+            while (isspace((unsigned char)*in))
+                in++;
+            if (out != key->text)
+                *out++ = ' ';
+        }
+        else if (*in == '"' || *in == '\'') {
+            const char *end = _skip_quoted(in);
+            memcpy(out, in, end - in);
+            out += end - in;
+            in = end;
+        }
+        else if (isalpha((unsigned char)*in)) {
+            const char *start = in;
+            while (isalnum((unsigned char)*in) || *in == '_')
+                in++;
+            memcpy(out, start, in - start);
+            out += in - start;
+
+            int prop;
+            for (prop = 0; prop < NUM_OVERRIDE_PROPERTIES; prop++) {
+                if ((strlen(override_properties[prop]) == (size_t)(in - start)) &&
+                    (strncasecmp(start, override_properties[prop], in - start) == 0))
+                    break;
+            }
+            if (prop == NUM_OVERRIDE_PROPERTIES)
+                continue;
+
+            /* property name, the value should follow the '=' */
+            const char *p = in;
+            while (isspace((unsigned char)*p))
+                p++;
+            if (*p != '=')
+                continue;
+            p++;
+            while (isspace((unsigned char)*p))
+                p++;
+            if (*p == '"' || *p == '\'') {
+                const char *end = _skip_quoted(p);
+                char **value = _override_value(key, prop);
+                if (*value)
+                    free(*value);
+                *value = strndup(p + 1, (end - p) > 1 ? (end - p) - 2 : 0);
+                *out++ = '=';
+                in = end;
+            }
+            else if (strncasecmp(p, "null", 4) != 0) {
+                /* a non string value cannot be overridden, let the parser deal with it */
+                goto Error;
+            }
+        }
+        else
+            *out++ = *in++;
+    }
+    *out = '\0';
+    if ((key->pool = strdup(pool)) == NULL)
+        goto Error;
+    free(ascii_str);
+    key->hash = _hash(key->text, key->pool, strict_checks);
+    key->strict_checks = strict_checks;
+    return true;
+
+ Error:
+    free(ascii_str);
+    rasd_cache_key_cleanup(key);
+    return false;
+}
+
+void rasd_cache_key_cleanup(
+    rasd_cache_key *key)
+{
+    if (key->text)
+        free(key->text);
+    if (key->pool)
+        free(key->pool);
+    if (key->element_name)
+        free(key->element_name);
+    if (key->instance_id)
+        free(key->instance_id);
+    if (key->address)
+        free(key->address);
+    memset(key, 0, sizeof(*key));
+}
+
+/******************************************************************************
+ * Record copies, only the fields filled in by disk_rasd_to_vbd and
+ * network_rasd_to_vif are of interest.
+ *****************************************************************************/
+static char *_strdup(const char *str)
+{
+    return str ? strdup(str) : NULL;
+}
+
+static xen_string_string_map *_map_copy(
+    xen_string_string_map *map)
+{
+    int i;
+    if (map == NULL)
+        return NULL;
+    xen_string_string_map *copy = xen_string_string_map_alloc(map->size);
+    for (i = 0; i < map->size; i++) {
+        copy->contents[i].key = _strdup(map->contents[i].key);
+        copy->contents[i].val = _strdup(map->contents[i].val);
+    }
+    return copy;
+}
+
+static xen_vdi_record *_vdi_record_copy(
+    xen_vdi_record *rec)
+{
+    xen_vdi_record *copy = xen_vdi_record_alloc();
+    copy->uuid = _strdup(rec->uuid);
+    copy->name_label = _strdup(rec->name_label);
+    copy->name_description = _strdup(rec->name_description);
+    copy->virtual_size = rec->virtual_size;
+    copy->type = rec->type;
+    copy->read_only = rec->read_only;
+    copy->sharable = rec->sharable;
+    copy->other_config = _map_copy(rec->other_config);
+#if XENAPI_VERSION > 400
+    copy->managed = rec->managed;
+#endif
+    return copy;
+}
+
+static xen_vbd_record *_vbd_record_copy(
+    xen_vbd_record *rec)
+{
+    xen_vbd_record *copy = xen_vbd_record_alloc();
+    copy->uuid = _strdup(rec->uuid);
+#if XENAPI_VERSION > 400
+    copy->userdevice = _strdup(rec->userdevice);
+    copy->other_config = _map_copy(rec->other_config);
+#endif
+    copy->bootable = rec->bootable;
+    copy->mode = rec->mode;
+    copy->type = rec->type;
+    copy->qos_algorithm_params = _map_copy(rec->qos_algorithm_params);
+    return copy;
+}
+
+static xen_vif_record *_vif_record_copy(
+    xen_vif_record *rec)
+{
+    xen_vif_record *copy = xen_vif_record_alloc();
+    copy->uuid = _strdup(rec->uuid);
+    copy->mac = _strdup(rec->mac);
+    copy->device = _strdup(rec->device);
+    if (rec->network) {
+        copy->network = xen_network_record_opt_alloc();
+        copy->network->u.handle = _strdup(rec->network->u.handle);
+    }
+#if XENAPI_VERSION > 400
+    copy->other_config = _map_copy(rec->other_config);
+#endif
+    copy->qos_algorithm_params = _map_copy(rec->qos_algorithm_params);
+    return copy;
+}
+
+static void _devices_copy(
+    rasd_cache_devices *from,
+    rasd_cache_devices *to)
+{
+    memset(to, 0, sizeof(*to));
+    to->type = from->type;
+    if (from->vbd_rec)
+        to->vbd_rec = _vbd_record_copy(from->vbd_rec);
+    if (from->vdi_rec)
+        to->vdi_rec = _vdi_record_copy(from->vdi_rec);
+    if (from->sr)
+        to->sr = (xen_sr)strdup((char *)from->sr);
+    if (from->vif_rec)
+        to->vif_rec = _vif_record_copy(from->vif_rec);
+}
+
+static void _devices_free(
+    rasd_cache_devices *devices)
+{
+    if (devices->vbd_rec)
+        xen_vbd_record_free(devices->vbd_rec);
+    if (devices->vdi_rec)
+        xen_vdi_record_free(devices->vdi_rec);
+    if (devices->sr)
+        xen_sr_free(devices->sr);
+    if (devices->vif_rec)
+        xen_vif_record_free(devices->vif_rec);
+    memset(devices, 0, sizeof(*devices));
+}
+
+#define REPLACE_FIELD(__field, __value)  \
+{                                        \
+    if (__field)                         \
+        free(__field);                   \
+    __field = (__value);                 \
+}
+
+/* Sets (or clears, for the template) the per-device properties */
+static void _devices_apply_overrides(
+    rasd_cache_devices *devices,
+    rasd_cache_key *key)
+{
+    char buf[MAX_INSTANCEID_LEN];
+    char *device_uuid = NULL;
+    if (key && key->instance_id) {
+        _CMPIStrncpyDeviceNameFromID(buf, key->instance_id, sizeof(buf)/sizeof(buf[0]));
+        device_uuid = buf;
+    }
+
+    if (devices->type == rasd_cache_disk) {
+        REPLACE_FIELD(devices->vdi_rec->name_label, key ? _strdup(key->element_name) : NULL);
+        REPLACE_FIELD(devices->vbd_rec->uuid, _strdup(device_uuid));
+    }
+    else {
+        REPLACE_FIELD(devices->vif_rec->mac, key ? _strdup(key->address) : NULL);
+        REPLACE_FIELD(devices->vif_rec->uuid, _strdup(device_uuid));
+    }
+}
+
+/******************************************************************************
+ * LRU handling, all called with the cache lock held
+ *****************************************************************************/
+static void _lru_unlink(
+    rasd_cache_entry *entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        lru_head = entry->lru_next;
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void _lru_push_front(
+    rasd_cache_entry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (lru_tail == NULL)
+        lru_tail = entry;
+}
+
+static rasd_cache_entry *_find(
+    rasd_cache_key *key)
+{
+    rasd_cache_entry *entry = cache_buckets[key->hash % RASD_CACHE_BUCKETS];
+    while (entry) {
+        if ((entry->hash == key->hash) && (entry->strict_checks == key->strict_checks) &&
+            (strcmp(entry->text, key->text) == 0) && (strcmp(entry->pool, key->pool) == 0))
+            return entry;
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+static void _evict(
+    rasd_cache_entry *entry)
+{
+    rasd_cache_entry **pentry = &cache_buckets[entry->hash % RASD_CACHE_BUCKETS];
+    while (*pentry && *pentry != entry)
+        pentry = &(*pentry)->hash_next;
+    if (*pentry)
+        *pentry = entry->hash_next;
+    _lru_unlink(entry);
+    _devices_free(&entry->devices);
+    free(entry->text);
+    free(entry->pool);
+    free(entry);
+    cache_count--;
+}
+
+/******************************************************************************
+ * rasd_cache_lookup
+ *
+ * Returns true and a private copy of the cached records, with the per-device
+ * properties of this RASD applied, if the RASD has been parsed for the same
+ * pool in the last RASD_CACHE_SECONDS.
+ *****************************************************************************/
+bool rasd_cache_lookup(
+    rasd_cache_key *key,
+    rasd_cache_devices *devices)
+{
+    bool found = false;
+    if (key->text == NULL)
+        return false;
+
+    pthread_mutex_lock(&cache_lock);
+    rasd_cache_entry *entry = _find(key);
+    if (entry && time(NULL) - entry->taken >= RASD_CACHE_SECONDS) {
+        /* the SR or network it refers to may be gone, parse it again */
+        _evict(entry);
+        entry = NULL;
+    }
+    if (entry) {
+        _lru_unlink(entry);
+        _lru_push_front(entry);
+        _devices_copy(&entry->devices, devices);
+        cache_hits++;
+        found = true;
+    }
+    else
+        cache_misses++;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (found)
+        _devices_apply_overrides(devices, key);
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_DEBUG, ("--- RASD template cache %s (hits=%lu, misses=%lu)",
+        found ? "hit" : "miss", cache_hits, cache_misses));
+    return found;
+}
+
+/******************************************************************************
+ * rasd_cache_insert
+ *
+ * Adds a copy of freshly parsed records to the cache, evicting the least
+ * recently used template if the cache is full. The caller keeps ownership
+ * of the records passed in.
+ *****************************************************************************/
+void rasd_cache_insert(
+    rasd_cache_key *key,
+    rasd_cache_devices *devices)
+{
+    if (key->text == NULL)
+        return;
+    if ((devices->type == rasd_cache_disk && (!devices->vbd_rec || !devices->vdi_rec)) ||
+        (devices->type == rasd_cache_network && !devices->vif_rec))
+        return;
+
+    rasd_cache_entry *entry = calloc(1, sizeof(rasd_cache_entry));
+    if (entry == NULL)
+        return;
+    entry->text = strdup(key->text);
+    entry->pool = strdup(key->pool);
+    if (entry->text == NULL || entry->pool == NULL) {
+        free(entry->text);
+        free(entry->pool);
+        free(entry);
+        return;
+    }
+    entry->hash = key->hash;
+    entry->strict_checks = key->strict_checks;
+    entry->taken = time(NULL);
+    _devices_copy(devices, &entry->devices);
+    _devices_apply_overrides(&entry->devices, NULL);
+
+    pthread_mutex_lock(&cache_lock);
+    rasd_cache_entry *existing = _find(key);
+    if (existing && time(NULL) - existing->taken >= RASD_CACHE_SECONDS) {
+        _evict(existing);
+        existing = NULL;
+    }
+    if (existing) {
+        /* someone else beat us to it */
+        pthread_mutex_unlock(&cache_lock);
+        _devices_free(&entry->devices);
+        free(entry->text);
+        free(entry->pool);
+        free(entry);
+        return;
+    }
+    rasd_cache_entry **bucket = &cache_buckets[entry->hash % RASD_CACHE_BUCKETS];
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    _lru_push_front(entry);
+    cache_count++;
+    while (cache_count > cache_size && lru_tail)
+        _evict(lru_tail);
+    pthread_mutex_unlock(&cache_lock);
+}
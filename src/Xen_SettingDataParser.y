@@ -13,18 +13,25 @@
 #define RC_OK 0
 #define RC_EOF EOF
 
-/* DEFINE ANY GLOBAL VARS HERE */
-static const CMPIBroker * _BROKER;
-static CMPIInstance ** _INSTANCE;	/* The current instance that is being read into */
 #ifdef DBG_PARSER
-char tmpfilename[L_tmpnam];
-FILE *fd;
+#define fd stderr
 #endif
+%}
 
-extern int Xen_SettingDatayylex(void);
-extern void Xen_SettingDatayyerror(char *);
+/* The parser is pure and the lexer reentrant: all the state of a parse lives
+   in the scanner and in the parse state below, so several embedded instances
+   can be parsed at the same time. */
+%code requires {
+typedef struct _Xen_SettingData_parse_state {
+   const CMPIBroker * broker;
+   CMPIInstance ** instance;	/* The current instance that is being read into */
+} Xen_SettingData_parse_state;
+}
 
-%}
+%define api.pure
+%lex-param {void *scanner}
+%parse-param {void *scanner}
+%parse-param {Xen_SettingData_parse_state *state}
 
 /* List all possible CIM property types that can be returned by the lexer */
 /* Note - we override the CIM definition of string to make this data type
@@ -36,6 +43,11 @@ extern void Xen_SettingDatayyerror(char *);
    CMPIReal64  real64;
 }
 
+%{
+extern int Xen_SettingDatayylex(YYSTYPE *, void *);
+extern void Xen_SettingDatayyerror(void *, Xen_SettingData_parse_state *, char *);
+%}
+
 /* DEFINE SIMPLE (UNTYPED) LEXICAL TOKENS */
 %token INSTANCE OF ENDOFFILE NULLTOK
 
@@ -60,9 +72,9 @@ instance:	/* empty */
 			fprintf(fd,"classname = %s\n",$3);
 #endif
          CMPIStatus status = {CMPI_RC_OK, NULL};
-			*_INSTANCE = _CMNewInstance(_BROKER, "root/cimv2", $3, &status);
+			*state->instance = _CMNewInstance(state->broker, "root/cimv2", $3, &status);
 			free($3);
-         if ((*_INSTANCE == NULL) || (status.rc != CMPI_RC_OK)){
+         if ((*state->instance == NULL) || (status.rc != CMPI_RC_OK)){
             YYABORT;
          }
 			}
@@ -89,19 +101,19 @@ property:	PROPERTYNAME '=' STRING ';'
 			fprintf(fd,"\ttype = CMPI_chars\n");
 			fprintf(fd,"\tvalue = --%s--\n",$3);
 #endif
-         CMPIData tmpprop = CMGetProperty(*_INSTANCE, $1, 0);
+         CMPIData tmpprop = CMGetProperty(*state->instance, $1, 0);
          /* check we are setting the right type for the property */
          if((tmpprop.type & CMPI_string) || (tmpprop.type & CMPI_chars))
          {
             if(CMIsArray(tmpprop))
             {
                /* Handle string array properties */
-               tmpprop.value.array = CMNewArray(_BROKER, 1, CMPI_chars, 0);
+               tmpprop.value.array = CMNewArray(state->broker, 1, CMPI_chars, 0);
                CMSetArrayElementAt(tmpprop.value.array, 0, $3, CMPI_chars);
-               CMSetProperty( *_INSTANCE, $1, &tmpprop.value, CMPI_charsA);
+               CMSetProperty( *state->instance, $1, &tmpprop.value, CMPI_charsA);
             }
             else
-               CMSetProperty( *_INSTANCE, $1, $3, CMPI_chars);
+               CMSetProperty( *state->instance, $1, $3, CMPI_chars);
          }
 			free($1); free($3);
       }
@@ -112,7 +124,7 @@ property:	PROPERTYNAME '=' STRING ';'
 			fprintf(fd,"\ttype = CMPI_sint64\n");
 			fprintf(fd,"\tvalue = %lld\n",$3);
 #endif
-         CMPIData tmpprop = CMGetProperty(*_INSTANCE, $1, 0);
+         CMPIData tmpprop = CMGetProperty(*state->instance, $1, 0);
 
          /* A real value could be masquareding as an integer */
          if(tmpprop.type & CMPI_REAL)
@@ -121,24 +133,24 @@ property:	PROPERTYNAME '=' STRING ';'
             if(CMIsArray(tmpprop))
             {
                /* Handle string array properties */
-               tmpprop.value.array = CMNewArray(_BROKER, 1, CMPI_real64, 0);
+               tmpprop.value.array = CMNewArray(state->broker, 1, CMPI_real64, 0);
                CMSetArrayElementAt(tmpprop.value.array, 0, &value, CMPI_real64);
-               CMSetProperty( *_INSTANCE, $1, &tmpprop.value, CMPI_real64A);
+               CMSetProperty( *state->instance, $1, &tmpprop.value, CMPI_real64A);
             }
             else
-               CMSetProperty( *_INSTANCE, $1, &(value), CMPI_real64 );
+               CMSetProperty( *state->instance, $1, &(value), CMPI_real64 );
          }
          else if(tmpprop.type & CMPI_INTEGER){
             unsigned long long value = $3;
             if(CMIsArray(tmpprop))
             {
                /* Handle string array properties */
-               tmpprop.value.array = CMNewArray(_BROKER, 1, CMPI_uint64, 0);
+               tmpprop.value.array = CMNewArray(state->broker, 1, CMPI_uint64, 0);
                CMSetArrayElementAt(tmpprop.value.array, 0, &value, CMPI_uint64);
-               CMSetProperty( *_INSTANCE, $1, &tmpprop.value, CMPI_uint64A);
+               CMSetProperty( *state->instance, $1, &tmpprop.value, CMPI_uint64A);
             }
             else
-               CMSetProperty( *_INSTANCE, $1, &(value), CMPI_uint64 );
+               CMSetProperty( *state->instance, $1, &(value), CMPI_uint64 );
          }
 			free($1);
 		}
@@ -149,18 +161,18 @@ property:	PROPERTYNAME '=' STRING ';'
 			fprintf(fd,"\ttype = CMPI_boolean\n");
 			fprintf(fd,"\tvalue = %d\n",$3);
 #endif
-         CMPIData tmpprop = CMGetProperty(*_INSTANCE, $1, 0);
+         CMPIData tmpprop = CMGetProperty(*state->instance, $1, 0);
          bool value = $3;
          if(tmpprop.type & CMPI_boolean) {
             if(CMIsArray(tmpprop))
             {
                /* Handle string array properties */
-               tmpprop.value.array = CMNewArray(_BROKER, 1, CMPI_boolean, 0);
+               tmpprop.value.array = CMNewArray(state->broker, 1, CMPI_boolean, 0);
                CMSetArrayElementAt(tmpprop.value.array, 0, &value, CMPI_boolean);
-               CMSetProperty( *_INSTANCE, $1, &tmpprop.value, CMPI_booleanA);
+               CMSetProperty( *state->instance, $1, &tmpprop.value, CMPI_booleanA);
             }
             else
-               CMSetProperty( *_INSTANCE, $1, &(value), CMPI_boolean );
+               CMSetProperty( *state->instance, $1, &(value), CMPI_boolean );
          }
 			free($1);
       }
@@ -171,18 +183,18 @@ property:	PROPERTYNAME '=' STRING ';'
 			fprintf(fd,"\ttype = CMPI_real64\n");
 			fprintf(fd,"\tvalue = %f\n",$3);
 #endif
-         CMPIData tmpprop = CMGetProperty(*_INSTANCE, $1, 0);
+         CMPIData tmpprop = CMGetProperty(*state->instance, $1, 0);
          double value = $3;
          if(tmpprop.type & CMPI_REAL)
          {
             if(CMIsArray(tmpprop))
             {
-               tmpprop.value.array = CMNewArray(_BROKER, 1, CMPI_real64, 0);
+               tmpprop.value.array = CMNewArray(state->broker, 1, CMPI_real64, 0);
                CMSetArrayElementAt(tmpprop.value.array, 0, &value, CMPI_real64);
-               CMSetProperty( *_INSTANCE, $1, &tmpprop.value, CMPI_real64A);
+               CMSetProperty( *state->instance, $1, &tmpprop.value, CMPI_real64A);
             }
             else
-               CMSetProperty( *_INSTANCE, $1, &(value), CMPI_real64 );
+               CMSetProperty( *state->instance, $1, &(value), CMPI_real64 );
          }
 			free($1);
      }
@@ -193,18 +205,18 @@ property:	PROPERTYNAME '=' STRING ';'
 			fprintf(fd,"\ttype = CMPI_stringA\n");
 			fprintf(fd,"\tvalue = ----%s----\n", $4);
 #endif
-         CMPIData tmpprop = CMGetProperty(*_INSTANCE, $1, 0);
+         CMPIData tmpprop = CMGetProperty(*state->instance, $1, 0);
          if((tmpprop.type & CMPI_string)||(tmpprop.type & CMPI_chars))
          {
             if(CMIsArray(tmpprop))
             {
                /* Handle string array properties */
-               tmpprop.value.array = CMNewArray(_BROKER, 1, CMPI_chars, 0);
+               tmpprop.value.array = CMNewArray(state->broker, 1, CMPI_chars, 0);
                CMSetArrayElementAt(tmpprop.value.array, 0, $4, CMPI_chars);
-               CMSetProperty( *_INSTANCE, $1, &tmpprop.value, CMPI_charsA);
+               CMSetProperty( *state->instance, $1, &tmpprop.value, CMPI_charsA);
             }
             else
-               CMSetProperty( *_INSTANCE, $1, $4, CMPI_chars);
+               CMSetProperty( *state->instance, $1, $4, CMPI_chars);
          }
 			free($1); free($4);
      }
@@ -218,20 +230,31 @@ property:	PROPERTYNAME '=' STRING ';'
 %%
 
 /* USER SUBROUTINE SECTION */
-int Xen_SettingDatayyparseinstance( const CMPIBroker * broker, CMPIInstance ** instance )
+extern int Xen_SettingDatayylex_init(void **);
+extern void *Xen_SettingDatayy_scan_bytes(const char *, int, void *);
+extern int Xen_SettingDatayylex_destroy(void *);
+extern int Xen_SettingDatayyget_lineno(void *);
+extern char *Xen_SettingDatayyget_text(void *);
+
+void Xen_SettingDatayyerror(void *scanner, Xen_SettingData_parse_state *state, char *errmsg)
+{
+   fprintf(stderr, "error line %d: %s in '%s'\n", Xen_SettingDatayyget_lineno(scanner),
+           errmsg, Xen_SettingDatayyget_text(scanner));
+}
+
+/* Parse one instance out of the first len bytes of str. The scanner reads
+   straight from memory and is private to this call. */
+int Xen_SettingDatayyparseinstance( const CMPIBroker * broker, const char * str, int len, CMPIInstance ** instance )
 {
-   _BROKER = broker;
-   _INSTANCE = instance;
+   void *scanner = NULL;
+   Xen_SettingData_parse_state state = {broker, instance};
+
+   if (Xen_SettingDatayylex_init(&scanner) != 0)
+      return 1;
+   Xen_SettingDatayy_scan_bytes(str, len, scanner);
 
-#ifdef DBG_PARSER
-   tmpnam(tmpfilename);
-   fd = fopen(tmpfilename, "w");
-#endif
    /* Parse the next instance */
-   int val = Xen_SettingDatayyparse();
-#ifdef DBG_PARSER
-   fclose(fd);
-#endif
+   int val = Xen_SettingDatayyparse(scanner, &state);
+   Xen_SettingDatayylex_destroy(scanner);
    return val;
 }
-
@@ -206,7 +206,7 @@ static CMPIrc xen_resource_record_getnext(
     if(ctx->currentsrnum >= ctx->sr_set->size)
         return rc;
 
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("getnext: %d (%d of %d)", ctx->currentsettingdatanum, ctx->currentsrnum, ctx->sr_set->size));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("getnext: %d (%d of %d)", ctx->currentsettingdatanum, ctx->currentsrnum, (int)ctx->sr_set->size));
     rc = populate_resource(
             resources_list->session,
             prov_res,
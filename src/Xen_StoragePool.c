@@ -16,11 +16,12 @@
 
 #include "Xen_AllocationCapabilities.h"
 #include "xen_utils.h"
+#include "xen_topology.h"
 #include "providerinterface.h"
 
 typedef struct {
-    xen_sr sr;
-    xen_sr_record *sr_rec;
+    xen_storage_sr *sr;
+    xen_storage_topology *topo;     /* owned when it is just for this SR */
 } local_sr_resource;
 
 static const char * storage_pool_cn = "Xen_StoragePool"; 
@@ -36,12 +37,14 @@ static CMPIrc allocation_capabilities_set_properties(
     provider_resource *resource, 
     CMPIInstance *inst);
 static void get_storage_pool_host(
-    xen_utils_session *session, 
-    xen_sr_record* sr_rec,
+    const xen_sr_record *sr_rec,
+    const xen_host_record *host_rec,
     bool *shared,
-    char **host_uuid,
-    char **host_name
+    const char **host_uuid,
+    const char **host_name
     );
+static const xen_host_record *get_local_host(
+    const xen_storage_sr *sr);
 
 /******************************************************************************
  ************ Provider Export functions ***************************************
@@ -74,10 +77,11 @@ static CMPIrc xen_resource_list_enum(
     provider_resource_list *resources
     )
 {
-    xen_sr_set *sr_set = NULL;
-    if (!xen_sr_get_all(session->xen, &sr_set))
+    /* the SRs along with the PBDs and hosts they are plugged into */
+    xen_storage_topology *topo = xen_storage_topology_new(session, true);
+    if (topo == NULL)
         return CMPI_RC_ERR_FAILED;
-    resources->ctx = sr_set;
+    resources->ctx = topo;
     return CMPI_RC_OK;
 }
 
@@ -95,7 +99,7 @@ static CMPIrc xen_resource_list_cleanup(
     )
 {
     if (resources && resources->ctx)
-        xen_sr_set_free((xen_sr_set *)resources->ctx);
+        xen_storage_topology_free((xen_storage_topology *)resources->ctx);
     return CMPI_RC_OK;
 }
 
@@ -113,26 +117,17 @@ static CMPIrc xen_resource_record_getnext(
     provider_resource *prov_res /* in , out */
     )
 {
-    xen_sr_set *sr_set = resources_list->ctx;
-    if (sr_set == NULL || resources_list->current_resource >= sr_set->size)
+    xen_storage_topology *topo = resources_list->ctx;
+    if (topo == NULL || resources_list->current_resource >= topo->sr_count)
         return CMPI_RC_ERR_NOT_FOUND;
 
-    xen_sr_record *sr_rec = NULL;
-    if (!xen_sr_get_record(
-        session->xen,
-        &sr_rec,
-        sr_set->contents[resources_list->current_resource]
-        )) {
-        xen_utils_trace_error(resources_list->session->xen, __FILE__, __LINE__);
-        return CMPI_RC_ERR_FAILED;
-    }
     local_sr_resource *ctx = calloc(1, sizeof(local_sr_resource));
     if (ctx == NULL)
         return CMPI_RC_ERR_FAILED;
 
-    ctx->sr = sr_set->contents[resources_list->current_resource];
-    sr_set->contents[resources_list->current_resource] = NULL; /* do not delete this*/
-    ctx->sr_rec = sr_rec;
+    /* the topology stays with the list */
+    ctx->sr = &topo->srs[resources_list->current_resource];
+    ctx->topo = NULL;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -148,10 +143,8 @@ static CMPIrc xen_resource_record_cleanup(
 {
     if (prov_res->ctx) {
         local_sr_resource *ctx = prov_res->ctx;
-        if (ctx->sr_rec)
-            xen_sr_record_free(ctx->sr_rec);
-        if (ctx->sr)
-            xen_sr_free(ctx->sr);
+        if (ctx->topo)
+            xen_storage_topology_free(ctx->topo);
         free(ctx);
     }
     return CMPI_RC_OK;
@@ -179,19 +172,19 @@ static CMPIrc xen_resource_record_get_from_id(
     }
     else
         _CMPIStrncpyDeviceNameFromID(buf, res_uuid, sizeof(buf));
-    xen_sr sr;
-    xen_sr_record *sr_rec = NULL;
-    if (!xen_sr_get_by_uuid(session->xen, &sr, buf) || 
-        !xen_sr_get_record(session->xen, &sr_rec, sr)) {
-        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+    xen_storage_topology *topo = xen_storage_topology_new_for_sr(session, buf, true);
+    if (topo == NULL || topo->sr_count != 1) {
+        xen_storage_topology_free(topo);
         return CMPI_RC_ERR_NOT_FOUND;
     }
     local_sr_resource *ctx = calloc(1, sizeof(local_sr_resource));
-    if (ctx == NULL)
+    if (ctx == NULL) {
+        xen_storage_topology_free(topo);
         return CMPI_RC_ERR_FAILED;
+    }
 
-    ctx->sr = sr;
-    ctx->sr_rec = sr_rec;
+    ctx->sr = &topo->srs[0];
+    ctx->topo = topo;
     prov_res->ctx = ctx;
     return CMPI_RC_OK;
 }
@@ -223,32 +216,33 @@ static CMPIrc storage_pool_set_properties(
     provider_resource *resource, 
     CMPIInstance *inst)
 {
-    char *host_uuid = NULL;
-    char *host_name = NULL;
+    const char *host_uuid = NULL;
+    const char *host_name = NULL;
     DMTF_OperationalStatus opStatus = DMTF_OperationalStatus_OK;
     char *status = DMTF_Status_OK;
     bool shared = false;
     char buf[MAX_INSTANCEID_LEN];
 
     local_sr_resource *ctx = resource->ctx; 
-    get_storage_pool_host(resource->session, ctx->sr_rec, &shared, &host_uuid, &host_name);
+    xen_sr_record *sr_rec = ctx->sr->rec;
+    get_storage_pool_host(sr_rec, get_local_host(ctx->sr), &shared, &host_uuid, &host_name);
     if(host_uuid){
-        _CMPICreateNewDeviceInstanceID(buf, MAX_INSTANCEID_LEN, host_uuid, ctx->sr_rec->uuid);
+        _CMPICreateNewDeviceInstanceID(buf, MAX_INSTANCEID_LEN, host_uuid, sr_rec->uuid);
         CMSetProperty(inst, "InstanceID",(CMPIValue *)buf, CMPI_chars);
     }
 
     /* Populate the instance's properties with the backend data */
     CMSetProperty(inst, "AllocationUnits",(CMPIValue *)"Bytes", CMPI_chars);
-    CMSetProperty(inst, "Capacity",(CMPIValue *)&(ctx->sr_rec->physical_size), CMPI_uint64);
+    CMSetProperty(inst, "Capacity",(CMPIValue *)&(sr_rec->physical_size), CMPI_uint64);
     CMSetProperty(inst, "Caption",(CMPIValue *)"Xen Storage Repository", CMPI_chars);
-    CMSetProperty(inst, "Description",(CMPIValue *)ctx->sr_rec->name_description, CMPI_chars);
+    CMSetProperty(inst, "Description",(CMPIValue *)sr_rec->name_description, CMPI_chars);
     CMSetProperty(inst, "ElementName",(CMPIValue *)host_name, CMPI_chars);
     DMTF_HealthState state = DMTF_HealthState_OK;
     CMSetProperty(inst, "HealthState",(CMPIValue *)&state, CMPI_uint16);
     /*CMPIDateTime *date_time = xen_utils_time_t_to_CMPIDateTime(broker, &<time_value>);
     CMSetProperty(inst, "InstallDate",(CMPIValue *)&date_time, CMPI_dateTime);*/
     CMSetProperty(inst, "InstanceID",(CMPIValue *)buf, CMPI_chars);
-    CMSetProperty(inst, "Name",(CMPIValue *)ctx->sr_rec->name_label, CMPI_chars);
+    CMSetProperty(inst, "Name",(CMPIValue *)sr_rec->name_label, CMPI_chars);
     CMPIArray *arr = CMNewArray(resource->broker, 1, CMPI_uint16, NULL);
     CMSetArrayElementAt(arr, 0, (CMPIValue *)&opStatus, CMPI_uint16);
     CMSetProperty(inst, "OperationalStatus",(CMPIValue *)&arr, CMPI_uint16A);
@@ -256,17 +250,17 @@ static CMPIrc storage_pool_set_properties(
 #if XENAPI_VERSION > 400
     CMPIArray *arr2 = xen_utils_convert_string_string_map_to_CMPIArray(
                             resource->broker,
-                            ctx->sr_rec->other_config);
+                            sr_rec->other_config);
     CMSetProperty(inst, "OtherConfig",(CMPIValue *)&arr2, CMPI_charsA);
 #endif
-    CMSetProperty(inst, "OtherResourceType",(CMPIValue *)ctx->sr_rec->content_type, CMPI_chars);
-    CMSetProperty(inst, "PoolID",(CMPIValue *)ctx->sr_rec->uuid, CMPI_chars);
+    CMSetProperty(inst, "OtherResourceType",(CMPIValue *)sr_rec->content_type, CMPI_chars);
+    CMSetProperty(inst, "PoolID",(CMPIValue *)sr_rec->uuid, CMPI_chars);
     bool primordial = true;
     CMSetProperty(inst, "Primordial",(CMPIValue *)&primordial, CMPI_boolean);
-    CMSetProperty(inst, "Reserved",(CMPIValue *)&ctx->sr_rec->physical_utilisation, CMPI_uint64);
-    CMSetProperty(inst, "ResourceSubType",(CMPIValue *)ctx->sr_rec->type, CMPI_chars);
+    CMSetProperty(inst, "Reserved",(CMPIValue *)&sr_rec->physical_utilisation, CMPI_uint64);
+    CMSetProperty(inst, "ResourceSubType",(CMPIValue *)sr_rec->type, CMPI_chars);
     DMTF_ResourceType res_type = DMTF_ResourceType_Storage_Extent;
-    if (strcmp(ctx->sr_rec->content_type, "iso") == 0)
+    if (strcmp(sr_rec->content_type, "iso") == 0)
         res_type = DMTF_ResourceType_DVD_drive;
     CMSetProperty(inst, "ResourceType",(CMPIValue *)&res_type, CMPI_uint16);
 
@@ -274,7 +268,7 @@ static CMPIrc storage_pool_set_properties(
 #if XENAPI_VERSION > 400
     CMPIArray *arr3 = xen_utils_convert_string_string_map_to_CMPIArray(
                             resource->broker,
-                            ctx->sr_rec->sm_config);
+                            sr_rec->sm_config);
     CMSetProperty(inst, "SMConfig",(CMPIValue *)&arr3, CMPI_charsA);
 #endif
     CMSetProperty(inst, "Status",(CMPIValue *)status, CMPI_chars);
@@ -282,10 +276,6 @@ static CMPIrc storage_pool_set_properties(
     CMSetArrayElementAt(arr, 0, (CMPIValue *)<value>, CMPI_chars);
     CMSetProperty(inst, "StatusDescriptions",(CMPIValue *)&arr, CMPI_charsA);*/
 
-    if (host_name)
-        free(host_name);
-    if (host_uuid)
-        free(host_uuid);
     return CMPI_RC_OK;
 }
 
@@ -297,18 +287,19 @@ static CMPIrc allocation_capabilities_set_properties(
     char buf[MAX_INSTANCEID_LEN];
 
     local_sr_resource *ctx = resource->ctx;
+    xen_sr_record *sr_rec = ctx->sr->rec;
     /* Populate the instance's properties with the backend data */
     CMSetProperty(inst, "Caption",(CMPIValue *)"Xen Storage Allocation Capabilities", CMPI_chars);
     CMSetProperty(inst, "Description",(CMPIValue *) "Xen Storage Allocation Capabilities", CMPI_chars);
-    CMSetProperty(inst, "ElementName",(CMPIValue *)ctx->sr_rec->name_label, CMPI_chars);
+    CMSetProperty(inst, "ElementName",(CMPIValue *)sr_rec->name_label, CMPI_chars);
     _CMPICreateNewDeviceInstanceID(buf, sizeof(buf)/sizeof(buf[0])-1,
-        ctx->sr_rec->uuid, "StorageAllocationCapabilities");
+        sr_rec->uuid, "StorageAllocationCapabilities");
     CMSetProperty(inst, "InstanceID",(CMPIValue *)buf, CMPI_chars);
-    CMSetProperty(inst, "OtherResourceType",(CMPIValue *)ctx->sr_rec->content_type, CMPI_chars);
+    CMSetProperty(inst, "OtherResourceType",(CMPIValue *)sr_rec->content_type, CMPI_chars);
     //CMSetProperty(inst, "RequestTypesSupported",(CMPIValue *)&<value>, CMPI_uint16);
-    CMSetProperty(inst, "ResourceSubType",(CMPIValue *)ctx->sr_rec->type, CMPI_chars);
+    CMSetProperty(inst, "ResourceSubType",(CMPIValue *)sr_rec->type, CMPI_chars);
     DMTF_ResourceType res_type = DMTF_ResourceType_Storage_Extent;
-    if (strcmp(ctx->sr_rec->content_type, "iso") == 0)
+    if (strcmp(sr_rec->content_type, "iso") == 0)
         res_type = DMTF_ResourceType_DVD_drive;
     CMSetProperty(inst, "ResourceType",(CMPIValue *)&res_type, CMPI_uint16);
     int sharingMode = DMTF_SharingMode_Dedicated;
@@ -323,56 +314,41 @@ static CMPIrc allocation_capabilities_set_properties(
     return CMPI_RC_OK;
 }
 
+/* The host of a local SR in the topology, NULL if it's shared or the host
+   couldn't be fetched */
+static const xen_host_record *get_local_host(
+    const xen_storage_sr *sr)
+{
+    if (sr->shared || sr->pbd_count == 0)
+        return NULL;
+    return sr->pbds[0].host_rec;
+}
+
 static void get_storage_pool_host(
-    xen_utils_session *session, 
-    xen_sr_record* sr_rec,
+    const xen_sr_record *sr_rec,
+    const xen_host_record *host_rec,
     bool *shared,
-    char **host_uuid,
-    char **host_name
+    const char **host_uuid,
+    const char **host_name
     )
 {
-    xen_host_record *host_rec = NULL;
-
+    /* The host uuid and name handed back point into host_rec, callers don't free them */
 #define NO_HOST_INFO "Shared"
     /* BUGBUG: The way we infer if an SR is shared is by inspecting the PBD->size. 
     If its > 1, then its an SR shared by multiple hosts */
-    if (sr_rec->pbds && sr_rec->pbds->size == 1) {
-        *shared = false;
-        xen_host host = NULL;
-        xen_pbd_record_opt* pbd_opt = sr_rec->pbds->contents[0];
-        if (!pbd_opt->is_record) {
-            xen_pbd_get_host(session->xen, &host, pbd_opt->u.handle);
-            if (host) {
-                xen_host_get_record(session->xen, &host_rec, host);
-                *host_uuid = strdup(host_rec->uuid);
-#if XENAPI_VERSION > 400
-                *host_name = strdup(host_rec->hostname);
-#endif
-                xen_host_free(host);
-            }
-        }
-        else {
-            xen_host_record_opt* host_opt = pbd_opt->u.record->host;
-            if (host_opt) {
-                if (host_opt->is_record)
-                    host_rec = host_opt->u.record;
-                else
-                    xen_host_get_record(session->xen, &host_rec, host_opt->u.handle);
-                *host_uuid = strdup(host_rec->uuid);
+    *shared = (sr_rec->pbds == NULL || sr_rec->pbds->size != 1);
+    if (!*shared) {
+        if (host_rec) {
+            *host_uuid = host_rec->uuid;
 #if XENAPI_VERSION > 400
-                *host_name = strdup(host_rec->hostname);
+            *host_name = host_rec->hostname;
 #endif
-            }
         }
     }
     else {
-        *shared = true;
-        *host_name = strdup(NO_HOST_INFO);
-        *host_uuid = strdup(NO_HOST_INFO);
+        *host_name = NO_HOST_INFO;
+        *host_uuid = NO_HOST_INFO;
     }
-    if (host_rec)
-        xen_host_record_free(host_rec);
-
 }
 
 /* External function used by other providers */
@@ -383,24 +359,29 @@ CMPIObjectPath * create_storage_pool_ref(
     )
 {
     char instance_id[MAX_INSTANCEID_LEN];
-    char *host_uuid = NULL, *host_name = NULL;
+    const char *host_uuid = NULL, *host_name = NULL;
     bool shared = false;
 
     /* create a storate pool reference and specify the 'System' part of the INstanceID
       as 'Shared' or using a host uuid */
     CMPIObjectPath *result_setting = CMNewObjectPath(broker, DEFAULT_NS, "Xen_StoragePool", NULL);
     if(result_setting) {
-        get_storage_pool_host(session, sr_rec, &shared, &host_uuid, &host_name);
+        /* only a local SR needs its host looked up, the record has the rest */
+        xen_host_record *host_rec = xen_storage_local_host(session, sr_rec);
+        get_storage_pool_host(sr_rec, host_rec, &shared, &host_uuid, &host_name);
         if(host_uuid) {
             _CMPICreateNewDeviceInstanceID(instance_id, MAX_INSTANCEID_LEN, host_uuid, sr_rec->uuid);
             CMAddKey(result_setting, "InstanceID", (CMPIValue *)instance_id, CMPI_chars);
         }
+        else {
+            /* a reference without its key is no reference at all */
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Couldn't find the host of SR %s", sr_rec->uuid));
+            CMRelease(result_setting);
+            result_setting = NULL;
+        }
+        if (host_rec)
+            xen_host_record_free(host_rec);
     }
 
-    if (host_uuid)
-        free(host_uuid);
-    if (host_name)
-        free(host_name);
-
     return result_setting;
 }
@@ -844,7 +844,7 @@ int create_resource_pool(
     }
     else {
         device_config = xen_utils_convert_CMPIArray_to_string_string_map(property.value.array);
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("device_Config has %d items", device_config->size));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("device_Config has %d items", (int)device_config->size));
     }
     property = CMGetProperty(setting_inst, "ResourceSubType", status);
     if (status->rc != CMPI_RC_OK || CMIsNullValue(property) || (property.type != CMPI_string)) {
@@ -18,6 +18,7 @@
 #include "Xen_VirtualSwitch.h"
 #include "providerinterface.h"
 #include "RASDs.h"
+#include "xen_topology.h"
 
 CMPIrc DefineSystem(
     const CMPIBroker *broker,
@@ -85,6 +86,7 @@ static CMPIrc _get_resource_settings(
     xen_utils_session *session,
     xen_pif_record_set **pif_recs,
     bool *create_bond,
+    xen_net_topology **topo,
     CMPIStatus *status
     );
 static bool _create_bond_or_vlan(
@@ -92,7 +94,8 @@ static bool _create_bond_or_vlan(
     xen_utils_session *session,
     xen_network net,
     xen_pif_record_set *pif_rec_set,
-    bool create_bond);
+    bool create_bond,
+    xen_net_topology *topo);
 
 static void _destroy_pif(
     xen_utils_session *session, 
@@ -215,6 +218,7 @@ CMPIrc DefineSystem(
     xen_network_record *net_rec = NULL;
     xen_network net = NULL;
     xen_pif_record_set *pif_rec_set = NULL;
+    xen_net_topology *topo = NULL;
     int rc = Xen_VirtualSwitchManagementService_DefineSystem_Invalid_Parameter;
     CMPIrc statusrc = CMPI_RC_ERR_INVALID_PARAMETER;
     char *error_msg = "ERROR: Unknown error";
@@ -234,7 +238,7 @@ CMPIrc DefineSystem(
     /* ResourceSettings is a list of all device names(s) to attach to the network */
     /* This can be NULL, if the caller is creating an internal network */
     bool create_bond = false;
-    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, status);
+    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, &topo, status);
     if ((statusrc != CMPI_RC_OK) && (statusrc != CMPI_RC_ERR_NOT_FOUND)) {
         error_msg = "ERROR: Couldn't get the 'ResourceSettings' parameter";
         goto Exit;
@@ -249,7 +253,7 @@ CMPIrc DefineSystem(
     /* If devices were created create a VLAN (one device speciifed) or Bond (multiple devices) */
     if (pif_rec_set) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Creating 'External' or 'Bonded' network"));
-        if (!_create_bond_or_vlan(broker, session, net, pif_rec_set, create_bond))
+        if (!_create_bond_or_vlan(broker, session, net, pif_rec_set, create_bond, topo))
             goto Exit;
     }
     else {
@@ -270,6 +274,7 @@ CMPIrc DefineSystem(
         RESET_XEN_ERROR(session->xen);
         xen_network_destroy(session->xen, net);
     }
+    xen_net_topology_free(topo);
     if (pif_rec_set)
         xen_pif_record_set_free(pif_rec_set);
     if (net_rec)
@@ -344,6 +349,7 @@ CMPIrc AddResourceSettings(
     CMPIrc statusrc = CMPI_RC_ERR_INVALID_PARAMETER;
     char *error_msg = "ERROR: Unknown error";
     xen_pif_record_set *pif_rec_set = NULL;
+    xen_net_topology *topo = NULL;
 
     /* find the switch we need to add the vlan/bond to */
     network = _get_affected_configuration(broker, argsin, session, status);
@@ -354,7 +360,7 @@ CMPIrc AddResourceSettings(
 
     /* get the device names for the new vlan/bond */
     bool create_bond = false;
-    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, status);
+    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, &topo, status);
     if (statusrc != CMPI_RC_OK) {
         error_msg = "ERROR: Couldnt parse/get the 'ResourceSettings' parameter";
         goto Exit;
@@ -364,7 +370,7 @@ CMPIrc AddResourceSettings(
     rc = Xen_VirtualSwitchManagementService_AddResourceSettings_Failed;
     statusrc = CMPI_RC_ERR_FAILED;
     if (pif_rec_set) {
-        if (!_create_bond_or_vlan(broker, session, network, pif_rec_set, create_bond)) {
+        if (!_create_bond_or_vlan(broker, session, network, pif_rec_set, create_bond, topo)) {
             error_msg = "ERROR: Couldn't create the bonded or a vlan tagged network";
             goto Exit;
         }
@@ -373,6 +379,7 @@ CMPIrc AddResourceSettings(
     }
 
     Exit:
+    xen_net_topology_free(topo);
     if (pif_rec_set)
         xen_pif_record_set_free(pif_rec_set);
 
@@ -399,7 +406,7 @@ CMPIrc RemoveResourceSettings(
 
     /* get the pif(s) that are being removed */
     bool create_bond = false;
-    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, status);
+    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, NULL, status);
     if (statusrc != CMPI_RC_OK || (pif_rec_set == NULL)) {
         error_msg = "ERROR: Couldn't parse/get the 'ResourceSettings' parameter. RASD needs to have the 'InstanceID' property set";
         goto Exit;
@@ -448,7 +455,7 @@ CMPIrc ModifyResourceSettings(
 
     /* get the pif(s) that are being modified - specified in the RASD passed in */
     bool create_bond = false;
-    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, status);
+    statusrc = _get_resource_settings(broker, argsin, session, &pif_rec_set, &create_bond, NULL, status);
     if (statusrc != CMPI_RC_OK || (pif_rec_set == NULL)) {
         error_msg = "ERROR: Couldn't parse/get the 'ResourceSettings' parameter. RASD needs to have the 'InstanceID' property set";
         goto Exit;
@@ -659,6 +666,7 @@ static CMPIrc _get_resource_settings(
     xen_utils_session *session,
     xen_pif_record_set **pif_recs,
     bool *create_bond,
+    xen_net_topology **topo,
     CMPIStatus *status
     )
 {
@@ -695,13 +703,13 @@ static CMPIrc _get_resource_settings(
                 CMPIData setting_data = CMGetArrayElementAt(argdata.value.array, i, status);
                 if ((status->rc != CMPI_RC_OK) || CMIsNullValue(setting_data))
                     goto Exit;
-                if (!host_network_port_rasd_parse(broker, session, &setting_data, pif_recs, create_bond, status))
+                if (!host_network_port_rasd_parse(broker, session, &setting_data, pif_recs, create_bond, topo, status))
                     goto Exit;
             }
         }
         else {
             _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Parsing the RASD"));
-            if (!host_network_port_rasd_parse(broker, session, &argdata, pif_recs, create_bond, status))
+            if (!host_network_port_rasd_parse(broker, session, &argdata, pif_recs, create_bond, topo, status))
                 goto Exit;
         }
         statusrc = CMPI_RC_OK;
@@ -718,51 +726,51 @@ static CMPIrc _get_resource_settings(
 }
 //
 // From the pif record set passed in, find all pif records that belong to the same host
-// so they can be bonded together. 
+// so they can be bonded together. The pifs are looked up in the network topology.
 // 
 // Mark that set, so that the next time we call this API, we dont get the same set.
 //
 static int _find_next_bondable_pif_set(
     const CMPIBroker *broker,
     xen_utils_session *session,
+    xen_net_topology *topo,
     xen_pif_record_set *pif_rec_set, 
     xen_pif_set **pif_set)
 {
     int i = 0, rc = 0;
-    char * host_uuid_to_check_for = NULL;
+    char *host_to_check_for = NULL;
 
     if (!pif_rec_set)
         return 0;
 
     *pif_set = NULL;
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, 
-        ("Finding PIFs (from %d PIFs) that can be bonded together....", pif_rec_set->size));
+        ("Finding PIFs (from %d PIFs) that can be bonded together....", (int)pif_rec_set->size));
 
     for (i=0; i < pif_rec_set->size; i++) {
         if (pif_rec_set->contents[i]->host) {
-            char *uuid = NULL;
-            if (!xen_host_get_uuid(session->xen, &uuid, pif_rec_set->contents[i]->host->u.handle))
+            /* the host refs are compared, no need to look up the uuids */
+            char *host = (char *)pif_rec_set->contents[i]->host->u.handle;
+            if (!host_to_check_for && (host_to_check_for = strdup(host)) == NULL)
                 goto Exit;
-            if (!host_uuid_to_check_for)
-                host_uuid_to_check_for = uuid;
-            if (strcmp(uuid, host_uuid_to_check_for) == 0) {
+            if (strcmp(host, host_to_check_for) == 0) {
                 _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, 
-                    ("Found PIF (%s) for host %s", pif_rec_set->contents[i]->device, uuid));
-                xen_pif pif = NULL;
-                if (xen_pif_get_by_uuid(session->xen, &pif, pif_rec_set->contents[i]->uuid))
+                    ("Found PIF (%s) for host %s", pif_rec_set->contents[i]->device, host));
+                xen_net_pif *net_pif = xen_net_topology_find_uuid(topo, pif_rec_set->contents[i]->uuid);
+                if (net_pif) {
+                    xen_pif pif = strdup((char *)net_pif->pif);
                     ADD_DEVICE_TO_LIST((*pif_set), pif, xen_pif);
+                }
                 // mark this host off as 'already checked', by setting it to null
                 xen_host_record_opt_free(pif_rec_set->contents[i]->host);
                 pif_rec_set->contents[i]->host = NULL;
                 rc = 1;
             }
-            if (host_uuid_to_check_for != uuid)
-                free(uuid);
         }
     }
     Exit:
-    if (host_uuid_to_check_for)
-        free(host_uuid_to_check_for);
+    if (host_to_check_for)
+        free(host_to_check_for);
     return rc;
 }
 
@@ -793,7 +801,8 @@ static bool _create_bond_or_vlan(
     xen_utils_session *session,
     xen_network net,
     xen_pif_record_set *pif_rec_set,
-    bool create_bond)
+    bool create_bond,
+    xen_net_topology *topo)
 {
     bool success = true;
     if (!create_bond) {
@@ -827,8 +836,12 @@ static bool _create_bond_or_vlan(
         // create a bond for the pifs specified, on every host 
         xen_bond bond = NULL;
         xen_pif_set *pif_set = NULL;
+        xen_net_topology *own_topo = NULL;
+        /* PIFs given by uuid don't come with the snapshot the RASDs were parsed with */
+        if (topo == NULL && (topo = own_topo = xen_net_topology_new(session)) == NULL)
+            return false;
         // find the pifs on each host and bond them
-        while (_find_next_bondable_pif_set(broker, session, pif_rec_set, &pif_set)) {
+        while (_find_next_bondable_pif_set(broker, session, topo, pif_rec_set, &pif_set)) {
 	  //'Balance-slb is the default bonding mode
 	  if (!xen_bond_create(session->xen, &bond, net, pif_set, NULL, XEN_BOND_MODE_BALANCE_SLB, NULL)) {
                 _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Bond creation failed"));
@@ -840,6 +853,9 @@ static bool _create_bond_or_vlan(
             xen_pif_set_free(pif_set);
             pif_set = NULL;
         }
+        if (pif_set)
+            xen_pif_set_free(pif_set);
+        xen_net_topology_free(own_topo);
     }
     return success;
 }
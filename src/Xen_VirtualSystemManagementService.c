@@ -34,6 +34,7 @@
 #include "cmpiutil.h"
 #include "providerinterface.h"
 #include "RASDs.h"
+#include "Xen_RASDCache.h"
 #include "Xen_HostComputerSystem.h"
 #include "Xen_VirtualSystemManagementService.h"
 #include "Xen_Job.h"
@@ -1480,9 +1481,37 @@ static int _rasd_parse(
     CMPIObjectPath *objectpath = NULL;
     char *settingclassname = NULL;
     int resourceType = 0;
+    int rc = 0;
+    rasd_cache_key cache_key;
+    bool cacheable = false;
 
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("_rasd_parse"));
 
+    /* Disk and network RASDs passed in as embedded strings are mostly copies
+     * of each other, try the parsed template cache before parsing them again */
+    memset(&cache_key, 0, sizeof(cache_key));
+    if ((setting_data->type == CMPI_string) && (*vm_rec != NULL) && 
+        vbd_recs && vdi_recs && srs && vifs) {
+        rasd_cache_devices cached;
+        cacheable = rasd_cache_key_init(CMGetCharPtr(setting_data->value.string), 
+                                        session->host_url, strict_checks, &cache_key);
+        if (cacheable && rasd_cache_lookup(&cache_key, &cached)) {
+            if (cached.type == rasd_cache_disk) {
+                _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,("--- adding cached Xen_DiskSettingData to configuration"));
+                ADD_DEVICE_TO_LIST((*srs), cached.sr, xen_sr);
+                ADD_DEVICE_TO_LIST((*vdi_recs), cached.vdi_rec, xen_vdi_record);
+                ADD_DEVICE_TO_LIST((*vbd_recs), cached.vbd_rec, xen_vbd_record);
+            }
+            else {
+                _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,("--- adding cached Xen_NetworkPortSettingData to configuration"));
+                ADD_DEVICE_TO_LIST((*vifs), cached.vif_rec, xen_vif_record);
+            }
+            status->rc = CMPI_RC_OK;
+            rc = 1;
+            goto Exit;
+        }
+    }
+
     if (!xen_utils_get_cmpi_instance(broker, setting_data, &objectpath, &instance) || !instance) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- resource instance is NULL"));
         goto Exit;
@@ -1552,6 +1581,10 @@ static int _rasd_parse(
         xen_sr sr = NULL;
         if (!disk_rasd_to_vbd(broker, session, instance, &vbd_rec, &vdi_rec, &sr, status))
             goto Exit;
+        if (cacheable) {
+            rasd_cache_devices parsed = {rasd_cache_disk, vbd_rec, vdi_rec, sr, NULL};
+            rasd_cache_insert(&cache_key, &parsed);
+        }
         if (vdi_recs && vbd_recs && srs) {
             /* These are the devices that we are responsible for creating */
             ADD_DEVICE_TO_LIST((*srs), sr, xen_sr);
@@ -1577,6 +1610,10 @@ static int _rasd_parse(
         xen_vif_record *vif_rec;
         if (!network_rasd_to_vif(broker, session, instance, strict_checks, &vif_rec, status))
             goto Exit;
+        if (cacheable) {
+            rasd_cache_devices parsed = {rasd_cache_network, NULL, NULL, NULL, vif_rec};
+            rasd_cache_insert(&cache_key, &parsed);
+        }
         ADD_DEVICE_TO_LIST((*vifs), vif_rec, xen_vif_record);
     }
     else if (con_rec && (strcmp(settingclassname,"Xen_ConsoleSettingData") == 0 ||
@@ -1597,11 +1634,11 @@ static int _rasd_parse(
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- invalid setting data - class %s, resource type %d", settingclassname, resourceType));
         goto Exit;
     }
-
-    return 1;
+    rc = 1;
 
     Exit:
-    return 0;
+    rasd_cache_key_cleanup(&cache_key);
+    return rc;
 }
 
 /******************************************************************************
@@ -1623,7 +1660,7 @@ static xen_sr _sr_find_default(
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, 
             ("Couldnt get pool %s to find default SR: size %d", 
             (pool_set ? "<pool_name>":"NULL"),
-            (pool_set ? pool_set->size:0)) );
+            (pool_set ? (int)pool_set->size:0)) );
         xen_utils_trace_error(session->xen, __FILE__, __LINE__);
         return NULL;
     }
@@ -1736,7 +1773,7 @@ static int _kvp_rasd_to_kvp(
 
   if ((*kvp_obj)->key == NULL) {
     error_msg = "Error parsing KVP: No Key has been provided";
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, (error_msg));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s", error_msg));
     goto Error;
   }
 
@@ -2064,7 +2101,7 @@ static int _vm_add_resources(
 
     /* Add the VBDs at the end, since they create VBDs that could fail */
     if (vdi_recs) {
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Adding %d disks", vdi_recs->size));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Adding %d disks", (int)vdi_recs->size));
 
         for (i = 0; i < vdi_recs->size; i++) {
             xen_vdi new_vdi = NULL;
@@ -2318,7 +2355,7 @@ static int _vm_vbds_destroy(
 {
     xen_vbd_set *vbd_set = NULL;
     if (xen_vm_get_vbds(session->xen, &vbd_set, vm)) {
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("got %d VBDs for VM", vbd_set->size));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("got %d VBDs for VM", (int)vbd_set->size));
         /* Get the VBD list */
         int i=0;
         for (i=0; i<vbd_set->size; i++) {
@@ -2342,7 +2379,7 @@ static int _vbd_destroy(
         xen_vbd_set *vbds_using_this_vdi = NULL;
         /* check how many other vbds are using it */
         if (xen_vdi_get_vbds(session->xen, &vbds_using_this_vdi, vdi)) {
-            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("VDI contains %d VBDs", vbds_using_this_vdi->size));
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("VDI contains %d VBDs", (int)vbds_using_this_vdi->size));
 
             /* Destroy if this is the only vbd using it, its not a CD-Rom ISO (read-only) and its not sharable */
             bool read_only = true; 
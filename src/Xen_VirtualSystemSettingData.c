@@ -15,6 +15,7 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <assert.h>
 #include "xen_utils.h"
+#include "xen_hosts.h"
 #include "Xen_VirtualSystemSettingData.h"
 #include "RASDs.h"
 
@@ -222,13 +223,17 @@ static int _modify_vm_setting(
         if (map) {
             int i=0; 
             xen_string_string_map *other_config = NULL;
+            xen_utils_string_map_index *index = NULL;
             xen_vm_get_other_config(pSession->xen, &other_config, vm_handle);
-            for (i=0; i<map->size; i++)
-                xen_utils_add_to_string_string_map(map->contents[i].key, map->contents[i].val, &other_config);
-            if (other_config) {
+            if ((index = xen_utils_string_map_index_new(other_config))) {
+                /* merge the new settings into the existing ones */
+                for (i=0; i<map->size; i++)
+                    xen_utils_string_map_index_set(index, map->contents[i].key, map->contents[i].val);
+                other_config = xen_utils_string_map_index_release(index);
                 xen_vm_set_other_config(pSession->xen, vm_handle, other_config);
-                xen_string_string_map_free(other_config);
             }
+            if (other_config)
+                xen_string_string_map_free(other_config);
         }
             xen_string_string_map_free(map);
     }
@@ -623,6 +628,8 @@ int vssd_from_vm_rec(
     xen_host_record_opt *host_opt = vm_rec->resident_on;
     xen_host_record *host_affinity_rec = NULL, *host_rec = NULL;
     char *host_uuid = NULL, *host_affinity_uuid = NULL;
+    xen_host_directory *hosts = NULL;
+    const xen_host_entry *host_entry = NULL;
     xen_vm_metrics vm_metrics = NULL;
 
     vssd_create_instance_id(session, vm_rec, buf, sizeof(buf));
@@ -630,7 +637,7 @@ int vssd_from_vm_rec(
     if(ref_only)
         return CMPI_RC_OK;
     
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("vm reference: %s", vm));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("vm reference: %s", (char *)vm));
     if (xen_vm_get_metrics(session->xen, &vm_metrics, vm) && 
         (vm_metrics != NULL)) {
         xen_vm_metrics_record *vm_metrics_rec = NULL;
@@ -653,8 +660,8 @@ int vssd_from_vm_rec(
     if (host_affinity_opt && (strcmp(host_affinity_opt->u.handle, XAPI_NULL_REF) != 0)) {
         if (host_affinity_opt->is_record)
             host_affinity_rec = host_affinity_opt->u.record;
-        else
-            xen_host_get_uuid(session->xen, &host_affinity_uuid, host_affinity_opt->u.handle);
+        else if ((host_entry = xen_host_directory_lookup(session, &hosts, host_affinity_opt->u.handle)))
+            host_affinity_uuid = strdup(host_entry->uuid);
         RESET_XEN_ERROR(session->xen);
     }
     else
@@ -663,14 +670,15 @@ int vssd_from_vm_rec(
     if (host_opt && (strcmp(host_opt->u.handle, XAPI_NULL_REF) != 0)) {
         if (host_opt->is_record)
             host_rec = host_opt->u.record;
-        else 
-	    xen_host_get_uuid(session->xen, &host_uuid, host_opt->u.handle);
+        else if ((host_entry = xen_host_directory_lookup(session, &hosts, host_opt->u.handle)))
+            host_uuid = strdup(host_entry->uuid);
 
 	
         RESET_XEN_ERROR(session->xen);
     }
     else
       _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Caught a 'OpaqueRef:NULL (host_opt)"));
+    xen_host_directory_release(hosts);
 
     // Either active settings, template or snapshot settings
     CMPIStatus status = {CMPI_RC_OK, NULL};
@@ -765,7 +773,7 @@ int vssd_from_vm_rec(
             else {
 	      if( strcmp(child_vm_opt->u.handle,XAPI_NULL_REF) != 0) {
                 xen_vm_get_record(session->xen, &child_rec, child_vm_opt->u.handle);
-		_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VM ref %s", child_vm_opt->u.handle));
+		_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VM ref %s", (char *)child_vm_opt->u.handle));
 	      }
 	      else
 		_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VM has no children. Null ref caught"));
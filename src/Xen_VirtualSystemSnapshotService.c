@@ -824,7 +824,7 @@ static int _exec_create_instruction(
     xen_string_set *instruction_args,
     xen_utils_session *session,
     char *sr_uuid,
-    xen_string_string_map **vdi_map,
+    xen_utils_string_map_index *vdi_map,
     char **dest_vdi_uuid,
     char **old_vdi_uuid
     )
@@ -860,8 +860,8 @@ static int _exec_create_instruction(
     if(xen_vdi_create(session->xen, &newvdi, vdi_rec)) {
         xen_vdi_get_uuid(session->xen, dest_vdi_uuid, newvdi);
         if(*dest_vdi_uuid) {
-            xen_utils_add_to_string_string_map(
-                *old_vdi_uuid, *dest_vdi_uuid, vdi_map);
+            xen_utils_string_map_index_set(
+                vdi_map, *old_vdi_uuid, *dest_vdi_uuid);
         } else {
             xen_utils_trace_error(session->xen, __FILE__, __LINE__);
             rc = 0;
@@ -881,7 +881,7 @@ static int _exec_create_instruction(
 static int _exec_clone_instruction(
     xen_string_set *instruction_args,
     xen_utils_session *session,
-    xen_string_string_map **vdi_map,
+    xen_utils_string_map_index *vdi_map,
     char **dest_vdi_uuid,
     char **old_vdi_uuid
     )
@@ -897,21 +897,21 @@ static int _exec_clone_instruction(
     /* Clone an existing VDI */
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Executing clone instruction"));
     if(instruction_args->size != 3) {
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Clone command does not have the correct number of arguments. Expected 3, recieved %d", instruction_args->size));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Clone command does not have the correct number of arguments. Expected 3, recieved %d", (int)instruction_args->size));
         goto Exit;
     }
 
     child_vdi_uuid = strdup(instruction_args->contents[1]);
-    parent_vdi_uuid = xen_utils_get_from_string_string_map(
-                        *vdi_map, instruction_args->contents[2]);
+    parent_vdi_uuid = xen_utils_string_map_index_get(
+                        vdi_map, instruction_args->contents[2]);
 
     if(xen_vdi_get_by_uuid(session->xen, &parent_vdi, parent_vdi_uuid)){
         driver_params = xen_string_string_map_alloc(0);
         if(xen_vdi_clone(session->xen, &newvdi, parent_vdi, driver_params) && newvdi) {
             xen_vdi_get_uuid(session->xen, dest_vdi_uuid, newvdi);
             if(*dest_vdi_uuid) {
-                xen_utils_add_to_string_string_map(
-                    child_vdi_uuid, *dest_vdi_uuid, vdi_map);
+                xen_utils_string_map_index_set(
+                    vdi_map, child_vdi_uuid, *dest_vdi_uuid);
             }
         } else {
             xen_utils_trace_error(session->xen, __FILE__ , __LINE__);
@@ -935,7 +935,7 @@ Exit:
 
 static int _exec_reuse_instruction(
     xen_string_set *instruction_args,
-    xen_string_string_map **vdi_map,
+    xen_utils_string_map_index *vdi_map,
     char **dest_vdi_uuid,
     char **old_vdi_uuid
     )
@@ -948,8 +948,8 @@ static int _exec_reuse_instruction(
     *old_vdi_uuid = strdup(instruction_args->contents[1]);
 
     /* lookup the dsetination VDI from the vdi_map */
-    char *mapped_vdi_uuid = xen_utils_get_from_string_string_map(
-                            *vdi_map, instruction_args->contents[2]);
+    char *mapped_vdi_uuid = xen_utils_string_map_index_get(
+                            vdi_map, instruction_args->contents[2]);
 
     if(!mapped_vdi_uuid) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Unable to find %s in vdi_map",
@@ -960,19 +960,19 @@ static int _exec_reuse_instruction(
     *dest_vdi_uuid = strdup(mapped_vdi_uuid);
 
     /* remove the parent uuid from the map */
-    xen_utils_remove_from_string_string_map(
-        instruction_args->contents[2], vdi_map);
+    xen_utils_string_map_index_remove(
+        vdi_map, instruction_args->contents[2]);
 
     /* now update the child_uuid's contents with the dest_uuid */
-    xen_utils_add_to_string_string_map(
-        *old_vdi_uuid, *dest_vdi_uuid, vdi_map);
+    xen_utils_string_map_index_set(
+        vdi_map, *old_vdi_uuid, *dest_vdi_uuid);
     return 1;
 }
 
 static int _exec_snap_instruction(
     xen_string_set *instruction_args,
     xen_utils_session *session,
-    xen_string_string_map **vdi_map
+    xen_utils_string_map_index *vdi_map
     )
 {
     int rc = 0;
@@ -982,8 +982,8 @@ static int _exec_snap_instruction(
     if(instruction_args->size != 2)
         return 0;
     char *old_uuid = instruction_args->contents[1];
-    char *dest_uuid = xen_utils_get_from_string_string_map(
-                            *vdi_map, old_uuid);
+    char *dest_uuid = xen_utils_string_map_index_get(
+                            vdi_map, old_uuid);
     xen_vdi dest_vdi = NULL;
     xen_sr sr = NULL;
     xen_vdi newvdi = NULL;
@@ -1025,8 +1025,8 @@ static int _exec_snap_instruction(
 
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("About to update map"));
         if(dest_vdi_uuid) {
-            xen_utils_add_to_string_string_map(
-                instruction_args->contents[1], dest_vdi_uuid, vdi_map);
+            xen_utils_string_map_index_set(
+                vdi_map, instruction_args->contents[1], dest_vdi_uuid);
         } else {
             _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("No dest_vdi_uuid. Skipping adding to map."));
         }
@@ -1055,15 +1055,15 @@ Exit:
 static int _exec_leaf_instruction(
     xen_string_set *instruction_args,
     xen_utils_session *session,
-    xen_string_string_map **vdi_map
+    xen_utils_string_map_index *vdi_map
     )
 {
     /* instruction is of the form 'leaf <vdi-uuid>' */
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Executing leaf instruction"));
     if(instruction_args->size != 2)
         return 0;
-    char *dest_uuid = xen_utils_get_from_string_string_map(
-                            *vdi_map, instruction_args->contents[1]);
+    char *dest_uuid = xen_utils_string_map_index_get(
+                            vdi_map, instruction_args->contents[1]);
     xen_vdi dest_vdi = NULL;
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("dest_vdi: %s, old_vdi: %s", 
                                            dest_uuid,instruction_args->contents[1]));
@@ -1218,6 +1218,7 @@ int create_next_disk_in_import_sequence(
     CMPIData argdata;
     char *import_sequence = NULL, *next_instruction = NULL;
     xen_string_string_map *vdi_map = NULL;
+    xen_utils_string_map_index *vdi_index = NULL;
     char* dest_vdi_uuid = NULL;
     char* old_vdi_uuid = NULL;
     char *sr_uuid = NULL;
@@ -1247,6 +1248,13 @@ int create_next_disk_in_import_sequence(
 	      _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Key:%s,Val:%s", vdi_map->contents[i].key, vdi_map->contents[i].val));   
 	  }
 	}
+        /* the instructions look up, replace and add disks in the map one at a time */
+        vdi_index = xen_utils_string_map_index_new(vdi_map);
+        if (vdi_index == NULL) {
+            error_msg = "ERROR: Couldn't allocate memory for the 'DiskImageMap'";
+            goto Exit;
+        }
+        vdi_map = NULL;
     }
 
     /* Get the VDI map that maps the old disk UUIDs to the new ones */
@@ -1280,10 +1288,10 @@ int create_next_disk_in_import_sequence(
 
 
 
-	if (vdi_map->size > 0) {
+	if (vdi_index->map->size > 0) {
 	  int i;
-	  for(i=0;i< vdi_map->size; i++){
-	      _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Key:%s,Val:%s", vdi_map->contents[i].key, vdi_map->contents[i].val));   
+	  for(i=0;i< vdi_index->map->size; i++){
+	      _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Key:%s,Val:%s", vdi_index->map->contents[i].key, vdi_index->map->contents[i].val));   
 	  }
 	}
 
@@ -1296,25 +1304,25 @@ int create_next_disk_in_import_sequence(
             if(instruction_args && instruction_args->size > 0) {
                 if(strcmp(instruction_args->contents[0], "create") == 0) {
                     if(!_exec_create_instruction(instruction_args, session, sr_uuid, 
-                                                 &vdi_map, &dest_vdi_uuid, &old_vdi_uuid))
+                                                 vdi_index, &dest_vdi_uuid, &old_vdi_uuid))
                         goto Exit;
                 }
                 else if(strcmp(instruction_args->contents[0], "clone") == 0) {
                     if(!_exec_clone_instruction(instruction_args, session, 
-                                                &vdi_map, &dest_vdi_uuid, &old_vdi_uuid))
+                                                vdi_index, &dest_vdi_uuid, &old_vdi_uuid))
                         goto Exit;
                 }
                 else if(strcmp(instruction_args->contents[0], "reuse") == 0) {
                     if(!_exec_reuse_instruction(instruction_args, 
-                                                &vdi_map, &dest_vdi_uuid, &old_vdi_uuid))
+                                                vdi_index, &dest_vdi_uuid, &old_vdi_uuid))
                         goto Exit;
                 }
                 else if(strcmp(instruction_args->contents[0], "snap") == 0) {
-                    if(!_exec_snap_instruction(instruction_args, session, &vdi_map))
+                    if(!_exec_snap_instruction(instruction_args, session, vdi_index))
                         goto Exit;
                 }
                 else if(strcmp(instruction_args->contents[0], "leaf") == 0) {
-                    if(!_exec_leaf_instruction(instruction_args, session, &vdi_map))
+                    if(!_exec_leaf_instruction(instruction_args, session, vdi_index))
                         goto Exit;
                 }
                 else if(strcmp(instruction_args->contents[0], "pass") == 0) {
@@ -1338,7 +1346,7 @@ int create_next_disk_in_import_sequence(
                 CMAddArg(argsout, "NewDiskImage", &disk_image_op, CMPI_ref);
                 CMAddArg(argsout, "OldDiskID", old_vdi_uuid, CMPI_chars); /* caller needs to identify disk to copy contents from */
             }
-            char *vdi_map_str = xen_utils_flatten_string_string_map(vdi_map);
+            char *vdi_map_str = xen_utils_flatten_string_string_map(vdi_index->map);
             CMAddArg(argsout, "DiskImageMap", vdi_map_str, CMPI_chars);
             free(vdi_map_str);
             statusrc = CMPI_RC_OK;
@@ -1363,6 +1371,8 @@ Exit:
         free(import_sequence);
     if(vdi_map)
         xen_string_string_map_free(vdi_map);
+    if(vdi_index)
+        xen_utils_string_map_index_free(vdi_index);
     if(sr_uuid)
         free(sr_uuid);
     if(old_vdi_uuid)
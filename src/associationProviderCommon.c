@@ -32,6 +32,7 @@
 
 /* Include _SBLIM_TRACE() logging support */
 #include "cmpitrace.h"
+#include "xen_stats.h"
 
 
 // ----------------------------------------------------------------------------
@@ -424,6 +425,34 @@ association_class_info g_assoc_table[] = {
    };
 
 
+/* Targets of an association that can be picked out by a query on one of
+   their properties, equal to the key taken from the source, rather than
+   by enumerating all of them. The instance provider looks at just what
+   the query is on. */
+typedef struct _association_target_query {
+    char *assocclass;
+    char *targetclass;
+    char *targetproperty;
+} association_target_query;
+
+static association_target_query g_target_query_table[] = {
+   {"Xen_StoragePoolComponent", "Xen_DiskImage", "PoolID"},
+   };
+
+static const char *_target_query_property(
+    const char *assocclass,
+    const char *targetclass
+    )
+{
+    int i;
+    for(i=0; i<(sizeof(g_target_query_table)/sizeof(g_target_query_table[0])); i++) {
+        if (strcmp(g_target_query_table[i].assocclass, assocclass) == 0 &&
+            strcmp(g_target_query_table[i].targetclass, targetclass) == 0)
+            return g_target_query_table[i].targetproperty;
+    }
+    return NULL;
+}
+
 association_class_info_set FindAssociationClasses(
     const char * assoc_class_name, 
     const char *ns
@@ -519,7 +548,7 @@ static CMPIStatus _AssociationRoutine(
         CMPIObjectPath * rhsclassop = CMNewObjectPath(_BROKER, association->rhsnamespace, association->rhsclass, NULL);
 
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
-                         ("--- Checking class %s, with %d or %d. Ignoring request.",
+                         ("--- Checking class %s, with %s or %s. Ignoring request.",
                           sourceclass, association->lhsclass, association->rhsclass));
 
         /* Determine the target class from the source class. 
@@ -571,9 +600,24 @@ static CMPIStatus _AssociationRoutine(
             continue;
         }
     
-        /* Get the list of all target class object instances from the providers. */
+        /* Get the target class object instances that can match from the providers,
+           all of them unless a query on the source's key narrows them down. */
         CMPIEnumeration * enumeration = NULL;
-        enumeration = CBEnumInstances(_BROKER, context, objectpath, NULL, &status);
+        const char *query_property = _target_query_property(association->assocclass, targetclass);
+        if (query_property && sourcekeyname && strchr(sourcename, '\'') == NULL) {
+            char query[MAX_SYSTEM_NAME_LEN + 128];
+            snprintf(query, sizeof(query), "SELECT * FROM %s WHERE %s = '%s'",
+                     targetclass, query_property, sourcename);
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("--- querying \"%s\"", query));
+            enumeration = CBExecQuery(_BROKER, context, objectpath, query, "WQL", &status);
+            if ((status.rc != CMPI_RC_OK) || CMIsNullObject(enumeration)) {
+                _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_WARNING,
+                             ("--- CBExecQuery() failed - %s, enumerating instead", CMGetCharPtr(status.msg)));
+                enumeration = NULL;
+            }
+        }
+        if (enumeration == NULL)
+            enumeration = CBEnumInstances(_BROKER, context, objectpath, NULL, &status);
         if ((status.rc != CMPI_RC_OK) || CMIsNullObject(enumeration)) {
             _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
                          ("--- CBEnumInstanceNames() failed - %s", CMGetCharPtr(status.msg)));
@@ -581,14 +625,13 @@ static CMPIStatus _AssociationRoutine(
             continue;
         }
 
-        CMPIArray *arr = CMToArray(enumeration, &status);
-        CMPICount cnt = CMGetArrayCount(arr, &status);
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Enumeration returned %d count", cnt));
-
         /* Return all object paths/objects (depending on what was requested)  
-         * that exactly match the target class and resultClass, if specified. */
+         * that exactly match the target class and resultClass, if specified. 
+         * They are looked at as they come, the enumeration is never copied. */
+        CMPICount cnt = 0;
         while (CMHasNext(enumeration, NULL)) {
             CMPIData data = CMGetNext(enumeration, NULL);
+            cnt++;
             CMPIObjectPath *objectPath = NULL;
             char *classname = NULL;
     
@@ -626,6 +669,7 @@ static CMPIStatus _AssociationRoutine(
                        CMReturnInstance(results, data.value.inst);
             }
         }
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("--- Enumeration returned %d count", cnt));
     }
     CMReturnDone(results);
 
@@ -845,6 +889,17 @@ static CMPIStatus AssociationCleanup(
 }
 
 
+/* Association calls are accounted against the association class, if there's one */
+static const char *_stats_classname(
+    const CMPIObjectPath *reference,
+    const char *assocClass)
+{
+    if (assocClass)
+        return assocClass;
+    CMPIString *cn = CMGetClassName(reference, NULL);
+    return cn ? CMGetCharPtr(cn) : NULL;
+}
+
 // ----------------------------------------------------------------------------
 // AssociatorNames()
 // ----------------------------------------------------------------------------
@@ -858,7 +913,11 @@ static CMPIStatus AssociatorNames(
 		const char * role,
 		const char * resultRole)
 {
-    return _AssociationRoutine(self, context, results, reference, assocClass, resultClass, role, resultRole, 1);
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_associator_names, _stats_classname(reference, assocClass), NULL);
+    CMPIStatus status = _AssociationRoutine(self, context, results, reference, assocClass, resultClass, role, resultRole, 1);
+    xen_stats_call_end(&stats, status.rc);
+    return status;
 }
 
 
@@ -876,7 +935,11 @@ static CMPIStatus Associators(
 		const char *resultRole,
 		const char ** properties)		/* [in] List of desired properties (NULL=all). */
 {
-    return _AssociationRoutine(self, context, results, reference, assocClass, resultClass, role, resultRole, 0);
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_associators, _stats_classname(reference, assocClass), NULL);
+    CMPIStatus status = _AssociationRoutine(self, context, results, reference, assocClass, resultClass, role, resultRole, 0);
+    xen_stats_call_end(&stats, status.rc);
+    return status;
 }
 
 
@@ -891,7 +954,11 @@ static CMPIStatus ReferenceNames(
 		const char *assocClass, 
 		const char *role)
 {
-    return _ReferencesRoutine(self,	context, results, reference, assocClass, role, NULL, 1);
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_reference_names, _stats_classname(reference, assocClass), NULL);
+    CMPIStatus status = _ReferencesRoutine(self,	context, results, reference, assocClass, role, NULL, 1);
+    xen_stats_call_end(&stats, status.rc);
+    return status;
 }
 
 
@@ -907,8 +974,11 @@ static CMPIStatus References(
 		const char *role,
 		const char **properties)		/* [in] List of desired properties (NULL=all). */
 {
-    return _ReferencesRoutine(self,	context, results, reference, assocClass, role, properties, 0);
-
+    xen_stats_call stats;
+    xen_stats_call_begin(&stats, xen_stats_op_references, _stats_classname(reference, assocClass), NULL);
+    CMPIStatus status = _ReferencesRoutine(self,	context, results, reference, assocClass, role, properties, 0);
+    xen_stats_call_end(&stats, status.rc);
+    return status;
 }
 
 
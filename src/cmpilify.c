@@ -25,6 +25,8 @@
 #include "cmpilify.h"
 #include "cmpitrace.h"
 #include "cmpiutil.h"
+#include "xen_query.h"
+#include "xen_frozen.h"
 
 
 #define _BROKER (((CMPILIFYInstanceMI*)(mi->hdl))->brkr)
@@ -98,6 +100,42 @@ static int getres4op(
    return rc;
 }
 
+/* Get the resource a query selects through its keys. Returns 1 if the
+   equalities in the query were enough to get it (res is NULL if there is
+   no such resource, or getting it failed, see rc), 0 if the query has to
+   be run by enumerating. */
+static int getres4query(
+    void** res,
+    const CMPIObjectPath* ref,
+    const xen_query* q,
+    struct xen_call_context *caller_ctx,
+    CMPIInstanceMI* mi,
+    CMPIrc *rc)
+{
+   CMPIStatus status = {CMPI_RC_OK, NULL};
+   CMPIObjectPath* op;
+   CMPIInstance* inst;
+   void* resId = NULL;
+   int i;
+
+   *res = NULL;
+   *rc = CMPI_RC_OK;
+   if (q == NULL) return 0;
+
+   /* The resource provider knows which of them are the keys */
+   op = CMNewObjectPath(_BROKER, CMGetCharPtr(CMGetNameSpace(ref, NULL)), _CLASS, &status);
+   if ((status.rc != CMPI_RC_OK) || CMIsNullObject(op)) return 0;
+   for (i = 0; i < q->term_count; i++)
+      CMAddKey(op, q->terms[i].property, (CMPIValue *)q->terms[i].value, CMPI_chars);
+   if (!op2inst(op, &inst, mi)) return 0;
+   if (_FT->extractid(&resId, inst) != CMPI_RC_OK || resId == NULL) return 0;
+
+   if ((*rc = _FT->get(resId, caller_ctx, res, NULL)) != CMPI_RC_OK)
+      *res = NULL;
+   _FT->releaseid(resId);
+   return 1;
+}
+
 /* ------------------------------------------------------------------------- *
  * Shared CMPILIFY CMPI instance provider functions.     
  * These are exported as entry points to each provider.                    
@@ -595,7 +633,8 @@ CMPIStatus CMPILIFYInstance_deleteInstance(
 /*****************************************************************************
  * CMPILIFYInstance_execQuery
  *     Execute a WQL or CQL query,
- *     Intended to get a filtered list of objects
+ *     Intended to get a filtered list of objects. A query with equalities
+ *     on the keys gets that one object instead of enumerating them all.
  *****************************************************************************/
 CMPIStatus CMPILIFYInstance_execQuery(
     CMPIInstanceMI* mi, 
@@ -614,6 +653,8 @@ CMPIStatus CMPILIFYInstance_execQuery(
    CMPIObjectPath* op;
    CMPIInstance* inst;
    CMPIBoolean match;
+   xen_query* pushdown = NULL;
+   struct xen_call_context *ctx = NULL;
 
    CMPIString *cn = CMGetClassName(ref, &status);
    _CLASS = CMGetCharPtr(cn);
@@ -626,11 +667,50 @@ CMPIStatus CMPILIFYInstance_execQuery(
       goto exit;
    }
 
-   struct xen_call_context *ctx = NULL;
    if(!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)){
        goto exit;
    }
 
+   ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
+   pushdown = xen_query_analyse(query);
+   CMPIrc rc;
+   if (getres4query(&res, ref, pushdown, ctx, mi, &rc)) {
+      if (res == NULL) {
+         /* no such object, nothing matches, but a failing xapi is an error */
+         if (rc != CMPI_RC_ERR_NOT_FOUND)
+            CMSetStatusWithChars(_BROKER, &status, rc, "get() failed");
+         goto exit;
+      }
+      op = CMNewObjectPath(_BROKER, ns, _CLASS, &status);
+      inst = CMIsNullObject(op) ? NULL : CMNewInstance(_BROKER, op, &status);
+      if ((status.rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
+         _FT->release(res);
+         CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+         goto exit;
+      }
+      status.rc = _FT->setproperties(inst, res, NULL);
+      _FT->release(res);
+      if (status.rc != CMPI_RC_OK) {
+         CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
+                              "setproperties() failed");
+         goto exit;
+      }
+      match = CMEvaluateSelExp(expr, inst, &status);
+      if (status.rc != CMPI_RC_OK) {
+         CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+         goto exit;
+      }
+      if (match) {
+         status = CMReturnInstance(rslt, inst);
+         if (status.rc != CMPI_RC_OK) {
+            CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+            goto exit;
+         }
+         CMReturnDone(rslt);
+      }
+      goto exit;
+   }
+
    /* Get list of resources. */
    if (_FT->begin(&resList, _CLASS, ctx, NULL) != CMPI_RC_OK) {
       CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
@@ -639,7 +719,6 @@ CMPIStatus CMPILIFYInstance_execQuery(
    }
 
    /* Enumerate resources and return CMPIObjectPath for each. */
-   ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
    while (1) {
       /* Create new CMPIObjectPath for next resource. */
       op = CMNewObjectPath(_BROKER, ns, _CLASS, &status);
@@ -696,6 +775,7 @@ CMPIStatus CMPILIFYInstance_execQuery(
    }
 
  exit:
+     xen_query_free(pushdown);
      if(ctx)
          xen_utils_free_call_context(ctx);
    _SBLIM_RETURNSTATUS(status);
@@ -737,6 +817,66 @@ CMPIStatus CMPILIFYInstance1RO_cleanup(
 
 /* ------------------------------------------------------------------------- */
 
+/*
+ * The frozen instance of a 1RO class in a namespace. It's read-only and the
+ * same for every caller, so it's built the first time it is asked for,
+ * without the caller's context, and kept (see xen_frozen.h). Requests get
+ * copies of it.
+ */
+static const xen_frozen_class* getfrozen(
+    CMPIInstanceMI* mi, 
+    const char* ns,
+    const char* classname,
+    CMPIStatus* status)
+{
+   const xen_frozen_class* frozen;
+   CMPIObjectPath* op;
+   CMPIInstance* inst;
+   void* res = NULL;
+
+   if ((frozen = xen_frozen_find(ns, classname)) != NULL)
+      return frozen;
+
+   /* Create the new CMPIInstance. */
+   op = CMNewObjectPath(_BROKER, ns, classname, status);
+   if ((status->rc != CMPI_RC_OK) || CMIsNullObject(op)) {
+      CMSetStatus(status, CMPI_RC_ERR_FAILED);
+      return NULL;
+   }
+   inst = CMNewInstance(_BROKER, op, status);
+   CMRelease(op); /* the instance has a copy of its own */
+   if ((status->rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
+      if (!CMIsNullObject(inst))
+         CMRelease(inst);
+      CMSetStatus(status, CMPI_RC_ERR_FAILED);
+      return NULL;
+   }
+
+   /* Get the instance data. */
+   status->rc = _FT->get(NULL, &res, NULL);
+   if (status->rc != CMPI_RC_OK)
+      goto exit;
+
+   /* Set the CMPIInstance properties from the instance data. */
+   status->rc = _FT->setproperties(inst, res, NULL);
+   _FT->release(res);
+   if (status->rc != CMPI_RC_OK) {
+      CMSetStatusWithChars(_BROKER, status, CMPI_RC_ERR_FAILED,
+                           "CMPILIFY setproperties() failed");
+      goto exit;
+   }
+
+   if ((frozen = xen_frozen_add(ns, classname, &inst, 1)) == NULL)
+      CMSetStatus(status, CMPI_RC_ERR_FAILED);
+
+ exit:
+   /* xen_frozen keeps a copy, this was only the template */
+   CMRelease(inst);
+   return frozen;
+}
+
+/* ------------------------------------------------------------------------- */
+
 CMPIStatus CMPILIFYInstance1RO_enumInstanceNames(
     CMPIInstanceMI* mi, 
     const CMPIContext* cmpi_ctx, 
@@ -744,8 +884,8 @@ CMPIStatus CMPILIFYInstance1RO_enumInstanceNames(
     const CMPIObjectPath* ref)
 {
    CMPIStatus status = {CMPI_RC_OK, NULL};
-   void* res = NULL;
-   CMPIInstance* inst;
+   const xen_frozen_class* frozen;
+   const CMPIInstance* frozen_inst;
    CMPIObjectPath* op;
    char* ns;
 
@@ -756,34 +896,13 @@ CMPIStatus CMPILIFYInstance1RO_enumInstanceNames(
 
    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
 
-   /* Create the new CMPIInstance. */
-   inst = CMNewInstance(_BROKER, ref, &status);
-   if ((status.rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
-      CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-      goto exit;
-   }
-
-   struct xen_call_context *ctx = NULL;
-   if(!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)){
-       goto exit;
-   }
-
-   /* Get the instance data. */
-   status.rc = _FT->get(ctx, &res,  NULL);
-   if (status.rc != CMPI_RC_OK)
-      goto exit;
-
-   /* Set the CMPIInstance properties from the instance data. */
-   status.rc = _FT->setproperties(inst, res, NULL);
-   _FT->release(res);
-   if (status.rc != CMPI_RC_OK) {
-      CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
-                           "CMPILIFY setproperties() failed");
+   frozen = getfrozen(mi, ns, CMGetCharPtr(cn), &status);
+   if (frozen == NULL)
       goto exit;
-   }
+   frozen_inst = xen_frozen_get(frozen, 0);
 
    /* Get the CMPIObjectPath for this CMPIInstance. */
-   op = CMGetObjectPath(inst, &status);
+   op = CMGetObjectPath(frozen_inst, &status);
    if ((status.rc != CMPI_RC_OK) || CMIsNullObject(op)) {
       CMSetStatus(&status, CMPI_RC_ERR_FAILED);
       goto exit;
@@ -803,8 +922,6 @@ CMPIStatus CMPILIFYInstance1RO_enumInstanceNames(
 
    CMReturnDone(rslt);
  exit:
-     if(ctx) xen_utils_free_call_context(ctx);
-     
    _SBLIM_RETURNSTATUS(status);
 }
 
@@ -818,7 +935,8 @@ CMPIStatus CMPILIFYInstance1RO_enumInstances(
     const char** properties)
 {
    CMPIStatus status = {CMPI_RC_OK, NULL};
-   void* res = NULL;
+   const xen_frozen_class* frozen;
+   const CMPIInstance* frozen_inst;
    CMPIInstance* inst;
    char* ns;
 
@@ -828,43 +946,21 @@ CMPIStatus CMPILIFYInstance1RO_enumInstances(
 
    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
 
-   /* Create the new CMPIInstance. */
-   inst = CMNewInstance(_BROKER, ref, &status);
-   if ((status.rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
-      CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-      goto exit;
-   }
-
-   /* If specified, set the property filter. */
-   if (properties) {
-      status = CMSetPropertyFilter(inst, properties, NULL);
-      if (status.rc != CMPI_RC_OK) {
-         CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-         goto exit;
-      }
-   }
-
-   struct xen_call_context *ctx = NULL;
-   if(!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)){
-       goto exit;
-   }
-
-   /* Get the instance data. */
-   status.rc = _FT->get(ctx, &res, properties);
-   if (status.rc != CMPI_RC_OK)
+   frozen = getfrozen(mi, ns, CMGetCharPtr(cn), &status);
+   if (frozen == NULL)
       goto exit;
+   frozen_inst = xen_frozen_get(frozen, 0);
 
-   /* Set the CMPIInstance properties from the instance data. */
-   status.rc = _FT->setproperties(inst, res, properties);
-   _FT->release(res);
-   if (status.rc != CMPI_RC_OK) {
-      CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
-                           "CMPILIFY setproperties() failed");
+   /* Copy it, with the property filter if specified. */
+   inst = xen_frozen_clone(frozen_inst, properties, NULL);
+   if (inst == NULL) {
+      CMSetStatus(&status, CMPI_RC_ERR_FAILED);
       goto exit;
    }
 
    /* Return the CMPIInstance for the resource. */
    status = CMReturnInstance(rslt, inst);
+   CMRelease(inst);
    if (status.rc != CMPI_RC_OK) {
       CMSetStatus(&status, CMPI_RC_ERR_FAILED);
       goto exit;
@@ -872,8 +968,6 @@ CMPIStatus CMPILIFYInstance1RO_enumInstances(
 
    CMReturnDone(rslt);
  exit:
-     if(ctx) xen_utils_free_call_context(ctx);
-     
    _SBLIM_RETURNSTATUS(status);
 }
 
@@ -887,9 +981,9 @@ CMPIStatus CMPILIFYInstance1RO_getInstance(
     const char** properties)
 {
    CMPIStatus status = {CMPI_RC_OK, NULL};
-   void* res = NULL;
+   const xen_frozen_class* frozen;
+   const CMPIInstance* frozen_inst;
    CMPIInstance* inst;
-   CMPIObjectPath* op;
    char* ns;
 
    CMPIString *cn = CMGetClassName(ref, &status);
@@ -898,61 +992,27 @@ CMPIStatus CMPILIFYInstance1RO_getInstance(
 
    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
 
-   /* Create the new CMPIInstance. */
-   inst = CMNewInstance(_BROKER, ref, &status);
-   if ((status.rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
-      CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+   frozen = getfrozen(mi, ns, CMGetCharPtr(cn), &status);
+   if (frozen == NULL)
       goto exit;
-   }
-
-   /* If specified, set the property filter. */
-   if (properties) {
-      status = CMSetPropertyFilter(inst, properties, NULL);
-      if (status.rc != CMPI_RC_OK) {
-         CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-         goto exit;
-      }
-   }
-
-   struct xen_call_context *ctx = NULL;
-   if(!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)){
-       goto exit;
-   }
 
-   /* Get the instance data. */
-   status.rc = _FT->get(ctx, &res, properties);
-   if (status.rc != CMPI_RC_OK)
-      goto exit;
-
-   /* Set the CMPIInstance properties from the instance data. */
-   status.rc = _FT->setproperties(inst, res, properties);
-   _FT->release(res);
-   if (status.rc != CMPI_RC_OK) {
-      CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
-                           "CMPILIFY setproperties() failed");
+   /* Check the CMPIInstance matches the requested reference. */
+   frozen_inst = xen_frozen_lookup(frozen, ref);
+   if (frozen_inst == NULL) {
+      CMSetStatus(&status, CMPI_RC_ERR_NOT_FOUND);
       goto exit;
    }
 
-   /* Get the CMPIObjectPath for this CMPIInstance. */
-   op = CMGetObjectPath(inst, &status);
-   if ((status.rc != CMPI_RC_OK) || CMIsNullObject(op)) {
-      CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-      goto exit;
-   }
-   status = CMSetNameSpace(op, ns);
-   if (status.rc != CMPI_RC_OK) {
+   /* Copy it, with the property filter if specified. */
+   inst = xen_frozen_clone(frozen_inst, properties, NULL);
+   if (inst == NULL) {
       CMSetStatus(&status, CMPI_RC_ERR_FAILED);
       goto exit;
    }
-
-   /* Check the CMPIInstance matches the requested reference. */
-   if (!_CMSameObject(op, (CMPIObjectPath*)ref)) {
-      CMSetStatus(&status, CMPI_RC_ERR_NOT_FOUND);
-      goto exit;
-   }
  
    /* Return the CMPIInstance for the resource. */
    status = CMReturnInstance(rslt, inst);
+   CMRelease(inst);
    if (status.rc != CMPI_RC_OK) {
       CMSetStatus(&status, CMPI_RC_ERR_FAILED);
       goto exit;
@@ -960,8 +1020,6 @@ CMPIStatus CMPILIFYInstance1RO_getInstance(
 
    CMReturnDone(rslt);
  exit:
-     if(ctx) xen_utils_free_call_context(ctx);
-     
    _SBLIM_RETURNSTATUS(status);
 }
 
@@ -1026,7 +1084,8 @@ CMPIStatus CMPILIFYInstance1RO_execQuery(
     const char* lang)
 {
    CMPIStatus status = {CMPI_RC_OK, NULL};
-   void* res;
+   const xen_frozen_class* frozen;
+   const CMPIInstance* frozen_inst;
    char* ns;
    CMPISelectExp* expr;
    CMPIInstance* inst;
@@ -1045,34 +1104,13 @@ CMPIStatus CMPILIFYInstance1RO_execQuery(
 
    ns = CMGetCharPtr(CMGetNameSpace(ref, NULL));
 
-   /* Create the new CMPIInstance. */
-   inst = CMNewInstance(_BROKER, ref, &status);
-   if ((status.rc != CMPI_RC_OK) || CMIsNullObject(inst)) {
-      CMSetStatus(&status, CMPI_RC_ERR_FAILED);
-      goto exit;
-   }
-
-   struct xen_call_context *ctx = NULL;
-   if(!xen_utils_get_call_context(cmpi_ctx, &ctx, &status)){
-       goto exit;
-   }
-
-   /* Get the instance data. */
-   status.rc = _FT->get(ctx, &res, NULL);
-   if (status.rc != CMPI_RC_OK)
+   frozen = getfrozen(mi, ns, CMGetCharPtr(cn), &status);
+   if (frozen == NULL)
       goto exit;
-
-   /* Set the CMPIInstance properties from the instance data. */
-   status.rc = _FT->setproperties(inst, res, NULL);
-   _FT->release(res);
-   if (status.rc != CMPI_RC_OK) {
-      CMSetStatusWithChars(_BROKER, &status, CMPI_RC_ERR_FAILED,
-                           "CMPILIFY setproperties() failed");
-      goto exit;
-   }
+   frozen_inst = xen_frozen_get(frozen, 0);
 
    /* Evaluate the select expression against this CMPIInstance. */
-   match = CMEvaluateSelExp(expr, inst, &status);
+   match = CMEvaluateSelExp(expr, frozen_inst, &status);
    if (status.rc != CMPI_RC_OK) {
       CMSetStatus(&status, CMPI_RC_ERR_FAILED);
       goto exit;
@@ -1080,7 +1118,13 @@ CMPIStatus CMPILIFYInstance1RO_execQuery(
 
    /* Return the CMPIInstance for the resource if it match the query. */
    if (match) {
+      inst = xen_frozen_clone(frozen_inst, NULL, NULL);
+      if (inst == NULL) {
+         CMSetStatus(&status, CMPI_RC_ERR_FAILED);
+         goto exit;
+      }
       status = CMReturnInstance(rslt, inst);
+      CMRelease(inst);
       if (status.rc != CMPI_RC_OK) {
          CMSetStatus(&status, CMPI_RC_ERR_FAILED);
          goto exit;
@@ -1091,8 +1135,6 @@ CMPIStatus CMPILIFYInstance1RO_execQuery(
 
    CMReturnDone(rslt);
  exit:
-     if(ctx) xen_utils_free_call_context(ctx);
-    
    _SBLIM_RETURNSTATUS(status);
 }
 
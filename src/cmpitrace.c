@@ -25,9 +25,12 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -36,94 +39,387 @@
 /* Maximum length of trace message text. */
 #define _MAXLENGTH 2048
 
+/* Size of each thread's trace ring buffer, must be a power of 2. */
+#define _RING_SIZE (64 * 1024)
+
 /* By default log all trace messages. */
 int _SBLIM_TRACE_LEVEL = _SBLIM_TRACE_LEVEL_ALL;
 
 /* By default log trace messages to stderr. */
 static char * _SBLIM_TRACE_FILE = NULL;
 
-char *_sblim_format_trace(char * fmt, ...)
+/*
+ * Trace messages are queued on a ring buffer that belongs to the calling
+ * thread and are written out to the trace file by a background writer
+ * thread, so tracing a message costs a vsnprintf and a memcpy. The writer
+ * sleeps on a condition variable while the rings are empty, the thread
+ * that queues the next message wakes it. Each ring
+ * has a single producer (its thread) and a single consumer (whoever holds
+ * _trace_out_lock, normally the writer), so the head and tail counters are
+ * all the synchronisation needed. A thread that fills up its ring drains
+ * the rings itself rather than losing messages.
+ * Rings are never freed while the library is loaded, the ring of a thread
+ * that exits is picked up by the next new thread.
+ * Setting SBLIM_TRACE_SYNC writes each message out as it comes instead.
+ */
+typedef struct _trace_record {
+    unsigned int size;           /* bytes taken by the record, including padding */
+    int level;                   /* 0 marks padding up to the end of the ring */
+    int line;
+    time_t sec;
+    const char *file;            /* compile time constant */
+    char msg[];
+} trace_record;
+
+typedef struct _trace_ring {
+    struct _trace_ring *next;    /* list of all the rings */
+    int in_use;                  /* owned by a live thread */
+    unsigned long head;          /* only written by the owning thread */
+    unsigned long tail;          /* only written with _trace_out_lock held */
+    unsigned long dropped;       /* messages lost because the ring was full */
+    char buf[_RING_SIZE] __attribute__((aligned(8)));
+} trace_ring;
+
+#define _RECORD_ALIGN(__size) (((__size) + 7) & ~((size_t)7))
+
+static trace_ring *_trace_rings = NULL;
+static __thread trace_ring *_thread_ring = NULL;
+static __thread char _thread_msg[_MAXLENGTH];
+static pthread_key_t _ring_key;
+
+static FILE *_trace_out = NULL;
+static int _trace_sync = 0;
+static int _trace_tz_offset = 0;
+static pid_t _trace_pid = 0;
+static pthread_mutex_t _trace_out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t _writer_thread;
+static int _writer_running = 0;
+static volatile int _writer_stop = 0;
+static int _writer_waiting = 0;      /* the writer is or is about to be asleep */
+static pthread_mutex_t _writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _writer_wake = PTHREAD_COND_INITIALIZER;
+
+/* Timestamp of the last message written, formatted only when the second changes */
+static time_t _cached_sec = -1;
+static char _cached_tm[20];
+
+static const char *_level_str(int level)
 {
-    va_list ap;
-    char * msg = (char *)malloc(_MAXLENGTH);
-    va_start(ap, fmt);
-    vsnprintf(msg, _MAXLENGTH, fmt, ap);
-    va_end(ap);
-    return msg;
+    switch (level) {
+    case _SBLIM_TRACE_LEVEL_ERROR:
+        return "ERROR";
+    case _SBLIM_TRACE_LEVEL_WARNING:
+        return "WARNING";
+    case _SBLIM_TRACE_LEVEL_INFO:
+        return "INFO";
+    default:
+        return "DEBUG";
+    }
 }
 
-void _sblim_trace(int level, char *srcfile, int srcline, char *msg)
+/* Called with _trace_out_lock held, or from the writer thread */
+static void _write_message(int level, time_t sec, const char *srcfile, int srcline, const char *msg)
 {
     struct tm cttm;
+
+    if (sec != _cached_sec) {
+        time_t local = sec + _trace_tz_offset;
+        _cached_tm[0] = '\0';
+        if (gmtime_r(&local, &cttm) != NULL)
+            strftime(_cached_tm, sizeof(_cached_tm), "%m/%d/%Y %H:%M:%S", &cttm);
+        _cached_sec = sec;
+    }
+
+    /* Strip off the directory path from the compile-time src filename. */
+    if (index(srcfile,'/') != NULL)
+        srcfile = index(srcfile,'/')+1;
+
+    fprintf(_trace_out, "[%s] [%s] %d --- %s(%i) : %s\n",
+            _level_str(level), _cached_tm, _trace_pid, srcfile, srcline, msg);
+}
+
+/* Writes out everything queued on all the rings, returns the number of messages */
+static int _drain_rings()
+{
+    trace_ring *ring;
+    int count = 0;
+
+    pthread_mutex_lock(&_trace_out_lock);
+    for (ring = __atomic_load_n(&_trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        unsigned long tail = ring->tail;
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            trace_record *rec = (trace_record *)(ring->buf + (tail & (_RING_SIZE - 1)));
+            if (rec->level) {
+                _write_message(rec->level, rec->sec, rec->file, rec->line, rec->msg);
+                count++;
+            }
+            tail += rec->size;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        unsigned long dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "%lu trace messages dropped", dropped);
+            _write_message(_SBLIM_TRACE_LEVEL_WARNING, time(NULL), __FILE__, __LINE__, msg);
+            count++;
+        }
+    }
+    if (count)
+        fflush(_trace_out);
+    pthread_mutex_unlock(&_trace_out_lock);
+    return count;
+}
+
+/* Whether there's nothing queued on any of the rings */
+static int _rings_empty()
+{
+    trace_ring *ring;
+    for (ring = __atomic_load_n(&_trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+            return 0;
+    }
+    return 1;
+}
+
+static void _wake_writer()
+{
+    pthread_mutex_lock(&_writer_lock);
+    pthread_cond_signal(&_writer_wake);
+    pthread_mutex_unlock(&_writer_lock);
+}
+
+static void *_writer_main(void *arg)
+{
+    while (!_writer_stop) {
+        if (_drain_rings())
+            continue;
+        pthread_mutex_lock(&_writer_lock);
+        /* a message queued after the check below finds _writer_waiting set
+           and wakes us, one queued before it is seen by the check */
+        __atomic_store_n(&_writer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (!_writer_stop && _rings_empty())
+            pthread_cond_wait(&_writer_wake, &_writer_lock);
+        __atomic_store_n(&_writer_waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&_writer_lock);
+    }
+    _drain_rings();
+    return NULL;
+}
+
+/* Gives the ring of an exiting thread back for reuse */
+static void _release_ring(void *ring)
+{
+    __atomic_store_n(&((trace_ring *)ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static trace_ring *_get_thread_ring()
+{
+    trace_ring *ring;
+
+    for (ring = __atomic_load_n(&_trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        int free_ring = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &free_ring, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            goto Exit;
+    }
+
+    ring = calloc(1, sizeof(trace_ring));
+    if (ring == NULL)
+        return NULL;
+    ring->in_use = 1;
+    ring->next = __atomic_load_n(&_trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&_trace_rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+Exit:
+    pthread_setspecific(_ring_key, ring);
+    _thread_ring = ring;
+    return ring;
+}
+
+/* Queues a message on the calling thread's ring, drops it if the ring is full */
+static void _queue_message(int level, const char *srcfile, int srcline, const char *msg)
+{
+    trace_ring *ring = _thread_ring;
+    if (ring == NULL && (ring = _get_thread_ring()) == NULL)
+        return;
+
+    size_t len = strlen(msg) + 1;
+    size_t size = _RECORD_ALIGN(offsetof(trace_record, msg) + len);
+    unsigned long head = ring->head;
+    unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t to_end = _RING_SIZE - (head & (_RING_SIZE - 1));
+    size_t needed = (to_end < size) ? to_end + size : size;
+
+    if (_RING_SIZE - (head - tail) < needed) {
+        /* the writer is falling behind, do its job */
+        _drain_rings();
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (_RING_SIZE - (head - tail) < needed) {
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    if (to_end < size) {
+        /* doesn't fit before the end of the ring, pad and start over */
+        trace_record *pad = (trace_record *)(ring->buf + (head & (_RING_SIZE - 1)));
+        pad->size = to_end;
+        pad->level = 0;
+        head += to_end;
+    }
+
+    trace_record *rec = (trace_record *)(ring->buf + (head & (_RING_SIZE - 1)));
+    rec->size = size;
+    rec->level = level;
+    rec->line = srcline;
+    rec->sec = time(NULL);
+    rec->file = srcfile;
+    memcpy(rec->msg, msg, len);
+    __atomic_store_n(&ring->head, head + size, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_writer_waiting, __ATOMIC_SEQ_CST))
+        _wake_writer();
+}
+
+/* Nobody may be writing out messages while the process forks */
+static void _before_fork()
+{
+    pthread_mutex_lock(&_trace_out_lock);
+}
+
+static void _after_fork_parent()
+{
+    pthread_mutex_unlock(&_trace_out_lock);
+}
+
+static void _after_fork_child()
+{
+    /* the writer thread didn't come along, write the child's messages
+       directly. The locks are copies of the parent's, held by threads
+       the child doesn't have. */
+    pthread_mutex_init(&_trace_out_lock, NULL);
+    pthread_mutex_init(&_writer_lock, NULL);
+    pthread_cond_init(&_writer_wake, NULL);
+    _writer_running = 0;
+    _writer_waiting = 0;
+    _trace_sync = 1;
+    _trace_pid = getpid();
+}
+
+/* Initialize _SBLIM_TRACE_LEVEL and _SBLIM_TRACE_FILE from env vars when the library is loaded. */
+static void __attribute__((constructor)) _sblim_trace_init()
+{
     struct timeval tv;
     struct timezone tz;
-    long sec = 0;
-    char * tm = NULL;
-    FILE * ferr = stderr;
-    int pid;
-
-    static int firsttime = 1;
-
-    /* Initialize _SBLIM_TRACE_LEVEL and _SBLIM_TRACE_FILE from env vars. */
-    if (firsttime) {
-        char * tracelevel = getenv("SBLIM_TRACE");
-        if (tracelevel != NULL) 
-            _SBLIM_TRACE_LEVEL = atoi(tracelevel);
-        char * tracefile = getenv("SBLIM_TRACE_FILE");
-        if (tracefile != NULL) 
-            _SBLIM_TRACE_FILE = strdup(tracefile);
-
-        fprintf(ferr, "_SBLIM_TRACE_LEVEL=%x\n", _SBLIM_TRACE_LEVEL);
-        fprintf(ferr, "_SBLIM_TRACE_FILE=%s\n", _SBLIM_TRACE_FILE);
-        firsttime = 0;
-    }
 
-    /* Append this trace message to the existing _SBLIM_TRACE_FILE. */
-    if ((_SBLIM_TRACE_FILE != NULL) && (ferr = fopen(_SBLIM_TRACE_FILE, "a")) == NULL) {
+    char * tracelevel = getenv("SBLIM_TRACE");
+    if (tracelevel != NULL)
+        _SBLIM_TRACE_LEVEL = atoi(tracelevel);
+    char * tracefile = getenv("SBLIM_TRACE_FILE");
+    if (tracefile != NULL)
+        _SBLIM_TRACE_FILE = strdup(tracefile);
+    if (getenv("SBLIM_TRACE_SYNC") != NULL)
+        _trace_sync = 1;
+
+    fprintf(stderr, "_SBLIM_TRACE_LEVEL=%x\n", _SBLIM_TRACE_LEVEL);
+    fprintf(stderr, "_SBLIM_TRACE_FILE=%s\n", _SBLIM_TRACE_FILE);
+
+    if (gettimeofday(&tv, &tz) == 0)
+        _trace_tz_offset = tz.tz_minuteswest * -1 * 60;
+    _trace_pid = getpid();
+
+    /* Keep the trace file open for as long as we are loaded. */
+    _trace_out = stderr;
+    if ((_SBLIM_TRACE_FILE != NULL) && (_trace_out = fopen(_SBLIM_TRACE_FILE, "a")) == NULL) {
         fprintf(stderr, "Cannot open SBLIM_TRACE_FILE %s", _SBLIM_TRACE_FILE);
+        _SBLIM_TRACE_LEVEL = 0;
         return;
     }
 
-    /* Generate a timestamp for this trace message. */
-    if (gettimeofday(&tv, &tz) == 0) {
-        sec = tv.tv_sec + (tz.tz_minuteswest * -1 * 60);
-        tm = (char *) malloc(20 * sizeof(char));
-        memset(tm, 0, 20 * sizeof(char));
-        if (gmtime_r(&sec, &cttm) != NULL) 
-            strftime(tm, 20, "%m/%d/%Y %H:%M:%S", &cttm);
+    if (_SBLIM_TRACE_LEVEL <= 0 || _trace_sync)
+        return;
+    if (pthread_key_create(&_ring_key, _release_ring) != 0) {
+        _trace_sync = 1;
+        return;
     }
+    pthread_atfork(_before_fork, _after_fork_parent, _after_fork_child);
+    if (pthread_create(&_writer_thread, NULL, _writer_main, NULL) == 0)
+        _writer_running = 1;
+    else
+        _trace_sync = 1;
+}
 
-    /* Get PID of the current process. */
-    pid = getpid();
+/* Flushes whatever is still queued and stops the writer before the library goes away. */
+static void __attribute__((destructor)) _sblim_trace_shutdown()
+{
+    trace_ring *ring, *next;
 
-    /* Strip off the directory path from the compile-time src filename. */
-    if (index(srcfile,'/') != NULL) 
-        srcfile = index(srcfile,'/')+1;
+    if (_writer_running) {
+        _writer_stop = 1;
+        _wake_writer();
+        pthread_join(_writer_thread, NULL);
+        _writer_running = 0;
+    }
+    if (_trace_out == NULL)
+        return;
+    if (!_trace_sync) {
+        _drain_rings();
+        /* our destructor must not be run for threads that outlive us */
+        pthread_key_delete(_ring_key);
+        for (ring = _trace_rings; ring; ring = next) {
+            next = ring->next;
+            free(ring);
+        }
+        _trace_rings = NULL;
+    }
+    if (_trace_out != stderr)
+        fclose(_trace_out);
+    _trace_out = NULL;
+}
 
-    char *level_str;
-    switch (level) {
-    case _SBLIM_TRACE_LEVEL_ERROR:
-        level_str = "ERROR";
-        break;
-    case _SBLIM_TRACE_LEVEL_WARNING:
-        level_str = "WARNING";
-        break;
-    case _SBLIM_TRACE_LEVEL_INFO:
-        level_str = "INFO";
-        break;
-    case _SBLIM_TRACE_LEVEL_DEBUG:
-        level_str = "DEBUG";
-        break;
-    default:
-        level_str = "DEBUG";
+static void _trace_message(int level, const char *srcfile, int srcline, const char *msg)
+{
+    if (_trace_out == NULL)
+        return;
+    if (_trace_sync) {
+        pthread_mutex_lock(&_trace_out_lock);
+        _write_message(level, time(NULL), srcfile, srcline, msg);
+        fflush(_trace_out);
+        pthread_mutex_unlock(&_trace_out_lock);
     }
+    else
+        _queue_message(level, srcfile, srcline, msg);
+}
 
-    /* Format and print the trace message. */
-    fprintf(ferr, "[%s] [%s] %d --- %s(%i) : %s\n", level_str, tm, pid, srcfile, srcline, msg);
-    if (tm != NULL) 
-        free(tm);
+/* Formats the message on a per thread buffer and queues it, used by _SBLIM_TRACE() */
+void _sblim_trace_log(int level, const char *srcfile, int srcline, const char *fmt, ...)
+{
+    va_list ap;
 
-    if ((_SBLIM_TRACE_FILE != NULL)) 
-        fclose(ferr);
+    if (level > _SBLIM_TRACE_LEVEL || level <= 0)
+        return;
+    va_start(ap, fmt);
+    vsnprintf(_thread_msg, _MAXLENGTH, fmt, ap);
+    va_end(ap);
+    _trace_message(level, srcfile, srcline, _thread_msg);
 }
 
+char *_sblim_format_trace(char * fmt, ...)
+{
+    va_list ap;
+    char * msg = (char *)malloc(_MAXLENGTH);
+    va_start(ap, fmt);
+    vsnprintf(msg, _MAXLENGTH, fmt, ap);
+    va_end(ap);
+    return msg;
+}
+
+void _sblim_trace(int level, char *srcfile, int srcline, char *msg)
+{
+    if (level > _SBLIM_TRACE_LEVEL || level <= 0)
+        return;
+    _trace_message(level, srcfile, srcline, msg);
+}
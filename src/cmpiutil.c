@@ -402,7 +402,7 @@ int _CMPICreateNewSystemInstanceID(char *buf, int buf_len, char *systemid)
     snprintf(buf, buf_len, "Xen:%s", systemid);
     return 1;
 }
-int _CMPICreateNewDeviceInstanceID(char *buf, int buf_len, char *systemid, char *deviceid)
+int _CMPICreateNewDeviceInstanceID(char *buf, int buf_len, const char *systemid, const char *deviceid)
 {
     snprintf(buf, buf_len, "Xen:%s/%s", systemid, deviceid);
     return 1;
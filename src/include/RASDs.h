@@ -25,6 +25,7 @@
 
 #include <cmpidt.h>
 #include "xen_utils.h"
+#include "xen_topology.h"
 
 typedef enum {
     resource_add = 0,
@@ -45,7 +46,7 @@ void set_memory_defaults(xen_vm_record *vm_rec);
 CMPIObjectPath *memory_rasd_create_ref(const CMPIBroker *broker, const char *name_space, xen_utils_session *session, xen_vm_record *vm_rec);
 
 int disk_rasd_to_vbd(const CMPIBroker* broker, xen_utils_session* session, CMPIInstance *disk_rasd, xen_vbd_record **vbd_rec, xen_vdi_record **vdi_rec, xen_sr  *sr, CMPIStatus *status);
-int disk_rasd_from_vbd(const CMPIBroker* broker, xen_utils_session *session, CMPIInstance *inst, xen_vm_record *vm_rec, xen_vbd_record *vbd_rec, xen_vdi_record *vdi_rec);
+int disk_rasd_from_vbd(const CMPIBroker* broker, xen_utils_session *session, xen_storage_topology *storage, CMPIInstance *inst, xen_vm_record *vm_rec, xen_vbd_record *vbd_rec, xen_vdi_record *vdi_rec);
 int disk_rasd_modify(xen_utils_session *session, xen_vbd_record *vbd_rec_template, xen_vdi_record *vdi_rec_template);
 CMPIObjectPath *disk_rasd_create_ref(const CMPIBroker *broker, const char *name_space, xen_utils_session *session, xen_vm_record *vm_rec, xen_vbd vbd);
 
@@ -67,6 +68,7 @@ bool host_network_port_rasd_parse(
     CMPIData *setting_data,
     xen_pif_record_set **pif_rec_set,
     bool *bonded_set,
+    xen_net_topology **topo,
     CMPIStatus *status
     );
 
@@ -0,0 +1,72 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_METRICALERT_H__
+#define __XEN_METRICALERT_H__
+
+#include "xen_utils.h"
+
+/* Alert rules are persisted in the pool's other_config, one key per rule,
+   so that they are shared by every CIMOM in the pool */
+#define ALERT_RULE_KEY_PREFIX "cim_alert_rule:"
+#define ALERT_RULE_ID_PREFIX  "AlertRule"
+
+/* Values for the RuleType property of Xen_MetricAlertRule */
+typedef enum _Xen_MetricAlertRule_RuleType{
+    Xen_MetricAlertRule_RuleType_Threshold=0,
+    Xen_MetricAlertRule_RuleType_Rate_Of_Change=1,
+}Xen_MetricAlertRule_RuleType;
+
+/* Values for the SystemType property of Xen_MetricAlertRule */
+typedef enum _Xen_MetricAlertRule_SystemType{
+    Xen_MetricAlertRule_SystemType_VM=0,
+    Xen_MetricAlertRule_SystemType_Host=1,
+}Xen_MetricAlertRule_SystemType;
+
+/* Values for the Comparison property of Xen_MetricAlertRule */
+typedef enum _Xen_MetricAlertRule_Comparison{
+    Xen_MetricAlertRule_Comparison_Above=0,
+    Xen_MetricAlertRule_Comparison_Below=1,
+}Xen_MetricAlertRule_Comparison;
+
+typedef struct _metric_alert_rule {
+    char *name;             /* unique name of the rule, forms the InstanceID */
+    char *data_source;      /* RRD data source name, a trailing '*' matches a prefix */
+    char *system;           /* optional uuid of the only VM/host the rule applies to */
+    int system_type;        /* Xen_MetricAlertRule_SystemType */
+    int rule_type;          /* Xen_MetricAlertRule_RuleType */
+    int comparison;         /* Xen_MetricAlertRule_Comparison */
+    double threshold;       /* alert is raised when the value crosses this */
+    double clear_threshold; /* ... and cleared when it crosses back over this (hysteresis) */
+    int severity;           /* CIM_AlertIndication PerceivedSeverity to report */
+    bool enabled;
+} metric_alert_rule;
+
+typedef struct _metric_alert_rule_set {
+    int size;
+    metric_alert_rule *contents[];
+} metric_alert_rule_set;
+
+/* Rule (de)serialization and persistence, shared by the Xen_MetricAlertRule
+   instance provider and the Xen_MetricAlert indication provider */
+metric_alert_rule *metric_alert_rule_from_string(const char *name, const char *str);
+char *metric_alert_rule_to_string(metric_alert_rule *rule);
+void metric_alert_rule_free(metric_alert_rule *rule);
+int metric_alert_rules_get_all(xen_utils_session *session, metric_alert_rule_set **rules);
+void metric_alert_rule_set_free(metric_alert_rule_set *rules);
+bool metric_alert_rule_matches(metric_alert_rule *rule, bool host, const char *uuid, const char *data_source);
+
+#endif /*__XEN_METRICALERT_H__*/
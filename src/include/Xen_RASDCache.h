@@ -0,0 +1,68 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_RASDCACHE_H__
+#define __XEN_RASDCACHE_H__
+
+#include "xen_utils.h"
+
+/* Number of parsed RASD templates kept around, can be overridden
+   with the XEN_CIM_RASD_CACHE_SIZE environment variable (0 disables) */
+#define RASD_CACHE_DEFAULT_SIZE 64
+
+/* A template refers to SRs and networks by ref, which can go away under
+   us. Templates are dropped this many seconds after they were parsed. */
+#define RASD_CACHE_SECONDS 60
+
+/*
+ * Cache key for an embedded RASD string. The properties that typically
+ * differ between otherwise identical RASDs (ElementName, InstanceID and
+ * Address) are left out of the key and kept aside, so that they can be
+ * applied on top of the cached template on a hit. The refs in a template
+ * only mean something to the pool they came from, so the pool is part
+ * of the key.
+ */
+typedef struct _rasd_cache_key {
+    char *text;              /* normalized RASD text, without the per-device values */
+    char *pool;              /* host url of the session */
+    unsigned long hash;
+    bool strict_checks;
+    char *element_name;      /* per-device values, NULL if absent from the RASD */
+    char *instance_id;
+    char *address;
+} rasd_cache_key;
+
+typedef enum {
+    rasd_cache_disk = 0,
+    rasd_cache_network
+} rasd_cache_type;
+
+/* The parsed, provider-side form of a disk or network RASD */
+typedef struct _rasd_cache_devices {
+    rasd_cache_type type;
+    xen_vbd_record *vbd_rec;  /* disk */
+    xen_vdi_record *vdi_rec;  /* disk */
+    xen_sr sr;                /* disk, can be NULL */
+    xen_vif_record *vif_rec;  /* network */
+} rasd_cache_devices;
+
+bool rasd_cache_key_init(const char *rasd_str, const char *pool, bool strict_checks,
+                         rasd_cache_key *key);
+void rasd_cache_key_cleanup(rasd_cache_key *key);
+bool rasd_cache_lookup(rasd_cache_key *key, rasd_cache_devices *devices);
+void rasd_cache_insert(rasd_cache_key *key, rasd_cache_devices *devices);
+
+#endif /*__XEN_RASDCACHE_H__*/
@@ -32,10 +32,14 @@
 
 #define XEN_CLASS_NAMESPACE "root/cimv2"
 
+/* Region allocator scoped to a single CIM operation, see xen_utils.h */
+typedef struct _xen_utils_arena xen_utils_arena;
+
 struct xen_call_context
 {
      char *user;
      char *pw;
+     xen_utils_arena *arena;  /* everything allocated on behalf of this call */
 };
 
 int xen_utils_get_call_context(
@@ -182,6 +186,9 @@ CMPIInstanceMI* pn##_Create_InstanceMI(const CMPIBroker* brkr, \
 /* ------------------------------------------------------------------------- */
 /* Optimized CMPILIFY 1RO instance provider abstract resource API.           */
 /* ------------------------------------------------------------------------- */
+/* The one instance is built once per namespace and then kept frozen (see    */
+/* xen_frozen.h), get() is called without the caller's context: it must be   */
+/* the same for every caller.                                                */
 typedef struct {
    CMPIrc (*load)();
    CMPIrc (*unload)(const int terminating);
@@ -39,11 +39,13 @@
 
 /* Setup _SBLIM_TRACE() macros. */
 
+/* Strips the parentheses off the (fmt, ...) argument list of _SBLIM_TRACE() */
+#define _SBLIM_TRACE_ARGS( ... ) __VA_ARGS__
+
+/* Nothing gets formatted unless LEVEL is being traced. */
 #define _SBLIM_TRACE( LEVEL, STR )                      \
-   if ((LEVEL <= _SBLIM_TRACE_LEVEL) && (LEVEL > 0)){   \
-      char *msg = _sblim_format_trace STR;              \
-      _sblim_trace(LEVEL, __FILE__, __LINE__, msg);     \
-      free(msg);                                        \
+   if (__builtin_expect((LEVEL <= _SBLIM_TRACE_LEVEL) && (LEVEL > 0), 0)){ \
+      _sblim_trace_log(LEVEL, __FILE__, __LINE__, _SBLIM_TRACE_ARGS STR); \
    }
 
 #define _SBLIM_ENTER( f ) \
@@ -85,6 +87,8 @@
 
 extern int _SBLIM_TRACE_LEVEL;
 extern void _sblim_trace( int level, char * file, int line, char * msg );
+extern void _sblim_trace_log( int level, const char * file, int line, const char * fmt, ... )
+   __attribute__((format(printf, 4, 5)));
 extern char * _sblim_format_trace( char * fmt, ... );
 
 
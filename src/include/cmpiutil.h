@@ -69,7 +69,7 @@ typedef char * (*_CMPIKeyValExtractFunc_t)(char *, const char *, size_t);
 
 /* Create InstanceID strings of the right form */
 int _CMPICreateNewSystemInstanceID(char *buf, int buf_len, char *systemid);
-int _CMPICreateNewDeviceInstanceID(char *buf, int buf_len, char *systemid, char *deviceid);
+int _CMPICreateNewDeviceInstanceID(char *buf, int buf_len, const char *systemid, const char *deviceid);
 /*
  * Return the 'system' component of InstanceID property values.
  * The system name will be returned in buffer buf of buf_len.
@@ -6,6 +6,7 @@
 #include <cmpitrace.h>
 #include <stdio.h>
 #include <xen_utils.h>
+#include <xen_query.h>
 #include <provider_common.h>
 #include <dmtf.h>
 
@@ -20,25 +21,54 @@
 typedef struct
 {
     const CMPIBroker *broker;
-    const char *classname;      /* Name of the CIM class the provider is working with */
+    const char *classname;      /* Name of the CIM class the provider is working with (interned) */
     xen_utils_session *session; /* xen session */
     bool cleanupsession;        /* should the session be cleaned up or not after the method is done */
     void *ctx;                  /* provider specific resource */
     bool ref_only;              /* just get the key properties */
+    xen_utils_arena *arena;     /* allocator for the CIM operation, can be NULL */
+    xen_utils_arena_mark arena_mark; /* arena position before this resource was allocated */
 } provider_resource;
 
+/* Longest position of a paged enumeration, including the terminator */
+#define XEN_POSITION_LEN 128
+
 typedef struct
 {
     const CMPIBroker *broker;
-    const char *classname;      /* Name of the CIM class the provider is working with */
+    const char *classname;      /* Name of the CIM class the provider is working with (interned) */
     int current_resource;       /* index of the current resource - used during enumeration */
     xen_utils_session *session; /* xen session */
     void *ctx;                  /* provider specific resource */
     bool ref_only;              /* just get the key properties */
+    xen_utils_arena *arena;     /* allocator for the CIM operation, can be NULL */
+    const xen_query *query;     /* conditions every result of an ExecQuery meets, NULL if none.
+                                   Providers may skip the resources that don't */
+    int page_size;              /* most objects a paging provider fetches at a time, 0 for no limit */
+    char position[XEN_POSITION_LEN]; /* where a paging provider's next page starts, empty when
+                                   there are no more */
 } provider_resource_list;
 
+/* Scratch memory that lives as long as the provider resource it's allocated for.
+   It comes from the CIM operation's arena, if there is one, and is released
+   along with the resource */
+#define PROV_RES_ALLOC(__res, __type)                                         \
+    ((__res)->arena ? (__type *)xen_utils_arena_alloc_for((__res)->arena, &(__res)->arena_mark, sizeof(__type)) \
+                    : (__type *)calloc(1, sizeof(__type)))
+#define PROV_RES_FREE(__res, __ptr)                                           \
+{                                                                             \
+    if ((__res)->arena == NULL)                                               \
+        free(__ptr);                                                          \
+}
+
 /* ------------------------------------------------------------------------- */
 /* Generic instance provider abstract resource API.                 */
+/*                                                                           */
+/* A provider whose list_enum would otherwise hold a lot of data (not just   */
+/* refs) may fetch it in pages instead. list_enum then fetches the first     */
+/* page_size or so objects, getnext returns NOT_FOUND at the end of the      */
+/* page, and list_next_page replaces the page with the one at position.      */
+/* Either leaves position set to where the page after starts.                */
 /* ------------------------------------------------------------------------- */
 typedef struct {
     const char *(*xen_resource_get_key_property)(
@@ -85,6 +115,9 @@ typedef struct {
                 void **res, 
                 const CMPIInstance *inst, 
                 const char **properties);
+    CMPIrc (*xen_resource_list_next_page)(
+                xen_utils_session *session,
+                provider_resource_list *resources);
 } XenProviderInstanceFT;
 
 /* ------------------------------------------------------------------------- */
@@ -104,6 +137,7 @@ static XenProviderInstanceFT _XenInstanceProviderFT = { \
    NULL, \
    NULL, \
    NULL, \
+   NULL, \
 }; \
 \
 CMPI_EXTERN_C XenProviderInstanceFT* pn##_Load_Instance_Provider()\
@@ -126,6 +160,30 @@ static XenProviderInstanceFT _XenInstanceProviderFT = { \
    xen_resource_delete, \
    xen_resource_modify, \
    xen_resource_extract, \
+   NULL, \
+}; \
+\
+CMPI_EXTERN_C XenProviderInstanceFT* pn##_Load_Instance_Provider()\
+{\
+\
+   return &_XenInstanceProviderFT;\
+}
+
+#define XenPagedInstanceMIStub(pn) \
+static XenProviderInstanceFT _XenInstanceProviderFT = { \
+   xen_resource_get_key_property,\
+   xen_resource_get_keys,\
+   xen_resource_list_enum, \
+   xen_resource_list_cleanup, \
+   xen_resource_record_getnext, \
+   xen_resource_record_cleanup, \
+   xen_resource_record_get_from_id, \
+   xen_resource_set_properties, \
+   NULL, \
+   NULL, \
+   NULL, \
+   NULL, \
+   xen_resource_list_next_page, \
 }; \
 \
 CMPI_EXTERN_C XenProviderInstanceFT* pn##_Load_Instance_Provider()\
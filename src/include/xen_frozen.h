@@ -0,0 +1,69 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_FROZEN_H__
+#define __XEN_FROZEN_H__
+
+#include <cmpidt.h>
+#include <cmpift.h>
+#include <cmpimacs.h>
+
+/*
+ * Instances of the classes that are the same in every pool and for every
+ * caller, like the virtualization capabilities or the registered profiles.
+ * They are built once per namespace, by the provider at load or the first
+ * time they're asked for, and kept for the life of the process. Serving one
+ * is then a matter of cloning the kept instance, there's no xapi session
+ * and none of the provider's code involved.
+ *
+ * Only a class none of whose properties come from xapi may be frozen: its
+ * instances are returned without checking the caller's credentials against
+ * the pool.
+ */
+typedef struct _xen_frozen_class xen_frozen_class;
+
+/* The frozen instances of a class, NULL if it hasn't been frozen in ns */
+const xen_frozen_class *xen_frozen_find(const char *ns, const char *classname);
+
+/*
+ * Freezes the 'count' instances of a class. Copies of them are kept, the
+ * caller still owns the instances passed in. If another thread froze the
+ * class first, its instances are the ones kept. Returns NULL if the
+ * instances couldn't be copied.
+ */
+const xen_frozen_class *xen_frozen_add(
+    const char *ns,
+    const char *classname,
+    CMPIInstance **instances,
+    int count);
+
+/* The kept instances, not to be modified or released */
+int xen_frozen_count(const xen_frozen_class *cls);
+const CMPIInstance *xen_frozen_get(const xen_frozen_class *cls, int i);
+
+/* The kept instance with the keys of op, NULL if there's none */
+const CMPIInstance *xen_frozen_lookup(const xen_frozen_class *cls, const CMPIObjectPath *op);
+
+/*
+ * A copy of a kept instance to return, with only 'properties' (and the
+ * keys) if properties isn't NULL. To be released by the caller.
+ */
+CMPIInstance *xen_frozen_clone(
+    const CMPIInstance *inst,
+    const char **properties,
+    const char **keys);
+
+#endif /*__XEN_FROZEN_H__*/
@@ -0,0 +1,81 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_HOSTS_H__
+#define __XEN_HOSTS_H__
+
+#include "xen_utils.h"
+
+/*
+ * A directory of the hosts of a pool, with what the providers need to
+ * name the host a VM is resident on or to talk to it. A pool has a few
+ * dozen hosts but thousands of VMs, so rather than look the host up for
+ * every VM, the providers share one directory per pool (per master URL),
+ * fetched with a single get_all_records.
+ *
+ * Every fetch is a new generation of the directory. A generation is used
+ * for XEN_HOST_DIRECTORY_SECONDS, or until a host turns up that isn't in
+ * it, whichever comes first. A caller holds on to the generation it got
+ * for as long as it uses its entries.
+ */
+#define XEN_HOST_DIRECTORY_SECONDS 60
+
+typedef struct {
+    char *host;                                 /* ref */
+    char *uuid;
+    char *name_label;
+    char *hostname;
+    char *address;
+    char *metrics;                              /* ref, NULL if there's none */
+    xen_string_string_map *software_version;
+} xen_host_entry;
+
+typedef struct _xen_host_directory xen_host_directory;
+
+/*
+ * The current generation of the directory of the session's pool, to be
+ * released. Returns NULL if the hosts couldn't be fetched, the error is
+ * left in the session.
+ */
+xen_host_directory *xen_host_directory_get(xen_utils_session *session);
+void xen_host_directory_release(xen_host_directory *dir);
+
+/* Lookups in one generation, NULL if it doesn't have the host */
+const xen_host_entry *xen_host_directory_find(const xen_host_directory *dir, xen_host host);
+const xen_host_entry *xen_host_directory_find_uuid(const xen_host_directory *dir, const char *uuid);
+
+/* The hosts of one generation, by ref, for going through all of them */
+int xen_host_directory_count(const xen_host_directory *dir);
+const xen_host_entry *xen_host_directory_entry(const xen_host_directory *dir, int i);
+
+/*
+ * The entry of a host, by ref or by uuid. *dir is the generation to look
+ * in, NULL for the current one. If the host isn't in it, a newer one is
+ * fetched, unless the generation is less than a second old. On return
+ * *dir is the generation the entry is in, to be released once done with
+ * the entry (even if there's no entry). Returns NULL if there's no such
+ * host, or the hosts couldn't be fetched (the error is traced and reset).
+ */
+const xen_host_entry *xen_host_directory_lookup(
+    xen_utils_session *session,
+    xen_host_directory **dir,
+    xen_host host);
+const xen_host_entry *xen_host_directory_lookup_uuid(
+    xen_utils_session *session,
+    xen_host_directory **dir,
+    const char *uuid);
+
+#endif /*__XEN_HOSTS_H__*/
@@ -0,0 +1,48 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_PROBES_H__
+#define __XEN_PROBES_H__
+
+/*
+ * USDT static tracepoints, provider 'xscim'.
+ *
+ * Each probe is a single nop in the instruction stream plus a note in the
+ * ELF file; systemtap or bpftrace patch it into a breakpoint only while
+ * something is attached, so they cost next to nothing the rest of the time.
+ * configure turns them on (XEN_CIM_USDT) when sys/sdt.h is available.
+ * The probes and their arguments are listed in test/bpftrace/README.
+ */
+#ifdef XEN_CIM_USDT
+#include <sys/sdt.h>
+
+#define XEN_PROBE0(name)                   DTRACE_PROBE(xscim, name)
+#define XEN_PROBE1(name, a1)               DTRACE_PROBE1(xscim, name, a1)
+#define XEN_PROBE2(name, a1, a2)           DTRACE_PROBE2(xscim, name, a1, a2)
+#define XEN_PROBE3(name, a1, a2, a3)       DTRACE_PROBE3(xscim, name, a1, a2, a3)
+#define XEN_PROBE4(name, a1, a2, a3, a4)   DTRACE_PROBE4(xscim, name, a1, a2, a3, a4)
+
+#else
+
+#define XEN_PROBE0(name)                   do {} while (0)
+#define XEN_PROBE1(name, a1)               do {} while (0)
+#define XEN_PROBE2(name, a1, a2)           do {} while (0)
+#define XEN_PROBE3(name, a1, a2, a3)       do {} while (0)
+#define XEN_PROBE4(name, a1, a2, a3, a4)   do {} while (0)
+
+#endif /* XEN_CIM_USDT */
+
+#endif /*__XEN_PROBES_H__*/
@@ -0,0 +1,54 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_QUERY_H__
+#define __XEN_QUERY_H__
+
+/*
+ * The parts of a WQL or CQL query that can be pushed down to xapi.
+ *
+ * Only the conditions that every matching instance has to satisfy are
+ * extracted, the 'property = literal' terms ANDed together at the top of
+ * the WHERE clause. A query with an OR at the top has none. The ExecQuery
+ * implementations use them to narrow down the resources they look at (a
+ * key equality turns into a get, other equalities into a filter that the
+ * instance provider may apply to the xapi records), and still evaluate the
+ * whole query on the instances built from what's left, so a provider that
+ * ignores them gives the same results, only slower.
+ */
+#define XEN_QUERY_MAX_TERMS 16
+
+typedef struct {
+    char *property;     /* as written, without any class qualifier */
+    char *value;        /* the literal, unquoted. TRUE and FALSE as "true" and "false" */
+} xen_query_term;
+
+typedef struct {
+    int term_count;
+    xen_query_term terms[XEN_QUERY_MAX_TERMS];
+} xen_query;
+
+/*
+ * Extracts the pushable conditions of 'query'.
+ * Returns NULL if there's nothing to push down (or no memory).
+ */
+xen_query *xen_query_analyse(const char *query);
+void xen_query_free(xen_query *q);
+
+/* The value 'property' (case insensitive) must have, NULL if there's no such condition */
+const char *xen_query_get(const xen_query *q, const char *property);
+
+#endif /*__XEN_QUERY_H__*/
@@ -0,0 +1,80 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef __XEN_RRD_H__
+#define __XEN_RRD_H__
+
+#include <time.h>
+#include <curl/curl.h>
+#include "xen_utils.h"
+
+/*
+ * Snapshots of the cpu utilisation of a host and the VMs running on it.
+ *
+ * A single rrd_updates request to a host returns the latest value of all
+ * its data sources and those of its resident VMs, the cpuN ones among
+ * them. The cpu values are kept for XEN_RRD_SNAPSHOT_SECONDS (one rrd
+ * step), so an enumeration of the processors of a pool costs a request
+ * per host rather than a query_data_source call per cpu.
+ */
+#define XEN_RRD_SNAPSHOT_SECONDS 5
+
+/* How long an rrd_updates request may take before it is given up on */
+#define XEN_RRD_TIMEOUT_SECONDS 10
+
+typedef struct {
+    int size;           /* one more than the highest cpu number */
+    double *load;       /* load[n] is the utilisation of cpuN, 0.0 to 1.0, and
+                           negative if the host didn't report it */
+} xen_cpu_utilisation;
+
+/*
+ * The utilisation of the cpus of the host with the given uuid, or of the
+ * vcpus of the VM with the given uuid, running on host.
+ * Returns NULL if the host couldn't be reached or doesn't report on the
+ * host or VM (the VM isn't running there, say).
+ */
+xen_cpu_utilisation *xen_rrd_get_cpu_utilisation(
+    xen_utils_session *session,
+    xen_host host,
+    const char *uuid);
+
+void xen_rrd_cpu_utilisation_free(xen_cpu_utilisation *utilisation);
+
+/* The load of cpu n, 'otherwise' if it isn't known */
+double xen_rrd_cpu_load(const xen_cpu_utilisation *utilisation, int n, double otherwise);
+
+/*
+ * The raw rrd_updates Xport XML of the host at 'address' and its resident
+ * VMs, since 'start'. 'curl' is a handle to reuse across requests, NULL
+ * for a one off request. Returns NULL if the request failed, the caller
+ * frees the XML.
+ */
+char *xen_rrd_get_updates(
+    CURL *curl,
+    xen_utils_session *session,
+    const char *address,
+    time_t start);
+
+/*
+ * The text of the next <tag>text</tag> of the XML after *pos, no further
+ * than 'limit' if it isn't NULL. The text is terminated in place and *pos
+ * moved past it.
+ */
+char *xen_rrd_next_element(char **pos, const char *tag, const char *limit);
+
+#endif /*__XEN_RRD_H__*/
@@ -0,0 +1,130 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_STATS_H__
+#define __XEN_STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * Per operation statistics for the providers.
+ *
+ * Every CIM operation is accounted against its class (and method, for
+ * InvokeMethod): the number of calls, errors and instances, the xapi RPCs
+ * it made along with the bytes sent and received, the time spent in each
+ * phase of the provider interface and a log-linear latency histogram.
+ * Counters are kept per thread and only the owning thread ever updates
+ * them, so accounting costs a couple of clock reads and plain stores.
+ * They are merged when someone asks for them, through the
+ * Xen_ProviderStatistics class or a text dump on a signal.
+ *
+ * Counters are per process. The CIM server may run the association
+ * providers in a process of their own, in which case Xen_ProviderStatistics
+ * (an instance provider) doesn't see their counters; the dump of that
+ * process has them.
+ *
+ * Environment:
+ *   XEN_CIM_STATISTICS=0           turns accounting off
+ *   XEN_CIM_STATISTICS_SIGNAL      signal that dumps the statistics (none by default)
+ *   XEN_CIM_STATISTICS_DIR         where the dumps go (default XEN_STATS_DEFAULT_DIR), a
+ *                                  directory private to the CIM server, one file per
+ *                                  process and dump
+ */
+#define XEN_STATS_DEFAULT_DIR "/var/run/xen-cim-statistics"
+
+typedef enum {
+    xen_stats_op_enum_instance_names = 0,
+    xen_stats_op_enum_instances,
+    xen_stats_op_get_instance,
+    xen_stats_op_create_instance,
+    xen_stats_op_modify_instance,
+    xen_stats_op_delete_instance,
+    xen_stats_op_exec_query,
+    xen_stats_op_invoke_method,
+    xen_stats_op_associators,
+    xen_stats_op_associator_names,
+    xen_stats_op_references,
+    xen_stats_op_reference_names,
+    xen_stats_op_other,             /* work done outside of a CIM operation (jobs, indications) */
+    xen_stats_op_count
+} xen_stats_op;
+
+typedef enum {
+    xen_stats_phase_session = 0,    /* xen_utils_validate_session(), including login */
+    xen_stats_phase_list_enum,      /* xen_resource_list_enum() */
+    xen_stats_phase_getnext,        /* xen_resource_record_getnext() */
+    xen_stats_phase_get,            /* xen_resource_record_get_from_id() */
+    xen_stats_phase_set_properties, /* xen_resource_set_properties() */
+    xen_stats_phase_cleanup,        /* resource and resource list cleanup */
+    xen_stats_phase_count
+} xen_stats_phase;
+
+/* Latencies are bucketed in microseconds, 4 buckets per power of 2 */
+#define XEN_STATS_HIST_SUB_BITS 2
+#define XEN_STATS_HIST_BUCKETS  148
+
+typedef struct _xen_stats_record {
+    const char *classname;          /* interned */
+    const char *method;             /* interned, NULL unless op is xen_stats_op_invoke_method */
+    xen_stats_op op;
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t instances;
+    uint64_t rpcs;
+    uint64_t rpc_bytes_sent;
+    uint64_t rpc_bytes_received;
+    uint64_t rpc_ns;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t phase_ns[xen_stats_phase_count];
+    uint64_t histogram[XEN_STATS_HIST_BUCKETS];
+} xen_stats_record;
+
+typedef struct {
+    size_t size;
+    time_t start_time;              /* when accounting started */
+    xen_stats_record contents[];
+} xen_stats_record_set;
+
+/* One of these lives on the stack of each CIM operation entry point */
+typedef struct _xen_stats_call {
+    xen_stats_record *record;
+    struct _xen_stats_call *prev;   /* operation this one is nested in, if any */
+    uint64_t start;
+    xen_stats_op op;                /* the rest are for the op__return probe */
+    const char *classname;
+    const char *method;
+} xen_stats_call;
+
+uint64_t xen_stats_now();
+void xen_stats_call_begin(xen_stats_call *call, xen_stats_op op, const char *classname, const char *method);
+void xen_stats_call_end(xen_stats_call *call, int rc);
+void xen_stats_phase_end(xen_stats_phase phase, uint64_t start);
+void xen_stats_instance();
+void xen_stats_rpc(uint64_t start, size_t bytes_sent, size_t bytes_received);
+
+int xen_stats_get_all(xen_stats_record_set **set);
+void xen_stats_record_set_free(xen_stats_record_set *set);
+const char *xen_stats_op_name(xen_stats_op op);
+const char *xen_stats_phase_name(xen_stats_phase phase);
+uint64_t xen_stats_bucket_upper_bound(int bucket);
+uint64_t xen_stats_percentile(const xen_stats_record *record, double percentile);
+void xen_stats_dump(FILE *out);
+
+#endif /*__XEN_STATS_H__*/
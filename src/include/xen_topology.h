@@ -0,0 +1,148 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef __XEN_TOPOLOGY_H__
+#define __XEN_TOPOLOGY_H__
+
+#include "xen_utils.h"
+
+/*
+ * Snapshots of how the objects of a pool hang together, taken with a
+ * handful of get_all_records calls so that the providers can walk them
+ * without a call per object.
+ *
+ * The network topology has every PIF with its host, metrics, network,
+ * the master PIF of the bond it is a slave of and the tagged PIF of the
+ * VLAN it is the master of. The PIFs are sorted by host and device.
+ *
+ * The storage topology has every SR with the PBDs that plug it into the
+ * hosts, and the host of each PBD. Whether the PBD is currently attached
+ * is in its record.
+ *
+ * A snapshot is as old as the call that took it, providers take one per
+ * request and don't keep it across requests.
+ */
+typedef struct _xen_net_pif {
+    xen_pif pif;                        /* ref */
+    xen_pif_record *rec;
+    xen_host host;                      /* ref, NULL if the PIF has none */
+    xen_host_record *host_rec;          /* NULL if it couldn't be found */
+    xen_pif_metrics_record *metrics;    /* NULL if it couldn't be found */
+    xen_network_record *network;        /* NULL if it couldn't be found */
+    struct _xen_net_pif *bond_master;   /* of the bond it is a slave of, NULL if none */
+    struct _xen_net_pif *vlan_tagged;   /* physical PIF under this VLAN PIF, NULL if none */
+} xen_net_pif;
+
+typedef struct {
+    int pif_count;
+    xen_net_pif *pifs;                  /* by host and device */
+    xen_net_pif **by_ref;               /* the same, by PIF ref */
+    /* the records the PIFs point into */
+    xen_pif_xen_pif_record_map *pif_map;
+    xen_host_xen_host_record_map *host_map;
+    xen_pif_metrics_xen_pif_metrics_record_map *metrics_map;
+    xen_network_xen_network_record_map *network_map;
+    xen_bond_xen_bond_record_map *bond_map;
+    xen_vlan_xen_vlan_record_map *vlan_map;
+} xen_net_topology;
+
+/*
+ * The network topology of the whole pool. Returns NULL if the PIFs
+ * couldn't be listed, or the bonds of the bond slaves couldn't be found,
+ * the error is left in the session. The other records are optional, a
+ * PIF whose host, metrics or network couldn't be fetched has NULL for it.
+ */
+xen_net_topology *xen_net_topology_new(xen_utils_session *session);
+
+/*
+ * Just the PIF with the given uuid, along with its bond master and
+ * VLAN tagged PIF, fetched one object at a time. Cheaper than the whole
+ * pool for looking at one PIF.
+ */
+xen_net_topology *xen_net_topology_new_for_pif(xen_utils_session *session, const char *uuid);
+
+void xen_net_topology_free(xen_net_topology *topo);
+
+/* Lookups, NULL if there's no such PIF */
+xen_net_pif *xen_net_topology_find(xen_net_topology *topo, xen_pif pif);
+xen_net_pif *xen_net_topology_find_uuid(xen_net_topology *topo, const char *uuid);
+
+/*
+ * Hands the PIF's record over to the caller, who then has to free it,
+ * but not before it is done with the topology: the PIF still points to
+ * the record.
+ */
+xen_pif_record *xen_net_topology_take_record(xen_net_topology *topo, xen_net_pif *pif);
+
+typedef struct {
+    xen_pbd pbd;                        /* ref */
+    xen_pbd_record *rec;
+    xen_host host;                      /* ref, NULL if the PBD has none */
+    xen_host_record *host_rec;          /* NULL if it couldn't be found */
+} xen_storage_pbd;
+
+typedef struct {
+    xen_sr sr;                          /* ref */
+    xen_sr_record *rec;
+    /* BUGBUG: An SR counts as shared unless its record lists exactly one
+       PBD, the way the StoragePool InstanceIDs have always been made. */
+    bool shared;
+    int pbd_count;
+    xen_storage_pbd *pbds;              /* in the topology's PBDs, by host,
+                                           only those that were fetched */
+} xen_storage_sr;
+
+typedef struct {
+    int sr_count;
+    xen_storage_sr *srs;                /* by SR ref */
+    int pbd_count;
+    xen_storage_pbd *pbds;              /* by SR and host */
+    /* the records the SRs and PBDs point into */
+    xen_sr_xen_sr_record_map *sr_map;
+    xen_pbd_xen_pbd_record_map *pbd_map;
+    xen_host_xen_host_record_map *host_map;
+} xen_storage_topology;
+
+/*
+ * The storage topology of the whole pool, with the PBDs and their hosts
+ * if hosts is set, otherwise just the SRs. Returns NULL if the SRs
+ * couldn't be listed, the error is left in the session. An SR whose PBDs
+ * couldn't be fetched has none, a PBD whose host couldn't be fetched has
+ * NULL for it.
+ */
+xen_storage_topology *xen_storage_topology_new(xen_utils_session *session, bool hosts);
+
+/*
+ * Just the SR with the given uuid. With hosts set, a local SR also gets
+ * its PBD and host; a shared SR never has them, there's no single host.
+ */
+xen_storage_topology *xen_storage_topology_new_for_sr(xen_utils_session *session, const char *uuid, bool hosts);
+
+/* The host of a local SR, for the caller to free. NULL for a shared SR or
+   if it couldn't be fetched. */
+xen_host_record *xen_storage_local_host(xen_utils_session *session, xen_sr_record *sr_rec);
+
+void xen_storage_topology_free(xen_storage_topology *topo);
+
+/* Lookups, NULL if there's no such SR */
+xen_storage_sr *xen_storage_topology_find(xen_storage_topology *topo, xen_sr sr);
+xen_storage_sr *xen_storage_topology_find_uuid(xen_storage_topology *topo, const char *uuid);
+
+/* The PBD plugging the SR into a host, NULL if there's none */
+xen_storage_pbd *xen_storage_topology_host_pbd(xen_storage_sr *sr, xen_host host);
+
+#endif /*__XEN_TOPOLOGY_H__*/
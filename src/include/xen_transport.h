@@ -0,0 +1,70 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __XEN_TRANSPORT_H__
+#define __XEN_TRANSPORT_H__
+
+#include <stddef.h>
+#include <curl/curl.h>
+
+/*
+ * All the HTTP traffic to xapi goes through xen_transport_perform(): the
+ * XML-RPC calls, the KVP plugin and rrd_updates. Normally it just runs
+ * the curl request. It can also record every request and its response to
+ * a file during a live session, and later answer the same requests from
+ * that file without a network, so a trace taken on a real pool can be
+ * replayed to benchmark the providers against it.
+ *
+ * Environment:
+ *   XEN_CIM_TRANSPORT=record:<file>    record all traffic to <file>
+ *   XEN_CIM_TRANSPORT=replay:<file>    answer all requests from <file>
+ *
+ * The file is a gzip stream of records, each being a line with the curl
+ * result, the HTTP status and the lengths of the request and the
+ * response, followed by the request ("<method> <url>\n<body>") and the
+ * response. Replay matches requests byte for byte, apart from the start
+ * and end times in the query string of the rrd_updates URLs. A request
+ * seen several times is answered with the recorded responses in order,
+ * and the last one from then on (think task polling). A request not in
+ * the file fails as if xapi couldn't be reached.
+ *
+ * Recordings are meant to be taken off the pool. The user name and the
+ * password of the logins are written as "redacted", and the session refs
+ * as "OpaqueRef:recorded-session-<n>", n counting the logins. The file is
+ * created readable by its owner only, and an existing file is never
+ * overwritten.
+ */
+
+/* Same as a curl write callback */
+typedef size_t (*xen_transport_write_func)(void *ptr, size_t size, size_t nmemb, void *handle);
+
+/*
+ * Runs a request that the caller has set up on 'curl' (URL, method, body
+ * and the like). The response goes to 'write', or nowhere if it is NULL.
+ * 'url' and 'body' identify the request in the recording, 'http_code'
+ * gets the HTTP status if it isn't NULL.
+ */
+CURLcode xen_transport_perform(
+    CURL *curl,
+    const char *method,
+    const char *url,
+    const void *body,
+    size_t body_len,
+    xen_transport_write_func write,
+    void *write_handle,
+    long *http_code);
+
+#endif /*__XEN_TRANSPORT_H__*/
@@ -65,6 +65,7 @@ typedef struct {
     unsigned int numdomains;     /* Totoal number of domains */
     unsigned int currentdomain;  /* Current domain in the list */
     enum domain_choice choice; /* do we want to enumerate templates/vms/snapshots/all */
+    int power_state;           /* only the domains in this enum xen_vm_power_state, -1 for any */
 } xen_domain_resources;
 
     #define INSTANCEID_SEPARATOR_CHAR '/' /* used to spearate out the elements that make up an instanceID string */
@@ -234,6 +235,41 @@ void xen_utils_xen_close();
 int xen_utils_get_call_context(const CMPIContext *cmpi_ctx, struct xen_call_context **ctx, CMPIStatus* status);
 void xen_utils_free_call_context(struct xen_call_context *ctx);
 
+/*
+ * Arena allocator for memory that lives as long as a single CIM operation.
+ * One is created along with the call context and freed with it, providers
+ * get to it through their provider_resource(_list). Allocations are zeroed
+ * and are never freed individually, rewind to a mark or free the arena.
+ * Rewinding only gives memory back when it is safe to, when the mark's
+ * allocations are the last ones made (see xen_utils.c), otherwise it is
+ * kept until the arena is freed.
+ */
+typedef struct _xen_utils_arena_block xen_utils_arena_block;
+typedef struct {
+    xen_utils_arena_block *block;
+    size_t used;
+    unsigned long frame;        /* 0 for no mark */
+    unsigned long enclosing;    /* the frame open when the mark was taken */
+} xen_utils_arena_mark;
+
+xen_utils_arena *xen_utils_arena_new();
+void *xen_utils_arena_alloc(xen_utils_arena *arena, size_t size);
+void *xen_utils_arena_alloc_for(xen_utils_arena *arena, const xen_utils_arena_mark *mark, size_t size);
+char *xen_utils_arena_strdup(xen_utils_arena *arena, const char *str);
+xen_utils_arena_mark xen_utils_arena_get_mark(xen_utils_arena *arena);
+void xen_utils_arena_rewind(xen_utils_arena *arena, xen_utils_arena_mark mark);
+void xen_utils_arena_free(xen_utils_arena *arena);
+
+/*
+ * Process wide pool of immutable strings drawn from a bounded set (CIM
+ * class, property and method names). Interning the same contents twice
+ * gives back the same pointer, so interned strings can be compared with
+ * XEN_INTERNED_EQ instead of strcmp(). Interned strings are never freed,
+ * so per-object strings such as xapi refs and UUIDs must not be interned.
+ */
+const char *xen_utils_intern(const char *str);
+#define XEN_INTERNED_EQ(__a, __b) ((__a) == (__b))
+
 /*
  * Validate xen session.  If sesssion is null, create one.
  * Session is ready for use on success.
@@ -258,12 +294,29 @@ int xen_utils_get_domain_resources(xen_utils_session *session,
     xen_domain_resources **resources,
     enum domain_choice temlates_or_vms);
 
+/*
+ * Same as xen_utils_get_domain_resources(), for only the domains called
+ * name_label (unless it is NULL) and in power_state (unless it is -1).
+ * This is how the conditions of an ExecQuery get to xapi.
+ */
+int xen_utils_get_domain_resources_where(xen_utils_session *session,
+    xen_domain_resources **resources,
+    enum domain_choice temlates_or_vms,
+    const char *name_label,
+    int power_state);
+
 /*
  * Free the list of domain resources.
  * Returns non-zero on success, 0 on failure.
  */
 int xen_utils_free_domain_resources(xen_domain_resources *resources);
 
+/*
+ * Whether a domain is one of those enumerated for choice (a template, a
+ * snapshot or a VM), for looking one up the way it is enumerated.
+ */
+bool xen_utils_domain_is_choice(xen_vm_record *vm_rec, enum domain_choice choice);
+
 /*
  * Retrieve the next domain from the list of domain resources.
  * Returns non-zero on success, 0 on failure.
@@ -363,6 +416,52 @@ int xen_utils_remove_from_string_string_map(
     xen_string_string_map **map
     );
 
+/*
+ * Open addressing hash index over a xen_string_string_map, for code paths
+ * that do more than a handful of lookups or updates on the same map.
+ * The index owns the map while it is in use, the map keeps the SDK layout
+ * (in no particular order) and is handed back by
+ * xen_utils_string_map_index_release() when it has to go over the wire.
+ */
+typedef struct _xen_utils_string_map_index {
+    xen_string_string_map *map;
+    int capacity;   /* entries allocated in map->contents */
+    int *slots;     /* positions in map->contents, or empty/deleted markers */
+    int num_slots;  /* always a power of 2 */
+    int used;       /* slots that are not empty, including deleted ones */
+} xen_utils_string_map_index;
+
+xen_utils_string_map_index *xen_utils_string_map_index_new(
+    xen_string_string_map *map);
+char *xen_utils_string_map_index_get(
+    xen_utils_string_map_index *index,
+    const char *key);
+int xen_utils_string_map_index_set(
+    xen_utils_string_map_index *index,
+    const char *key,
+    const char *val);
+int xen_utils_string_map_index_remove(
+    xen_utils_string_map_index *index,
+    const char *key);
+xen_string_string_map *xen_utils_string_map_index_release(
+    xen_utils_string_map_index *index);
+void xen_utils_string_map_index_free(
+    xen_utils_string_map_index *index);
+
+/*
+ * Joins between record maps (or arrays of structs that start with a ref).
+ * Sort the entries with xen_utils_compare_refs, then
+ * xen_utils_find_ref returns the index of the entry for ref, or -1.
+ */
+int xen_utils_compare_refs(
+    const void *a,
+    const void *b);
+int xen_utils_find_ref(
+    const void *contents,
+    size_t size,
+    size_t entry_size,
+    const char *ref);
+
 /*
  * Flatten a Xen API string-string map.  The flattened map will be in form
  * key0=value0,key1=value1,...,keyN=valueN
@@ -409,6 +508,7 @@ CMPIDateTime* xen_utils_CMPIDateTime_now(
 void xen_utils_trace_error(xen_session *session, char *file, int line);
 void xen_utils_set_status(const CMPIBroker *broker, CMPIStatus *status, int rc, char *default_msg, xen_session *session);
 char* xen_utils_get_xen_error(xen_session *session);
+bool xen_utils_error_is_not_found(xen_session *session);
 
 xen_vm_set* xen_utils_enum_domains(
     xen_utils_session *session,
@@ -422,6 +522,7 @@ int xen_utils_log_domains(xen_vm_set *vm_set);
 int64_t xen_utils_get_alloc_units(const char *allocStr);
 
 /* Utility functions to parse embedded instances in mof format */
+char *XmlToAsciiStr(const char *XmlStr);
 CMPIInstance *xen_utils_parse_embedded_instance(
     const CMPIBroker *broker, 
     const char *instanceStr);
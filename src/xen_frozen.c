@@ -0,0 +1,195 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include "xen_frozen.h"
+#include "cmpiutil.h"
+#include "cmpitrace.h"
+
+struct _xen_frozen_class {
+    char *ns;
+    char *classname;
+    int count;
+    CMPIInstance **instances;           /* clones, owned */
+    struct _xen_frozen_class *next;
+};
+
+/* A class is never taken off the list once on it, nor changed, so what
+   xen_frozen_find() returns can be used without the lock */
+static xen_frozen_class *frozen_classes = NULL;
+static pthread_mutex_t frozen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _free_class(xen_frozen_class *cls)
+{
+    int i;
+    for (i = 0; i < cls->count; i++)
+        if (cls->instances[i])
+            CMRelease(cls->instances[i]);
+    free(cls->instances);
+    free(cls->classname);
+    free(cls->ns);
+    free(cls);
+}
+
+/* Called with the lock held */
+static xen_frozen_class *_find(const char *ns, const char *classname)
+{
+    xen_frozen_class *cls;
+    for (cls = frozen_classes; cls; cls = cls->next)
+        if (strcmp(cls->ns, ns) == 0 && strcasecmp(cls->classname, classname) == 0)
+            return cls;
+    return NULL;
+}
+
+const xen_frozen_class *xen_frozen_find(
+    const char *ns,
+    const char *classname)
+{
+    xen_frozen_class *cls;
+    if (ns == NULL || classname == NULL)
+        return NULL;
+    pthread_mutex_lock(&frozen_lock);
+    cls = _find(ns, classname);
+    pthread_mutex_unlock(&frozen_lock);
+    return cls;
+}
+
+const xen_frozen_class *xen_frozen_add(
+    const char *ns,
+    const char *classname,
+    CMPIInstance **instances,
+    int count)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    xen_frozen_class *cls, *frozen;
+    int i;
+
+    if (ns == NULL || classname == NULL)
+        return NULL;
+    if ((cls = calloc(1, sizeof(xen_frozen_class))) == NULL ||
+        (cls->ns = strdup(ns)) == NULL ||
+        (cls->classname = strdup(classname)) == NULL ||
+        (cls->instances = calloc(count + 1, sizeof(CMPIInstance *))) == NULL)
+        goto Error;
+    /* cloned without the lock, two threads may both freeze the same class
+       now and then, the later one's instances are dropped */
+    for (i = 0; i < count; i++) {
+        cls->instances[i] = CMClone(instances[i], &status);
+        if (status.rc != CMPI_RC_OK || CMIsNullObject(cls->instances[i])) {
+            cls->instances[i] = NULL;
+            goto Error;
+        }
+        cls->count++;
+    }
+
+    pthread_mutex_lock(&frozen_lock);
+    if ((frozen = _find(ns, classname)) == NULL) {
+        cls->next = frozen_classes;
+        frozen_classes = cls;
+    }
+    pthread_mutex_unlock(&frozen_lock);
+    if (frozen) {
+        _free_class(cls);
+        return frozen;
+    }
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Froze %d instances of %s in %s",
+                                           count, classname, ns));
+    return cls;
+
+Error:
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Could not freeze the instances of %s", classname));
+    if (cls)
+        _free_class(cls);
+    return NULL;
+}
+
+int xen_frozen_count(
+    const xen_frozen_class *cls)
+{
+    return cls ? cls->count : 0;
+}
+
+const CMPIInstance *xen_frozen_get(
+    const xen_frozen_class *cls,
+    int i)
+{
+    if (cls == NULL || i < 0 || i >= cls->count)
+        return NULL;
+    return cls->instances[i];
+}
+
+/* Whether the key properties of inst have the values of the keys of op */
+static int _has_keys(
+    const CMPIInstance *inst,
+    const CMPIObjectPath *op)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    int numkeys, i;
+
+    numkeys = CMGetKeyCount(op, &status);
+    if (status.rc != CMPI_RC_OK || numkeys == 0)
+        return 0;
+    for (i = 0; i < numkeys; i++) {
+        CMPIString *keyname = NULL;
+        CMPIData key = CMGetKeyAt(op, i, &keyname, &status);
+        if (status.rc != CMPI_RC_OK || CMIsNullObject(keyname))
+            return 0;
+        CMPIData prop = CMGetProperty(inst, CMGetCharPtr(keyname), &status);
+        if (status.rc != CMPI_RC_OK)
+            return 0;
+        if ((CMIsNullValue(key) ^ CMIsNullValue(prop)) || !_CMSameValue(key, prop))
+            return 0;
+    }
+    return 1;
+}
+
+const CMPIInstance *xen_frozen_lookup(
+    const xen_frozen_class *cls,
+    const CMPIObjectPath *op)
+{
+    int i;
+    if (cls == NULL || CMIsNullObject(op))
+        return NULL;
+    for (i = 0; i < cls->count; i++)
+        if (_has_keys(cls->instances[i], op))
+            return cls->instances[i];
+    return NULL;
+}
+
+CMPIInstance *xen_frozen_clone(
+    const CMPIInstance *inst,
+    const char **properties,
+    const char **keys)
+{
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    CMPIInstance *clone;
+
+    clone = CMClone(inst, &status);
+    if (status.rc != CMPI_RC_OK || CMIsNullObject(clone))
+        return NULL;
+    if (properties) {
+        status = CMSetPropertyFilter(clone, properties, keys);
+        if (status.rc != CMPI_RC_OK) {
+            CMRelease(clone);
+            return NULL;
+        }
+    }
+    return clone;
+}
@@ -0,0 +1,321 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "xen_hosts.h"
+#include "cmpitrace.h"
+
+#define XAPI_NULL_REF "OpaqueRef:NULL"
+
+struct _xen_host_directory {
+    char *host_url;                     /* of the pool master */
+    unsigned long generation;
+    time_t taken;
+    int refcount;                       /* under directory_lock */
+    int host_count;
+    xen_host_entry *hosts;              /* by ref */
+    xen_host_entry **by_uuid;
+    struct _xen_host_directory *next;   /* in the current generations */
+};
+
+/* The current generation of each pool, each holding a reference to it */
+static xen_host_directory *directories = NULL;
+static unsigned long last_generation = 0;
+static pthread_mutex_t directory_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _free_directory(xen_host_directory *dir)
+{
+    int i;
+    for (i = 0; i < dir->host_count; i++) {
+        xen_host_entry *entry = &dir->hosts[i];
+        free(entry->host);
+        free(entry->uuid);
+        free(entry->name_label);
+        free(entry->hostname);
+        free(entry->address);
+        free(entry->metrics);
+        if (entry->software_version)
+            xen_string_string_map_free(entry->software_version);
+    }
+    free(dir->hosts);
+    free(dir->by_uuid);
+    free(dir->host_url);
+    free(dir);
+}
+
+/* Called with the lock held */
+static void _release(xen_host_directory *dir)
+{
+    if (--dir->refcount == 0)
+        _free_directory(dir);
+}
+
+static int _cmp_host_ref(const void *a, const void *b)
+{
+    return strcmp(((const xen_host_entry *)a)->host, ((const xen_host_entry *)b)->host);
+}
+
+static int _cmp_host_uuid(const void *a, const void *b)
+{
+    return strcmp((*(xen_host_entry * const *)a)->uuid, (*(xen_host_entry * const *)b)->uuid);
+}
+
+static int _cmp_ref_to_host(const void *key, const void *elem)
+{
+    return strcmp((const char *)key, ((const xen_host_entry *)elem)->host);
+}
+
+static int _cmp_uuid_to_host(const void *key, const void *elem)
+{
+    return strcmp((const char *)key, (*(xen_host_entry * const *)elem)->uuid);
+}
+
+/* A new generation, made of the host records. The parts of them the
+   entries keep are taken out of the records. */
+static xen_host_directory *_fetch_directory(xen_utils_session *session)
+{
+    xen_host_xen_host_record_map *host_map = NULL;
+    xen_host_directory *dir = NULL;
+    size_t i;
+
+    if (!xen_host_get_all_records(session->xen, &host_map)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        return NULL;
+    }
+    if ((dir = calloc(1, sizeof(xen_host_directory))) == NULL ||
+        (dir->host_url = strdup(session->host_url)) == NULL ||
+        (dir->hosts = calloc(host_map->size + 1, sizeof(xen_host_entry))) == NULL ||
+        (dir->by_uuid = calloc(host_map->size + 1, sizeof(xen_host_entry *))) == NULL)
+        goto Error;
+
+    for (i = 0; i < host_map->size; i++) {
+        xen_host_record *host_rec = host_map->contents[i].val;
+        xen_host_entry *entry = &dir->hosts[dir->host_count];
+        if (host_rec == NULL || host_rec->uuid == NULL)
+            continue;
+        entry->host = (char *)host_map->contents[i].key;
+        host_map->contents[i].key = NULL;
+        entry->uuid = host_rec->uuid;
+        host_rec->uuid = NULL;
+        entry->name_label = host_rec->name_label;
+        host_rec->name_label = NULL;
+        entry->hostname = host_rec->hostname;
+        host_rec->hostname = NULL;
+        entry->address = host_rec->address;
+        host_rec->address = NULL;
+        entry->software_version = host_rec->software_version;
+        host_rec->software_version = NULL;
+        if (host_rec->metrics && !host_rec->metrics->is_record && host_rec->metrics->u.handle &&
+            strcmp((char *)host_rec->metrics->u.handle, XAPI_NULL_REF) != 0) {
+            entry->metrics = (char *)host_rec->metrics->u.handle;
+            host_rec->metrics->u.handle = NULL;
+        }
+        dir->host_count++;
+    }
+    qsort(dir->hosts, dir->host_count, sizeof(xen_host_entry), _cmp_host_ref);
+    for (i = 0; i < dir->host_count; i++)
+        dir->by_uuid[i] = &dir->hosts[i];
+    qsort(dir->by_uuid, dir->host_count, sizeof(xen_host_entry *), _cmp_host_uuid);
+    xen_host_xen_host_record_map_free(host_map);
+    return dir;
+
+Error:
+    xen_host_xen_host_record_map_free(host_map);
+    if (dir)
+        _free_directory(dir);
+    return NULL;
+}
+
+/* Called with the lock held */
+static xen_host_directory **_find_current(const char *host_url)
+{
+    xen_host_directory **link = &directories;
+    while (*link && strcmp((*link)->host_url, host_url) != 0)
+        link = &(*link)->next;
+    return link;
+}
+
+/* Makes dir the current generation of its pool, returns it with a
+   reference for the caller */
+static xen_host_directory *_install(xen_host_directory *dir)
+{
+    pthread_mutex_lock(&directory_lock);
+    xen_host_directory **link = _find_current(dir->host_url);
+    dir->generation = ++last_generation;
+    dir->taken = time(NULL);
+    dir->refcount = 2;
+    if (*link) {
+        xen_host_directory *old = *link;
+        dir->next = old->next;
+        _release(old);
+    }
+    else
+        dir->next = NULL;
+    *link = dir;
+    pthread_mutex_unlock(&directory_lock);
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Host directory generation %lu of %s: %d hosts",
+                                           dir->generation, dir->host_url, dir->host_count));
+    return dir;
+}
+
+xen_host_directory *xen_host_directory_get(
+    xen_utils_session *session)
+{
+    xen_host_directory *dir;
+
+    if (session == NULL)
+        return NULL;
+    pthread_mutex_lock(&directory_lock);
+    dir = *_find_current(session->host_url);
+    if (dir && time(NULL) - dir->taken < XEN_HOST_DIRECTORY_SECONDS)
+        dir->refcount++;
+    else
+        dir = NULL;
+    pthread_mutex_unlock(&directory_lock);
+    if (dir)
+        return dir;
+
+    /* fetched without the lock, two threads may both fetch the same pool
+       now and then, the later one replaces the other's generation */
+    if ((dir = _fetch_directory(session)) == NULL)
+        return NULL;
+    return _install(dir);
+}
+
+/*
+ * A generation newer than dir, which a host was missing from: the current
+ * one if another thread has fetched it since, a new one otherwise. Keeps
+ * dir if it is too recent to fetch again, or the fetch fails.
+ */
+static xen_host_directory *_refresh(
+    xen_utils_session *session,
+    xen_host_directory *dir)
+{
+    xen_host_directory *newer;
+
+    pthread_mutex_lock(&directory_lock);
+    newer = *_find_current(session->host_url);
+    if (newer && newer->generation > dir->generation &&
+        time(NULL) - newer->taken < XEN_HOST_DIRECTORY_SECONDS)
+        newer->refcount++;
+    else if (time(NULL) == dir->taken)
+        newer = dir;
+    else
+        newer = NULL;
+    pthread_mutex_unlock(&directory_lock);
+    if (newer == dir)
+        return dir;
+
+    if (newer == NULL) {
+        if ((newer = _fetch_directory(session)) == NULL) {
+            RESET_XEN_ERROR(session->xen);
+            return dir;
+        }
+        newer = _install(newer);
+    }
+    xen_host_directory_release(dir);
+    return newer;
+}
+
+void xen_host_directory_release(
+    xen_host_directory *dir)
+{
+    if (dir == NULL)
+        return;
+    pthread_mutex_lock(&directory_lock);
+    _release(dir);
+    pthread_mutex_unlock(&directory_lock);
+}
+
+const xen_host_entry *xen_host_directory_find(
+    const xen_host_directory *dir,
+    xen_host host)
+{
+    if (dir == NULL || host == NULL)
+        return NULL;
+    return bsearch(host, dir->hosts, dir->host_count, sizeof(xen_host_entry), _cmp_ref_to_host);
+}
+
+const xen_host_entry *xen_host_directory_find_uuid(
+    const xen_host_directory *dir,
+    const char *uuid)
+{
+    xen_host_entry **found;
+    if (dir == NULL || uuid == NULL)
+        return NULL;
+    found = bsearch(uuid, dir->by_uuid, dir->host_count, sizeof(xen_host_entry *), _cmp_uuid_to_host);
+    return found ? *found : NULL;
+}
+
+int xen_host_directory_count(
+    const xen_host_directory *dir)
+{
+    return dir ? dir->host_count : 0;
+}
+
+const xen_host_entry *xen_host_directory_entry(
+    const xen_host_directory *dir,
+    int i)
+{
+    if (dir == NULL || i < 0 || i >= dir->host_count)
+        return NULL;
+    return &dir->hosts[i];
+}
+
+const xen_host_entry *xen_host_directory_lookup(
+    xen_utils_session *session,
+    xen_host_directory **dir,
+    xen_host host)
+{
+    const xen_host_entry *entry;
+
+    if (host == NULL || strcmp((char *)host, XAPI_NULL_REF) == 0)
+        return NULL;
+    if (*dir == NULL && (*dir = xen_host_directory_get(session)) == NULL) {
+        RESET_XEN_ERROR(session->xen);
+        return NULL;
+    }
+    if ((entry = xen_host_directory_find(*dir, host)) == NULL) {
+        *dir = _refresh(session, *dir);
+        entry = xen_host_directory_find(*dir, host);
+    }
+    return entry;
+}
+
+const xen_host_entry *xen_host_directory_lookup_uuid(
+    xen_utils_session *session,
+    xen_host_directory **dir,
+    const char *uuid)
+{
+    const xen_host_entry *entry;
+
+    if (uuid == NULL)
+        return NULL;
+    if (*dir == NULL && (*dir = xen_host_directory_get(session)) == NULL) {
+        RESET_XEN_ERROR(session->xen);
+        return NULL;
+    }
+    if ((entry = xen_host_directory_find_uuid(*dir, uuid)) == NULL) {
+        *dir = _refresh(session, *dir);
+        entry = xen_host_directory_find_uuid(*dir, uuid);
+    }
+    return entry;
+}
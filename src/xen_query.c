@@ -0,0 +1,268 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "xen_query.h"
+#include "cmpitrace.h"
+
+/*
+ * Just enough of a tokenizer for the WHERE clauses of WQL and CQL to find
+ * the top level conjunction. Anything it doesn't understand ends up in a
+ * term that isn't pushed down, which is always safe.
+ */
+typedef enum {
+    tok_end,
+    tok_ident,      /* property names and keywords */
+    tok_string,
+    tok_number,
+    tok_equals,
+    tok_op,         /* any other comparison */
+    tok_lparen,
+    tok_rparen,
+    tok_other
+} token_type;
+
+typedef struct {
+    token_type type;
+    const char *start;
+    size_t len;
+} token;
+
+static const char *next_token(const char *p, token *t)
+{
+    while (*p && isspace((unsigned char)*p))
+        p++;
+    t->start = p;
+    if (*p == '\0') {
+        t->type = tok_end;
+    }
+    else if (isalpha((unsigned char)*p) || *p == '_') {
+        /* qualified names (Class.Property) are one token */
+        while (isalnum((unsigned char)*p) || *p == '_' || *p == '.')
+            p++;
+        t->type = tok_ident;
+    }
+    else if (*p == '\'' || *p == '"') {
+        /* a doubled quote stands for one */
+        char quote = *p++;
+        while (*p && !(*p == quote && p[1] != quote))
+            p += (*p == quote) ? 2 : 1;
+        if (*p == quote)
+            p++;
+        t->type = tok_string;
+    }
+    else if (isdigit((unsigned char)*p) ||
+             ((*p == '-' || *p == '+') && isdigit((unsigned char)p[1]))) {
+        p++;
+        while (isalnum((unsigned char)*p) || *p == '.')
+            p++;
+        t->type = tok_number;
+    }
+    else if (*p == '=') {
+        p++;
+        t->type = tok_equals;
+    }
+    else if (*p == '<' || *p == '>' || *p == '!') {
+        p++;
+        if (*p == '=' || *p == '>')
+            p++;
+        t->type = tok_op;
+    }
+    else {
+        t->type = (*p == '(') ? tok_lparen : (*p == ')') ? tok_rparen : tok_other;
+        p++;
+    }
+    t->len = p - t->start;
+    return p;
+}
+
+static bool is_word(const token *t, const char *word)
+{
+    return t->type == tok_ident && t->len == strlen(word) &&
+           strncasecmp(t->start, word, t->len) == 0;
+}
+
+static bool is_literal(const token *t)
+{
+    return t->type == tok_string || t->type == tok_number ||
+           is_word(t, "TRUE") || is_word(t, "FALSE");
+}
+
+static bool is_property(const token *t)
+{
+    static const char *keywords[] = {"TRUE", "FALSE", "NULL", "NOT", "AND", "OR",
+                                     "LIKE", "IS", "ISA", "BETWEEN", NULL};
+    int i;
+    if (t->type != tok_ident)
+        return false;
+    for (i = 0; keywords[i]; i++)
+        if (is_word(t, keywords[i]))
+            return false;
+    return true;
+}
+
+static char *literal_value(const token *t)
+{
+    char *value, *out;
+    const char *p;
+
+    if (is_word(t, "TRUE"))
+        return strdup("true");
+    if (is_word(t, "FALSE"))
+        return strdup("false");
+    if (t->type != tok_string)
+        return strndup(t->start, t->len);
+
+    if ((value = malloc(t->len)) == NULL)
+        return NULL;
+    out = value;
+    for (p = t->start + 1; p < t->start + t->len - 1; p++) {
+        *out++ = *p;
+        if (*p == *t->start)
+            p++;
+    }
+    *out = '\0';
+    return value;
+}
+
+static char *property_name(const token *t)
+{
+    const char *dot = memchr(t->start, '.', t->len);
+    const char *start = t->start;
+    while (dot) {
+        start = dot + 1;
+        dot = memchr(start, '.', t->start + t->len - start);
+    }
+    return strndup(start, t->start + t->len - start);
+}
+
+/* Adds the conjunct of 'count' tokens, if it is a property = literal */
+static void add_term(xen_query *q, const token *conjunct, int count)
+{
+    const token *prop, *lit;
+
+    if (count != 3 || conjunct[1].type != tok_equals || q->term_count == XEN_QUERY_MAX_TERMS)
+        return;
+    if (is_property(&conjunct[0]) && is_literal(&conjunct[2])) {
+        prop = &conjunct[0];
+        lit = &conjunct[2];
+    }
+    else if (is_literal(&conjunct[0]) && is_property(&conjunct[2])) {
+        prop = &conjunct[2];
+        lit = &conjunct[0];
+    }
+    else
+        return;
+
+    xen_query_term *term = &q->terms[q->term_count];
+    term->property = property_name(prop);
+    term->value = literal_value(lit);
+    if (term->property == NULL || term->value == NULL) {
+        free(term->property);
+        free(term->value);
+        return;
+    }
+    q->term_count++;
+}
+
+xen_query *xen_query_analyse(const char *query)
+{
+    token conjunct[4];
+    token t;
+    int count = 0, depth = 0;
+    bool between = false;
+    const char *p = query;
+    xen_query *q;
+
+    if (query == NULL)
+        return NULL;
+
+    /* skip to the WHERE clause */
+    do {
+        p = next_token(p, &t);
+    } while (t.type != tok_end && !is_word(&t, "WHERE"));
+    if (t.type == tok_end)
+        return NULL;
+
+    if ((q = calloc(1, sizeof(xen_query))) == NULL)
+        return NULL;
+    while (1) {
+        p = next_token(p, &t);
+        if (t.type == tok_lparen)
+            depth++;
+        else if (t.type == tok_rparen)
+            depth--;
+        else if (depth == 0 && is_word(&t, "OR")) {
+            /* nothing has to hold for every result */
+            xen_query_free(q);
+            return NULL;
+        }
+        else if (depth == 0 && is_word(&t, "BETWEEN"))
+            between = true;
+
+        if (t.type == tok_end || (depth == 0 && is_word(&t, "AND") && !between)) {
+            add_term(q, conjunct, count);
+            count = 0;
+            if (t.type == tok_end)
+                break;
+            continue;
+        }
+        if (depth == 0 && is_word(&t, "AND"))
+            between = false;
+        /* only the first few tokens matter, a longer conjunct can't be pushed */
+        if (count < (int)(sizeof(conjunct) / sizeof(conjunct[0])))
+            conjunct[count] = t;
+        count++;
+    }
+
+    if (q->term_count == 0) {
+        xen_query_free(q);
+        return NULL;
+    }
+    int i;
+    for (i = 0; i < q->term_count; i++)
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Query condition %s = '%s'",
+                                               q->terms[i].property, q->terms[i].value));
+    return q;
+}
+
+void xen_query_free(xen_query *q)
+{
+    int i;
+    if (q == NULL)
+        return;
+    for (i = 0; i < q->term_count; i++) {
+        free(q->terms[i].property);
+        free(q->terms[i].value);
+    }
+    free(q);
+}
+
+const char *xen_query_get(const xen_query *q, const char *property)
+{
+    int i;
+    if (q == NULL || property == NULL)
+        return NULL;
+    for (i = 0; i < q->term_count; i++)
+        if (strcasecmp(q->terms[i].property, property) == 0)
+            return q->terms[i].value;
+    return NULL;
+}
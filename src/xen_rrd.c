@@ -0,0 +1,351 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "xen_rrd.h"
+#include "xen_transport.h"
+#include "xen_hosts.h"
+#include "cmpitrace.h"
+#include "provider_common.h"
+
+/* The cpu utilisation of a host or VM in a snapshot */
+typedef struct {
+    char uuid[UUID_LEN+1];
+    xen_cpu_utilisation cpus;
+} rrd_system;
+
+/* The latest rrd_updates row of a host */
+typedef struct _rrd_snapshot {
+    char *host;                 /* ref */
+    time_t taken;
+    int system_count;
+    rrd_system *systems;
+    struct _rrd_snapshot *next;
+} rrd_snapshot;
+
+static rrd_snapshot *snapshots = NULL;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void _free_snapshot(rrd_snapshot *snapshot)
+{
+    int i;
+    for (i = 0; i < snapshot->system_count; i++)
+        free(snapshot->systems[i].cpus.load);
+    free(snapshot->systems);
+    free(snapshot->host);
+    free(snapshot);
+}
+
+/* The latest rrd_updates of the host and its resident VMs */
+static char *_get_host_updates(
+    xen_utils_session *session,
+    xen_host host)
+{
+    char *address = NULL;
+    char *xml;
+
+    xen_host_directory *hosts = NULL;
+    const xen_host_entry *entry = xen_host_directory_lookup(session, &hosts, host);
+    if (entry && entry->address)
+        address = strdup(entry->address);
+    xen_host_directory_release(hosts);
+    if (address == NULL)
+        return NULL;
+    /* two steps back, so there's at least one complete row */
+    xml = xen_rrd_get_updates(NULL, session, address, time(NULL) - 2*XEN_RRD_SNAPSHOT_SECONDS);
+    free(address);
+    return xml;
+}
+
+/* A cpuN column of the legend */
+typedef struct {
+    int system;                 /* index in the snapshot's systems */
+    int cpu;
+} rrd_column;
+
+/* The system an AVERAGE:host|vm:<uuid>:cpuN legend entry is about, added if
+   it's a new one, and N. Returns -1 for any other column. */
+static int _parse_cpu_column(char *entry, rrd_snapshot *snapshot, int *cpu)
+{
+    char *uuid, *ds, *end;
+    int i;
+
+    if (strncmp(entry, "AVERAGE:host:", strlen("AVERAGE:host:")) == 0)
+        uuid = entry + strlen("AVERAGE:host:");
+    else if (strncmp(entry, "AVERAGE:vm:", strlen("AVERAGE:vm:")) == 0)
+        uuid = entry + strlen("AVERAGE:vm:");
+    else
+        return -1;
+    if ((ds = strchr(uuid, ':')) == NULL || ds - uuid > UUID_LEN ||
+        strncmp(ds + 1, "cpu", 3) != 0)
+        return -1;
+    *cpu = (int)strtol(ds + 4, &end, 10);
+    if (end == ds + 4 || *end != '\0' || *cpu < 0)
+        return -1;
+    *ds = '\0';
+
+    for (i = 0; i < snapshot->system_count; i++)
+        if (strcmp(snapshot->systems[i].uuid, uuid) == 0)
+            break;
+    if (i == snapshot->system_count) {
+        rrd_system *systems = realloc(snapshot->systems, sizeof(rrd_system) * (i + 1));
+        if (systems == NULL)
+            return -1;
+        snapshot->systems = systems;
+        memset(&systems[i], 0, sizeof(rrd_system));
+        strncpy(systems[i].uuid, uuid, UUID_LEN);
+        snapshot->system_count++;
+    }
+    rrd_system *system = &snapshot->systems[i];
+    if (*cpu >= system->cpus.size) {
+        double *load = realloc(system->cpus.load, sizeof(double) * (*cpu + 1));
+        if (load == NULL)
+            return -1;
+        while (system->cpus.size <= *cpu)
+            load[system->cpus.size++] = -1.0;
+        system->cpus.load = load;
+    }
+    return i;
+}
+
+/* Picks the cpu columns out of the Xport XML, the first row is the latest */
+static rrd_snapshot *_parse_rrd_updates(char *xml)
+{
+    rrd_column *columns = NULL;
+    int column_count = 0, col;
+    char *pos = xml, *text;
+
+    rrd_snapshot *snapshot = calloc(1, sizeof(rrd_snapshot));
+    if (snapshot == NULL)
+        return NULL;
+
+    char *legend_end = strstr(xml, "</legend>");
+    while (legend_end && (text = xen_rrd_next_element(&pos, "entry", legend_end))) {
+        rrd_column *more = realloc(columns, sizeof(rrd_column) * (column_count + 1));
+        if (more == NULL)
+            goto Error;
+        columns = more;
+        columns[column_count].system = _parse_cpu_column(text, snapshot, &columns[column_count].cpu);
+        column_count++;
+    }
+
+    char *row = xen_rrd_next_element(&pos, "row", NULL);
+    if (row == NULL)
+        goto Error;
+    for (col = 0; col < column_count && (text = xen_rrd_next_element(&row, "v", NULL)); col++) {
+        if (columns[col].system < 0)
+            continue;
+        double value = strtod(text, NULL);
+        if (!isnan(value))
+            snapshot->systems[columns[col].system].cpus.load[columns[col].cpu] = value;
+    }
+    free(columns);
+    return snapshot;
+
+ Error:
+    free(columns);
+    _free_snapshot(snapshot);
+    return NULL;
+}
+
+/* A copy of the system's utilisation in the snapshot. Called with the lock held. */
+static xen_cpu_utilisation *_copy_utilisation(rrd_snapshot *snapshot, const char *uuid)
+{
+    int i;
+    for (i = 0; i < snapshot->system_count; i++) {
+        xen_cpu_utilisation *cpus = &snapshot->systems[i].cpus;
+        if (strcmp(snapshot->systems[i].uuid, uuid) != 0)
+            continue;
+        xen_cpu_utilisation *copy = calloc(1, sizeof(xen_cpu_utilisation));
+        if (copy == NULL || (copy->load = malloc(sizeof(double) * cpus->size)) == NULL) {
+            free(copy);
+            return NULL;
+        }
+        copy->size = cpus->size;
+        memcpy(copy->load, cpus->load, sizeof(double) * cpus->size);
+        return copy;
+    }
+    return NULL;
+}
+
+/* The host's snapshot if it is recent enough, after dropping the stale ones.
+   Called with the lock held. */
+static rrd_snapshot *_find_snapshot(const char *host, time_t now)
+{
+    rrd_snapshot **link = &snapshots, *found = NULL;
+    while (*link) {
+        rrd_snapshot *snapshot = *link;
+        if (now - snapshot->taken >= XEN_RRD_SNAPSHOT_SECONDS) {
+            *link = snapshot->next;
+            _free_snapshot(snapshot);
+            continue;
+        }
+        if (strcmp(snapshot->host, host) == 0)
+            found = snapshot;
+        link = &snapshot->next;
+    }
+    return found;
+}
+
+xen_cpu_utilisation *xen_rrd_get_cpu_utilisation(
+    xen_utils_session *session,
+    xen_host host,
+    const char *uuid)
+{
+    xen_cpu_utilisation *result = NULL;
+    rrd_snapshot *snapshot;
+
+    if (session == NULL || host == NULL || uuid == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&snapshot_lock);
+    if ((snapshot = _find_snapshot((char *)host, time(NULL))))
+        result = _copy_utilisation(snapshot, uuid);
+    pthread_mutex_unlock(&snapshot_lock);
+    if (snapshot)
+        return result;
+
+    /* fetched without the lock, two threads may both fetch the same host now
+       and then, the later one replaces the other's snapshot */
+    char *xml = _get_host_updates(session, host);
+    if (xml) {
+        snapshot = _parse_rrd_updates(xml);
+        free(xml);
+    }
+    if (snapshot == NULL) {
+        /* an empty snapshot, so that a host that can't be reached isn't
+           asked again for every cpu until the snapshot goes stale */
+        snapshot = calloc(1, sizeof(rrd_snapshot));
+        if (snapshot == NULL)
+            return NULL;
+    }
+    if ((snapshot->host = strdup((char *)host)) == NULL) {
+        _free_snapshot(snapshot);
+        return NULL;
+    }
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("rrd_updates snapshot of %s: %d hosts and VMs",
+                                           (char *)host, snapshot->system_count));
+
+    pthread_mutex_lock(&snapshot_lock);
+    snapshot->taken = time(NULL);
+    rrd_snapshot **link = &snapshots;
+    while (*link && strcmp((*link)->host, snapshot->host) != 0)
+        link = &(*link)->next;
+    if (*link) {
+        rrd_snapshot *old = *link;
+        snapshot->next = old->next;
+        _free_snapshot(old);
+    }
+    else
+        snapshot->next = NULL;
+    *link = snapshot;
+    result = _copy_utilisation(snapshot, uuid);
+    pthread_mutex_unlock(&snapshot_lock);
+    return result;
+}
+
+void xen_rrd_cpu_utilisation_free(xen_cpu_utilisation *utilisation)
+{
+    if (utilisation == NULL)
+        return;
+    free(utilisation->load);
+    free(utilisation);
+}
+
+double xen_rrd_cpu_load(const xen_cpu_utilisation *utilisation, int n, double otherwise)
+{
+    if (utilisation == NULL || n < 0 || n >= utilisation->size || utilisation->load[n] < 0)
+        return otherwise;
+    return utilisation->load[n];
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+} rrd_response;
+
+static size_t _write_data(void *buffer, size_t size, size_t nmemb, void *userp)
+{
+    size_t realsize = size * nmemb;
+    rrd_response *resp = userp;
+    char *data = realloc(resp->data, resp->len + realsize + 1);
+    if (data == NULL)
+        return 0;
+    resp->data = data;
+    memcpy(&resp->data[resp->len], buffer, realsize);
+    resp->len += realsize;
+    resp->data[resp->len] = '\0';
+    return realsize;
+}
+
+char *xen_rrd_get_updates(
+    CURL *curl,
+    xen_utils_session *session,
+    const char *address,
+    time_t start)
+{
+    char url[512];
+    long http_code = 0;
+    rrd_response resp = {NULL, 0};
+    CURL *own_curl = NULL;
+    CURLcode res;
+
+    if (curl == NULL && (curl = own_curl = curl_easy_init()) == NULL)
+        return NULL;
+    snprintf(url, sizeof(url), "http://%s/rrd_updates?session_id=%s&start=%ld&host=true&cf=AVERAGE",
+             address, session->xen->session_id, (long)start);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, false);
+    /* a host that has gone away shouldn't hold up the enumeration or the
+       alert thread */
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)XEN_RRD_TIMEOUT_SECONDS);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+
+    res = xen_transport_perform(curl, "GET", url, NULL, 0, _write_data, &resp, &http_code);
+    if (own_curl)
+        curl_easy_cleanup(own_curl);
+    if (res != CURLE_OK || http_code != 200) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_WARNING, ("rrd_updates from %s failed: HTTP %ld, curl %d", address, http_code, res));
+        free(resp.data);
+        resp.data = NULL;
+    }
+    return resp.data;
+}
+
+char *xen_rrd_next_element(char **pos, const char *tag, const char *limit)
+{
+    char open[32], close[32];
+    snprintf(open, sizeof(open), "<%s>", tag);
+    snprintf(close, sizeof(close), "</%s>", tag);
+    char *start = strstr(*pos, open);
+    if (start == NULL || (limit && start > limit))
+        return NULL;
+    start += strlen(open);
+    char *end = strstr(start, close);
+    if (end == NULL)
+        return NULL;
+    *end = '\0';
+    *pos = end + strlen(close);
+    return start;
+}
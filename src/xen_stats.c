@@ -0,0 +1,595 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "xen_utils.h"
+#include "xen_stats.h"
+#include "xen_probes.h"
+#include "cmpitrace.h"
+
+/*
+ * Each thread accounts into its own table of records, keyed by the
+ * interned (classname, op, method). Records are allocated on first use
+ * and published with a release store, after which only the owning thread
+ * writes to them. Readers walk all the tables and add the records up,
+ * using relaxed loads since a slightly stale count is fine. Tables are
+ * never freed while the library is loaded, the table of a thread that
+ * exits is handed to the next new thread so its counts are kept.
+ */
+#define STATS_TABLE_SLOTS 1024
+
+typedef struct _stats_table {
+    struct _stats_table *next;          /* list of all the tables */
+    int in_use;                         /* owned by a live thread */
+    xen_stats_record *slots[STATS_TABLE_SLOTS];
+    xen_stats_record overflow;          /* used once the slots run out */
+} stats_table;
+
+#define STATS_ADD(__field, __val) \
+    __atomic_store_n(&(__field), (__field) + (__val), __ATOMIC_RELAXED)
+#define STATS_READ(__field) \
+    __atomic_load_n(&(__field), __ATOMIC_RELAXED)
+
+static stats_table *stats_tables = NULL;
+static __thread stats_table *thread_table = NULL;
+static __thread xen_stats_call *thread_call = NULL;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static int stats_enabled = 0;
+static time_t stats_start_time = 0;
+
+/* Dumping on a signal, if asked for: the handler pokes a pipe that a dump
+   thread waits on, the dump itself is done on that thread */
+static int dump_signal = 0;
+static int dump_pipe[2] = {-1, -1};
+static pthread_t dump_thread;
+static int dump_thread_running = 0;
+static struct sigaction dump_old_action;
+
+static const char *op_names[xen_stats_op_count] = {
+    "EnumerateInstanceNames",
+    "EnumerateInstances",
+    "GetInstance",
+    "CreateInstance",
+    "ModifyInstance",
+    "DeleteInstance",
+    "ExecQuery",
+    "InvokeMethod",
+    "Associators",
+    "AssociatorNames",
+    "References",
+    "ReferenceNames",
+    "Other"
+};
+
+static const char *phase_names[xen_stats_phase_count] = {
+    "Session",
+    "ListEnum",
+    "GetNext",
+    "Get",
+    "SetProperties",
+    "Cleanup"
+};
+
+const char *xen_stats_op_name(
+    xen_stats_op op)
+{
+    return (op >= 0 && op < xen_stats_op_count) ? op_names[op] : "Unknown";
+}
+
+const char *xen_stats_phase_name(
+    xen_stats_phase phase)
+{
+    return (phase >= 0 && phase < xen_stats_phase_count) ? phase_names[phase] : "Unknown";
+}
+
+static void _stats_init();
+
+uint64_t xen_stats_now()
+{
+    struct timespec ts;
+    pthread_once(&stats_once, _stats_init);
+    if (!stats_enabled)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/******************************************************************************
+ * Latency histogram
+ *****************************************************************************/
+static int _bucket(
+    uint64_t usecs)
+{
+    const int sub_buckets = 1 << XEN_STATS_HIST_SUB_BITS;
+    if (usecs < sub_buckets)
+        return (int)usecs;
+    int msb = 63 - __builtin_clzll(usecs);
+    int bucket = ((msb - XEN_STATS_HIST_SUB_BITS + 1) << XEN_STATS_HIST_SUB_BITS) +
+        (int)((usecs >> (msb - XEN_STATS_HIST_SUB_BITS)) & (sub_buckets - 1));
+    return (bucket < XEN_STATS_HIST_BUCKETS) ? bucket : XEN_STATS_HIST_BUCKETS - 1;
+}
+
+/* Largest latency (in microseconds) that lands in the bucket */
+uint64_t xen_stats_bucket_upper_bound(
+    int bucket)
+{
+    const int sub_buckets = 1 << XEN_STATS_HIST_SUB_BITS;
+    if (bucket < sub_buckets)
+        return bucket;
+    int msb = (bucket >> XEN_STATS_HIST_SUB_BITS) + XEN_STATS_HIST_SUB_BITS - 1;
+    uint64_t sub = bucket & (sub_buckets - 1);
+    return ((sub_buckets + sub + 1) << (msb - XEN_STATS_HIST_SUB_BITS)) - 1;
+}
+
+/* Latency (in microseconds) below which 'percentile' percent of the calls completed */
+uint64_t xen_stats_percentile(
+    const xen_stats_record *record,
+    double percentile)
+{
+    int i;
+    uint64_t total = 0, seen = 0;
+    for (i = 0; i < XEN_STATS_HIST_BUCKETS; i++)
+        total += record->histogram[i];
+    if (total == 0)
+        return 0;
+    uint64_t wanted = (uint64_t)((total * percentile + 99) / 100);
+    for (i = 0; i < XEN_STATS_HIST_BUCKETS; i++) {
+        seen += record->histogram[i];
+        if (seen >= wanted && record->histogram[i])
+            return xen_stats_bucket_upper_bound(i);
+    }
+    return xen_stats_bucket_upper_bound(XEN_STATS_HIST_BUCKETS - 1);
+}
+
+/******************************************************************************
+ * Per thread tables
+ *****************************************************************************/
+static void _release_table(
+    void *table)
+{
+    __atomic_store_n(&((stats_table *)table)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void _dump_signal_handler(
+    int sig)
+{
+    char c = 0;
+    int saved_errno = errno;
+    if (dump_pipe[1] != -1 && write(dump_pipe[1], &c, 1) < 0)
+        ; /* a dump is already pending */
+    errno = saved_errno;
+}
+
+/*
+ * A new file for a dump, in a directory only we can write to (created if
+ * need be), so that nobody else can have it point somewhere else. Never
+ * follows a link nor reuses a file.
+ */
+static FILE *_open_dump_file(
+    unsigned long dump)
+{
+    char *dir = getenv("XEN_CIM_STATISTICS_DIR");
+    char path[PATH_MAX];
+    struct stat st;
+    int fd;
+    FILE *out;
+
+    if (dir == NULL || *dir == '\0')
+        dir = XEN_STATS_DEFAULT_DIR;
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+        return NULL;
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
+            ("%s isn't a directory private to the CIM server, not dumping the statistics", dir));
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/statistics-%d-%ld-%lu.txt",
+             dir, (int)getpid(), (long)time(NULL), dump);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600)) < 0)
+        return NULL;
+    if ((out = fdopen(fd, "w")) == NULL)
+        close(fd);
+    return out;
+}
+
+static void *_dump_thread_main(
+    void *arg)
+{
+    unsigned long dumps = 0;
+    char c;
+    while (read(dump_pipe[0], &c, 1) == 1) {
+        FILE *out = _open_dump_file(++dumps);
+        if (out == NULL) {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Could not create the statistics dump"));
+            continue;
+        }
+        xen_stats_dump(out);
+        fclose(out);
+    }
+    return NULL;
+}
+
+static void _stats_init()
+{
+    char *val = getenv("XEN_CIM_STATISTICS");
+    if (val && atoi(val) == 0)
+        return;
+    if (pthread_key_create(&stats_key, _release_table) != 0)
+        return;
+    stats_start_time = time(NULL);
+    stats_enabled = 1;
+
+    /* the signal may well be used by the CIM server already, only take it
+       over when asked to */
+    val = getenv("XEN_CIM_STATISTICS_SIGNAL");
+    if (val)
+        dump_signal = atoi(val);
+    if (dump_signal <= 0 || pipe(dump_pipe) != 0)
+        return;
+    if (pthread_create(&dump_thread, NULL, _dump_thread_main, NULL) != 0) {
+        close(dump_pipe[0]);
+        close(dump_pipe[1]);
+        dump_pipe[0] = dump_pipe[1] = -1;
+        return;
+    }
+    dump_thread_running = 1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = _dump_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(dump_signal, &action, &dump_old_action);
+}
+
+/* Stops the dump thread and puts the old signal handler back before the library goes away */
+static void __attribute__((destructor)) _stats_shutdown()
+{
+    stats_table *table, *next;
+    int i;
+
+    if (!stats_enabled)
+        return;
+    stats_enabled = 0;
+    if (dump_thread_running) {
+        sigaction(dump_signal, &dump_old_action, NULL);
+        close(dump_pipe[1]);
+        dump_pipe[1] = -1;
+        pthread_join(dump_thread, NULL);
+        close(dump_pipe[0]);
+        dump_thread_running = 0;
+    }
+    /* our destructor must not be run for threads that outlive us */
+    pthread_key_delete(stats_key);
+    for (table = stats_tables; table; table = next) {
+        next = table->next;
+        for (i = 0; i < STATS_TABLE_SLOTS; i++)
+            free(table->slots[i]);
+        free(table);
+    }
+    stats_tables = NULL;
+}
+
+static stats_table *_get_thread_table()
+{
+    stats_table *table = thread_table;
+    if (table)
+        return table;
+
+    for (table = __atomic_load_n(&stats_tables, __ATOMIC_ACQUIRE); table; table = table->next) {
+        int free_table = 0;
+        if (__atomic_compare_exchange_n(&table->in_use, &free_table, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            goto Exit;
+    }
+
+    table = calloc(1, sizeof(stats_table));
+    if (table == NULL)
+        return NULL;
+    table->in_use = 1;
+    table->overflow.classname = "(overflow)";
+    table->overflow.op = xen_stats_op_other;
+    table->next = __atomic_load_n(&stats_tables, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&stats_tables, &table->next, table, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+Exit:
+    pthread_setspecific(stats_key, table);
+    thread_table = table;
+    return table;
+}
+
+/* Finds (or adds) the calling thread's record for an operation */
+static xen_stats_record *_get_record(
+    xen_stats_op op,
+    const char *classname,
+    const char *method)
+{
+    stats_table *table = _get_thread_table();
+    if (table == NULL)
+        return NULL;
+
+    classname = xen_utils_intern(classname ? classname : "(none)");
+    method = xen_utils_intern(method);
+    size_t i, slot = (((uintptr_t)classname >> 4) ^ ((uintptr_t)method >> 4) ^ (op * 31)) % STATS_TABLE_SLOTS;
+    for (i = 0; i < STATS_TABLE_SLOTS; i++, slot = (slot + 1) % STATS_TABLE_SLOTS) {
+        xen_stats_record *record = table->slots[slot];
+        if (record == NULL)
+            break;
+        if (record->op == op && XEN_INTERNED_EQ(record->classname, classname) &&
+            XEN_INTERNED_EQ(record->method, method))
+            return record;
+    }
+    if (i == STATS_TABLE_SLOTS || classname == NULL)
+        return &table->overflow;
+
+    xen_stats_record *record = calloc(1, sizeof(xen_stats_record));
+    if (record == NULL)
+        return &table->overflow;
+    record->op = op;
+    record->classname = classname;
+    record->method = method;
+    __atomic_store_n(&table->slots[slot], record, __ATOMIC_RELEASE);
+    return record;
+}
+
+/* The record to account to when there's no operation in progress on this thread */
+static xen_stats_record *_current_record()
+{
+    if (thread_call)
+        return thread_call->record;
+    return _get_record(xen_stats_op_other, NULL, NULL);
+}
+
+/******************************************************************************
+ * Accounting
+ *****************************************************************************/
+void xen_stats_call_begin(
+    xen_stats_call *call,
+    xen_stats_op op,
+    const char *classname,
+    const char *method)
+{
+    pthread_once(&stats_once, _stats_init);
+    call->record = NULL;
+    call->prev = NULL;
+    call->start = 0;
+    call->op = op;
+    call->classname = classname;
+    call->method = method;
+    /* every CIM operation entry point comes through here */
+    XEN_PROBE3(op__entry, xen_stats_op_name(op), classname, method);
+    if (!stats_enabled)
+        return;
+
+    call->record = _get_record(op, classname, method);
+    if (call->record == NULL)
+        return;
+    call->prev = thread_call;
+    call->start = xen_stats_now();
+    thread_call = call;
+}
+
+void xen_stats_call_end(
+    xen_stats_call *call,
+    int rc)
+{
+    xen_stats_record *record = call->record;
+    XEN_PROBE4(op__return, xen_stats_op_name(call->op), call->classname, call->method, rc);
+    if (record == NULL)
+        return;
+
+    uint64_t elapsed = xen_stats_now() - call->start;
+    STATS_ADD(record->calls, 1);
+    if (rc != 0)
+        STATS_ADD(record->errors, 1);
+    STATS_ADD(record->total_ns, elapsed);
+    if (elapsed > record->max_ns)
+        __atomic_store_n(&record->max_ns, elapsed, __ATOMIC_RELAXED);
+    STATS_ADD(record->histogram[_bucket(elapsed / 1000)], 1);
+    thread_call = call->prev;
+    call->record = NULL;
+}
+
+void xen_stats_phase_end(
+    xen_stats_phase phase,
+    uint64_t start)
+{
+    if (!stats_enabled || start == 0 || phase < 0 || phase >= xen_stats_phase_count)
+        return;
+    xen_stats_record *record = _current_record();
+    if (record)
+        STATS_ADD(record->phase_ns[phase], xen_stats_now() - start);
+}
+
+void xen_stats_instance()
+{
+    if (!stats_enabled)
+        return;
+    xen_stats_record *record = _current_record();
+    if (record)
+        STATS_ADD(record->instances, 1);
+}
+
+void xen_stats_rpc(
+    uint64_t start,
+    size_t bytes_sent,
+    size_t bytes_received)
+{
+    if (!stats_enabled || start == 0)
+        return;
+    xen_stats_record *record = _current_record();
+    if (record == NULL)
+        return;
+    STATS_ADD(record->rpcs, 1);
+    STATS_ADD(record->rpc_bytes_sent, bytes_sent);
+    STATS_ADD(record->rpc_bytes_received, bytes_received);
+    STATS_ADD(record->rpc_ns, xen_stats_now() - start);
+}
+
+/******************************************************************************
+ * Merging
+ *****************************************************************************/
+static void _merge_record(
+    xen_stats_record *to,
+    xen_stats_record *from)
+{
+    int i;
+    to->calls += STATS_READ(from->calls);
+    to->errors += STATS_READ(from->errors);
+    to->instances += STATS_READ(from->instances);
+    to->rpcs += STATS_READ(from->rpcs);
+    to->rpc_bytes_sent += STATS_READ(from->rpc_bytes_sent);
+    to->rpc_bytes_received += STATS_READ(from->rpc_bytes_received);
+    to->rpc_ns += STATS_READ(from->rpc_ns);
+    to->total_ns += STATS_READ(from->total_ns);
+    uint64_t max_ns = STATS_READ(from->max_ns);
+    if (max_ns > to->max_ns)
+        to->max_ns = max_ns;
+    for (i = 0; i < xen_stats_phase_count; i++)
+        to->phase_ns[i] += STATS_READ(from->phase_ns[i]);
+    for (i = 0; i < XEN_STATS_HIST_BUCKETS; i++)
+        to->histogram[i] += STATS_READ(from->histogram[i]);
+}
+
+static xen_stats_record *_find_merged(
+    xen_stats_record_set *set,
+    xen_stats_record *record)
+{
+    size_t i;
+    for (i = 0; i < set->size; i++) {
+        xen_stats_record *merged = &set->contents[i];
+        if (merged->op == record->op && XEN_INTERNED_EQ(merged->classname, record->classname) &&
+            XEN_INTERNED_EQ(merged->method, record->method))
+            return merged;
+    }
+    return NULL;
+}
+
+/*
+ * Adds up the records of all the threads, one record per class, operation
+ * and method that has been seen so far.
+ * Returns 1 on success, 0 on failure.
+ */
+int xen_stats_get_all(
+    xen_stats_record_set **set)
+{
+    stats_table *table;
+    size_t i, count = 0;
+    xen_stats_record_set *merged = NULL;
+
+    pthread_once(&stats_once, _stats_init);
+    *set = NULL;
+
+    /* there can't be more distinct records than there are records in all */
+    for (table = __atomic_load_n(&stats_tables, __ATOMIC_ACQUIRE); table; table = table->next) {
+        for (i = 0; i < STATS_TABLE_SLOTS; i++)
+            if (__atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE))
+                count++;
+        count++; /* overflow */
+    }
+
+    merged = calloc(1, sizeof(xen_stats_record_set) + count * sizeof(xen_stats_record));
+    if (merged == NULL)
+        return 0;
+    merged->start_time = stats_start_time;
+
+    for (table = __atomic_load_n(&stats_tables, __ATOMIC_ACQUIRE); table; table = table->next) {
+        for (i = 0; i <= STATS_TABLE_SLOTS; i++) {
+            xen_stats_record *record = (i < STATS_TABLE_SLOTS) ?
+                __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE) : &table->overflow;
+            if (record == NULL || STATS_READ(record->calls) + STATS_READ(record->rpcs) == 0)
+                continue;
+            xen_stats_record *to = _find_merged(merged, record);
+            if (to == NULL) {
+                if (merged->size == count)
+                    continue; /* a record was added since we counted them */
+                to = &merged->contents[merged->size++];
+                to->classname = record->classname;
+                to->method = record->method;
+                to->op = record->op;
+            }
+            _merge_record(to, record);
+        }
+    }
+    *set = merged;
+    return 1;
+}
+
+void xen_stats_record_set_free(
+    xen_stats_record_set *set)
+{
+    free(set);
+}
+
+/* Writes out a text table of the merged statistics, times are in microseconds */
+void xen_stats_dump(
+    FILE *out)
+{
+    xen_stats_record_set *set = NULL;
+    size_t i;
+    int phase;
+    char started[32] = "";
+    struct tm tm;
+
+    if (!xen_stats_get_all(&set))
+        return;
+    if (localtime_r(&set->start_time, &tm))
+        strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", &tm);
+    fprintf(out, "# xen-cim provider statistics since %s, times in microseconds\n", started);
+    fprintf(out, "# class operation[.method] calls errors instances rpcs rpc_bytes_sent "
+            "rpc_bytes_received rpc_time total_time mean p50 p90 p99 max");
+    for (phase = 0; phase < xen_stats_phase_count; phase++)
+        fprintf(out, " %s", xen_stats_phase_name(phase));
+    fprintf(out, "\n");
+
+    for (i = 0; i < set->size; i++) {
+        xen_stats_record *rec = &set->contents[i];
+        fprintf(out, "%s %s%s%s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+                rec->classname, xen_stats_op_name(rec->op),
+                rec->method ? "." : "", rec->method ? rec->method : "",
+                (unsigned long long)rec->calls,
+                (unsigned long long)rec->errors,
+                (unsigned long long)rec->instances,
+                (unsigned long long)rec->rpcs,
+                (unsigned long long)rec->rpc_bytes_sent,
+                (unsigned long long)rec->rpc_bytes_received,
+                (unsigned long long)(rec->rpc_ns / 1000),
+                (unsigned long long)(rec->total_ns / 1000),
+                (unsigned long long)(rec->calls ? rec->total_ns / rec->calls / 1000 : 0),
+                (unsigned long long)xen_stats_percentile(rec, 50),
+                (unsigned long long)xen_stats_percentile(rec, 90),
+                (unsigned long long)xen_stats_percentile(rec, 99),
+                (unsigned long long)(rec->max_ns / 1000));
+        for (phase = 0; phase < xen_stats_phase_count; phase++)
+            fprintf(out, " %llu", (unsigned long long)(rec->phase_ns[phase] / 1000));
+        fprintf(out, "\n");
+    }
+    xen_stats_record_set_free(set);
+}
@@ -0,0 +1,572 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xen_topology.h"
+#include "cmpitrace.h"
+
+#define XAPI_NULL_REF "OpaqueRef:NULL"
+
+/* The ref an opt holds, NULL if it holds a record or the null ref */
+#define OPT_REF(opt__)                                                         \
+    (((opt__) && !(opt__)->is_record && (opt__)->u.handle &&                   \
+      strcmp((char *)(opt__)->u.handle, XAPI_NULL_REF) != 0) ?                 \
+     (char *)(opt__)->u.handle : NULL)
+
+/* The entries of all the record maps start with the ref, they are sorted
+   and searched by it in place */
+#define SORT_MAP(map__)                                                        \
+{                                                                              \
+    if (map__)                                                                 \
+        qsort((map__)->contents, (map__)->size, sizeof((map__)->contents[0]),  \
+              xen_utils_compare_refs);                                         \
+}
+
+/* Sets result__ to the record for ref__ in a sorted map, NULL if it isn't there */
+#define MAP_GET(map__, ref__, result__)                                        \
+{                                                                              \
+    int found__ = (map__) ? xen_utils_find_ref((map__)->contents, (map__)->size, \
+                                               sizeof((map__)->contents[0]), (ref__)) : -1; \
+    (result__) = found__ >= 0 ? (map__)->contents[found__].val : NULL;         \
+}
+
+static int _cmp_str(const char *a, const char *b)
+{
+    return strcmp(a ? a : "", b ? b : "");
+}
+
+static int _cmp_host_device(const void *a, const void *b)
+{
+    const xen_net_pif *pa = a, *pb = b;
+    int rc = _cmp_str((char *)pa->host, (char *)pb->host);
+    if (rc == 0)
+        rc = _cmp_str(pa->rec->device, pb->rec->device);
+    if (rc == 0)
+        rc = (pa->rec->vlan > pb->rec->vlan) - (pa->rec->vlan < pb->rec->vlan);
+    return rc;
+}
+
+static int _cmp_pif_ref(const void *a, const void *b)
+{
+    return strcmp((char *)(*(xen_net_pif * const *)a)->pif, (char *)(*(xen_net_pif * const *)b)->pif);
+}
+
+static int _cmp_ref_to_pif(const void *key, const void *elem)
+{
+    return strcmp(*(const char * const *)key, (char *)(*(xen_net_pif * const *)elem)->pif);
+}
+
+/* A record list that the topology can do without */
+static void _missing(xen_utils_session *session, const char *what)
+{
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_WARNING, ("Topology without the %s records", what));
+    xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+    RESET_XEN_ERROR(session->xen);
+}
+
+/* Links the PIFs to the other records, once all the maps are in */
+static int _index(xen_net_topology *topo)
+{
+    int i, n = topo->pif_map->size;
+
+    SORT_MAP(topo->host_map);
+    SORT_MAP(topo->metrics_map);
+    SORT_MAP(topo->network_map);
+    SORT_MAP(topo->bond_map);
+    SORT_MAP(topo->vlan_map);
+
+    topo->pifs = calloc(n + 1, sizeof(xen_net_pif));
+    topo->by_ref = calloc(n + 1, sizeof(xen_net_pif *));
+    if (topo->pifs == NULL || topo->by_ref == NULL)
+        return 0;
+    for (i = 0; i < n; i++) {
+        xen_net_pif *pif = &topo->pifs[i];
+        pif->pif = topo->pif_map->contents[i].key;
+        pif->rec = topo->pif_map->contents[i].val;
+        pif->host = OPT_REF(pif->rec->host);
+        MAP_GET(topo->host_map, pif->host, pif->host_rec);
+        MAP_GET(topo->metrics_map, OPT_REF(pif->rec->metrics), pif->metrics);
+        MAP_GET(topo->network_map, OPT_REF(pif->rec->network), pif->network);
+    }
+    topo->pif_count = n;
+    qsort(topo->pifs, n, sizeof(xen_net_pif), _cmp_host_device);
+    for (i = 0; i < n; i++)
+        topo->by_ref[i] = &topo->pifs[i];
+    qsort(topo->by_ref, n, sizeof(xen_net_pif *), _cmp_pif_ref);
+
+    for (i = 0; i < n; i++) {
+        xen_net_pif *pif = &topo->pifs[i];
+        xen_bond_record *bond = NULL;
+        xen_vlan_record *vlan = NULL;
+        MAP_GET(topo->bond_map, OPT_REF(pif->rec->bond_slave_of), bond);
+        if (bond)
+            pif->bond_master = xen_net_topology_find(topo, OPT_REF(bond->master));
+        if (pif->bond_master == pif)
+            pif->bond_master = NULL;
+        MAP_GET(topo->vlan_map, OPT_REF(pif->rec->vlan_master_of), vlan);
+        if (vlan)
+            pif->vlan_tagged = xen_net_topology_find(topo, OPT_REF(vlan->tagged_pif));
+        if (pif->vlan_tagged == pif)
+            pif->vlan_tagged = NULL;
+    }
+    return 1;
+}
+
+/* The bond of each PIF that is a slave of one, fetched one at a time */
+static int _fetch_bonds(
+    xen_utils_session *session,
+    xen_net_topology *topo)
+{
+    size_t i;
+
+    topo->bond_map = xen_bond_xen_bond_record_map_alloc(topo->pif_map->size);
+    if (topo->bond_map == NULL)
+        return 0;
+    topo->bond_map->size = 0;
+    for (i = 0; i < topo->pif_map->size; i++) {
+        char *ref = OPT_REF(topo->pif_map->contents[i].val->bond_slave_of);
+        xen_bond_record *rec = NULL;
+        if (ref == NULL)
+            continue;
+        if (!xen_bond_get_record(session->xen, &rec, ref)) {
+            xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+            return 0;
+        }
+        topo->bond_map->contents[topo->bond_map->size].key = strdup(ref);
+        topo->bond_map->contents[topo->bond_map->size].val = rec;
+        topo->bond_map->size++;
+    }
+    return 1;
+}
+
+xen_net_topology *xen_net_topology_new(
+    xen_utils_session *session)
+{
+    xen_net_topology *topo = calloc(1, sizeof(xen_net_topology));
+    if (topo == NULL)
+        return NULL;
+
+    if (!xen_pif_get_all_records(session->xen, &topo->pif_map)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        free(topo);
+        return NULL;
+    }
+    if (!xen_host_get_all_records(session->xen, &topo->host_map))
+        _missing(session, "host");
+    if (!xen_pif_metrics_get_all_records(session->xen, &topo->metrics_map))
+        _missing(session, "PIF_metrics");
+    if (!xen_network_get_all_records(session->xen, &topo->network_map))
+        _missing(session, "network");
+    if (!xen_bond_get_all_records(session->xen, &topo->bond_map)) {
+        /* the bond slaves are left out of the enumeration, so they are
+           looked up one PIF at a time rather than done without */
+        _missing(session, "Bond");
+        if (!_fetch_bonds(session, topo)) {
+            xen_net_topology_free(topo);
+            return NULL;
+        }
+    }
+    if (!xen_vlan_get_all_records(session->xen, &topo->vlan_map))
+        _missing(session, "VLAN");
+
+    if (!_index(topo)) {
+        xen_net_topology_free(topo);
+        return NULL;
+    }
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Network topology of %d PIFs", topo->pif_count));
+    return topo;
+}
+
+/* Fetches the record of one object into a map of its own */
+#define FETCH_ONE(type__, map__, ref__)                                        \
+{                                                                              \
+    char *ref_one__ = (ref__);                                                 \
+    type__ ## _record *rec_one__ = NULL;                                       \
+    if (ref_one__) {                                                           \
+        if (!type__ ## _get_record(session->xen, &rec_one__, ref_one__))       \
+            _missing(session, #type__);                                        \
+        else if (((map__) = type__ ## _ ## type__ ## _record_map_alloc(1)) == NULL) \
+            type__ ## _record_free(rec_one__);                                 \
+        else {                                                                 \
+            (map__)->contents[0].key = strdup(ref_one__);                      \
+            (map__)->contents[0].val = rec_one__;                              \
+        }                                                                      \
+    }                                                                          \
+}
+
+/* Adds another PIF to the topology of a single PIF */
+static void _add_pif(
+    xen_utils_session *session,
+    xen_net_topology *topo,
+    char *ref)
+{
+    xen_pif_record *rec = NULL;
+    if (ref == NULL)
+        return;
+    if (!xen_pif_get_record(session->xen, &rec, ref)) {
+        _missing(session, "PIF");
+        return;
+    }
+    topo->pif_map->contents[topo->pif_map->size].key = strdup(ref);
+    topo->pif_map->contents[topo->pif_map->size].val = rec;
+    topo->pif_map->size++;
+}
+
+xen_net_topology *xen_net_topology_new_for_pif(
+    xen_utils_session *session,
+    const char *uuid)
+{
+    xen_pif pif = NULL;
+    xen_pif_record *rec = NULL;
+    xen_net_topology *topo = NULL;
+
+    if (!xen_pif_get_by_uuid(session->xen, &pif, (char *)uuid) ||
+        !xen_pif_get_record(session->xen, &rec, pif)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        goto Error;
+    }
+    /* the PIF, its bond master and the PIF under its VLAN */
+    if ((topo = calloc(1, sizeof(xen_net_topology))) == NULL ||
+        (topo->pif_map = xen_pif_xen_pif_record_map_alloc(3)) == NULL)
+        goto Error;
+    topo->pif_map->size = 1;
+    topo->pif_map->contents[0].key = pif;
+    topo->pif_map->contents[0].val = rec;
+    pif = NULL;
+    rec = NULL;
+
+    xen_pif_record *pif_rec = topo->pif_map->contents[0].val;
+    FETCH_ONE(xen_host, topo->host_map, OPT_REF(pif_rec->host));
+    FETCH_ONE(xen_pif_metrics, topo->metrics_map, OPT_REF(pif_rec->metrics));
+    FETCH_ONE(xen_network, topo->network_map, OPT_REF(pif_rec->network));
+    FETCH_ONE(xen_bond, topo->bond_map, OPT_REF(pif_rec->bond_slave_of));
+    if (topo->bond_map)
+        _add_pif(session, topo, OPT_REF(topo->bond_map->contents[0].val->master));
+    FETCH_ONE(xen_vlan, topo->vlan_map, OPT_REF(pif_rec->vlan_master_of));
+    if (topo->vlan_map)
+        _add_pif(session, topo, OPT_REF(topo->vlan_map->contents[0].val->tagged_pif));
+
+    SORT_MAP(topo->pif_map);
+    if (!_index(topo))
+        goto Error;
+    return topo;
+
+ Error:
+    if (rec)
+        xen_pif_record_free(rec);
+    if (pif)
+        xen_pif_free(pif);
+    xen_net_topology_free(topo);
+    return NULL;
+}
+
+void xen_net_topology_free(
+    xen_net_topology *topo)
+{
+    if (topo == NULL)
+        return;
+    if (topo->pif_map)
+        xen_pif_xen_pif_record_map_free(topo->pif_map);
+    if (topo->host_map)
+        xen_host_xen_host_record_map_free(topo->host_map);
+    if (topo->metrics_map)
+        xen_pif_metrics_xen_pif_metrics_record_map_free(topo->metrics_map);
+    if (topo->network_map)
+        xen_network_xen_network_record_map_free(topo->network_map);
+    if (topo->bond_map)
+        xen_bond_xen_bond_record_map_free(topo->bond_map);
+    if (topo->vlan_map)
+        xen_vlan_xen_vlan_record_map_free(topo->vlan_map);
+    free(topo->pifs);
+    free(topo->by_ref);
+    free(topo);
+}
+
+xen_net_pif *xen_net_topology_find(
+    xen_net_topology *topo,
+    xen_pif pif)
+{
+    const char *key = (char *)pif;
+    if (topo == NULL || key == NULL)
+        return NULL;
+    xen_net_pif **found = bsearch(&key, topo->by_ref, topo->pif_count,
+                                  sizeof(xen_net_pif *), _cmp_ref_to_pif);
+    return found ? *found : NULL;
+}
+
+xen_net_pif *xen_net_topology_find_uuid(
+    xen_net_topology *topo,
+    const char *uuid)
+{
+    int i;
+    if (topo == NULL || uuid == NULL)
+        return NULL;
+    for (i = 0; i < topo->pif_count; i++)
+        if (topo->pifs[i].rec->uuid && strcmp(topo->pifs[i].rec->uuid, uuid) == 0)
+            return &topo->pifs[i];
+    return NULL;
+}
+
+xen_pif_record *xen_net_topology_take_record(
+    xen_net_topology *topo,
+    xen_net_pif *pif)
+{
+    size_t i;
+    for (i = 0; topo && pif && i < topo->pif_map->size; i++) {
+        if (topo->pif_map->contents[i].val == pif->rec) {
+            topo->pif_map->contents[i].val = NULL;
+            return pif->rec;
+        }
+    }
+    return NULL;
+}
+
+/* Storage */
+
+static int _cmp_sr_host(const void *a, const void *b)
+{
+    const xen_storage_pbd *pa = a, *pb = b;
+    int rc = _cmp_str(OPT_REF(pa->rec->sr), OPT_REF(pb->rec->sr));
+    if (rc == 0)
+        rc = _cmp_str((char *)pa->host, (char *)pb->host);
+    return rc;
+}
+
+static int _cmp_ref_to_sr(const void *key, const void *elem)
+{
+    return strcmp(*(const char * const *)key, (char *)((const xen_storage_sr *)elem)->sr);
+}
+
+/* Links the SRs to their PBDs and the PBDs to their hosts */
+static int _index_storage(xen_storage_topology *topo)
+{
+    int i, j, n = topo->sr_map->size, np = topo->pbd_map ? topo->pbd_map->size : 0;
+
+    SORT_MAP(topo->sr_map);
+    SORT_MAP(topo->host_map);
+
+    topo->srs = calloc(n + 1, sizeof(xen_storage_sr));
+    topo->pbds = calloc(np + 1, sizeof(xen_storage_pbd));
+    if (topo->srs == NULL || topo->pbds == NULL)
+        return 0;
+    for (i = 0; i < np; i++) {
+        xen_storage_pbd *pbd = &topo->pbds[i];
+        pbd->pbd = topo->pbd_map->contents[i].key;
+        pbd->rec = topo->pbd_map->contents[i].val;
+        pbd->host = OPT_REF(pbd->rec->host);
+        MAP_GET(topo->host_map, pbd->host, pbd->host_rec);
+    }
+    topo->pbd_count = np;
+    qsort(topo->pbds, np, sizeof(xen_storage_pbd), _cmp_sr_host);
+
+    /* both are sorted by SR ref, the PBDs of each SR follow on */
+    for (i = 0, j = 0; i < n; i++) {
+        xen_storage_sr *sr = &topo->srs[i];
+        sr->sr = topo->sr_map->contents[i].key;
+        sr->rec = topo->sr_map->contents[i].val;
+        while (j < np && _cmp_str(OPT_REF(topo->pbds[j].rec->sr), (char *)sr->sr) < 0)
+            j++;
+        sr->pbds = &topo->pbds[j];
+        while (j < np && _cmp_str(OPT_REF(topo->pbds[j].rec->sr), (char *)sr->sr) == 0)
+            j++;
+        sr->pbd_count = &topo->pbds[j] - sr->pbds;
+        /* from the SR's own list, not the PBDs that could be fetched */
+        sr->shared = (sr->rec->pbds == NULL || sr->rec->pbds->size != 1);
+    }
+    topo->sr_count = n;
+    return 1;
+}
+
+xen_storage_topology *xen_storage_topology_new(
+    xen_utils_session *session,
+    bool hosts)
+{
+    xen_storage_topology *topo = calloc(1, sizeof(xen_storage_topology));
+    if (topo == NULL)
+        return NULL;
+
+    if (!xen_sr_get_all_records(session->xen, &topo->sr_map)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        free(topo);
+        return NULL;
+    }
+    if (hosts && !xen_pbd_get_all_records(session->xen, &topo->pbd_map))
+        _missing(session, "PBD");
+    if (hosts && !xen_host_get_all_records(session->xen, &topo->host_map))
+        _missing(session, "host");
+
+    if (!_index_storage(topo)) {
+        xen_storage_topology_free(topo);
+        return NULL;
+    }
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Storage topology of %d SRs and %d PBDs",
+                                           topo->sr_count, topo->pbd_count));
+    return topo;
+}
+
+/*
+ * The PBD of a local SR and its host, a shared SR has no host to fetch.
+ * Either record may be left NULL when it couldn't be fetched, the error
+ * is reset.
+ */
+static void _get_local_pbd(
+    xen_utils_session *session,
+    xen_sr_record *sr_rec,
+    xen_pbd_record **pbd_rec,
+    xen_host_record **host_rec)
+{
+    char *ref;
+
+    *pbd_rec = NULL;
+    *host_rec = NULL;
+    if (sr_rec->pbds == NULL || sr_rec->pbds->size != 1 ||
+        (ref = OPT_REF(sr_rec->pbds->contents[0])) == NULL)
+        return;
+    if (!xen_pbd_get_record(session->xen, pbd_rec, ref)) {
+        _missing(session, "PBD");
+        *pbd_rec = NULL;
+        return;
+    }
+    if ((ref = OPT_REF((*pbd_rec)->host)) != NULL &&
+        !xen_host_get_record(session->xen, host_rec, ref)) {
+        _missing(session, "host");
+        *host_rec = NULL;
+    }
+}
+
+xen_storage_topology *xen_storage_topology_new_for_sr(
+    xen_utils_session *session,
+    const char *uuid,
+    bool hosts)
+{
+    xen_sr sr = NULL;
+    xen_sr_record *rec = NULL;
+    xen_storage_topology *topo = NULL;
+    xen_pbd_record *pbd_rec = NULL;
+    xen_host_record *host_rec = NULL;
+
+    if (!xen_sr_get_by_uuid(session->xen, &sr, (char *)uuid) ||
+        !xen_sr_get_record(session->xen, &rec, sr)) {
+        xen_utils_trace_error(session->xen, __FILE__, __LINE__);
+        goto Error;
+    }
+    if ((topo = calloc(1, sizeof(xen_storage_topology))) == NULL ||
+        (topo->sr_map = xen_sr_xen_sr_record_map_alloc(1)) == NULL)
+        goto Error;
+    topo->sr_map->contents[0].key = sr;
+    topo->sr_map->contents[0].val = rec;
+    sr = NULL;
+
+    if (hosts)
+        _get_local_pbd(session, rec, &pbd_rec, &host_rec);
+    rec = NULL;
+    if (pbd_rec) {
+        if ((topo->pbd_map = xen_pbd_xen_pbd_record_map_alloc(1)) == NULL ||
+            (topo->pbd_map->contents[0].key = strdup(OPT_REF(topo->sr_map->contents[0].val->pbds->contents[0]))) == NULL)
+            goto Error;
+        topo->pbd_map->contents[0].val = pbd_rec;
+        pbd_rec = NULL;
+    }
+    if (host_rec) {
+        if ((topo->host_map = xen_host_xen_host_record_map_alloc(1)) == NULL ||
+            (topo->host_map->contents[0].key = strdup(OPT_REF(topo->pbd_map->contents[0].val->host))) == NULL)
+            goto Error;
+        topo->host_map->contents[0].val = host_rec;
+        host_rec = NULL;
+    }
+
+    if (!_index_storage(topo))
+        goto Error;
+    return topo;
+
+ Error:
+    if (host_rec)
+        xen_host_record_free(host_rec);
+    if (pbd_rec)
+        xen_pbd_record_free(pbd_rec);
+    if (rec)
+        xen_sr_record_free(rec);
+    if (sr)
+        xen_sr_free(sr);
+    xen_storage_topology_free(topo);
+    return NULL;
+}
+
+xen_host_record *xen_storage_local_host(
+    xen_utils_session *session,
+    xen_sr_record *sr_rec)
+{
+    xen_pbd_record *pbd_rec = NULL;
+    xen_host_record *host_rec = NULL;
+
+    _get_local_pbd(session, sr_rec, &pbd_rec, &host_rec);
+    if (pbd_rec)
+        xen_pbd_record_free(pbd_rec);
+    return host_rec;
+}
+
+void xen_storage_topology_free(
+    xen_storage_topology *topo)
+{
+    if (topo == NULL)
+        return;
+    if (topo->sr_map)
+        xen_sr_xen_sr_record_map_free(topo->sr_map);
+    if (topo->pbd_map)
+        xen_pbd_xen_pbd_record_map_free(topo->pbd_map);
+    if (topo->host_map)
+        xen_host_xen_host_record_map_free(topo->host_map);
+    free(topo->srs);
+    free(topo->pbds);
+    free(topo);
+}
+
+xen_storage_sr *xen_storage_topology_find(
+    xen_storage_topology *topo,
+    xen_sr sr)
+{
+    const char *key = (char *)sr;
+    if (topo == NULL || key == NULL)
+        return NULL;
+    return bsearch(&key, topo->srs, topo->sr_count, sizeof(xen_storage_sr), _cmp_ref_to_sr);
+}
+
+xen_storage_sr *xen_storage_topology_find_uuid(
+    xen_storage_topology *topo,
+    const char *uuid)
+{
+    int i;
+    if (topo == NULL || uuid == NULL)
+        return NULL;
+    for (i = 0; i < topo->sr_count; i++)
+        if (topo->srs[i].rec->uuid && strcmp(topo->srs[i].rec->uuid, uuid) == 0)
+            return &topo->srs[i];
+    return NULL;
+}
+
+xen_storage_pbd *xen_storage_topology_host_pbd(
+    xen_storage_sr *sr,
+    xen_host host)
+{
+    int i;
+    for (i = 0; sr && host && i < sr->pbd_count; i++)
+        if (_cmp_str((char *)sr->pbds[i].host, (char *)host) == 0)
+            return &sr->pbds[i];
+    return NULL;
+}
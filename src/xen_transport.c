@@ -0,0 +1,659 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "xen_transport.h"
+#include "cmpitrace.h"
+
+typedef enum {
+    transport_live = 0,
+    transport_record,
+    transport_replay
+} transport_mode;
+
+#define TRANSPORT_MAGIC "xs-cim transport 1\n"
+#define LOGIN_METHOD "<methodName>session.login_with_password</methodName>"
+#define LOGOUT_METHOD "<methodName>session.logout</methodName>"
+#define REDACTED "redacted"
+
+/* A request and what was recorded for it, in the order it was seen */
+typedef struct _replay_response {
+    int result;
+    long http_code;
+    size_t len;
+    char *data;
+} replay_response;
+
+typedef struct _replay_entry {
+    struct _replay_entry *next;     /* hash chain */
+    char *key;
+    size_t key_len;
+    unsigned int hash;
+    size_t count;
+    size_t size;
+    size_t next_response;
+    replay_response *responses;
+} replay_entry;
+
+static pthread_once_t transport_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t transport_lock = PTHREAD_MUTEX_INITIALIZER;
+static transport_mode mode = transport_live;
+static gzFile record_file = NULL;
+static replay_entry **replay_table = NULL;
+static size_t replay_buckets = 0;
+static size_t replay_entries = 0;
+
+/* The session refs seen in the recording and what they are written as,
+   under transport_lock. A session is forgotten once it is logged out. */
+typedef struct _recorded_session {
+    struct _recorded_session *next;
+    char *ref;
+    char *alias;
+} recorded_session;
+
+static recorded_session *recorded_sessions = NULL;
+static unsigned long recorded_logins = 0;
+
+/* FNV-1a */
+static unsigned int _hash(
+    const char *key,
+    size_t len)
+{
+    unsigned int h = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Blanks out the text of the first two parameters of a login, the user
+ * name and the password, in place (key has room for REDACTED twice more).
+ * Recordings are taken off the pool, so they mustn't hold the credentials,
+ * and a replay then matches the login whoever logs in. Returns the new
+ * length.
+ */
+static size_t _redact_login(
+    char *key,
+    size_t key_len)
+{
+    char *end = key + key_len;
+    char *param = strstr(key, LOGIN_METHOD);
+    int i;
+
+    for (i = 0; param && i < 2; i++) {
+        char *text, *text_end;
+        if ((param = strstr(param, "<param>")) == NULL ||
+            (text = strstr(param, "<value>")) == NULL)
+            break;
+        text += strlen("<value>");
+        if (strncmp(text, "<string>", strlen("<string>")) == 0)
+            text += strlen("<string>");
+        if ((text_end = strchr(text, '<')) == NULL)
+            break;
+        memmove(text + strlen(REDACTED), text_end, end - text_end + 1);
+        memcpy(text, REDACTED, strlen(REDACTED));
+        end += strlen(REDACTED) - (text_end - text);
+        param = text + strlen(REDACTED);
+    }
+    return end - key;
+}
+
+/*
+ * The request as it is matched: "<method> <url>\n<body>", with the
+ * start and end parameters taken out of the query string since those
+ * are times that won't be the same when the trace is replayed.
+ */
+static char *_request_key(
+    const char *method,
+    const char *url,
+    const void *body,
+    size_t body_len,
+    size_t *key_len)
+{
+    size_t url_len = strlen(url);
+    char *key = malloc(strlen(method) + url_len + body_len + 2 * strlen(REDACTED) + 3);
+    char *out = key;
+    const char *query = strchr(url, '?');
+
+    if (key == NULL)
+        return NULL;
+    out += sprintf(out, "%s ", method);
+    if (query == NULL) {
+        memcpy(out, url, url_len);
+        out += url_len;
+    }
+    else {
+        const char *param = query + 1;
+        memcpy(out, url, param - url);
+        out += param - url;
+        while (*param) {
+            const char *end = strchr(param, '&');
+            size_t len = end ? (size_t)(end - param) : strlen(param);
+            if (strncmp(param, "start=", 6) != 0 && strncmp(param, "end=", 4) != 0) {
+                memcpy(out, param, len);
+                out += len;
+                if (end)
+                    *out++ = '&';
+            }
+            param += len + (end ? 1 : 0);
+        }
+        if (out[-1] == '&')
+            out--;
+    }
+    *out++ = '\n';
+    if (body_len) {
+        memcpy(out, body, body_len);
+        out += body_len;
+    }
+    *out = '\0';
+    *key_len = _redact_login(key, out - key);
+    return key;
+}
+
+static replay_entry *_replay_find(
+    const char *key,
+    size_t key_len,
+    unsigned int hash)
+{
+    replay_entry *entry;
+    if (replay_buckets == 0)
+        return NULL;
+    for (entry = replay_table[hash % replay_buckets]; entry; entry = entry->next)
+        if (entry->hash == hash && entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0)
+            return entry;
+    return NULL;
+}
+
+static int _replay_grow()
+{
+    size_t buckets = replay_buckets ? replay_buckets * 2 : 1024;
+    replay_entry **table = calloc(buckets, sizeof(replay_entry *));
+    size_t i;
+    if (table == NULL)
+        return 0;
+    for (i = 0; i < replay_buckets; i++) {
+        replay_entry *entry = replay_table[i];
+        while (entry) {
+            replay_entry *next = entry->next;
+            entry->next = table[entry->hash % buckets];
+            table[entry->hash % buckets] = entry;
+            entry = next;
+        }
+    }
+    free(replay_table);
+    replay_table = table;
+    replay_buckets = buckets;
+    return 1;
+}
+
+/* Takes ownership of key and data */
+static int _replay_add(
+    char *key,
+    size_t key_len,
+    int result,
+    long http_code,
+    char *data,
+    size_t len)
+{
+    unsigned int hash = _hash(key, key_len);
+    replay_entry *entry = _replay_find(key, key_len, hash);
+
+    if (entry == NULL) {
+        if (replay_entries >= replay_buckets && !_replay_grow())
+            return 0;
+        entry = calloc(1, sizeof(replay_entry));
+        if (entry == NULL)
+            return 0;
+        entry->key = key;
+        entry->key_len = key_len;
+        entry->hash = hash;
+        entry->next = replay_table[hash % replay_buckets];
+        replay_table[hash % replay_buckets] = entry;
+        replay_entries++;
+    }
+    else
+        free(key);
+
+    if (entry->count == entry->size) {
+        size_t size = entry->size ? entry->size * 2 : 1;
+        replay_response *responses = realloc(entry->responses, size * sizeof(replay_response));
+        if (responses == NULL) {
+            free(data);
+            return 0;
+        }
+        entry->responses = responses;
+        entry->size = size;
+    }
+    replay_response *response = &entry->responses[entry->count++];
+    response->result = result;
+    response->http_code = http_code;
+    response->data = data;
+    response->len = len;
+    return 1;
+}
+
+static char *_read_bytes(
+    gzFile file,
+    size_t len)
+{
+    char *buf = malloc(len + 1);
+    if (buf == NULL)
+        return NULL;
+    if (len && gzread(file, buf, (unsigned int)len) != (int)len) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+static int _replay_load(
+    const char *path)
+{
+    char line[128];
+    unsigned long records = 0;
+    gzFile file = gzopen(path, "rb");
+
+    if (file == NULL) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Could not open the transport recording %s", path));
+        return 0;
+    }
+    if (gzgets(file, line, sizeof(line)) == NULL || strcmp(line, TRANSPORT_MAGIC) != 0) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s is not a transport recording", path));
+        gzclose(file);
+        return 0;
+    }
+    while (gzgets(file, line, sizeof(line))) {
+        int result;
+        long http_code;
+        unsigned long key_len, len;
+        if (sscanf(line, "%d %ld %lu %lu", &result, &http_code, &key_len, &len) != 4)
+            break;
+        char *key = _read_bytes(file, key_len);
+        char *data = key ? _read_bytes(file, len) : NULL;
+        if (data == NULL || gzgetc(file) != '\n') {
+            free(key);
+            free(data);
+            break;
+        }
+        if (!_replay_add(key, key_len, result, http_code, data, len))
+            break;
+        records++;
+    }
+    if (!gzeof(file))
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_WARNING, ("%s is truncated after %lu records", path, records));
+    gzclose(file);
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,
+        ("Replaying %lu records for %lu requests from %s", records, (unsigned long)replay_entries, path));
+    return 1;
+}
+
+static void _transport_shutdown()
+{
+    pthread_mutex_lock(&transport_lock);
+    if (record_file) {
+        gzclose(record_file);
+        record_file = NULL;
+    }
+    while (recorded_sessions) {
+        recorded_session *session = recorded_sessions;
+        recorded_sessions = session->next;
+        free(session->ref);
+        free(session->alias);
+        free(session);
+    }
+    pthread_mutex_unlock(&transport_lock);
+}
+
+/* The recording is only for whoever made it, and never overwrites a file */
+static gzFile _record_create(
+    const char *path)
+{
+    gzFile file;
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    if ((file = gzdopen(fd, "wb")) == NULL)
+        close(fd);
+    return file;
+}
+
+static void _transport_init()
+{
+    char *val = getenv("XEN_CIM_TRANSPORT");
+    if (val == NULL || *val == '\0' || strcmp(val, "live") == 0)
+        return;
+
+    if (strncmp(val, "record:", 7) == 0) {
+        record_file = _record_create(val + 7);
+        if (record_file == NULL || gzputs(record_file, TRANSPORT_MAGIC) < 0) {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Could not create the transport recording %s", val + 7));
+            return;
+        }
+        atexit(_transport_shutdown);
+        mode = transport_record;
+    }
+    else if (strncmp(val, "replay:", 7) == 0) {
+        /* never fall back to the network, a replay is meant to run without one */
+        mode = transport_replay;
+        _replay_load(val + 7);
+    }
+    else {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Unknown XEN_CIM_TRANSPORT %s", val));
+    }
+}
+
+/******************************************************************************
+ * Running the request
+ *****************************************************************************/
+/* Passes the response on to the caller, keeping a copy of what it took */
+typedef struct {
+    xen_transport_write_func write;
+    void *handle;
+    char *data;
+    size_t len;
+    size_t size;
+    int failed;
+} record_tee;
+
+static size_t _discard(
+    void *ptr,
+    size_t size,
+    size_t nmemb,
+    void *handle)
+{
+    return size * nmemb;
+}
+
+static size_t _record_tee(
+    void *ptr,
+    size_t size,
+    size_t nmemb,
+    void *handle)
+{
+    record_tee *tee = (record_tee *)handle;
+    size_t taken = tee->write(ptr, size, nmemb, tee->handle);
+    size_t len = (taken == size * nmemb) ? taken : 0;
+
+    if (len && !tee->failed) {
+        if (tee->len + len > tee->size) {
+            size_t new_size = tee->size ? tee->size * 2 : 4096;
+            while (new_size < tee->len + len)
+                new_size *= 2;
+            char *data = realloc(tee->data, new_size);
+            if (data == NULL) {
+                tee->failed = 1;
+                return taken;
+            }
+            tee->data = data;
+            tee->size = new_size;
+        }
+        memcpy(tee->data + tee->len, ptr, len);
+        tee->len += len;
+    }
+    return taken;
+}
+
+static const char *_find_bytes(
+    const char *buf,
+    size_t len,
+    const char *what,
+    size_t what_len)
+{
+    const char *end = buf + len;
+    for (; what_len <= (size_t)(end - buf); buf++) {
+        if ((buf = memchr(buf, what[0], end - buf - what_len + 1)) == NULL)
+            return NULL;
+        if (memcmp(buf, what, what_len) == 0)
+            return buf;
+    }
+    return NULL;
+}
+
+/*
+ * Called with the lock held. The session refs a login response hands out
+ * are written as "OpaqueRef:recorded-session-<n>", n counting the logins
+ * of the recording, so a replay hands out the same aliases in the same
+ * order and the requests made with them match.
+ */
+static void _add_sessions(
+    const char *data,
+    size_t len)
+{
+    const char *end = data + len;
+    const char *ref = data;
+
+    while ((ref = _find_bytes(ref, end - ref, "OpaqueRef:", 10)) != NULL) {
+        const char *ref_end = memchr(ref, '<', end - ref);
+        recorded_session *session = calloc(1, sizeof(recorded_session));
+        char alias[64];
+        snprintf(alias, sizeof(alias), "OpaqueRef:recorded-session-%lu", ++recorded_logins);
+        if (ref_end == NULL || session == NULL ||
+            (session->ref = strndup(ref, ref_end - ref)) == NULL ||
+            (session->alias = strdup(alias)) == NULL) {
+            if (session)
+                free(session->ref);
+            free(session);
+            return;
+        }
+        session->next = recorded_sessions;
+        recorded_sessions = session;
+        ref = ref_end;
+    }
+}
+
+/* Called with the lock held. A copy of buf with the session refs replaced
+   by their aliases, NULL if there's no session ref in it. */
+static char *_scrub_sessions(
+    const char *buf,
+    size_t len,
+    size_t *scrubbed_len)
+{
+    char *scrubbed = NULL;
+    recorded_session *session;
+
+    for (session = recorded_sessions; session; session = session->next) {
+        size_t ref_len = strlen(session->ref), alias_len = strlen(session->alias);
+        const char *from = scrubbed ? scrubbed : buf;
+        size_t from_len = scrubbed ? *scrubbed_len : len;
+        const char *found = _find_bytes(from, from_len, session->ref, ref_len);
+        if (found == NULL)
+            continue;
+
+        size_t count = 0;
+        const char *p;
+        for (p = found; p; p = _find_bytes(p + ref_len, from + from_len - (p + ref_len), session->ref, ref_len))
+            count++;
+        char *to = malloc(from_len + count * alias_len + 1);
+        char *out = to;
+        if (to == NULL) {
+            free(scrubbed);
+            return NULL;
+        }
+        for (p = from; (found = _find_bytes(p, from + from_len - p, session->ref, ref_len)) != NULL;
+             p = found + ref_len) {
+            memcpy(out, p, found - p);
+            out += found - p;
+            memcpy(out, session->alias, alias_len);
+            out += alias_len;
+        }
+        memcpy(out, p, from + from_len - p);
+        out += from + from_len - p;
+        *out = '\0';
+        free(scrubbed);
+        scrubbed = to;
+        *scrubbed_len = out - to;
+    }
+    return scrubbed;
+}
+
+/* Called with the lock held, once a logout has been written */
+static void _forget_sessions(
+    const char *key,
+    size_t key_len)
+{
+    recorded_session **link = &recorded_sessions;
+    while (*link) {
+        recorded_session *session = *link;
+        if (_find_bytes(key, key_len, session->ref, strlen(session->ref))) {
+            *link = session->next;
+            free(session->ref);
+            free(session->alias);
+            free(session);
+        }
+        else
+            link = &session->next;
+    }
+}
+
+static void _record(
+    const char *key,
+    size_t key_len,
+    CURLcode result,
+    long http_code,
+    const char *data,
+    size_t len)
+{
+    char *scrubbed_key, *scrubbed_data;
+    size_t scrubbed_key_len = 0, scrubbed_len = 0;
+
+    pthread_mutex_lock(&transport_lock);
+    if (record_file) {
+        if (len && _find_bytes(key, key_len, LOGIN_METHOD, strlen(LOGIN_METHOD)))
+            _add_sessions(data, len);
+        scrubbed_key = _scrub_sessions(key, key_len, &scrubbed_key_len);
+        scrubbed_data = len ? _scrub_sessions(data, len, &scrubbed_len) : NULL;
+        if (_find_bytes(key, key_len, LOGOUT_METHOD, strlen(LOGOUT_METHOD)))
+            _forget_sessions(key, key_len);
+        if (scrubbed_key) {
+            key = scrubbed_key;
+            key_len = scrubbed_key_len;
+        }
+        if (scrubbed_data) {
+            data = scrubbed_data;
+            len = scrubbed_len;
+        }
+        gzprintf(record_file, "%d %ld %lu %lu\n", (int)result, http_code,
+                 (unsigned long)key_len, (unsigned long)len);
+        gzwrite(record_file, key, (unsigned int)key_len);
+        if (len)
+            gzwrite(record_file, data, (unsigned int)len);
+        gzputc(record_file, '\n');
+        /* the CIMOM may kill us at any time, keep what has been written readable */
+        gzflush(record_file, Z_SYNC_FLUSH);
+        free(scrubbed_key);
+        free(scrubbed_data);
+    }
+    pthread_mutex_unlock(&transport_lock);
+}
+
+static CURLcode _replay(
+    const char *key,
+    size_t key_len,
+    xen_transport_write_func write,
+    void *write_handle,
+    long *http_code)
+{
+    replay_response response = {CURLE_COULDNT_CONNECT, 0, 0, NULL};
+
+    pthread_mutex_lock(&transport_lock);
+    replay_entry *entry = _replay_find(key, key_len, _hash(key, key_len));
+    if (entry) {
+        response = entry->responses[entry->next_response];
+        if (entry->next_response + 1 < entry->count)
+            entry->next_response++;
+    }
+    pthread_mutex_unlock(&transport_lock);
+
+    if (entry == NULL) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_WARNING, ("No recorded response for %.*s",
+                     (int)(strchr(key, '\n') - key), key));
+    }
+    if (http_code)
+        *http_code = response.http_code;
+    /* recorded responses are never freed, they are handed out as they are */
+    if (response.len && write(response.data, 1, response.len, write_handle) != response.len)
+        return CURLE_WRITE_ERROR;
+    return (CURLcode)response.result;
+}
+
+CURLcode xen_transport_perform(
+    CURL *curl,
+    const char *method,
+    const char *url,
+    const void *body,
+    size_t body_len,
+    xen_transport_write_func write,
+    void *write_handle,
+    long *http_code)
+{
+    CURLcode result;
+    char *key = NULL;
+    size_t key_len = 0;
+    record_tee tee;
+
+    pthread_once(&transport_once, _transport_init);
+    if (write == NULL)
+        write = _discard;
+
+    if (mode == transport_live) {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, write_handle);
+        result = curl_easy_perform(curl);
+        if (http_code)
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, http_code);
+        return result;
+    }
+
+    key = _request_key(method, url, body, body_len, &key_len);
+    if (key == NULL)
+        return CURLE_OUT_OF_MEMORY;
+
+    if (mode == transport_replay) {
+        result = _replay(key, key_len, write, write_handle, http_code);
+        free(key);
+        return result;
+    }
+
+    long code = 0;
+    memset(&tee, 0, sizeof(tee));
+    tee.write = write;
+    tee.handle = write_handle;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _record_tee);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &tee);
+    result = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    if (http_code)
+        *http_code = code;
+    if (tee.failed) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Out of memory recording %s", url));
+    }
+    else
+        _record(key, key_len, result, code, tee.data, tee.len);
+    free(tee.data);
+    free(key);
+    return result;
+}
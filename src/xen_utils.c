@@ -36,6 +36,10 @@
 #include <cmpiutil.h>
 #include <cmpimacs.h>
 #include "xen_utils.h"
+#include "xen_stats.h"
+#include "xen_probes.h"
+#include "xen_transport.h"
+#include "xen_hosts.h"
 #include "provider_common.h"
 //#include "cmpilify.h"
 
@@ -45,8 +49,7 @@
 #include "Xen_KVP.h"
 
 // XXX I don't like having these declarations here.
-extern void Xen_SettingDatayyrestart(FILE *);
-extern int Xen_SettingDatayyparseinstance(const CMPIBroker *, CMPIInstance **);
+extern int Xen_SettingDatayyparseinstance(const CMPIBroker *, const char *, int, CMPIInstance **);
 
 /* Global variables for reference counting this library's use. */
 static pthread_mutex_t ref_count_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -136,8 +139,16 @@ int xen_utils_get_call_context(
     int rc = 0;
     CMPIData principal = cmpi_ctx->ft->getEntry(cmpi_ctx, "CMPIPrincipal", status);
     if (status->rc == CMPI_RC_OK) {
-        char *str = strdup(CMGetCharPtr(principal.value.string));
-        *ctx = calloc(1, sizeof(struct xen_call_context));
+        /* The call context and everything the providers allocate while
+           servicing this call come out of the same arena */
+        xen_utils_arena *arena = xen_utils_arena_new();
+        if (arena == NULL) {
+            CMSetStatus(status, CMPI_RC_ERR_FAILED);
+            goto Exit;
+        }
+        char *str = xen_utils_arena_strdup(arena, CMGetCharPtr(principal.value.string));
+        *ctx = xen_utils_arena_alloc(arena, sizeof(struct xen_call_context));
+        (*ctx)->arena = arena;
         (*ctx)->user = str;
         str = strchr(str, ' ');
         if(str == NULL) {
@@ -150,6 +161,7 @@ int xen_utils_get_call_context(
             rc = 1;
         }
     }
+ Exit:
     if(rc != 1) {
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, 
                      ("Couldnt get Caller Principal: ERROR %d", status->rc));
@@ -162,74 +174,314 @@ void xen_utils_free_call_context(
     )
 {
     if(ctx) {
-        /* user and pw are both pointing to the same buffer */
-        free(ctx->user);
-        ctx->user = NULL;
-        free(ctx);
+        /* the context itself lives in the arena, along with user and pw */
+        xen_utils_arena_free(ctx->arena);
     }
 }
 
-int xen_utils_get_host_address(xen_utils_session *session, xen_vm vm_ref, char**address) {
-  int rc = 0;
-  xen_vm_record *vm_rec;
-  
-  if (!xen_vm_get_record(session->xen, &vm_rec, vm_ref)){
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find record for VM %s", vm_ref));
-    goto exit;
-  }
+/*
+ * Per call arena allocator.
+ * Memory is handed out from large blocks by bumping a pointer and is only
+ * given back all at once, either by rewinding the arena to a previously
+ * taken mark or by freeing the whole arena at the end of the call. An arena
+ * is only ever used by the thread servicing the call, so there's no locking.
+ *
+ * A mark opens a frame, which the allocations for it go to. Rewinding is
+ * only safe for the innermost frame with nothing allocated after it for
+ * anybody else, so the arena keeps track of the open frames: an allocation
+ * for another frame, or for no frame at all, closes all those opened
+ * before it. Rewinding a closed frame does nothing, its memory is then
+ * given back with the rest of the arena at the end of the call.
+ */
+#define ARENA_BLOCK_SIZE  (16 * 1024)
+#define ARENA_ALIGN(__size) (((__size) + 15) & ~((size_t)15))
+
+struct _xen_utils_arena_block {
+    struct _xen_utils_arena_block *next;  /* next older block */
+    size_t size;                          /* usable bytes in data */
+    size_t used;
+    char data[] __attribute__((aligned(16)));
+};
 
-  xen_host_record_opt *host = vm_rec->resident_on;
-  
-  if (!host->u.handle) {
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Error: could not find a host reference"));
-    goto exit;
-  }
+struct _xen_utils_arena {
+    xen_utils_arena_block *blocks;        /* blocks in use, newest first */
+    xen_utils_arena_block *spare;         /* blocks given back by a rewind, for reuse */
+    unsigned long frames;                 /* frames opened so far */
+    unsigned long top;                    /* innermost open frame, 0 if none */
+};
 
-  if (!xen_host_get_address(session->xen, &(*address), host->u.handle)){
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find a host address for %s", host->u.handle));
-    goto exit;
-  }
+xen_utils_arena *xen_utils_arena_new()
+{
+    return calloc(1, sizeof(xen_utils_arena));
+}
 
-  rc = 1;
-  
- exit:
-  if (vm_rec)
-    xen_vm_record_free(vm_rec);
+static void *_arena_alloc(
+    xen_utils_arena *arena,
+    size_t size)
+{
+    xen_utils_arena_block *block = arena->blocks;
+    size = ARENA_ALIGN(size ? size : 1);
 
-  return rc;
+    if (block == NULL || (block->size - block->used) < size) {
+        /* reuse a spare block if its big enough, get a new one otherwise */
+        if (arena->spare && arena->spare->size >= size) {
+            block = arena->spare;
+            arena->spare = block->next;
+        }
+        else {
+            size_t block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+            block = malloc(sizeof(xen_utils_arena_block) + block_size);
+            if (block == NULL)
+                return NULL;
+            block->size = block_size;
+        }
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    void *mem = block->data + block->used;
+    block->used += size;
+    memset(mem, 0, size);
+    return mem;
 }
 
-int xen_utils_get_hostname(xen_utils_session *session, xen_vm vm_ref, char **hostname){
-  xen_vm_record *vm_rec;
+/* Allocates zeroed memory from the arena, just like calloc(), for as long
+   as the arena lives */
+void *xen_utils_arena_alloc(
+    xen_utils_arena *arena,
+    size_t size)
+{
+    arena->top = 0;
+    return _arena_alloc(arena, size);
+}
 
-  if (!xen_vm_get_record(session->xen, &vm_rec, vm_ref)){
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find record for VM %s", vm_ref));
-    goto exit;
-  }
+/* Allocates zeroed memory in the frame of a mark, given back when the
+   arena is rewound to it */
+void *xen_utils_arena_alloc_for(
+    xen_utils_arena *arena,
+    const xen_utils_arena_mark *mark,
+    size_t size)
+{
+    if (arena->top != mark->frame)
+        arena->top = 0;
+    return _arena_alloc(arena, size);
+}
 
-  xen_host_record_opt *host = vm_rec->resident_on;
-  
-  if (!host->u.handle) {
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find host reference"));
-    goto exit;
-  }
+char *xen_utils_arena_strdup(
+    xen_utils_arena *arena,
+    const char *str)
+{
+    if (str == NULL)
+        return NULL;
+    size_t len = strlen(str) + 1;
+    char *copy = xen_utils_arena_alloc(arena, len);
+    if (copy)
+        memcpy(copy, str, len);
+    return copy;
+}
 
+/* Opens a frame for the allocations that follow */
+xen_utils_arena_mark xen_utils_arena_get_mark(
+    xen_utils_arena *arena)
+{
+    xen_utils_arena_mark mark = {arena->blocks, arena->blocks ? arena->blocks->used : 0,
+                                 ++arena->frames, arena->top};
+    arena->top = mark.frame;
+    return mark;
+}
 
-  if (!xen_host_get_hostname(session->xen, &(*hostname), host->u.handle)){
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find hostname for host %s", host->u.handle));
-    goto exit;
+/* Gives back everything allocated since the mark was taken, if nothing
+   still in use was allocated since */
+void xen_utils_arena_rewind(
+    xen_utils_arena *arena,
+    xen_utils_arena_mark mark)
+{
+    if (mark.frame == 0 || arena->top != mark.frame)
+        return;
+    arena->top = mark.enclosing;
+    while (arena->blocks && arena->blocks != mark.block) {
+        xen_utils_arena_block *block = arena->blocks;
+        arena->blocks = block->next;
+        block->next = arena->spare;
+        arena->spare = block;
+    }
+    if (arena->blocks)
+        arena->blocks->used = mark.used;
+}
+
+void xen_utils_arena_free(
+    xen_utils_arena *arena)
+{
+    xen_utils_arena_block *block, *next;
+    if (arena == NULL)
+        return;
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    for (block = arena->spare; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
+
+/*
+ * Process wide string intern pool.
+ * Interned strings are stored once and live until the provider is
+ * unloaded, so two interned strings are equal if and only if their
+ * pointers are. The pool is split into stripes, each with its own lock
+ * and hash table, so that threads interning different strings rarely
+ * contend with each other.
+ */
+#define INTERN_STRIPES         16
+#define INTERN_INITIAL_BUCKETS 64
+
+typedef struct _intern_entry {
+    struct _intern_entry *next;
+    unsigned long hash;
+    char str[];
+} intern_entry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    intern_entry **buckets;
+    size_t num_buckets;
+    size_t count;
+} intern_stripe;
+
+static intern_stripe intern_pool[INTERN_STRIPES];
+static pthread_once_t intern_pool_once = PTHREAD_ONCE_INIT;
+
+static void _intern_pool_init()
+{
+    int i;
+    for (i = 0; i < INTERN_STRIPES; i++)
+        pthread_mutex_init(&intern_pool[i].lock, NULL);
+}
+
+static unsigned long _intern_hash(const char *str)
+{
+    unsigned long hash = 5381;
+    while (*str)
+        hash = (hash * 33) ^ (unsigned char)*str++;
+    return hash;
+}
+
+/* Called with the stripe lock held */
+static void _intern_stripe_grow(intern_stripe *stripe)
+{
+    size_t i, num_buckets = stripe->num_buckets ? stripe->num_buckets * 2 : INTERN_INITIAL_BUCKETS;
+    intern_entry **buckets = calloc(num_buckets, sizeof(intern_entry *));
+    if (buckets == NULL)
+        return; /* keep going with longer chains */
+    for (i = 0; i < stripe->num_buckets; i++) {
+        intern_entry *entry = stripe->buckets[i], *next;
+        for (; entry; entry = next) {
+            next = entry->next;
+            entry->next = buckets[entry->hash % num_buckets];
+            buckets[entry->hash % num_buckets] = entry;
+        }
+    }
+    free(stripe->buckets);
+    stripe->buckets = buckets;
+    stripe->num_buckets = num_buckets;
+}
+
+/*
+ * Returns the pooled copy of 'str', adding it to the pool if it isn't
+ * there yet. The returned string must never be modified or freed.
+ * Returns NULL if 'str' is NULL or if we ran out of memory.
+ */
+const char *xen_utils_intern(
+    const char *str)
+{
+    intern_entry *entry;
+    const char *interned = NULL;
+
+    if (str == NULL)
+        return NULL;
+    pthread_once(&intern_pool_once, _intern_pool_init);
+
+    unsigned long hash = _intern_hash(str);
+    /* use the high bits for the stripe, the low ones pick the bucket */
+    intern_stripe *stripe = &intern_pool[(hash >> 16) % INTERN_STRIPES];
+
+    pthread_mutex_lock(&stripe->lock);
+    if (stripe->num_buckets) {
+        for (entry = stripe->buckets[hash % stripe->num_buckets]; entry; entry = entry->next) {
+            if (entry->hash == hash && strcmp(entry->str, str) == 0) {
+                interned = entry->str;
+                goto Exit;
+            }
+        }
+    }
+    if (stripe->count >= stripe->num_buckets)
+        _intern_stripe_grow(stripe);
+    if (stripe->num_buckets == 0)
+        goto Exit;
+
+    size_t len = strlen(str) + 1;
+    entry = malloc(sizeof(intern_entry) + len);
+    if (entry == NULL)
+        goto Exit;
+    entry->hash = hash;
+    memcpy(entry->str, str, len);
+    entry->next = stripe->buckets[hash % stripe->num_buckets];
+    stripe->buckets[hash % stripe->num_buckets] = entry;
+    stripe->count++;
+    interned = entry->str;
+
+Exit:
+    pthread_mutex_unlock(&stripe->lock);
+    return interned;
+}
+
+/* The directory entry of the host the VM is resident on */
+static const xen_host_entry *_get_resident_host(
+    xen_utils_session *session,
+    xen_vm vm_ref,
+    xen_host_directory **hosts)
+{
+  xen_host host = NULL;
+  const xen_host_entry *entry = NULL;
+
+  if (!xen_vm_get_resident_on(session->xen, &host, vm_ref) || (host == NULL)) {
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find a host reference for VM %s", (char *)vm_ref));
+    RESET_XEN_ERROR(session->xen);
+    return NULL;
   }
+  entry = xen_host_directory_lookup(session, hosts, host);
+  if (entry == NULL)
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find host %s", host));
+  xen_host_free(host);
+  return entry;
+}
 
+int xen_utils_get_host_address(xen_utils_session *session, xen_vm vm_ref, char**address) {
+  int rc = 0;
+  xen_host_directory *hosts = NULL;
+  const xen_host_entry *host = _get_resident_host(session, vm_ref, &hosts);
 
-  xen_vm_record_free(vm_rec);
+  if (host && host->address && (*address = strdup(host->address)))
+    rc = 1;
+  else
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find a host address for VM %s", vm_ref));
+  xen_host_directory_release(hosts);
+  return rc;
+}
 
-  return 1;
+int xen_utils_get_hostname(xen_utils_session *session, xen_vm vm_ref, char **hostname){
+  int rc = 0;
+  xen_host_directory *hosts = NULL;
+  const xen_host_entry *host = _get_resident_host(session, vm_ref, &hosts);
 
-exit:
-      if(vm_rec)
-	xen_vm_record_free(vm_rec);
-      
-      return 0;
+  if (host && host->hostname && (*hostname = strdup(host->hostname)))
+    rc = 1;
+  else
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("Error: could not find hostname for VM %s", vm_ref));
+  xen_host_directory_release(hosts);
+  return rc;
 }
 
 
@@ -240,6 +492,7 @@ typedef struct
 {
     xen_result_func func;
     void *handle;
+    size_t received;
 } xen_comms;
 
 /*
@@ -264,7 +517,7 @@ write_to_buffer(void *data, size_t size, size_t nmemb, void *stream){
 
   kvp_comms *mem = (kvp_comms *) stream;
 
-  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Size: %d", mem->size));
+  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Size: %d", (int)mem->size));
   mem->memory = realloc(mem->memory, mem->size + len + 1 + 1);
 
   if(mem->memory == NULL) {
@@ -323,11 +576,10 @@ long post_to_url(const char *url, char *data){
     curl_easy_setopt(curl, CURLOPT_READDATA, data_obj);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, data_obj->sizeleft);
 
-    res = curl_easy_perform(curl);
+    res = xen_transport_perform(curl, "POST", url, data, data_obj->sizeleft, NULL, NULL, &http_code);
 
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Curl RC: %d", res));
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP RC: %d", http_code));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP RC: %ld", http_code));
 
     curl_easy_cleanup(curl);
   } else {
@@ -356,11 +608,9 @@ long get_from_url(char *url, char** buffer){
 
   if (curl && chunk) {
     curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_buffer);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
 
-    res = curl_easy_perform(curl);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);  
+    res = xen_transport_perform(curl, "GET", url, NULL, 0,
+                                write_to_buffer, (void *)chunk, &http_code);
     curl_easy_cleanup(curl);
 
     *buffer = chunk->memory;
@@ -372,7 +622,7 @@ long get_from_url(char *url, char** buffer){
   }
   
   _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Curl Return Code: %d", res));
-  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP Return Code: %d", http_code));
+  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP Return Code: %ld", http_code));
   
   return http_code;
 
@@ -673,7 +923,7 @@ Xen_KVP_RC xen_utils_delete_kvp(xen_utils_session *session,
 
    http_code = post_to_url(url, "");
 
-  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP RC: %d", http_code));
+  _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("HTTP RC: %ld", http_code));
 
   if (http_code == 200)
     rc = Xen_KVP_RC_OK;
@@ -846,9 +1096,11 @@ Xen_KVP_RC xen_utils_finishmigration_kvp_channel(xen_utils_session *session, cha
 }
 
 static size_t
-write_func(void *ptr, size_t size, size_t nmemb, xen_comms *comms)
+write_func(void *ptr, size_t size, size_t nmemb, void *handle)
 {
+    xen_comms *comms = (xen_comms *)handle;
     size_t n = size * nmemb;
+    comms->received += n;
     return comms->func(ptr, n, comms->handle) ? n : 0;
 }
 
@@ -863,7 +1115,6 @@ _initialize_curlsession(xen_utils_session* session)
 #ifdef CURLOPT_MUTE
     curl_easy_setopt(curl, CURLOPT_MUTE, 1);
 #endif
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &write_func);
     curl_easy_setopt(curl, CURLOPT_POST, 1);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
@@ -893,12 +1144,16 @@ call_func(const void *data, size_t len, void *user_handle,
 
     char *useragent = "xs-cim\0";
     xen_utils_session *s = (xen_utils_session *)user_handle;
-    curl_easy_setopt(s->curl_handle, CURLOPT_WRITEDATA, &comms);
     curl_easy_setopt(s->curl_handle, CURLOPT_POSTFIELDS, data);
     curl_easy_setopt(s->curl_handle, CURLOPT_POSTFIELDSIZE, len);
     curl_easy_setopt(s->curl_handle, CURLOPT_USERAGENT, useragent);
-    CURLcode result = curl_easy_perform(s->curl_handle);
+    XEN_PROBE2(xapi__request, data, len);
+    uint64_t start = xen_stats_now();
+    CURLcode result = xen_transport_perform(s->curl_handle, "POST", s->host_url, data, len,
+                                            write_func, &comms, NULL);
 
+    XEN_PROBE2(xapi__response, (int)result, comms.received);
+    xen_stats_rpc(start, len, comms.received);
     return result;
 }
 
@@ -967,8 +1222,10 @@ int xen_utils_get_session(
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("No memory for Xen Daemon session object"));
         return 0;
     }
-    /* direct the request at the local xapi */
-    strncpy(s->host_url, "http://127.0.0.1", MAX_HOST_URL_LEN );
+    /* direct the request at the local xapi, unless told otherwise (the
+       benchmarks point this at test/benchmarks/mock_xapi.py) */
+    const char *url = getenv("XEN_CIM_XAPI_URL");
+    snprintf(s->host_url, MAX_HOST_URL_LEN, "%s", url ? url : "http://127.0.0.1");
     _initialize_curlsession(s);
     s->xen = xen_session_login_with_password(call_func,
                  (void *)s,
@@ -1141,7 +1398,7 @@ xen_vm_set* xen_utils_enum_domains(
     }
 
     _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("got %d VMs from xen call", 
-                                           resident_vms_including_templates->size));
+                                           (int)resident_vms_including_templates->size));
 
     //xen_utils_log_domains(resident_vms_including_templates);
     return resident_vms_including_templates;
@@ -1155,7 +1412,7 @@ xen_vm_set* xen_utils_enum_domains(
 int xen_utils_log_domains(xen_vm_set *vm_set) {
   int i;
   for(i = 0; i < vm_set->size; i++) {
-    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VM Ref: %s", vm_set->contents[i]));
+    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("VM Ref: %s", (char *)vm_set->contents[i]));
   }
   return 0;
 }
@@ -1170,6 +1427,16 @@ int xen_utils_get_domain_resources(
     xen_utils_session *session,
     xen_domain_resources **resources,
     enum domain_choice templates_or_vms)
+{
+    return xen_utils_get_domain_resources_where(session, resources, templates_or_vms, NULL, -1);
+}
+
+int xen_utils_get_domain_resources_where(
+    xen_utils_session *session,
+    xen_domain_resources **resources,
+    enum domain_choice templates_or_vms,
+    const char *name_label,
+    int power_state)
 {
     if (session == NULL)
         return 0;
@@ -1179,14 +1446,23 @@ int xen_utils_get_domain_resources(
     if (*resources == NULL)
         return 0;
 
-    /* Get the list of Xen domains. */
+    /* Get the list of Xen domains, xapi looks names up for us */
     RESET_XEN_ERROR(session->xen);
-    (*resources)->domains = xen_utils_enum_domains(session, templates_or_vms);
+    if (name_label) {
+        if (!xen_vm_get_by_name_label(session->xen, &(*resources)->domains, (char *)name_label)) {
+            _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
+                         ("--- xen_vm_get_by_name_label failed: \"%s\"", session->xen->error_description[0]));
+            (*resources)->domains = NULL;
+        }
+    }
+    else
+        (*resources)->domains = xen_utils_enum_domains(session, templates_or_vms);
     if ((*resources)->domains == NULL)
         return 0;
 
     (*resources)->numdomains = (*resources)->domains->size;
     (*resources)->choice = templates_or_vms;
+    (*resources)->power_state = power_state;
 
     return 1;
 }
@@ -1256,7 +1532,7 @@ int xen_utils_get_next_domain_resource(
             RESET_XEN_ERROR(session->xen);
 
 	    *resource_handle = resources->domains->contents[resources->currentdomain];
-	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Current resource handle = %s", *resource_handle));
+	    _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Current resource handle = %s", (char *)*resource_handle));
 	    
 	    if (!xen_vm_get_record(session->xen, resource_rec, *resource_handle)) {
 	      _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,
@@ -1271,25 +1547,17 @@ int xen_utils_get_next_domain_resource(
 	      return -1; /*Returning a failure code */
 	    }
 
-	    if (resources->choice == all)
-	      break;
-
-            bool is_a_template = false, is_a_snapshot = false;
-	    is_a_template = (**resource_rec).is_a_template;
-	    is_a_snapshot = (**resource_rec).is_a_snapshot;
+            if (resources->power_state != -1 &&
+                (int)(**resource_rec).power_state != resources->power_state) {
+                /* not in the state asked for, continue to the next one */
+                xen_vm_record_free(*resource_rec);
+                if(++resources->currentdomain == resources->numdomains)
+                    return 0;
+                continue;
+            }
 
-            if(resources->choice == templates_only && is_a_template) {
-		_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Found a template"));
-                break;
-	    }
-            else if(resources->choice == snapshots_only && is_a_snapshot) {
-		_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Found a snapshot"));
-                break;
-	    }
-            else if(resources->choice == vms_only && !is_a_snapshot && !is_a_template) {
-		_SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO, ("Found a VM"));
-                break;
-	    }
+	    if (xen_utils_domain_is_choice(*resource_rec, resources->choice))
+	      break;
     
             /* didnt match up, continue to the next one and check if we are at the end */
 	    if (resource_rec != NULL)
@@ -1306,6 +1574,26 @@ int xen_utils_get_next_domain_resource(
     return 1;
 }
 
+/*
+ * Whether a domain is one of those enumerated for choice.
+ */
+bool xen_utils_domain_is_choice(
+    xen_vm_record *vm_rec,
+    enum domain_choice choice)
+{
+    switch (choice) {
+    case all:
+        return true;
+    case templates_only:
+        return vm_rec->is_a_template;
+    case snapshots_only:
+        return vm_rec->is_a_snapshot;
+    case vms_only:
+    default:
+        return !vm_rec->is_a_snapshot && !vm_rec->is_a_template;
+    }
+}
+
 /*
  * Free the domain resource specified by resource.
  * Returns non-zero on success, 0 on failure.
@@ -1564,43 +1852,259 @@ int xen_utils_remove_from_string_string_map(
     xen_string_string_map **map
     )
 {
-    char *map_str = xen_utils_flatten_string_string_map(*map);
-    if (map_str) {
-        int buflen = strlen(map_str);
-        char *new_map_str = calloc(1, buflen);
-        /* remove the parent_uuid item from the map */
-        char *key_begin = strstr(map_str, key_to_remove);
-        char *key_end = NULL;
-        if(key_begin) {
-            /* skip over the key item in the map */
-            if(key_begin == map_str) 
-                *key_begin++ = '\0';
-            else {
-                *(key_begin-1) = '\0'; /* get rid of the previous ',' as well */
-                key_begin++;
-            }
-            key_end = strchr(key_begin, ',');
-            if(key_end) {
-                key_end++; /* skip over the trailing ',' */
-                /* create new map string minus the key_to_remove mapping */
-                if (strlen(map_str) > 0)
-                    snprintf(new_map_str, (buflen-1), "%s,%s", map_str, key_end);
-                else
-                    snprintf(new_map_str, (buflen-1), "%s", key_end);
-            }
-            else
-                snprintf(new_map_str, (buflen-1), "%s", map_str);
-            /* recreate the new map minus the 'key_to_remove=value' string */
-            xen_string_string_map_free(*map);
-            *map = xen_utils_convert_string_to_string_map(new_map_str, ","); 
+    int i;
+    if (*map == NULL || (*map)->size == 0)
+        return 0;
+
+    for (i = 0; i < (*map)->size; i++) {
+        if (strcmp((*map)->contents[i].key, key_to_remove) == 0) {
+            free((*map)->contents[i].key);
+            free((*map)->contents[i].val);
+            /* fill the hole with the last entry, order doesnt matter in a map */
+            (*map)->size--;
+            (*map)->contents[i] = (*map)->contents[(*map)->size];
+            break;
         }
-        free(map_str);
-        free(new_map_str);
     }
-    else
+    return 1;
+}
+
+/**********************************************************************
+  Hash index over a xen_string_string_map
+***********************************************************************/
+#define MAP_INDEX_SLOT_EMPTY    -1
+#define MAP_INDEX_SLOT_DELETED  -2
+#define MAP_INDEX_MIN_SLOTS     16
+
+static unsigned int _map_index_hash(const char *key)
+{
+    unsigned int hash = 5381;
+    int c;
+    while ((c = (unsigned char)*key++))
+        hash = ((hash << 5) + hash) + c;
+    return hash;
+}
+
+/* Returns the slot holding key, or -1 if it's not in the index. If
+   free_slot is passed in, it's set to the slot the key should go in */
+static int _map_index_find(
+    xen_utils_string_map_index *index,
+    const char *key,
+    int *free_slot)
+{
+    unsigned int mask = index->num_slots - 1;
+    unsigned int slot = _map_index_hash(key) & mask;
+    int first_deleted = -1;
+
+    while (index->slots[slot] != MAP_INDEX_SLOT_EMPTY) {
+        int pos = index->slots[slot];
+        if (pos == MAP_INDEX_SLOT_DELETED) {
+            if (first_deleted == -1)
+                first_deleted = slot;
+        }
+        else if (strcmp(index->map->contents[pos].key, key) == 0)
+            return slot;
+        slot = (slot + 1) & mask;
+    }
+    if (free_slot)
+        *free_slot = (first_deleted != -1) ? first_deleted : (int)slot;
+    return -1;
+}
+
+/* (Re)builds the slot table, big enough to hold 'entries' entries */
+static int _map_index_rehash(
+    xen_utils_string_map_index *index,
+    int entries)
+{
+    int i, num_slots = MAP_INDEX_MIN_SLOTS;
+    while (num_slots * 3 <= entries * 4)   /* keep the load under 75% */
+        num_slots <<= 1;
+
+    int *slots = malloc(num_slots * sizeof(int));
+    if (slots == NULL)
         return 0;
+    for (i = 0; i < num_slots; i++)
+        slots[i] = MAP_INDEX_SLOT_EMPTY;
+    if (index->slots)
+        free(index->slots);
+    index->slots = slots;
+    index->num_slots = num_slots;
+    index->used = 0;
+
+    for (i = 0; i < index->map->size; i++) {
+        int slot;
+        /* keep the first of any duplicate keys, as the linear lookup does */
+        if (_map_index_find(index, index->map->contents[i].key, &slot) == -1) {
+            index->slots[slot] = i;
+            index->used++;
+        }
+    }
     return 1;
 }
+
+/*
+ * Creates a hash index over map, taking ownership of it. map can be NULL,
+ * in which case an empty map is created.
+ * Returns NULL on failure, in which case map is still owned by the caller.
+ */
+xen_utils_string_map_index *xen_utils_string_map_index_new(
+    xen_string_string_map *map)
+{
+    xen_utils_string_map_index *index = calloc(1, sizeof(xen_utils_string_map_index));
+    if (index == NULL)
+        return NULL;
+    if (map == NULL) {
+        map = xen_string_string_map_alloc(0);
+        if (map == NULL) {
+            free(index);
+            return NULL;
+        }
+        map->size = 0;
+    }
+    index->map = map;
+    index->capacity = map->size;
+    if (!_map_index_rehash(index, map->size)) {
+        free(index);
+        return NULL;
+    }
+    return index;
+}
+
+/*
+ * Get value of key from the indexed map.
+ * Returns pointer to value on success, NULL if key does not exist in map.
+ */
+char *xen_utils_string_map_index_get(
+    xen_utils_string_map_index *index,
+    const char *key)
+{
+    int slot = _map_index_find(index, key, NULL);
+    if (slot == -1)
+        return NULL;
+    return index->map->contents[index->slots[slot]].val;
+}
+
+/*
+ * Add key/val to the indexed map.  If map contains key, update value for that key.
+ * Returns non-zero on success, 0 on failure.  On failure, map is unchanged.
+ */
+int xen_utils_string_map_index_set(
+    xen_utils_string_map_index *index,
+    const char *key,
+    const char *val)
+{
+    int slot;
+    xen_string_string_map *map = index->map;
+    char *new_val = strdup(val);
+    if (new_val == NULL)
+        return 0;
+
+    if ((slot = _map_index_find(index, key, NULL)) != -1) {
+        int pos = index->slots[slot];
+        free(map->contents[pos].val);
+        map->contents[pos].val = new_val;
+        return 1;
+    }
+
+    /* new key, make room for it in the map and in the slot table */
+    if (map->size == index->capacity) {
+        int capacity = index->capacity ? index->capacity * 2 : 4;
+        map = realloc(map, sizeof(xen_string_string_map) +
+                      capacity * sizeof(xen_string_string_map_contents));
+        if (map == NULL) {
+            free(new_val);
+            return 0;
+        }
+        index->map = map;
+        index->capacity = capacity;
+    }
+    if (((index->used + 1) * 4 > index->num_slots * 3) &&
+        !_map_index_rehash(index, map->size + 1)) {
+        free(new_val);
+        return 0;
+    }
+    _map_index_find(index, key, &slot);
+    if (index->slots[slot] == MAP_INDEX_SLOT_EMPTY)
+        index->used++;
+
+    map->contents[map->size].key = strdup(key);
+    map->contents[map->size].val = new_val;
+    index->slots[slot] = map->size;
+    map->size++;
+    return 1;
+}
+
+/*
+ * Remove key/val from the indexed map, in place.
+ * Returns non-zero if the key was removed, 0 if it wasnt found.
+ */
+int xen_utils_string_map_index_remove(
+    xen_utils_string_map_index *index,
+    const char *key)
+{
+    xen_string_string_map *map = index->map;
+    int slot = _map_index_find(index, key, NULL);
+    if (slot == -1)
+        return 0;
+
+    int pos = index->slots[slot];
+    free(map->contents[pos].key);
+    free(map->contents[pos].val);
+    index->slots[slot] = MAP_INDEX_SLOT_DELETED;
+    map->size--;
+
+    /* fill the hole with the last entry and point its slot to the new position */
+    if (pos != map->size) {
+        map->contents[pos] = map->contents[map->size];
+        int moved = _map_index_find(index, map->contents[pos].key, NULL);
+        if (moved != -1 && index->slots[moved] == map->size)
+            index->slots[moved] = pos;
+    }
+    return 1;
+}
+
+/*
+ * Free the index and hand back the map, in the layout expected by the Xen API.
+ * Caller is responsible for freeing the map.
+ */
+xen_string_string_map *xen_utils_string_map_index_release(
+    xen_utils_string_map_index *index)
+{
+    xen_string_string_map *map = index->map;
+    free(index->slots);
+    free(index);
+    return map;
+}
+
+/* Free the index along with the map */
+void xen_utils_string_map_index_free(
+    xen_utils_string_map_index *index)
+{
+    if (index)
+        xen_string_string_map_free(xen_utils_string_map_index_release(index));
+}
+
+int xen_utils_compare_refs(
+    const void *a,
+    const void *b
+    )
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int xen_utils_find_ref(
+    const void *contents,
+    size_t size,
+    size_t entry_size,
+    const char *ref
+    )
+{
+    const char *entry = NULL;
+    if (contents && ref)
+        entry = bsearch(&ref, contents, size, entry_size, xen_utils_compare_refs);
+    return entry ? (int)((entry - (const char *)contents) / entry_size) : -1;
+}
+
 /*
 * Create a string map from a 'flattened' string map
 * Converts a string of form key0=value0,key1=value1,...keyN=valueN
@@ -1612,8 +2116,9 @@ xen_string_string_map* xen_utils_convert_string_to_string_map(
     const char *delimiter
     )
 {
-    xen_string_string_map *map = xen_string_string_map_alloc(0);
-    map->size = 0;
+    xen_utils_string_map_index *index = xen_utils_string_map_index_new(NULL);
+    if (index == NULL)
+        return NULL;
     if (str && *str != '\0') {
         char *tmp=NULL, *tok = NULL;
         char *tmp_str = strdup(str);
@@ -1630,12 +2135,12 @@ xen_string_string_map* xen_utils_convert_string_to_string_map(
                     val++; /* skip over start/end string quotes (WBEM URI) */
                     val[strlen(val)-1] = '\0';
                 }
-                xen_utils_add_to_string_string_map(key, val, &map);
+                xen_utils_string_map_index_set(index, key, val);
             }
         }
         free(tmp_str);
     }
-    return map;
+    return xen_utils_string_map_index_release(index);
 }
 
 /*
@@ -1720,6 +2225,9 @@ xen_utils_convert_CMPIArray_to_string_string_map(CMPIArray *arr)
     xen_string_string_map *map = NULL;
     int i=0;
     int elems = CMGetArrayCount(arr, NULL);
+    xen_utils_string_map_index *index = xen_utils_string_map_index_new(NULL);
+    if (index == NULL)
+        return NULL;
     for (i=0; i<elems; i++) {
         CMPIData data = CMGetArrayElementAt(arr, i, NULL);
         if (!CMIsNullValue(data) && data.type == CMPI_string) {
@@ -1728,10 +2236,16 @@ xen_utils_convert_CMPIArray_to_string_string_map(CMPIArray *arr)
             char *key = strtok_r(strcopy, "=", &tmp2);
             char *val = strtok_r(NULL, "=", &tmp2);
             if (key && val)
-                xen_utils_add_to_string_string_map(key, val, &map);
+                xen_utils_string_map_index_set(index, key, val);
             free(strcopy);
         }
     }
+    map = xen_utils_string_map_index_release(index);
+    if (map->size == 0) {
+        /* callers expect no map at all if there were no valid entries */
+        xen_string_string_map_free(map);
+        map = NULL;
+    }
     return map;
 }
 
@@ -2042,6 +2556,22 @@ char* xen_utils_get_xen_error(
     return tmp;
 }
 
+/*
+ * Whether the failure of a call is down to the object asked for not being
+ * there: xapi doesn't know the uuid or the ref, or xapi wasn't called at
+ * all because the id doesn't name an object.
+ */
+bool xen_utils_error_is_not_found(
+    xen_session *session
+    )
+{
+    if (session == NULL || session->ok)
+        return true;
+    return session->error_description_count > 0 &&
+        (strcmp(session->error_description[0], "UUID_INVALID") == 0 ||
+         strcmp(session->error_description[0], "HANDLE_INVALID") == 0);
+}
+
 void xen_utils_trace_error(
     xen_session *session, 
     char* file, 
@@ -2071,8 +2601,8 @@ void xen_utils_set_status(
         xen_err = xen_utils_get_xen_error(session);
         if(xen_err)
             tmp = xen_err;
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, (default_msg));
-        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, (tmp));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s", default_msg));
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR, ("%s", tmp));
     }
     else
         tmp = "";
@@ -2257,28 +2787,19 @@ int xen_utils_get_cmpi_instance(
 
 CMPIInstance *xen_utils_parse_embedded_instance(const CMPIBroker *broker, const char *instanceStr)
 {
-    char filename[L_tmpnam];
-    FILE *fd;
     int rc;
-    CMPIInstance *instance;
+    CMPIInstance *instance = NULL;
     char *asciiStr = NULL;
 
     /* fixup any escaped-XML style string sequences */
     asciiStr = XmlToAsciiStr(instanceStr);
+    if (asciiStr == NULL)
+        return NULL;
 
-    /* Store the embedded Xen_*SettingData string data in a file for parsing */
-    tmpnam(filename);
-    fd = fopen(filename, "w");
-    fprintf(fd, "%s", asciiStr);
-    fclose(fd);
+    /* Parse the embedded Xen_*SettingData string data into a CMPIInstance,
+       straight from memory. The parser is reentrant, no locking needed. */
+    rc = Xen_SettingDatayyparseinstance(broker, asciiStr, strlen(asciiStr), &instance);
     free(asciiStr);
-
-    /* Parse the embedded Xen_*SettingData string data into a CMPIInstance */
-    fd = fopen(filename, "r");
-    Xen_SettingDatayyrestart(fd);
-    rc = Xen_SettingDatayyparseinstance(broker, &instance);
-    fclose(fd);
-    remove(filename);
     if (rc != 0) { /* parser returns zero for success, non-zero for error */
         _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_ERROR,("--- error parsing instance %s", instanceStr));
         return NULL;
@@ -2371,14 +2892,65 @@ int xen_utils_get_vssd_param(
     return rc;
 }
 
+/*
+ * The class hierarchy doesn't change while the provider is loaded, so the
+ * answers from the CIMOM are remembered, keyed by the interned class names.
+ */
+#define SUBCLASS_MEMO_BUCKETS 128
+
+typedef struct _subclass_memo_entry {
+    struct _subclass_memo_entry *next;
+    const char *class_name;        /* interned */
+    const char *superclass;        /* interned */
+    bool is_subclass;
+} subclass_memo_entry;
+
+static subclass_memo_entry *subclass_memo[SUBCLASS_MEMO_BUCKETS];
+static pthread_mutex_t subclass_memo_lock = PTHREAD_MUTEX_INITIALIZER;
+
 bool xen_utils_class_is_subclass_of(
     const CMPIBroker *broker,
     const char *class_to_check, 
     const char *superclass)
 {
     CMPIStatus status = {CMPI_RC_OK, NULL};
+    subclass_memo_entry *entry;
+    const char *class_name = xen_utils_intern(class_to_check);
+    const char *super = xen_utils_intern(superclass);
+
+    if (class_name && class_name == super)
+        return true;
+
+    size_t bucket = (((size_t)class_name >> 4) ^ ((size_t)super >> 4)) % SUBCLASS_MEMO_BUCKETS;
+    if (class_name && super) {
+        pthread_mutex_lock(&subclass_memo_lock);
+        for (entry = subclass_memo[bucket]; entry; entry = entry->next) {
+            if (entry->class_name == class_name && entry->superclass == super) {
+                bool is_subclass = entry->is_subclass;
+                pthread_mutex_unlock(&subclass_memo_lock);
+                return is_subclass;
+            }
+        }
+        pthread_mutex_unlock(&subclass_memo_lock);
+    }
+
     CMPIObjectPath * op = CMNewObjectPath(broker, DEFAULT_NS, class_to_check, &status);
-    return CMClassPathIsA(broker, op, superclass, &status);
+    bool is_subclass = CMClassPathIsA(broker, op, superclass, &status);
+
+    /* only remember definitive answers */
+    if (class_name && super && status.rc == CMPI_RC_OK) {
+        entry = malloc(sizeof(subclass_memo_entry));
+        if (entry) {
+            entry->class_name = class_name;
+            entry->superclass = super;
+            entry->is_subclass = is_subclass;
+            pthread_mutex_lock(&subclass_memo_lock);
+            entry->next = subclass_memo[bucket];
+            subclass_memo[bucket] = entry;
+            pthread_mutex_unlock(&subclass_memo_lock);
+        }
+    }
+    return is_subclass;
 }
 
 /* Routines to parse transfer plugin output */
@@ -0,0 +1,637 @@
+#!/usr/bin/env python
+
+'''Copyright (C) 2008-2009 Citrix Systems Inc.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+=========================================================================
+
+A stand-in for xapi, good enough to benchmark the providers against.
+
+It serves a synthetic pool over XML-RPC, the same way xapi does (values
+wrapped in Status/Value structs, 64 bit integers as strings), along with
+the HTTP handlers the providers use: rrd_updates and the xscim KVP plugin.
+Objects are kept in a generic store, so any <class>.get_all,
+get_all_records, get_all_records_where, get_record, get_by_uuid,
+get_by_name_label, get_<field> and set_<field> call works without having
+to be written out here. Everything else that isn't known succeeds and
+returns an empty string, Async.* calls return a completed task.
+
+    mock_xapi.py [--port 8080] [--hosts 4] [--vms 10] [--vbds 2] [--vifs 2]
+                 [--tasks 10] [--templates 5] [--latency 0]
+                 [--total-vms N] [--snapshot-ratio 0] [--template-ratio 0]
+                 [--kvp-fraction 0]
+
+--vms, --vbds and --vifs are per host, per VM and per VM. --total-vms
+spreads that many VMs over the hosts instead, to build the pools of tens
+of thousands of VMs the scale benchmarks run against (scale_bench.py).
+--snapshot-ratio is the fraction of the VMs that have a snapshot, disks
+included, --template-ratio adds custom templates with disks of their own
+in proportion to the VMs, on top of the --templates default ones, and
+--kvp-fraction is the fraction of the VMs with the KVP channel enabled.
+--latency adds that many milliseconds to each XML-RPC call to look more
+like a real network. GET /mock/stats returns the number of calls made to each method
+since the last POST /mock/reset.
+'''
+
+import sys
+import re
+import time
+import uuid
+import random
+import threading
+from optparse import OptionParser
+
+try:
+    import xmlrpclib as xmlrpc_client
+except ImportError:
+    import xmlrpc.client as xmlrpc_client
+try:
+    from BaseHTTPServer import HTTPServer, BaseHTTPRequestHandler
+    from SocketServer import ThreadingMixIn
+except ImportError:
+    from http.server import HTTPServer, BaseHTTPRequestHandler
+    from socketserver import ThreadingMixIn
+
+NULL_REF = 'OpaqueRef:NULL'
+NOW = xmlrpc_client.DateTime(time.strftime('%Y%m%dT%H:%M:%SZ', time.gmtime()))
+
+def new_ref():
+    return 'OpaqueRef:' + str(uuid.uuid4())
+
+def i64(value):
+    # xapi sends 64 bit integers as strings
+    return str(int(value))
+
+class Store:
+    '''All the objects in the pool, by class and reference'''
+    def __init__(self):
+        self.classes = {}
+        self.uuids = {}
+        self.lock = threading.Lock()
+
+    def add(self, cls, record):
+        ref = new_ref()
+        record.setdefault('uuid', str(uuid.uuid4()))
+        record.setdefault('other_config', {})
+        self.classes.setdefault(cls.lower(), {})[ref] = record
+        # get_by_uuid is a lookup in xapi, it mustn't be what a large pool measures
+        self.uuids.setdefault(cls.lower(), {})[record['uuid']] = ref
+        return ref
+
+    def by_uuid(self, cls, value):
+        return self.uuids.get(cls.lower(), {}).get(value)
+
+    def records(self, cls):
+        return self.classes.setdefault(cls.lower(), {})
+
+    def get(self, cls, ref):
+        return self.records(cls).get(ref)
+
+    def link(self, cls, ref, field, other):
+        self.get(cls, ref)[field].append(other)
+
+def build_pool(opts):
+    '''Build a pool of opts.hosts hosts, running opts.vms VMs each or
+    opts.total_vms between them'''
+    s = Store()
+    rnd = random.Random(42)
+
+    shared_sr = s.add('SR', {
+        'name_label': 'Shared NFS storage', 'name_description': 'NFS SR',
+        'allowed_operations': [], 'current_operations': {}, 'VDIs': [], 'PBDs': [],
+        'virtual_allocation': i64(0), 'physical_utilisation': i64(0),
+        'physical_size': i64(4 << 40), 'type': 'nfs', 'content_type': 'user',
+        'shared': True, 'tags': [], 'sm_config': {}, 'blobs': {},
+        'local_cache_enabled': False})
+    iso_sr = s.add('SR', {
+        'name_label': 'XenServer Tools', 'name_description': 'ISOs',
+        'allowed_operations': [], 'current_operations': {}, 'VDIs': [], 'PBDs': [],
+        'virtual_allocation': i64(0), 'physical_utilisation': i64(0),
+        'physical_size': i64(0), 'type': 'iso', 'content_type': 'iso',
+        'shared': True, 'tags': [], 'sm_config': {}, 'blobs': {},
+        'local_cache_enabled': False})
+    tools_iso = s.add('VDI', vdi_record(s, iso_sr, 'xs-tools.iso', 40 << 20, 'user', True))
+    s.link('SR', iso_sr, 'VDIs', tools_iso)
+
+    networks = []
+    for i in range(2):
+        networks.append(s.add('network', {
+            'name_label': 'Pool-wide network associated with eth%d' % i,
+            'name_description': '', 'allowed_operations': [], 'current_operations': {},
+            'VIFs': [], 'PIFs': [], 'MTU': i64(1500), 'bridge': 'xenbr%d' % i,
+            'blobs': {}, 'tags': []}))
+
+    hosts = []
+    for h in range(opts.hosts):
+        host = s.add('host', host_record(h))
+        hosts.append(host)
+        hrec = s.get('host', host)
+        hrec['metrics'] = s.add('host_metrics', {
+            'memory_total': i64(64 << 30), 'memory_free': i64(32 << 30),
+            'live': True, 'last_updated': NOW})
+        for c in range(8):
+            cpu = s.add('host_cpu', {
+                'host': host, 'number': i64(c), 'vendor': 'GenuineIntel',
+                'speed': i64(2933), 'modelname': 'Intel(R) Xeon(R) CPU X5570 @ 2.93GHz',
+                'family': i64(6), 'model': i64(26), 'stepping': '5',
+                'flags': 'fpu de tsc msr pae mce cx8 apic sep mtrr mca cmov pat clflush acpi mmx fxsr sse sse2 ss ht nx constant_tsc',
+                'features': '0098e3fd-bfebfbff-00000001-28100800',
+                'utilisation': rnd.random()})
+            hrec['host_CPUs'].append(cpu)
+        for i, network in enumerate(networks):
+            pif = s.add('PIF', pif_record(s, host, network, 'eth%d' % i, h, i, i == 0))
+            hrec['PIFs'].append(pif)
+            s.link('network', network, 'PIFs', pif)
+        local_sr = s.add('SR', {
+            'name_label': 'Local storage on host%d' % h, 'name_description': '',
+            'allowed_operations': [], 'current_operations': {}, 'VDIs': [], 'PBDs': [],
+            'virtual_allocation': i64(0), 'physical_utilisation': i64(0),
+            'physical_size': i64(500 << 30), 'type': 'lvm', 'content_type': 'user',
+            'shared': False, 'tags': [], 'sm_config': {}, 'blobs': {},
+            'local_cache_enabled': False})
+        for sr in (local_sr, shared_sr, iso_sr):
+            pbd = s.add('PBD', {'host': host, 'SR': sr, 'device_config': {},
+                                'currently_attached': True})
+            hrec['PBDs'].append(pbd)
+            s.link('SR', sr, 'PBDs', pbd)
+
+        dom0 = s.add('VM', vm_record('Control domain on host: host%d' % h, 'Running', host, 0, True, False))
+        hrec['resident_VMs'].append(dom0)
+        add_vm_metrics(s, dom0, 1, rnd)
+
+        vms = opts.vms
+        if opts.total_vms is not None:
+            vms = opts.total_vms // opts.hosts + (h < opts.total_vms % opts.hosts and 1 or 0)
+        for v in range(vms):
+            running = (v % 4) != 3
+            vm = s.add('VM', vm_record('vm-%d-%d' % (h, v), running and 'Running' or 'Halted',
+                                       running and host or NULL_REF, running and v + 1 or -1,
+                                       False, False))
+            if running:
+                hrec['resident_VMs'].append(vm)
+            if rnd.random() < opts.kvp_fraction:
+                s.get('VM', vm)['other_config']['kvp_enabled'] = 'true'
+            add_vm_metrics(s, vm, 2, rnd)
+            sr = v % 2 and shared_sr or local_sr
+            add_vm_devices(s, vm, opts, sr, networks, tools_iso, running, rnd)
+            if rnd.random() < opts.snapshot_ratio:
+                add_vm_snapshot(s, vm, opts, sr, networks, tools_iso, rnd)
+
+    # the default templates come without disks, the ones users make have some
+    for t in range(opts.templates):
+        vm = s.add('VM', vm_record('Template %d' % t, 'Halted', NULL_REF, -1, False, True))
+        s.get('VM', vm)['other_config']['default_template'] = 'true'
+        add_vm_metrics(s, vm, 1, rnd)
+    vm_count = opts.total_vms is not None and opts.total_vms or opts.vms * opts.hosts
+    for t in range(int(vm_count * opts.template_ratio)):
+        vm = s.add('VM', vm_record('Custom template %d' % t, 'Halted', NULL_REF, -1, False, True))
+        add_vm_metrics(s, vm, 2, rnd)
+        add_vm_devices(s, vm, opts, shared_sr, networks, tools_iso, False, rnd)
+
+    master = hosts[0]
+    s.add('pool', {'name_label': 'mock pool', 'name_description': '', 'master': master,
+                   'default_SR': shared_sr, 'suspend_image_SR': shared_sr,
+                   'crash_dump_SR': shared_sr, 'ha_enabled': False,
+                   'ha_configuration': {}, 'ha_statefiles': [],
+                   'ha_host_failures_to_tolerate': i64(0), 'ha_plan_exists_for': i64(0),
+                   'ha_allow_overcommit': False, 'ha_overcommitted': False,
+                   'blobs': {}, 'tags': [], 'gui_config': {}, 'wlb_url': '',
+                   'wlb_username': '', 'wlb_enabled': False, 'wlb_verify_cert': False,
+                   'redo_log_enabled': False, 'redo_log_vdi': NULL_REF,
+                   'vswitch_controller': '', 'restrictions': {}})
+
+    for t in range(opts.tasks):
+        s.add('task', task_record('Async.VM.clean_shutdown', master, t % 3 and 'success' or 'pending'))
+    return s, master
+
+def host_record(h):
+    return {'name_label': 'host%d' % h, 'name_description': 'Default install of XenServer',
+            'allowed_operations': [], 'current_operations': {},
+            'API_version_major': i64(1), 'API_version_minor': i64(3),
+            'API_version_vendor': 'XenSource', 'API_version_vendor_implementation': {},
+            'enabled': True,
+            'software_version': {'product_version': '5.6.0', 'build_number': '31188p',
+                                 'xapi': '1.3', 'xen': '3.4.2', 'linux': '2.6.27.42-0.1.1.xs5.6.0.44.111158xen',
+                                 'product_brand': 'XenServer', 'hostname': 'mock'},
+            'capabilities': ['xen-3.0-x86_64', 'xen-3.0-x86_32p', 'hvm-3.0-x86_32',
+                             'hvm-3.0-x86_32p', 'hvm-3.0-x86_64'],
+            'cpu_configuration': {}, 'sched_policy': 'credit',
+            'supported_bootloaders': ['pygrub', 'eliloader'], 'resident_VMs': [],
+            'logging': {}, 'PIFs': [], 'suspend_image_sr': NULL_REF,
+            'crash_dump_sr': NULL_REF, 'crashdumps': [], 'patches': [], 'PBDs': [],
+            'host_CPUs': [], 'cpu_info': {'cpu_count': '8', 'vendor': 'GenuineIntel'},
+            'hostname': 'host%d' % h, 'address': '',
+            'metrics': NULL_REF, 'license_params': {'sku_type': 'XE Enterprise'},
+            'ha_statefiles': [], 'ha_network_peers': [], 'blobs': {}, 'tags': [],
+            'external_auth_type': '', 'external_auth_service_name': '',
+            'external_auth_configuration': {}, 'edition': 'enterprise',
+            'license_server': {}, 'bios_strings': {}, 'power_on_mode': '',
+            'power_on_config': {}, 'local_cache_sr': NULL_REF}
+
+def vm_record(name, power_state, host, domid, control_domain, template):
+    return {'allowed_operations': [], 'current_operations': {},
+            'power_state': power_state, 'name_label': name, 'name_description': '',
+            'user_version': i64(1), 'is_a_template': template, 'suspend_VDI': NULL_REF,
+            'resident_on': host, 'affinity': NULL_REF,
+            'memory_overhead': i64(4 << 20), 'memory_target': i64(512 << 20),
+            'memory_static_max': i64(512 << 20), 'memory_dynamic_max': i64(512 << 20),
+            'memory_dynamic_min': i64(512 << 20), 'memory_static_min': i64(256 << 20),
+            'VCPUs_params': {'weight': '256'}, 'VCPUs_max': i64(2),
+            'VCPUs_at_startup': i64(2), 'actions_after_shutdown': 'destroy',
+            'actions_after_reboot': 'restart', 'actions_after_crash': 'restart',
+            'consoles': [], 'VIFs': [], 'VBDs': [], 'crash_dumps': [], 'VTPMs': [],
+            'PV_bootloader': 'pygrub', 'PV_kernel': '', 'PV_ramdisk': '', 'PV_args': '',
+            'PV_bootloader_args': '', 'PV_legacy_args': '', 'HVM_boot_policy': '',
+            'HVM_boot_params': {}, 'HVM_shadow_multiplier': 1.0,
+            'platform': {'nx': 'false', 'acpi': 'true', 'apic': 'true', 'pae': 'true'},
+            'PCI_bus': '', 'domid': i64(domid), 'domarch': 'x64',
+            'last_boot_CPU_flags': {}, 'is_control_domain': control_domain,
+            'metrics': NULL_REF, 'guest_metrics': NULL_REF, 'last_booted_record': '',
+            'recommendations': '', 'xenstore_data': {}, 'ha_always_run': False,
+            'ha_restart_priority': '', 'is_a_snapshot': False, 'snapshot_of': NULL_REF,
+            'snapshots': [], 'snapshot_time': NOW, 'transportable_snapshot_id': '',
+            'blobs': {}, 'tags': [], 'blocked_operations': {}, 'snapshot_info': {},
+            'snapshot_metadata': '', 'parent': NULL_REF, 'children': [],
+            'bios_strings': {}, 'protection_policy': NULL_REF,
+            'is_snapshot_from_vmpp': False, 'appliance': NULL_REF,
+            'start_delay': i64(0), 'shutdown_delay': i64(0), 'order': i64(0),
+            'VGPUs': [], 'attached_PCIs': [], 'suspend_SR': NULL_REF, 'version': i64(0)}
+
+def add_vm_metrics(s, vm, vcpus, rnd):
+    rec = s.get('VM', vm)
+    running = rec['power_state'] == 'Running'
+    rec['metrics'] = s.add('VM_metrics', {
+        'memory_actual': i64(running and (512 << 20) or 0), 'VCPUs_number': i64(vcpus),
+        'VCPUs_utilisation': dict((str(i), running and rnd.random() or 0.0) for i in range(vcpus)),
+        'VCPUs_CPU': dict((str(i), i64(i)) for i in range(vcpus)),
+        'VCPUs_params': {}, 'VCPUs_flags': dict((str(i), ['online']) for i in range(vcpus)),
+        'state': running and ['running'] or [], 'start_time': NOW,
+        'install_time': NOW, 'last_updated': NOW})
+    if running:
+        rec['guest_metrics'] = s.add('VM_guest_metrics', {
+            'os_version': {'name': 'Debian Lenny 5.0', 'distro': 'debian', 'major': '5'},
+            'PV_drivers_version': {'major': '5', 'minor': '6', 'micro': '0', 'build': '31188'},
+            'PV_drivers_up_to_date': True,
+            'memory': {}, 'disks': {},
+            'networks': {'0/ip': '10.0.%d.%d' % (rnd.randint(0, 255), rnd.randint(1, 254))},
+            'other': {'feature-shutdown': '1', 'feature-suspend': '1'},
+            'last_updated': NOW, 'live': True})
+
+def vdi_record(s, sr, name, size, vdi_type, read_only):
+    return {'name_label': name, 'name_description': '', 'allowed_operations': [],
+            'current_operations': {}, 'SR': sr, 'VBDs': [], 'crash_dumps': [],
+            'virtual_size': i64(size), 'physical_utilisation': i64(size // 2),
+            'type': vdi_type, 'sharable': False, 'read_only': read_only,
+            'storage_lock': False, 'location': str(uuid.uuid4()), 'managed': True,
+            'missing': False, 'parent': NULL_REF, 'xenstore_data': {}, 'sm_config': {},
+            'is_a_snapshot': False, 'snapshot_of': NULL_REF, 'snapshots': [],
+            'snapshot_time': NOW, 'tags': [], 'allow_caching': False,
+            'on_boot': 'persist'}
+
+def add_vm_devices(s, vm, opts, sr, networks, tools_iso, attached, rnd):
+    rec = s.get('VM', vm)
+    for d in range(opts.vbds + 1):
+        cd = (d == opts.vbds)
+        vdi = cd and tools_iso or NULL_REF
+        if not cd:
+            vdi = s.add('VDI', vdi_record(s, sr, '%s disk %d' % (rec['name_label'], d), 8 << 30, 'user', False))
+            s.link('SR', sr, 'VDIs', vdi)
+        vbd = s.add('VBD', {
+            'allowed_operations': [], 'current_operations': {}, 'VM': vm, 'VDI': vdi,
+            'device': cd and 'hdd' or 'xvd%c' % (ord('a') + d), 'userdevice': str(cd and 3 or d),
+            'bootable': d == 0, 'mode': cd and 'RO' or 'RW', 'type': cd and 'CD' or 'Disk',
+            'unpluggable': cd, 'storage_lock': False, 'empty': False,
+            'currently_attached': attached, 'status_code': i64(0), 'status_detail': '',
+            'runtime_properties': {}, 'qos_algorithm_type': '', 'qos_algorithm_params': {},
+            'qos_supported_algorithms': [], 'metrics': NULL_REF})
+        vbd_rec = s.get('VBD', vbd)
+        vbd_rec['metrics'] = s.add('VBD_metrics', {
+            'io_read_kbs': rnd.random() * 100, 'io_write_kbs': rnd.random() * 100,
+            'last_updated': NOW})
+        rec['VBDs'].append(vbd)
+        s.link('VDI', vdi, 'VBDs', vbd)
+    for n in range(opts.vifs):
+        network = networks[n % len(networks)]
+        vif = s.add('VIF', {
+            'allowed_operations': [], 'current_operations': {}, 'device': str(n),
+            'network': network, 'VM': vm,
+            'MAC': 'ea:%02x:%02x:%02x:%02x:%02x' % tuple(rnd.randint(0, 255) for i in range(5)),
+            'MTU': i64(1500), 'currently_attached': attached, 'status_code': i64(0),
+            'status_detail': '', 'runtime_properties': {}, 'qos_algorithm_type': '',
+            'qos_algorithm_params': {}, 'qos_supported_algorithms': [],
+            'metrics': NULL_REF, 'MAC_autogenerated': True})
+        s.get('VIF', vif)['metrics'] = s.add('VIF_metrics', {
+            'io_read_kbs': rnd.random() * 100, 'io_write_kbs': rnd.random() * 100,
+            'last_updated': NOW})
+        rec['VIFs'].append(vif)
+        s.link('network', network, 'VIFs', vif)
+    console = s.add('console', {'protocol': 'rfb', 'VM': vm,
+                                'location': 'https://127.0.0.1/console?uuid=%s' % uuid.uuid4()})
+    rec['consoles'].append(console)
+
+def add_vm_snapshot(s, vm, opts, sr, networks, tools_iso, rnd):
+    '''A snapshot of vm, a halted template with copies of its disks'''
+    rec = s.get('VM', vm)
+    snap = s.add('VM', vm_record('%s snapshot' % rec['name_label'], 'Halted', NULL_REF, -1,
+                                 False, True))
+    snap_rec = s.get('VM', snap)
+    snap_rec['is_a_snapshot'] = True
+    snap_rec['snapshot_of'] = vm
+    snap_rec['children'].append(vm)
+    rec['snapshots'].append(snap)
+    rec['parent'] = snap
+    add_vm_metrics(s, snap, 2, rnd)
+    add_vm_devices(s, snap, opts, sr, networks, tools_iso, False, rnd)
+    disks = [s.get('VBD', vbd)['VDI'] for vbd in rec['VBDs'] if s.get('VBD', vbd)['type'] == 'Disk']
+    snap_disks = [s.get('VBD', vbd)['VDI'] for vbd in snap_rec['VBDs'] if s.get('VBD', vbd)['type'] == 'Disk']
+    for vdi, snap_vdi in zip(disks, snap_disks):
+        snap_vdi_rec = s.get('VDI', snap_vdi)
+        snap_vdi_rec['is_a_snapshot'] = True
+        snap_vdi_rec['snapshot_of'] = vdi
+        s.get('VDI', vdi)['snapshots'].append(snap_vdi)
+
+def pif_record(s, host, network, device, h, i, management):
+    metrics = s.add('PIF_metrics', {
+        'io_read_kbs': 0.0, 'io_write_kbs': 0.0, 'carrier': True,
+        'vendor_id': '8086', 'vendor_name': 'Intel Corporation', 'device_id': '10c9',
+        'device_name': '82576 Gigabit Network Connection', 'speed': i64(1000),
+        'duplex': True, 'pci_bus_path': '0000:01:00.%d' % i, 'last_updated': NOW})
+    return {'device': device, 'network': network, 'host': host,
+            'MAC': '00:1e:%02x:%02x:00:%02x' % (h >> 8, h & 0xff, i),
+            'MTU': i64(1500), 'VLAN': i64(-1), 'metrics': metrics, 'physical': True,
+            'currently_attached': True,
+            'ip_configuration_mode': management and 'Static' or 'None',
+            'IP': management and '10.1.%d.%d' % (h >> 8, h & 0xff) or '',
+            'netmask': management and '255.255.0.0' or '', 'gateway': '', 'DNS': '',
+            'bond_slave_of': NULL_REF, 'bond_master_of': [], 'VLAN_master_of': NULL_REF,
+            'VLAN_slave_of': [], 'management': management, 'disallow_unplug': False}
+
+def task_record(name, host, status):
+    return {'name_label': name, 'name_description': '', 'allowed_operations': [],
+            'current_operations': {}, 'created': NOW, 'finished': NOW, 'status': status,
+            'resident_on': host, 'progress': status == 'success' and 1.0 or 0.5,
+            'type': '<none/>', 'result': '', 'error_info': [], 'subtask_of': NULL_REF,
+            'subtasks': []}
+
+class Fault(Exception):
+    def __init__(self, *description):
+        self.description = list(description)
+
+class MockXapi:
+    def __init__(self, store, master, opts):
+        self.store = store
+        self.master = master
+        self.latency = opts.latency / 1000.0
+        self.sessions = {}
+        self.calls = {}
+        self.calls_lock = threading.Lock()
+
+    def count(self, name):
+        self.calls_lock.acquire()
+        self.calls[name] = self.calls.get(name, 0) + 1
+        self.calls_lock.release()
+
+    def dispatch(self, method, params):
+        self.count(method)
+        if self.latency:
+            time.sleep(self.latency)
+        try:
+            return {'Status': 'Success', 'Value': self.call(method, list(params))}
+        except Fault:
+            e = sys.exc_info()[1]
+            return {'Status': 'Failure', 'ErrorDescription': e.description}
+
+    def call(self, method, params):
+        if method == 'session.login_with_password':
+            ref = new_ref()
+            self.sessions[ref] = params[0]
+            return ref
+        if method.startswith('session.'):
+            if method == 'session.get_this_host':
+                return self.master
+            if method == 'session.logout':
+                self.sessions.pop(params[0], None)
+            return ''
+        if not params or params[0] not in self.sessions:
+            raise Fault('SESSION_INVALID', params and params[0] or '')
+        session = params[0]
+        params = params[1:]
+
+        if method.startswith('Async.'):
+            self.call(method[len('Async.'):], [session] + params)
+            return self.store.add('task', task_record(method, self.master, 'success'))
+        cls, op = method.split('.', 1)
+        records = self.store.records(cls)
+
+        if op == 'get_all':
+            return list(records.keys())
+        if op == 'get_all_records':
+            return records
+        if op == 'get_all_records_where':
+            return self.where(records, params[0])
+        if op == 'get_record':
+            return self.record(cls, records, params[0])
+        if op == 'get_by_uuid':
+            ref = self.store.by_uuid(cls, params[0])
+            if ref is None or ref not in records:
+                raise Fault('UUID_INVALID', cls, params[0])
+            return ref
+        if op == 'get_by_name_label':
+            return [ref for ref, rec in records.items() if rec.get('name_label') == params[0]]
+        if cls.lower() == 'host' and op == 'get_servertime':
+            return NOW
+        if cls.lower() == 'event':
+            if op == 'next':
+                time.sleep(1)
+                return []
+            return ''
+        if op.startswith('get_'):
+            rec = self.record(cls, records, params[0])
+            return self.field(rec, op[len('get_'):], cls)
+        if op.startswith('set_'):
+            rec = self.record(cls, records, params[0])
+            rec[self.field_name(rec, op[len('set_'):])] = params[1]
+            return ''
+        if op.startswith('add_to_') or op.startswith('remove_from_'):
+            rec = self.record(cls, records, params[0])
+            name = op.startswith('add_to_') and op[len('add_to_'):] or op[len('remove_from_'):]
+            field = rec.setdefault(self.field_name(rec, name), {})
+            if op.startswith('add_to_'):
+                field[params[1]] = params[2]
+            else:
+                field.pop(params[1], None)
+            return ''
+        # VM.start, VM.clean_shutdown, VDI.destroy and friends just succeed
+        return ''
+
+    def record(self, cls, records, ref):
+        rec = records.get(ref)
+        if rec is None:
+            raise Fault('HANDLE_INVALID', cls, ref)
+        return rec
+
+    def field_name(self, rec, name):
+        # getters are lower case in the C bindings (get_vcpus_max), fields aren't
+        if name in rec:
+            return name
+        for field in rec.keys():
+            if field.lower() == name.lower():
+                return field
+        return name
+
+    def field(self, rec, name, cls):
+        name = self.field_name(rec, name)
+        if name not in rec:
+            raise Fault('MESSAGE_METHOD_UNKNOWN', '%s.get_%s' % (cls, name))
+        return rec[name]
+
+    def where(self, records, expr):
+        # only conjunctions of field "name"="value" are understood
+        terms = re.findall(r'field\s*"([^"]+)"\s*=\s*"([^"]*)"', expr)
+        result = {}
+        for ref, rec in records.items():
+            for name, value in terms:
+                field = rec.get(self.field_name(rec, name))
+                if isinstance(field, bool):
+                    field = field and 'true' or 'false'
+                if str(field) != value:
+                    break
+            else:
+                result[ref] = rec
+        return result
+
+    def rrd_updates(self, query):
+        '''The Xport XML for all the hosts and resident VMs, one row'''
+        legend = []
+        values = []
+        for host_ref, host in self.store.records('host').items():
+            for i in range(len(host['host_CPUs'])):
+                legend.append('AVERAGE:host:%s:cpu%d' % (host['uuid'], i))
+                values.append(random.random())
+            legend.append('AVERAGE:host:%s:memory_free_kib' % host['uuid'])
+            values.append(32 << 20)
+            for vm_ref in host['resident_VMs']:
+                vm = self.store.get('VM', vm_ref)
+                for i in range(int(vm['VCPUs_max'])):
+                    legend.append('AVERAGE:vm:%s:cpu%d' % (vm['uuid'], i))
+                    values.append(random.random())
+                legend.append('AVERAGE:vm:%s:memory' % vm['uuid'])
+                values.append(512 << 20)
+        now = int(time.time())
+        out = ['<xport><meta><start>%d</start><step>5</step><end>%d</end>' % (now - 5, now),
+               '<rows>1</rows><columns>%d</columns><legend>' % len(legend)]
+        out += ['<entry>%s</entry>' % entry for entry in legend]
+        out.append('</legend></meta><data><row><t>%d</t>' % now)
+        out += ['<v>%g</v>' % value for value in values]
+        out.append('</row></data></xport>')
+        return ''.join(out)
+
+    def kvp(self, path):
+        # /services/plugin/xscim/vm/<uuid>[/key/<key>]
+        parts = path.split('?')[0].split('/')
+        vm_uuid = parts[5]
+        if len(parts) > 7 and parts[6] == 'key':
+            return 'value-of-%s' % parts[7]
+        return ''.join(['key%d value%d-%s\n' % (i, i, vm_uuid[:8]) for i in range(4)])
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, format, *args):
+        pass
+
+    def reply(self, body, code=200, content_type='text/xml'):
+        if not isinstance(body, bytes):
+            body = body.encode('utf-8')
+        self.send_response(code)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def body(self):
+        return self.rfile.read(int(self.headers.get('Content-Length', 0)))
+
+    def do_POST(self):
+        xapi = self.server.xapi
+        data = self.body()
+        if self.path == '/mock/reset':
+            xapi.calls_lock.acquire()
+            xapi.calls = {}
+            xapi.calls_lock.release()
+            return self.reply('', content_type='text/plain')
+        if self.path.startswith('/services/plugin/'):
+            xapi.count('HTTP POST ' + '/'.join(self.path.split('/')[:4]))
+            return self.reply('', content_type='text/plain')
+        params, method = xmlrpc_client.loads(data)
+        result = xapi.dispatch(method, params)
+        self.reply(xmlrpc_client.dumps((result,), methodresponse=True))
+
+    def do_GET(self):
+        xapi = self.server.xapi
+        if self.path.startswith('/mock/stats'):
+            xapi.calls_lock.acquire()
+            calls = sorted(xapi.calls.items())
+            xapi.calls_lock.release()
+            return self.reply(''.join(['%d %s\n' % (n, name) for name, n in calls]),
+                              content_type='text/plain')
+        if self.path.startswith('/rrd_updates'):
+            xapi.count('HTTP GET /rrd_updates')
+            return self.reply(xapi.rrd_updates(self.path))
+        if self.path.startswith('/services/plugin/xscim/vm/'):
+            xapi.count('HTTP GET /services/plugin/xscim')
+            return self.reply(xapi.kvp(self.path), content_type='text/plain')
+        self.reply('Not found', 404, 'text/plain')
+
+class Server(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+def main():
+    parser = OptionParser(usage='%prog [options]')
+    parser.add_option('--port', type='int', default=8080)
+    parser.add_option('--hosts', type='int', default=4)
+    parser.add_option('--vms', type='int', default=10, help='VMs per host')
+    parser.add_option('--vbds', type='int', default=2, help='disks per VM, plus a CD')
+    parser.add_option('--vifs', type='int', default=2, help='network interfaces per VM')
+    parser.add_option('--tasks', type='int', default=10)
+    parser.add_option('--templates', type='int', default=5)
+    parser.add_option('--latency', type='float', default=0, help='ms added to each call')
+    parser.add_option('--total-vms', type='int', help='VMs in the pool, instead of --vms per host')
+    parser.add_option('--snapshot-ratio', type='float', default=0, help='fraction of VMs with a snapshot')
+    parser.add_option('--template-ratio', type='float', default=0,
+                      help='custom templates per VM, on top of --templates')
+    parser.add_option('--kvp-fraction', type='float', default=0, help='fraction of VMs with KVP enabled')
+    opts, args = parser.parse_args()
+
+    store, master = build_pool(opts)
+    # the providers build the rrd and KVP URLs from the host address
+    for host in store.records('host').values():
+        host['address'] = '127.0.0.1:%d' % opts.port
+
+    server = Server(('127.0.0.1', opts.port), Handler)
+    server.xapi = MockXapi(store, master, opts)
+    sys.stdout.write('mock xapi serving %d hosts, %s on http://127.0.0.1:%d\n' %
+                     (opts.hosts, ', '.join(['%d %ss' % (len(store.records(cls)), cls)
+                                             for cls in ('VM', 'VBD', 'VIF', 'VDI', 'task')]),
+                      opts.port))
+    sys.stdout.flush()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+if __name__ == '__main__':
+    main()
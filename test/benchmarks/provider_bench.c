@@ -0,0 +1,490 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+/*
+ * Offline provider benchmark.
+ * Loads the provider modules into a stub broker (stub_broker.c), points
+ * them at a xapi, usually the mock one in mock_xapi.py, and times CIM
+ * operations against them. For each operation it reports the latency, the
+ * number of xapi calls made and the number and size of the allocations
+ * made, per call.
+ *
+ * usage: provider_bench [options] [operation...]
+ *   -u url        xapi to talk to (default http://127.0.0.1:8080, or the
+ *                 xapi of the recording when XEN_CIM_TRANSPORT=replay:<file>)
+ *   -U user       (default root)
+ *   -P password   (default xenroot)
+ *   -L dir        where the provider modules are (default ../../src/.libs)
+ *   -r file       provider registrations (default ../../schema/Xen_DefaultNamespace.regs)
+ *   -m dir        the MOFs (default ../../schema)
+ *   -n count      iterations of each operation (default 10)
+ *   -g count      instances to run get and association operations on (default 10)
+ *
+ * Operations are
+ *   enum:Class              EnumerateInstances
+ *   names:Class             EnumerateInstanceNames
+ *   get:Class               GetInstance on each of the (first -g) instances
+ *   assoc:Assoc:Class       Associators through Assoc from each instance of Class
+ *   assocnames:Assoc:Class  AssociatorNames
+ *   refs:Assoc:Class        References
+ *   refnames:Assoc:Class    ReferenceNames
+ *   query:Class:WQL         ExecQuery
+ *   invoke:Class:Method[:name=value,name:u16=value...]
+ *                           InvokeMethod on the first instance of Class
+ * and a representative set is run if none are given, for example
+ *   ./mock_xapi.py --hosts 16 --vms 20 &
+ *   ./provider_bench -n 20 enum:Xen_ComputerSystem get:Xen_Disk assocnames:Xen_ComputerSystemDisk:Xen_ComputerSystem
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+
+#include <cmpidt.h>
+#include <cmpift.h>
+#include <cmpimacs.h>
+
+#include "stub_broker.h"
+#include "xen_stats.h"
+
+/******************************************************************************
+ * Allocation accounting
+ *
+ * Replaces the allocator for the whole process, providers and the libraries
+ * they use included, and counts what goes through it. The stub broker
+ * allocates behind our back, so what is counted is what the providers cost.
+ *****************************************************************************/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_count = 0;
+static unsigned long alloc_bytes = 0;
+
+#define COUNT_ALLOC(__size) do { \
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED); \
+    __atomic_add_fetch(&alloc_bytes, (__size), __ATOMIC_RELAXED); \
+} while (0)
+
+void *malloc(size_t size)
+{
+    COUNT_ALLOC(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    COUNT_ALLOC(nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    COUNT_ALLOC(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+/******************************************************************************
+ * Counting the xapi calls, from the providers' own statistics
+ *****************************************************************************/
+typedef int (*stats_get_all_fn)(xen_stats_record_set **set);
+typedef void (*stats_set_free_fn)(xen_stats_record_set *set);
+
+static stats_get_all_fn stats_get_all = NULL;
+static stats_set_free_fn stats_set_free = NULL;
+
+static unsigned long long rpc_count()
+{
+    xen_stats_record_set *set = NULL;
+    unsigned long long rpcs = 0;
+    size_t i;
+
+    if (stats_get_all == NULL) {
+        /* libXen_Support comes in with the first provider module */
+        stats_get_all = (stats_get_all_fn)dlsym(RTLD_DEFAULT, "xen_stats_get_all");
+        stats_set_free = (stats_set_free_fn)dlsym(RTLD_DEFAULT, "xen_stats_record_set_free");
+        if (stats_get_all == NULL || stats_set_free == NULL)
+            return 0;
+    }
+    if (!stats_get_all(&set))
+        return 0;
+    for (i = 0; i < set->size; i++)
+        rpcs += set->contents[i].rpcs;
+    stats_set_free(set);
+    return rpcs;
+}
+
+/******************************************************************************
+ * Operations
+ *****************************************************************************/
+typedef enum {
+    op_enum, op_names, op_get, op_assoc, op_assocnames, op_refs, op_refnames, op_query, op_invoke
+} bench_op_type;
+
+static const struct {
+    const char *name;
+    bench_op_type type;
+    int fields;                 /* after the name, the last one may be optional */
+} op_types[] = {
+    {"enum", op_enum, 1},
+    {"names", op_names, 1},
+    {"get", op_get, 1},
+    {"assoc", op_assoc, 2},
+    {"assocnames", op_assocnames, 2},
+    {"refs", op_refs, 2},
+    {"refnames", op_refnames, 2},
+    {"query", op_query, 2},
+    {"invoke", op_invoke, 3},
+};
+
+typedef struct {
+    char *spec;
+    bench_op_type type;
+    char *classname;            /* the class the operation starts from */
+    char *assoc_class;
+    char *query;
+    char *method;
+    char *args;
+} bench_op;
+
+/* Totals over all the calls made for an operation */
+typedef struct {
+    unsigned long calls;
+    unsigned long errors;
+    unsigned long results;
+    double total;
+    double min;
+    double max;
+    unsigned long long rpcs;
+    unsigned long allocs;
+    unsigned long bytes;
+} bench_totals;
+
+static char *url = NULL;
+static char *user = "root";
+static char *password = "xenroot";
+static int iterations = 10;
+static int targets = 10;
+static CMPIContext *ctx = NULL;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int parse_op(const char *spec, bench_op *op)
+{
+    char *copy = strdup(spec);
+    char *fields[4] = {NULL, NULL, NULL, NULL};
+    char *p = copy;
+    int i, n = 0;
+
+    memset(op, 0, sizeof(*op));
+    op->spec = strdup(spec);
+    for (i = 0; i < sizeof(op_types) / sizeof(op_types[0]); i++)
+        if (strncmp(spec, op_types[i].name, strlen(op_types[i].name)) == 0 &&
+            spec[strlen(op_types[i].name)] == ':')
+            break;
+    if (i == sizeof(op_types) / sizeof(op_types[0]))
+        goto Error;
+    op->type = op_types[i].type;
+
+    /* the last field takes the rest, WQL and method arguments have colons of their own */
+    fields[n++] = p;
+    while (n <= op_types[i].fields && (p = strchr(p, ':'))) {
+        *p++ = '\0';
+        fields[n++] = p;
+    }
+    /* method arguments are optional */
+    if (n <= op_types[i].fields && !(op->type == op_invoke && n == op_types[i].fields))
+        goto Error;
+
+    switch (op->type) {
+    case op_assoc:
+    case op_assocnames:
+    case op_refs:
+    case op_refnames:
+        op->assoc_class = strdup(fields[1]);
+        op->classname = strdup(fields[2]);
+        break;
+    case op_query:
+        op->classname = strdup(fields[1]);
+        op->query = strdup(fields[2]);
+        break;
+    case op_invoke:
+        op->classname = strdup(fields[1]);
+        op->method = strdup(fields[2]);
+        op->args = strdup(fields[3] ? fields[3] : "");
+        break;
+    default:
+        op->classname = strdup(fields[1]);
+        break;
+    }
+    free(copy);
+    return 1;
+
+ Error:
+    fprintf(stderr, "bad operation '%s'\n", spec);
+    free(copy);
+    return 0;
+}
+
+static CMPIObjectPath *class_path(const char *classname)
+{
+    return CMNewObjectPath(stub_broker(), STUB_BROKER_NAMESPACE, classname, NULL);
+}
+
+/* The instances the per-instance operations run against, not timed */
+static CMPIResult *target_paths(const char *classname)
+{
+    CMPIInstanceMI *mi = stub_broker_instance_mi(classname);
+    CMPIResult *result = stub_broker_result();
+    if (mi == NULL) {
+        fprintf(stderr, "no instance provider for %s\n", classname);
+        return result;
+    }
+    mi->ft->enumerateInstanceNames(mi, ctx, result, class_path(classname));
+    return result;
+}
+
+/* Makes one call, and accounts for it */
+static CMPIStatus timed_call(const bench_op *op, const CMPIObjectPath *path, bench_totals *totals)
+{
+    CMPIStatus status = {CMPI_RC_ERR_NOT_SUPPORTED, NULL};
+    CMPIResult *result = stub_broker_result();
+    CMPIInstanceMI *imi = NULL;
+    CMPIAssociationMI *ami = NULL;
+    CMPIMethodMI *mmi = NULL;
+    CMPIArgs *in = NULL, *out = NULL;
+
+    /* the providers are loaded and the arguments made up front */
+    if (op->type == op_assoc || op->type == op_assocnames || op->type == op_refs || op->type == op_refnames)
+        ami = stub_broker_association_mi(op->assoc_class);
+    else if (op->type == op_invoke) {
+        mmi = stub_broker_method_mi(op->classname);
+        in = stub_broker_args(op->args);
+        out = CMNewArgs(stub_broker(), NULL);
+    }
+    else
+        imi = stub_broker_instance_mi(op->classname);
+    if (imi == NULL && ami == NULL && mmi == NULL) {
+        fprintf(stderr, "%s: no provider registered\n", op->spec);
+        totals->errors++;
+        return status;
+    }
+
+    unsigned long long rpcs = rpc_count();
+    unsigned long allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    unsigned long bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+    double start = now();
+
+    switch (op->type) {
+    case op_enum:
+        status = imi->ft->enumerateInstances(imi, ctx, result, path, NULL);
+        break;
+    case op_names:
+        status = imi->ft->enumerateInstanceNames(imi, ctx, result, path);
+        break;
+    case op_get:
+        status = imi->ft->getInstance(imi, ctx, result, path, NULL);
+        break;
+    case op_query:
+        status = imi->ft->execQuery(imi, ctx, result, path, op->query, "WQL");
+        break;
+    case op_assoc:
+        status = ami->ft->associators(ami, ctx, result, path, op->assoc_class, NULL, NULL, NULL, NULL);
+        break;
+    case op_assocnames:
+        status = ami->ft->associatorNames(ami, ctx, result, path, op->assoc_class, NULL, NULL, NULL);
+        break;
+    case op_refs:
+        status = ami->ft->references(ami, ctx, result, path, op->assoc_class, NULL, NULL);
+        break;
+    case op_refnames:
+        status = ami->ft->referenceNames(ami, ctx, result, path, op->assoc_class, NULL);
+        break;
+    case op_invoke:
+        status = mmi->ft->invokeMethod(mmi, ctx, result, path, op->method, in, out);
+        break;
+    }
+
+    double elapsed = now() - start;
+    totals->allocs += __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - allocs;
+    totals->bytes += __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED) - bytes;
+    totals->rpcs += rpc_count() - rpcs;
+    totals->calls++;
+    totals->total += elapsed;
+    if (totals->calls == 1 || elapsed < totals->min)
+        totals->min = elapsed;
+    if (elapsed > totals->max)
+        totals->max = elapsed;
+    if (status.rc != CMPI_RC_OK) {
+        totals->errors++;
+        if (totals->errors == 1)
+            fprintf(stderr, "%s: failed with %d%s%s\n", op->spec, status.rc,
+                    status.msg ? ", " : "", status.msg ? CMGetCharPtr(status.msg) : "");
+    }
+    else
+        totals->results += stub_broker_result_count(result);
+    return status;
+}
+
+static void run_op(const bench_op *op)
+{
+    bench_totals totals;
+    int i;
+    CMPICount t, count;
+
+    memset(&totals, 0, sizeof(totals));
+    for (i = 0; i < iterations; i++) {
+        if (op->type == op_enum || op->type == op_names || op->type == op_query) {
+            timed_call(op, class_path(op->classname), &totals);
+        }
+        else if (op->type == op_invoke) {
+            /* extrinsic methods run against an instance, or the class for static ones */
+            CMPIResult *paths = target_paths(op->classname);
+            CMPIObjectPath *path = stub_broker_result_count(paths) ?
+                stub_broker_result_at(paths, 0).value.ref : class_path(op->classname);
+            timed_call(op, path, &totals);
+        }
+        else {
+            CMPIResult *paths = target_paths(op->classname);
+            count = stub_broker_result_count(paths);
+            if (count > (CMPICount)targets)
+                count = targets;
+            for (t = 0; t < count; t++)
+                timed_call(op, stub_broker_result_at(paths, t).value.ref, &totals);
+        }
+        stub_broker_release_all();
+    }
+
+    if (totals.calls == 0) {
+        printf("%-60s no calls made\n", op->spec);
+        return;
+    }
+    printf("%-60s %6lu %6lu %8.1f %9.3f %9.3f %9.3f %8.1f %9.1f %9.1f\n",
+           op->spec, totals.calls, totals.errors,
+           (double)totals.results / totals.calls,
+           totals.total * 1e3 / totals.calls, totals.min * 1e3, totals.max * 1e3,
+           (double)totals.rpcs / totals.calls,
+           (double)totals.allocs / totals.calls,
+           (double)totals.bytes / totals.calls / 1024);
+}
+
+static const char *default_ops[] = {
+    "enum:Xen_HostComputerSystem",
+    "enum:Xen_ComputerSystem",
+    "names:Xen_ComputerSystem",
+    "get:Xen_ComputerSystem",
+    "enum:Xen_ComputerSystemSettingData",
+    "enum:Xen_Processor",
+    "enum:Xen_Memory",
+    "enum:Xen_Disk",
+    "enum:Xen_DiskImage",
+    "enum:Xen_NetworkPort",
+    "enum:Xen_HostNetworkPort",
+    "enum:Xen_StoragePool",
+    "enum:Xen_MemoryState",
+    "enum:Xen_ProcessorUtilization",
+    "query:Xen_ComputerSystem:SELECT * FROM Xen_ComputerSystem WHERE EnabledState = 2",
+    "assocnames:Xen_ComputerSystemDisk:Xen_ComputerSystem",
+    "assoc:Xen_HostedComputerSystem:Xen_HostComputerSystem",
+    "refnames:Xen_ComputerSystemProcessor:Xen_ComputerSystem",
+    "assoc:Xen_ProcessorElementSettingData:Xen_Processor",
+    NULL
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-u url] [-U user] [-P password] [-L libdir] [-r regs] [-m mofdir]\n"
+                    "          [-n iterations] [-g instances] [operation...]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    char *libdir = "../../src/.libs";
+    char *regs = "../../schema/Xen_DefaultNamespace.regs";
+    char *schema = "../../schema";
+    int c, i, op_count = 0;
+    bench_op *ops = NULL;
+
+    while ((c = getopt(argc, argv, "u:U:P:L:r:m:n:g:h")) != -1) {
+        switch (c) {
+        case 'u': url = optarg; break;
+        case 'U': user = optarg; break;
+        case 'P': password = optarg; break;
+        case 'L': libdir = optarg; break;
+        case 'r': regs = optarg; break;
+        case 'm': schema = optarg; break;
+        case 'n': iterations = atoi(optarg); break;
+        case 'g': targets = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0 || targets <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char **specs = (optind < argc) ? (const char **)&argv[optind] : default_ops;
+    int spec_count = (optind < argc) ? argc - optind : 0;
+    if (optind >= argc)
+        while (default_ops[spec_count])
+            spec_count++;
+    ops = calloc(spec_count, sizeof(bench_op));
+    for (i = 0; i < spec_count; i++)
+        if (parse_op(specs[i], &ops[op_count]))
+            op_count++;
+
+    /* the providers read these when they are loaded. A replay answers
+       requests for the xapi they were recorded against, leave that alone */
+    char *transport = getenv("XEN_CIM_TRANSPORT");
+    if (url == NULL && !(transport && strncmp(transport, "replay:", 7) == 0))
+        url = "http://127.0.0.1:8080";
+    if (url)
+        setenv("XEN_CIM_XAPI_URL", url, 1);
+    setenv("XEN_CIM_STATISTICS", "1", 0);
+
+    if (!stub_broker_init(libdir, regs, schema)) {
+        fprintf(stderr, "failed to set up the stub broker\n");
+        return 1;
+    }
+    ctx = stub_broker_context(user, password);
+
+    printf("%d iterations against %s, times in ms, per call figures\n", iterations,
+           url ? url : transport);
+    printf("%-60s %6s %6s %8s %9s %9s %9s %8s %9s %9s\n", "operation",
+           "calls", "errors", "results", "mean", "min", "max", "rpcs", "allocs", "KB");
+    for (i = 0; i < op_count; i++)
+        run_op(&ops[i]);
+    if (stub_broker_indications())
+        printf("%lu indications delivered\n", stub_broker_indications());
+
+    stub_broker_cleanup();
+    return 0;
+}
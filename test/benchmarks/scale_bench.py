@@ -0,0 +1,200 @@
+#!/usr/bin/env python
+
+'''Copyright (C) 2008-2009 Citrix Systems Inc.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+=========================================================================
+
+How the providers scale with the size of the pool.
+
+Runs provider_bench against mock_xapi.py pools of each of the given
+sizes (100, 1000 and 10000 VMs by default, with as many tasks, and the
+VBDs, VIFs, VDIs, snapshots and templates that go with them), over every
+instance class in g_instance_providers[] (ProxyHelper.c) and every
+association in g_assoc_table[] (associationProviderCommon.c). Instance
+classes are enumerated, instances and names, and associations are
+followed from each end that has an instance provider, from the first -g
+instances of it.
+
+For each operation it prints the time and xapi calls per call at each
+size, and how they grow with the pool: the exponent k in cost ~ size^k
+between the last two sizes. An enumeration that costs the same per
+instance has k close to 1, an association from one object close to 0.
+Anything over the threshold (1.2 by default) is marked, and listed again
+at the end, worst first.
+
+    scale_bench.py [--sizes 100,1000,10000] [--hosts 8] [-n 3] [-g 5]
+                   [--only regex] [--threshold 1.2]
+
+Run it from test/benchmarks after 'make' and 'make benchmarks'.
+'''
+
+import os
+import re
+import sys
+import math
+import time
+import signal
+import subprocess
+from optparse import OptionParser
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOP = os.path.join(HERE, '..', '..')
+
+def table(path, name):
+    '''The text of the C array initialiser 'name' in path, comments removed'''
+    src = open(path).read()
+    src = re.sub(r'/\*.*?\*/', '', src, flags=re.S)
+    src = re.sub(r'//[^\n]*', '', src)
+    start = src.index(name + '[]')
+    return src[start:src.index('};', start)]
+
+def instance_classes():
+    text = table(os.path.join(TOP, 'src', 'ProxyHelper.c'), 'g_instance_providers')
+    classes = []
+    for cls in re.findall(r'\{\s*"(\w+)"\s*,\s*\w+\s*\}', text):
+        if cls not in classes:
+            classes.append(cls)
+    return classes
+
+def associations():
+    '''(association, left class, left namespace, right class, right namespace)'''
+    text = table(os.path.join(TOP, 'src', 'associationProviderCommon.c'), 'g_assoc_table')
+    return re.findall(r'\{\s*"(\w+)"\s*,\s*"\w+"\s*,\s*"(\w+)"\s*,\s*(\w+)\s*,\s*"(\w+)"\s*,\s*(\w+)\s*,',
+                      text)
+
+def registered_instance_classes():
+    '''The classes with an instance provider in the default namespace'''
+    classes = set()
+    for line in open(os.path.join(TOP, 'schema', 'Xen_DefaultNamespace.regs')):
+        fields = line.split()
+        if len(fields) >= 5 and not fields[0].startswith('#') and \
+           fields[1] == 'root/cimv2' and 'instance' in fields[4:]:
+            classes.add(fields[0])
+    return classes
+
+def operations():
+    ops = []
+    for cls in instance_classes():
+        ops += ['enum:%s' % cls, 'names:%s' % cls]
+    registered = registered_instance_classes()
+    for assoc, left, left_ns, right, right_ns in associations():
+        for cls, ns in ((left, left_ns), (right, right_ns)):
+            if ns == 'DEFAULT_NS' and cls in registered:
+                ops.append('assocnames:%s:%s' % (assoc, cls))
+    return ops
+
+def start_mock(opts, size):
+    args = [sys.executable, os.path.join(HERE, 'mock_xapi.py'), '--port', str(opts.port),
+            '--hosts', str(opts.hosts), '--total-vms', str(size), '--tasks', str(size),
+            '--snapshot-ratio', str(opts.snapshot_ratio),
+            '--template-ratio', str(opts.template_ratio),
+            '--kvp-fraction', str(opts.kvp_fraction)]
+    mock = subprocess.Popen(args, stdout=subprocess.PIPE, universal_newlines=True)
+    # it prints a line once the pool is built and it is listening
+    line = mock.stdout.readline()
+    if not line.startswith('mock xapi serving'):
+        mock.wait()
+        raise SystemExit('mock_xapi.py failed to start')
+    sys.stderr.write('%d: %s' % (size, line))
+    return mock
+
+def run_bench(opts, ops):
+    '''{operation: (results, mean ms, rpcs)} from one provider_bench run'''
+    args = [opts.bench, '-u', 'http://127.0.0.1:%d' % opts.port,
+            '-n', str(opts.iterations), '-g', str(opts.targets)] + ops
+    out = subprocess.Popen(args, stdout=subprocess.PIPE, universal_newlines=True,
+                           cwd=HERE).communicate()[0]
+    results = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 10 and fields[0] in ops:
+            results[fields[0]] = (float(fields[3]), float(fields[4]), float(fields[7]))
+    return results
+
+def exponent(size_a, a, size_b, b):
+    if a <= 0 or b <= 0:
+        return None
+    return math.log(b / a) / math.log(float(size_b) / size_a)
+
+def fmt_exponent(k):
+    return k is None and '-' or '%.2f' % k
+
+def main():
+    parser = OptionParser(usage='%prog [options]')
+    parser.add_option('--sizes', default='100,1000,10000', help='VMs in each pool')
+    parser.add_option('--hosts', type='int', default=8)
+    parser.add_option('--port', type='int', default=8090)
+    parser.add_option('-n', dest='iterations', type='int', default=3)
+    parser.add_option('-g', dest='targets', type='int', default=5)
+    parser.add_option('--bench', default=os.path.join(HERE, 'provider_bench'))
+    parser.add_option('--only', help='only the operations matching this regex')
+    parser.add_option('--threshold', type='float', default=1.2,
+                      help='growth exponent above which an operation is marked')
+    parser.add_option('--min-ms', type='float', default=1.0,
+                      help='times below this are too noisy to mark')
+    parser.add_option('--snapshot-ratio', type='float', default=0.2)
+    parser.add_option('--template-ratio', type='float', default=0.02)
+    parser.add_option('--kvp-fraction', type='float', default=0.3)
+    opts, args = parser.parse_args()
+
+    sizes = [int(size) for size in opts.sizes.split(',')]
+    if len(sizes) < 2:
+        parser.error('need at least two sizes')
+    ops = operations()
+    if opts.only:
+        ops = [op for op in ops if re.search(opts.only, op)]
+
+    runs = {}
+    for size in sizes:
+        mock = start_mock(opts, size)
+        try:
+            started = time.time()
+            runs[size] = run_bench(opts, ops)
+            sys.stderr.write('%d: %d operations in %.0fs\n' % (size, len(ops), time.time() - started))
+        finally:
+            os.kill(mock.pid, signal.SIGTERM)
+            mock.wait()
+
+    a, b = sizes[-2], sizes[-1]
+    sys.stdout.write('%d iterations, times in ms per call, k is the growth exponent from %d to %d VMs\n' %
+                     (opts.iterations, a, b))
+    sys.stdout.write('%-70s %s %6s %6s\n' % ('operation', ' '.join(['%10s' % ('ms@%d' % size) for size in sizes]
+                                                                   + ['%8s' % ('rpcs@%d' % size) for size in sizes]),
+                                             'k(ms)', 'k(rpc)'))
+    marked = []
+    for op in ops:
+        if not all(op in runs[size] for size in sizes):
+            sys.stdout.write('%-70s failed or made no calls\n' % op)
+            continue
+        times = [runs[size][op][1] for size in sizes]
+        rpcs = [runs[size][op][2] for size in sizes]
+        k_time = exponent(a, times[-2], b, times[-1])
+        k_rpcs = exponent(a, rpcs[-2], b, rpcs[-1])
+        mark = ''
+        if (k_time is not None and k_time > opts.threshold and times[-1] >= opts.min_ms) or \
+           (k_rpcs is not None and k_rpcs > opts.threshold):
+            mark = ' <<'
+            marked.append((max(k_time or 0, k_rpcs or 0), op))
+        sys.stdout.write('%-70s %s %6s %6s%s\n' % (op, ' '.join(['%10.2f' % t for t in times] +
+                                                               ['%8.1f' % r for r in rpcs]),
+                                                   fmt_exponent(k_time), fmt_exponent(k_rpcs), mark))
+    if marked:
+        sys.stdout.write('\nsuper-linear:\n')
+        for k, op in sorted(marked, reverse=True):
+            sys.stdout.write('  %5.2f %s\n' % (k, op))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,2365 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+/*
+ * A stub CMPI broker for the benchmarks, see stub_broker.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <cmpidt.h>
+#include <cmpift.h>
+#include <cmpimacs.h>
+
+#include "stub_broker.h"
+
+/* The broker's own memory doesn't go through malloc() (see stub_broker.h) */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void *sb_calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+    if (p == NULL) {
+        fprintf(stderr, "stub broker: out of memory\n");
+        abort();
+    }
+    return p;
+}
+
+static void *sb_realloc(void *ptr, size_t size)
+{
+    void *p = __libc_realloc(ptr, size);
+    if (p == NULL) {
+        fprintf(stderr, "stub broker: out of memory\n");
+        abort();
+    }
+    return p;
+}
+
+static void sb_free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static char *sb_strdup(const char *str)
+{
+    if (str == NULL)
+        return NULL;
+    size_t len = strlen(str) + 1;
+    char *copy = sb_calloc(1, len);
+    memcpy(copy, str, len);
+    return copy;
+}
+
+#define SB_RETURN(__rc) do { CMPIStatus __st = {(__rc), NULL}; return __st; } while (0)
+#define SB_SET_RC(__status, __rc) do { if (__status) { (__status)->rc = (__rc); (__status)->msg = NULL; } } while (0)
+
+/******************************************************************************
+ * Object pool
+ *
+ * Every object handed out is linked into the pool of the thread that made
+ * it and freed by stub_broker_release_all(). Containers only point at the
+ * objects they hold, which are in the pool in their own right.
+ *****************************************************************************/
+typedef enum {
+    sb_type_string, sb_type_array, sb_type_datetime, sb_type_objectpath,
+    sb_type_instance, sb_type_args, sb_type_context, sb_type_enumeration,
+    sb_type_result, sb_type_selectexp
+} sb_type;
+
+static const char *sb_type_names[] = {
+    "CMPIString", "CMPIArray", "CMPIDateTime", "CMPIObjectPath",
+    "CMPIInstance", "CMPIArgs", "CMPIContext", "CMPIEnumeration",
+    "CMPIResult", "CMPISelectExp"
+};
+
+typedef struct _sb_obj {
+    struct _sb_obj *next;
+    sb_type type;
+    void (*destroy)(struct _sb_obj *obj);
+} sb_obj;
+
+static __thread sb_obj *thread_pool = NULL;
+
+static void *sb_obj_new(size_t size, sb_type type, void (*destroy)(sb_obj *), bool pooled)
+{
+    sb_obj *obj = sb_calloc(1, size);
+    obj->type = type;
+    obj->destroy = destroy;
+    if (pooled) {
+        obj->next = thread_pool;
+        thread_pool = obj;
+    }
+    return obj;
+}
+
+static void sb_obj_free(sb_obj *obj)
+{
+    if (obj->destroy)
+        obj->destroy(obj);
+    sb_free(obj);
+}
+
+void stub_broker_release_all()
+{
+    while (thread_pool) {
+        sb_obj *obj = thread_pool;
+        thread_pool = obj->next;
+        sb_obj_free(obj);
+    }
+}
+
+/* All the encapsulated types start with the handle, which is our object */
+static sb_obj *sb_obj_of(const void *enc)
+{
+    return enc ? (sb_obj *)((void * const *)enc)[0] : NULL;
+}
+
+static CMPIStatus sb_release(void *enc)
+{
+    /* everything is freed along with the rest of the call */
+    (void)enc;
+    SB_RETURN(CMPI_RC_OK);
+}
+
+/******************************************************************************
+ * Named lists of values, for properties, keys, arguments and context entries
+ *****************************************************************************/
+typedef struct {
+    CMPICount count;
+    CMPICount size;
+    char **names;
+    CMPIData *values;
+} sb_props;
+
+static void sb_props_free(sb_props *props)
+{
+    CMPICount i;
+    for (i = 0; i < props->count; i++)
+        sb_free(props->names[i]);
+    sb_free(props->names);
+    sb_free(props->values);
+    memset(props, 0, sizeof(*props));
+}
+
+static int sb_props_find(const sb_props *props, const char *name)
+{
+    CMPICount i;
+    for (i = 0; i < props->count; i++)
+        if (strcasecmp(props->names[i], name) == 0)
+            return (int)i;
+    return -1;
+}
+
+static void sb_props_set(sb_props *props, const char *name, CMPIData data)
+{
+    int i = sb_props_find(props, name);
+    if (i < 0) {
+        if (props->count == props->size) {
+            props->size = props->size ? props->size * 2 : 16;
+            props->names = sb_realloc(props->names, props->size * sizeof(char *));
+            props->values = sb_realloc(props->values, props->size * sizeof(CMPIData));
+        }
+        i = props->count++;
+        props->names[i] = sb_strdup(name);
+    }
+    props->values[i] = data;
+}
+
+static CMPIData sb_null_data(CMPIType type, CMPIValueState state)
+{
+    CMPIData data;
+    memset(&data, 0, sizeof(data));
+    data.type = type;
+    data.state = state;
+    return data;
+}
+
+static CMPIData sb_props_get(const sb_props *props, const char *name, CMPIStatus *rc)
+{
+    int i = sb_props_find(props, name);
+    if (i < 0) {
+        SB_SET_RC(rc, CMPI_RC_ERR_NO_SUCH_PROPERTY);
+        return sb_null_data(CMPI_null, CMPI_nullValue | CMPI_notFound);
+    }
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return props->values[i];
+}
+
+static CMPIString *sb_new_string(const char *str, bool pooled);
+static CMPIInstance *sb_instance_copy(const CMPIInstance *i, bool pooled);
+
+static CMPIData sb_props_get_at(const sb_props *props, CMPICount index, CMPIString **name, CMPIStatus *rc)
+{
+    if (index >= props->count) {
+        SB_SET_RC(rc, CMPI_RC_ERR_NO_SUCH_PROPERTY);
+        return sb_null_data(CMPI_null, CMPI_nullValue | CMPI_notFound);
+    }
+    if (name)
+        *name = sb_new_string(props->names[index], true);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return props->values[index];
+}
+
+/******************************************************************************
+ * CMPIString
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIString enc;
+    char *str;
+} sb_string;
+
+static void sb_string_destroy(sb_obj *obj)
+{
+    sb_free(((sb_string *)obj)->str);
+}
+
+static CMPIString *sb_string_clone(const CMPIString *s, CMPIStatus *rc);
+
+static char *sb_string_get_char_ptr(const CMPIString *s, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_string *)s->hdl)->str;
+}
+
+static CMPIStringFT sb_string_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIString *))sb_release,
+    .clone = sb_string_clone,
+    .getCharPtr = sb_string_get_char_ptr,
+};
+
+static CMPIString *sb_new_string(const char *str, bool pooled)
+{
+    sb_string *s = sb_obj_new(sizeof(sb_string), sb_type_string, sb_string_destroy, pooled);
+    s->enc.hdl = s;
+    s->enc.ft = &sb_string_ft;
+    s->str = sb_strdup(str);
+    return &s->enc;
+}
+
+static CMPIString *sb_string_clone(const CMPIString *s, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(((sb_string *)s->hdl)->str, true);
+}
+
+/******************************************************************************
+ * Copying values in, the broker owns what it is given
+ *****************************************************************************/
+static CMPIData sb_copy_value(const CMPIValue *value, CMPIType type)
+{
+    CMPIData data = sb_null_data(type, CMPI_goodValue);
+    if (value == NULL)
+        return sb_null_data(type == CMPI_chars ? CMPI_string : type, CMPI_nullValue);
+
+    if (type & CMPI_ARRAY) {
+        if (value->array == NULL)
+            return sb_null_data(type, CMPI_nullValue);
+        data.value.array = CMClone(value->array, NULL);
+        return data;
+    }
+    switch (type) {
+    case CMPI_chars:
+        data.type = CMPI_string;
+        data.value.string = sb_new_string((const char *)value, true);
+        break;
+    case CMPI_string:
+        if (value->string == NULL)
+            return sb_null_data(type, CMPI_nullValue);
+        data.value.string = sb_new_string(CMGetCharPtr(value->string), true);
+        break;
+    case CMPI_ref:
+        if (value->ref == NULL)
+            return sb_null_data(type, CMPI_nullValue);
+        data.value.ref = CMClone(value->ref, NULL);
+        break;
+    case CMPI_instance:
+        if (value->inst == NULL)
+            return sb_null_data(type, CMPI_nullValue);
+        data.value.inst = sb_instance_copy(value->inst, true);
+        break;
+    case CMPI_dateTime:
+        if (value->dateTime == NULL)
+            return sb_null_data(type, CMPI_nullValue);
+        data.value.dateTime = CMClone(value->dateTime, NULL);
+        break;
+    case CMPI_boolean:  data.value.boolean = value->boolean; break;
+    case CMPI_char16:   data.value.char16 = value->char16; break;
+    case CMPI_real32:   data.value.real32 = value->real32; break;
+    case CMPI_real64:   data.value.real64 = value->real64; break;
+    case CMPI_uint8:    data.value.uint8 = value->uint8; break;
+    case CMPI_uint16:   data.value.uint16 = value->uint16; break;
+    case CMPI_uint32:   data.value.uint32 = value->uint32; break;
+    case CMPI_uint64:   data.value.uint64 = value->uint64; break;
+    case CMPI_sint8:    data.value.sint8 = value->sint8; break;
+    case CMPI_sint16:   data.value.sint16 = value->sint16; break;
+    case CMPI_sint32:   data.value.sint32 = value->sint32; break;
+    case CMPI_sint64:   data.value.sint64 = value->sint64; break;
+    default:
+        /* pointers and anything else we don't know about are kept as is */
+        data.value = *value;
+        break;
+    }
+    return data;
+}
+
+/* The value as a string, for key bindings, toString() and queries */
+static void sb_value_to_string(CMPIData data, char *buf, size_t len)
+{
+    buf[0] = '\0';
+    if (data.state & CMPI_nullValue)
+        return;
+    switch (data.type) {
+    case CMPI_string:   snprintf(buf, len, "%s", CMGetCharPtr(data.value.string)); break;
+    case CMPI_boolean:  snprintf(buf, len, "%s", data.value.boolean ? "TRUE" : "FALSE"); break;
+    case CMPI_uint8:    snprintf(buf, len, "%u", data.value.uint8); break;
+    case CMPI_uint16:   snprintf(buf, len, "%u", data.value.uint16); break;
+    case CMPI_uint32:   snprintf(buf, len, "%u", data.value.uint32); break;
+    case CMPI_uint64:   snprintf(buf, len, "%llu", (unsigned long long)data.value.uint64); break;
+    case CMPI_sint8:    snprintf(buf, len, "%d", data.value.sint8); break;
+    case CMPI_sint16:   snprintf(buf, len, "%d", data.value.sint16); break;
+    case CMPI_sint32:   snprintf(buf, len, "%d", data.value.sint32); break;
+    case CMPI_sint64:   snprintf(buf, len, "%lld", (long long)data.value.sint64); break;
+    case CMPI_real32:   snprintf(buf, len, "%g", data.value.real32); break;
+    case CMPI_real64:   snprintf(buf, len, "%g", data.value.real64); break;
+    case CMPI_ref: {
+        CMPIString *str = CMObjectPathToString(data.value.ref, NULL);
+        snprintf(buf, len, "%s", str ? CMGetCharPtr(str) : "");
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/******************************************************************************
+ * CMPIArray
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIArray enc;
+    CMPIType type;              /* of the elements */
+    CMPICount size;
+    CMPIData *data;
+} sb_array;
+
+static void sb_array_destroy(sb_obj *obj)
+{
+    sb_free(((sb_array *)obj)->data);
+}
+
+static CMPIArray *sb_new_array(CMPICount size, CMPIType type);
+
+static CMPIArray *sb_array_clone(const CMPIArray *a, CMPIStatus *rc)
+{
+    sb_array *from = (sb_array *)a->hdl;
+    CMPIArray *to = sb_new_array(from->size, from->type);
+    sb_array *copy = (sb_array *)to->hdl;
+    CMPICount i;
+    for (i = 0; i < from->size; i++) {
+        if (from->data[i].state & CMPI_nullValue)
+            copy->data[i] = from->data[i];
+        else
+            copy->data[i] = sb_copy_value(&from->data[i].value, from->data[i].type);
+    }
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return to;
+}
+
+static CMPICount sb_array_get_size(const CMPIArray *a, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_array *)a->hdl)->size;
+}
+
+static CMPIType sb_array_get_simple_type(const CMPIArray *a, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_array *)a->hdl)->type;
+}
+
+static CMPIData sb_array_get_element_at(const CMPIArray *a, CMPICount index, CMPIStatus *rc)
+{
+    sb_array *array = (sb_array *)a->hdl;
+    if (index >= array->size) {
+        SB_SET_RC(rc, CMPI_RC_ERR_NO_SUCH_PROPERTY);
+        return sb_null_data(array->type, CMPI_badValue);
+    }
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return array->data[index];
+}
+
+static CMPIStatus sb_array_set_element_at(const CMPIArray *a, CMPICount index, const CMPIValue *value, CMPIType type)
+{
+    sb_array *array = (sb_array *)a->hdl;
+    if (index >= array->size)
+        SB_RETURN(CMPI_RC_ERR_NO_SUCH_PROPERTY);
+    array->data[index] = sb_copy_value(value, type);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIArrayFT sb_array_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIArray *))sb_release,
+    .clone = sb_array_clone,
+    .getSize = sb_array_get_size,
+    .getSimpleType = sb_array_get_simple_type,
+    .getElementAt = sb_array_get_element_at,
+    .setElementAt = sb_array_set_element_at,
+};
+
+static CMPIArray *sb_new_array(CMPICount size, CMPIType type)
+{
+    sb_array *a = sb_obj_new(sizeof(sb_array), sb_type_array, sb_array_destroy, true);
+    CMPICount i;
+    a->enc.hdl = a;
+    a->enc.ft = &sb_array_ft;
+    a->type = (type == CMPI_chars) ? CMPI_string : (type & ~CMPI_ARRAY);
+    a->size = size;
+    a->data = sb_calloc(size ? size : 1, sizeof(CMPIData));
+    for (i = 0; i < size; i++)
+        a->data[i] = sb_null_data(a->type, CMPI_nullValue);
+    return &a->enc;
+}
+
+/******************************************************************************
+ * CMPIDateTime, kept as microseconds since the epoch (or in the interval)
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIDateTime enc;
+    CMPIUint64 usecs;
+    CMPIBoolean interval;
+} sb_datetime;
+
+static CMPIDateTime *sb_new_datetime(CMPIUint64 usecs, CMPIBoolean interval);
+
+static CMPIDateTime *sb_datetime_clone(const CMPIDateTime *dt, CMPIStatus *rc)
+{
+    sb_datetime *from = (sb_datetime *)dt->hdl;
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_datetime(from->usecs, from->interval);
+}
+
+static CMPIUint64 sb_datetime_get_binary_format(const CMPIDateTime *dt, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_datetime *)dt->hdl)->usecs;
+}
+
+static CMPIString *sb_datetime_get_string_format(const CMPIDateTime *dt, CMPIStatus *rc)
+{
+    sb_datetime *d = (sb_datetime *)dt->hdl;
+    char buf[32];
+    CMPIUint64 secs = d->usecs / 1000000;
+    unsigned int usecs = (unsigned int)(d->usecs % 1000000);
+
+    if (d->interval) {
+        snprintf(buf, sizeof(buf), "%08llu%02u%02u%02u.%06u:000",
+                 (unsigned long long)(secs / 86400), (unsigned int)(secs / 3600 % 24),
+                 (unsigned int)(secs / 60 % 60), (unsigned int)(secs % 60), usecs);
+    }
+    else {
+        time_t t = (time_t)secs;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", &tm);
+        snprintf(buf + 14, sizeof(buf) - 14, ".%06u+000", usecs);
+    }
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(buf, true);
+}
+
+static CMPIBoolean sb_datetime_is_interval(const CMPIDateTime *dt, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_datetime *)dt->hdl)->interval;
+}
+
+static CMPIDateTimeFT sb_datetime_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIDateTime *))sb_release,
+    .clone = sb_datetime_clone,
+    .getBinaryFormat = sb_datetime_get_binary_format,
+    .getStringFormat = sb_datetime_get_string_format,
+    .isInterval = sb_datetime_is_interval,
+};
+
+static CMPIDateTime *sb_new_datetime(CMPIUint64 usecs, CMPIBoolean interval)
+{
+    sb_datetime *d = sb_obj_new(sizeof(sb_datetime), sb_type_datetime, NULL, true);
+    d->enc.hdl = d;
+    d->enc.ft = &sb_datetime_ft;
+    d->usecs = usecs;
+    d->interval = interval;
+    return &d->enc;
+}
+
+/******************************************************************************
+ * CMPIObjectPath
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIObjectPath enc;
+    char *ns;
+    char *cn;
+    char *host;
+    sb_props keys;
+} sb_objectpath;
+
+static void sb_objectpath_destroy(sb_obj *obj)
+{
+    sb_objectpath *op = (sb_objectpath *)obj;
+    sb_free(op->ns);
+    sb_free(op->cn);
+    sb_free(op->host);
+    sb_props_free(&op->keys);
+}
+
+static CMPIObjectPath *sb_new_objectpath(const char *ns, const char *cn);
+
+static CMPIObjectPath *sb_objectpath_clone(const CMPIObjectPath *o, CMPIStatus *rc)
+{
+    sb_objectpath *from = (sb_objectpath *)o->hdl;
+    CMPIObjectPath *to = sb_new_objectpath(from->ns, from->cn);
+    sb_objectpath *copy = (sb_objectpath *)to->hdl;
+    CMPICount i;
+    copy->host = sb_strdup(from->host);
+    for (i = 0; i < from->keys.count; i++)
+        sb_props_set(&copy->keys, from->keys.names[i], from->keys.values[i]);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return to;
+}
+
+static void sb_replace(char **str, const char *value)
+{
+    sb_free(*str);
+    *str = sb_strdup(value);
+}
+
+static CMPIStatus sb_objectpath_set_namespace(CMPIObjectPath *o, const char *ns)
+{
+    sb_replace(&((sb_objectpath *)o->hdl)->ns, ns);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIString *sb_objectpath_get_namespace(const CMPIObjectPath *o, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(((sb_objectpath *)o->hdl)->ns, true);
+}
+
+static CMPIStatus sb_objectpath_set_hostname(CMPIObjectPath *o, const char *host)
+{
+    sb_replace(&((sb_objectpath *)o->hdl)->host, host);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIString *sb_objectpath_get_hostname(const CMPIObjectPath *o, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(((sb_objectpath *)o->hdl)->host, true);
+}
+
+static CMPIStatus sb_objectpath_set_classname(CMPIObjectPath *o, const char *cn)
+{
+    sb_replace(&((sb_objectpath *)o->hdl)->cn, cn);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIString *sb_objectpath_get_classname(const CMPIObjectPath *o, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(((sb_objectpath *)o->hdl)->cn, true);
+}
+
+static CMPIStatus sb_objectpath_add_key(CMPIObjectPath *o, const char *name, const CMPIValue *value, const CMPIType type)
+{
+    CMPIData data = sb_copy_value(value, type);
+    data.state |= CMPI_keyValue;
+    sb_props_set(&((sb_objectpath *)o->hdl)->keys, name, data);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIData sb_objectpath_get_key(const CMPIObjectPath *o, const char *name, CMPIStatus *rc)
+{
+    return sb_props_get(&((sb_objectpath *)o->hdl)->keys, name, rc);
+}
+
+static CMPIData sb_objectpath_get_key_at(const CMPIObjectPath *o, CMPICount index, CMPIString **name, CMPIStatus *rc)
+{
+    return sb_props_get_at(&((sb_objectpath *)o->hdl)->keys, index, name, rc);
+}
+
+static CMPICount sb_objectpath_get_key_count(const CMPIObjectPath *o, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_objectpath *)o->hdl)->keys.count;
+}
+
+static CMPIStatus sb_objectpath_set_namespace_from(CMPIObjectPath *o, const CMPIObjectPath *src)
+{
+    sb_replace(&((sb_objectpath *)o->hdl)->ns, ((sb_objectpath *)src->hdl)->ns);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIStatus sb_objectpath_set_host_and_namespace_from(CMPIObjectPath *o, const CMPIObjectPath *src)
+{
+    sb_replace(&((sb_objectpath *)o->hdl)->ns, ((sb_objectpath *)src->hdl)->ns);
+    sb_replace(&((sb_objectpath *)o->hdl)->host, ((sb_objectpath *)src->hdl)->host);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+/* ns:cn.key="value",key="value" */
+static CMPIString *sb_objectpath_to_string(const CMPIObjectPath *o, CMPIStatus *rc)
+{
+    sb_objectpath *op = (sb_objectpath *)o->hdl;
+    size_t len = 256, used;
+    char *buf = sb_calloc(1, len);
+    char value[1024];
+    CMPICount i;
+
+    used = snprintf(buf, len, "%s:%s", op->ns ? op->ns : "", op->cn ? op->cn : "");
+    for (i = 0; i < op->keys.count; i++) {
+        sb_value_to_string(op->keys.values[i], value, sizeof(value));
+        size_t need = used + strlen(op->keys.names[i]) + strlen(value) + 5;
+        if (need > len) {
+            len = need * 2;
+            buf = sb_realloc(buf, len);
+        }
+        used += snprintf(buf + used, len - used, "%c%s=\"%s\"", i ? ',' : '.', op->keys.names[i], value);
+    }
+    CMPIString *str = sb_new_string(buf, true);
+    sb_free(buf);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return str;
+}
+
+static CMPIObjectPathFT sb_objectpath_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIObjectPath *))sb_release,
+    .clone = sb_objectpath_clone,
+    .setNameSpace = sb_objectpath_set_namespace,
+    .getNameSpace = sb_objectpath_get_namespace,
+    .setHostname = sb_objectpath_set_hostname,
+    .getHostname = sb_objectpath_get_hostname,
+    .setClassName = sb_objectpath_set_classname,
+    .getClassName = sb_objectpath_get_classname,
+    .addKey = sb_objectpath_add_key,
+    .getKey = sb_objectpath_get_key,
+    .getKeyAt = sb_objectpath_get_key_at,
+    .getKeyCount = sb_objectpath_get_key_count,
+    .setNameSpaceFromObjectPath = sb_objectpath_set_namespace_from,
+    .setHostAndNameSpaceFromObjectPath = sb_objectpath_set_host_and_namespace_from,
+    .toString = sb_objectpath_to_string,
+};
+
+static CMPIObjectPath *sb_new_objectpath(const char *ns, const char *cn)
+{
+    sb_objectpath *op = sb_obj_new(sizeof(sb_objectpath), sb_type_objectpath, sb_objectpath_destroy, true);
+    op->enc.hdl = op;
+    op->enc.ft = &sb_objectpath_ft;
+    op->ns = sb_strdup(ns);
+    op->cn = sb_strdup(cn);
+    return &op->enc;
+}
+
+/******************************************************************************
+ * CMPIInstance
+ *
+ * There is no class schema to say what the keys are. The providers pass
+ * them in with CMSetPropertyFilter() before setting the properties; for an
+ * instance that never had a filter set the usual key names are used.
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIInstance enc;
+    char *ns;
+    char *cn;
+    sb_props props;
+    char **filter;              /* properties to keep, NULL for all of them */
+    char **keys;
+    bool pooled;
+    sb_obj *owned;              /* the values of one out of the pool */
+} sb_instance;
+
+static const char *sb_default_keys[] = {
+    "InstanceID", "CreationClassName", "Name", "DeviceID",
+    "SystemCreationClassName", "SystemName", NULL
+};
+
+static char **sb_strv_dup(const char **strv)
+{
+    int i, n = 0;
+    if (strv == NULL)
+        return NULL;
+    while (strv[n])
+        n++;
+    char **copy = sb_calloc(n + 1, sizeof(char *));
+    for (i = 0; i < n; i++)
+        copy[i] = sb_strdup(strv[i]);
+    return copy;
+}
+
+static void sb_strv_free(char **strv)
+{
+    int i;
+    if (strv == NULL)
+        return;
+    for (i = 0; strv[i]; i++)
+        sb_free(strv[i]);
+    sb_free(strv);
+}
+
+static bool sb_strv_contains(char * const *strv, const char *str)
+{
+    int i;
+    for (i = 0; strv && strv[i]; i++)
+        if (strcasecmp(strv[i], str) == 0)
+            return true;
+    return false;
+}
+
+static void sb_instance_destroy(sb_obj *obj)
+{
+    sb_instance *inst = (sb_instance *)obj;
+    sb_free(inst->ns);
+    sb_free(inst->cn);
+    sb_props_free(&inst->props);
+    sb_strv_free(inst->filter);
+    sb_strv_free(inst->keys);
+}
+
+static CMPIStatus sb_instance_release(CMPIInstance *i)
+{
+    sb_instance *inst = (sb_instance *)i->hdl;
+    if (inst->pooled)
+        return sb_release(i);
+    while (inst->owned) {
+        sb_obj *obj = inst->owned;
+        inst->owned = obj->next;
+        sb_obj_free(obj);
+    }
+    sb_obj_free(&inst->obj);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+/* The values of an instance out of the pool are copied into what it owns */
+static CMPIData sb_instance_copy_value(sb_instance *inst, const CMPIData *data)
+{
+    sb_obj *pool = thread_pool;
+    CMPIData copy;
+    if (data->state & CMPI_nullValue)
+        return *data;
+    if (!inst->pooled)
+        thread_pool = inst->owned;
+    copy = sb_copy_value(&data->value, data->type);
+    copy.state = data->state;
+    if (!inst->pooled) {
+        inst->owned = thread_pool;
+        thread_pool = pool;
+    }
+    return copy;
+}
+
+static CMPIInstance *sb_new_instance(const char *ns, const char *cn);
+
+static CMPIInstance *sb_instance_copy(const CMPIInstance *i, bool pooled)
+{
+    sb_instance *from = (sb_instance *)i->hdl;
+    sb_obj *pool = thread_pool;
+    CMPIInstance *to = sb_new_instance(from->ns, from->cn);
+    sb_instance *copy = (sb_instance *)to->hdl;
+    CMPICount n;
+    if (!pooled) {
+        thread_pool = pool;
+        copy->obj.next = NULL;
+        copy->pooled = false;
+    }
+    for (n = 0; n < from->props.count; n++)
+        sb_props_set(&copy->props, from->props.names[n], sb_instance_copy_value(copy, &from->props.values[n]));
+    copy->filter = sb_strv_dup((const char **)from->filter);
+    copy->keys = sb_strv_dup((const char **)from->keys);
+    return to;
+}
+
+/* A clone is the MI's until it releases it, which may be long after the
+   call (see xen_frozen.h), so it is kept out of the pool */
+static CMPIInstance *sb_instance_clone(const CMPIInstance *i, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_instance_copy(i, false);
+}
+
+static CMPIData sb_instance_get_property(const CMPIInstance *i, const char *name, CMPIStatus *rc)
+{
+    return sb_props_get(&((sb_instance *)i->hdl)->props, name, rc);
+}
+
+static CMPIData sb_instance_get_property_at(const CMPIInstance *i, CMPICount index, CMPIString **name, CMPIStatus *rc)
+{
+    return sb_props_get_at(&((sb_instance *)i->hdl)->props, index, name, rc);
+}
+
+static CMPICount sb_instance_get_property_count(const CMPIInstance *i, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_instance *)i->hdl)->props.count;
+}
+
+static CMPIStatus sb_instance_set_property(const CMPIInstance *i, const char *name, const CMPIValue *value, CMPIType type)
+{
+    sb_instance *inst = (sb_instance *)i->hdl;
+    /* filtered out properties are dropped, just like a CIMOM would */
+    if (inst->filter && !sb_strv_contains(inst->filter, name) && !sb_strv_contains(inst->keys, name))
+        SB_RETURN(CMPI_RC_OK);
+    CMPIData data = sb_copy_value(value, type);
+    if (!inst->pooled)
+        data = sb_instance_copy_value(inst, &data);
+    sb_props_set(&inst->props, name, data);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIObjectPath *sb_instance_get_objectpath(const CMPIInstance *i, CMPIStatus *rc)
+{
+    sb_instance *inst = (sb_instance *)i->hdl;
+    CMPIObjectPath *op = sb_new_objectpath(inst->ns, inst->cn);
+    const char **keys = inst->keys ? (const char **)inst->keys : sb_default_keys;
+    int k;
+    for (k = 0; keys[k]; k++) {
+        int n = sb_props_find(&inst->props, keys[k]);
+        if (n >= 0) {
+            CMPIData data = inst->props.values[n];
+            data.state |= CMPI_keyValue;
+            sb_props_set(&((sb_objectpath *)op->hdl)->keys, keys[k], data);
+        }
+    }
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return op;
+}
+
+static CMPIStatus sb_instance_set_property_filter(CMPIInstance *i, const char **properties, const char **keys)
+{
+    sb_instance *inst = (sb_instance *)i->hdl;
+    sb_strv_free(inst->filter);
+    inst->filter = sb_strv_dup(properties);
+    if (keys) {
+        sb_strv_free(inst->keys);
+        inst->keys = sb_strv_dup(keys);
+    }
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIStatus sb_instance_set_objectpath(CMPIInstance *i, const CMPIObjectPath *o)
+{
+    sb_instance *inst = (sb_instance *)i->hdl;
+    sb_objectpath *op = (sb_objectpath *)o->hdl;
+    CMPICount k;
+    sb_replace(&inst->ns, op->ns);
+    sb_replace(&inst->cn, op->cn);
+    for (k = 0; k < op->keys.count; k++)
+        sb_props_set(&inst->props, op->keys.names[k], inst->pooled ? op->keys.values[k] :
+                     sb_instance_copy_value(inst, &op->keys.values[k]));
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIInstanceFT sb_instance_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = sb_instance_release,
+    .clone = sb_instance_clone,
+    .getProperty = sb_instance_get_property,
+    .getPropertyAt = sb_instance_get_property_at,
+    .getPropertyCount = sb_instance_get_property_count,
+    .setProperty = sb_instance_set_property,
+    .getObjectPath = sb_instance_get_objectpath,
+    .setPropertyFilter = sb_instance_set_property_filter,
+    .setObjectPath = sb_instance_set_objectpath,
+};
+
+static CMPIInstance *sb_new_instance(const char *ns, const char *cn)
+{
+    sb_instance *inst = sb_obj_new(sizeof(sb_instance), sb_type_instance, sb_instance_destroy, true);
+    inst->enc.hdl = inst;
+    inst->enc.ft = &sb_instance_ft;
+    inst->ns = sb_strdup(ns);
+    inst->cn = sb_strdup(cn);
+    inst->pooled = true;
+    return &inst->enc;
+}
+
+/******************************************************************************
+ * CMPIArgs
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIArgs enc;
+    sb_props args;
+} sb_args;
+
+static void sb_args_destroy(sb_obj *obj)
+{
+    sb_props_free(&((sb_args *)obj)->args);
+}
+
+static CMPIArgs *sb_new_args();
+
+static CMPIArgs *sb_args_clone(const CMPIArgs *a, CMPIStatus *rc)
+{
+    sb_args *from = (sb_args *)a->hdl;
+    CMPIArgs *to = sb_new_args();
+    CMPICount n;
+    for (n = 0; n < from->args.count; n++)
+        sb_props_set(&((sb_args *)to->hdl)->args, from->args.names[n], from->args.values[n]);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return to;
+}
+
+static CMPIStatus sb_args_add_arg(const CMPIArgs *a, const char *name, const CMPIValue *value, const CMPIType type)
+{
+    sb_props_set(&((sb_args *)a->hdl)->args, name, sb_copy_value(value, type));
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIData sb_args_get_arg(const CMPIArgs *a, const char *name, CMPIStatus *rc)
+{
+    return sb_props_get(&((sb_args *)a->hdl)->args, name, rc);
+}
+
+static CMPIData sb_args_get_arg_at(const CMPIArgs *a, CMPICount index, CMPIString **name, CMPIStatus *rc)
+{
+    return sb_props_get_at(&((sb_args *)a->hdl)->args, index, name, rc);
+}
+
+static CMPICount sb_args_get_arg_count(const CMPIArgs *a, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_args *)a->hdl)->args.count;
+}
+
+static CMPIArgsFT sb_args_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIArgs *))sb_release,
+    .clone = sb_args_clone,
+    .addArg = sb_args_add_arg,
+    .getArg = sb_args_get_arg,
+    .getArgAt = sb_args_get_arg_at,
+    .getArgCount = sb_args_get_arg_count,
+};
+
+static CMPIArgs *sb_new_args()
+{
+    sb_args *a = sb_obj_new(sizeof(sb_args), sb_type_args, sb_args_destroy, true);
+    a->enc.hdl = a;
+    a->enc.ft = &sb_args_ft;
+    return &a->enc;
+}
+
+/* name=value,name:type=value where type is one of u8, u16, u32, u64, s32, s64, bool */
+CMPIArgs *stub_broker_args(const char *str)
+{
+    CMPIArgs *args = sb_new_args();
+    char *copy = sb_strdup(str ? str : "");
+    char *save = NULL, *tok;
+
+    for (tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(tok, '=');
+        char *type;
+        CMPIValue v;
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+        type = strchr(tok, ':');
+        if (type)
+            *type++ = '\0';
+        if (type == NULL)
+            CMAddArg(args, tok, value, CMPI_chars);
+        else if (strcmp(type, "u8") == 0) {
+            v.uint8 = (CMPIUint8)strtoul(value, NULL, 0);
+            CMAddArg(args, tok, &v, CMPI_uint8);
+        }
+        else if (strcmp(type, "u16") == 0) {
+            v.uint16 = (CMPIUint16)strtoul(value, NULL, 0);
+            CMAddArg(args, tok, &v, CMPI_uint16);
+        }
+        else if (strcmp(type, "u32") == 0) {
+            v.uint32 = (CMPIUint32)strtoul(value, NULL, 0);
+            CMAddArg(args, tok, &v, CMPI_uint32);
+        }
+        else if (strcmp(type, "u64") == 0) {
+            v.uint64 = strtoull(value, NULL, 0);
+            CMAddArg(args, tok, &v, CMPI_uint64);
+        }
+        else if (strcmp(type, "s32") == 0) {
+            v.sint32 = (CMPISint32)strtol(value, NULL, 0);
+            CMAddArg(args, tok, &v, CMPI_sint32);
+        }
+        else if (strcmp(type, "s64") == 0) {
+            v.sint64 = strtoll(value, NULL, 0);
+            CMAddArg(args, tok, &v, CMPI_sint64);
+        }
+        else if (strcmp(type, "bool") == 0) {
+            v.boolean = (strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0);
+            CMAddArg(args, tok, &v, CMPI_boolean);
+        }
+        else
+            fprintf(stderr, "stub broker: unknown argument type %s for %s\n", type, tok);
+    }
+    sb_free(copy);
+    return args;
+}
+
+/******************************************************************************
+ * CMPIContext
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIContext enc;
+    sb_props entries;
+    bool pooled;
+} sb_context;
+
+static void sb_context_destroy(sb_obj *obj)
+{
+    sb_props_free(&((sb_context *)obj)->entries);
+}
+
+static CMPIContext *sb_new_context(bool pooled);
+
+/* Entries are copied as they are, contexts usually only hold strings and numbers */
+static CMPIContext *sb_context_copy(const CMPIContext *c, bool pooled)
+{
+    sb_context *from = (sb_context *)c->hdl;
+    CMPIContext *to = sb_new_context(pooled);
+    CMPICount n;
+    for (n = 0; n < from->entries.count; n++) {
+        CMPIData data = from->entries.values[n];
+        if (data.type == CMPI_string && !(data.state & CMPI_nullValue))
+            data.value.string = sb_new_string(CMGetCharPtr(data.value.string), pooled);
+        sb_props_set(&((sb_context *)to->hdl)->entries, from->entries.names[n], data);
+    }
+    return to;
+}
+
+static CMPIContext *sb_context_clone(const CMPIContext *c, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_context_copy(c, true);
+}
+
+static CMPIData sb_context_get_entry(const CMPIContext *c, const char *name, CMPIStatus *rc)
+{
+    return sb_props_get(&((sb_context *)c->hdl)->entries, name, rc);
+}
+
+static CMPIData sb_context_get_entry_at(const CMPIContext *c, CMPICount index, CMPIString **name, CMPIStatus *rc)
+{
+    return sb_props_get_at(&((sb_context *)c->hdl)->entries, index, name, rc);
+}
+
+static CMPICount sb_context_get_entry_count(const CMPIContext *c, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return ((sb_context *)c->hdl)->entries.count;
+}
+
+static CMPIStatus sb_context_add_entry(const CMPIContext *c, const char *name, const CMPIValue *value, const CMPIType type)
+{
+    sb_context *context = (sb_context *)c->hdl;
+    CMPIData data = sb_copy_value(value, type);
+    /* strings in a context outside of the pool go with the context */
+    if (!context->pooled && data.type == CMPI_string && !(data.state & CMPI_nullValue))
+        data.value.string = sb_new_string(CMGetCharPtr(data.value.string), false);
+    sb_props_set(&context->entries, name, data);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIContextFT sb_context_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIContext *))sb_release,
+    .clone = sb_context_clone,
+    .getEntry = sb_context_get_entry,
+    .getEntryAt = sb_context_get_entry_at,
+    .getEntryCount = sb_context_get_entry_count,
+    .addEntry = sb_context_add_entry,
+};
+
+static CMPIContext *sb_new_context(bool pooled)
+{
+    sb_context *c = sb_obj_new(sizeof(sb_context), sb_type_context, sb_context_destroy, pooled);
+    c->enc.hdl = c;
+    c->enc.ft = &sb_context_ft;
+    c->pooled = pooled;
+    return &c->enc;
+}
+
+/* The CIMOM passes "user password" in CMPIPrincipal, see xen_utils_get_call_context() */
+CMPIContext *stub_broker_context(const char *user, const char *password)
+{
+    CMPIContext *ctx = sb_new_context(false);
+    char principal[256];
+    CMPIValue v;
+    snprintf(principal, sizeof(principal), "%s %s", user, password);
+    CMAddContextEntry(ctx, CMPIPrincipal, principal, CMPI_chars);
+    v.uint32 = 0;
+    CMAddContextEntry(ctx, CMPIInvocationFlags, &v, CMPI_uint32);
+    return ctx;
+}
+
+/******************************************************************************
+ * CMPIResult, collects everything returned to it
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIResult enc;
+    CMPICount count;
+    CMPICount size;
+    CMPIData *data;
+} sb_result;
+
+static void sb_result_destroy(sb_obj *obj)
+{
+    sb_free(((sb_result *)obj)->data);
+}
+
+static void sb_result_add(const CMPIResult *r, CMPIData data)
+{
+    sb_result *result = (sb_result *)r->hdl;
+    if (result->count == result->size) {
+        result->size = result->size ? result->size * 2 : 64;
+        result->data = sb_realloc(result->data, result->size * sizeof(CMPIData));
+    }
+    result->data[result->count++] = data;
+}
+
+static CMPIResult *sb_result_clone(const CMPIResult *r, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_ERR_NOT_SUPPORTED);
+    return NULL;
+}
+
+static CMPIStatus sb_result_return_data(const CMPIResult *r, const CMPIValue *value, const CMPIType type)
+{
+    sb_result_add(r, sb_copy_value(value, type));
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIStatus sb_result_return_instance(const CMPIResult *r, const CMPIInstance *inst)
+{
+    CMPIData data = sb_null_data(CMPI_instance, CMPI_goodValue);
+    data.value.inst = (CMPIInstance *)inst;
+    sb_result_add(r, data);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIStatus sb_result_return_objectpath(const CMPIResult *r, const CMPIObjectPath *op)
+{
+    CMPIData data = sb_null_data(CMPI_ref, CMPI_goodValue);
+    data.value.ref = (CMPIObjectPath *)op;
+    sb_result_add(r, data);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIStatus sb_result_return_done(const CMPIResult *r)
+{
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIResultFT sb_result_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIResult *))sb_release,
+    .clone = sb_result_clone,
+    .returnData = sb_result_return_data,
+    .returnInstance = sb_result_return_instance,
+    .returnObjectPath = sb_result_return_objectpath,
+    .returnDone = sb_result_return_done,
+};
+
+CMPIResult *stub_broker_result()
+{
+    sb_result *r = sb_obj_new(sizeof(sb_result), sb_type_result, sb_result_destroy, true);
+    r->enc.hdl = r;
+    r->enc.ft = &sb_result_ft;
+    return &r->enc;
+}
+
+CMPICount stub_broker_result_count(const CMPIResult *result)
+{
+    return ((sb_result *)result->hdl)->count;
+}
+
+CMPIData stub_broker_result_at(const CMPIResult *result, CMPICount index)
+{
+    sb_result *r = (sb_result *)result->hdl;
+    if (index >= r->count)
+        return sb_null_data(CMPI_null, CMPI_nullValue);
+    return r->data[index];
+}
+
+/******************************************************************************
+ * CMPIEnumeration, over what a provider returned to a result
+ *****************************************************************************/
+typedef struct {
+    sb_obj obj;
+    CMPIEnumeration enc;
+    const CMPIResult *result;
+    CMPICount cursor;
+} sb_enumeration;
+
+static CMPIEnumeration *sb_new_enumeration(const CMPIResult *result);
+
+static CMPIEnumeration *sb_enumeration_clone(const CMPIEnumeration *e, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_enumeration(((sb_enumeration *)e->hdl)->result);
+}
+
+static CMPIData sb_enumeration_get_next(const CMPIEnumeration *e, CMPIStatus *rc)
+{
+    sb_enumeration *en = (sb_enumeration *)e->hdl;
+    if (en->cursor >= stub_broker_result_count(en->result)) {
+        SB_SET_RC(rc, CMPI_RC_ERR_NOT_FOUND);
+        return sb_null_data(CMPI_null, CMPI_nullValue);
+    }
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return stub_broker_result_at(en->result, en->cursor++);
+}
+
+static CMPIBoolean sb_enumeration_has_next(const CMPIEnumeration *e, CMPIStatus *rc)
+{
+    sb_enumeration *en = (sb_enumeration *)e->hdl;
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return en->cursor < stub_broker_result_count(en->result);
+}
+
+static CMPIArray *sb_enumeration_to_array(const CMPIEnumeration *e, CMPIStatus *rc)
+{
+    sb_enumeration *en = (sb_enumeration *)e->hdl;
+    CMPICount i, count = stub_broker_result_count(en->result);
+    CMPIType type = count ? stub_broker_result_at(en->result, 0).type : CMPI_ref;
+    CMPIArray *array = sb_new_array(count, type);
+    for (i = 0; i < count; i++)
+        ((sb_array *)array->hdl)->data[i] = stub_broker_result_at(en->result, i);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return array;
+}
+
+static CMPIEnumerationFT sb_enumeration_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPIEnumeration *))sb_release,
+    .clone = sb_enumeration_clone,
+    .getNext = sb_enumeration_get_next,
+    .hasNext = sb_enumeration_has_next,
+    .toArray = sb_enumeration_to_array,
+};
+
+static CMPIEnumeration *sb_new_enumeration(const CMPIResult *result)
+{
+    sb_enumeration *e = sb_obj_new(sizeof(sb_enumeration), sb_type_enumeration, NULL, true);
+    e->enc.hdl = e;
+    e->enc.ft = &sb_enumeration_ft;
+    e->result = result;
+    return &e->enc;
+}
+
+/******************************************************************************
+ * CMPISelectExp
+ *
+ * Understands "SELECT ... FROM <class> [WHERE <property> <op> <literal>
+ * [AND ...]]" with =, <>, <, <=, >, >=, which is as much WQL as the
+ * providers get asked. Anything else matches every instance.
+ *****************************************************************************/
+#define SB_MAX_TERMS 16
+
+typedef struct {
+    char *property;
+    char op[3];
+    char *literal;
+    bool quoted;
+} sb_term;
+
+typedef struct {
+    sb_obj obj;
+    CMPISelectExp enc;
+    char *query;
+    int term_count;
+    sb_term terms[SB_MAX_TERMS];
+} sb_selectexp;
+
+static void sb_selectexp_destroy(sb_obj *obj)
+{
+    sb_selectexp *se = (sb_selectexp *)obj;
+    int i;
+    sb_free(se->query);
+    for (i = 0; i < se->term_count; i++) {
+        sb_free(se->terms[i].property);
+        sb_free(se->terms[i].literal);
+    }
+}
+
+static const char *sb_skip_space(const char *p)
+{
+    while (*p && isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static const char *sb_find_word(const char *str, const char *word)
+{
+    size_t len = strlen(word);
+    const char *p;
+    for (p = str; *p; p++) {
+        if (strncasecmp(p, word, len) == 0 &&
+            (p == str || isspace((unsigned char)p[-1])) &&
+            (p[len] == '\0' || isspace((unsigned char)p[len])))
+            return p;
+    }
+    return NULL;
+}
+
+static void sb_selectexp_parse(sb_selectexp *se)
+{
+    const char *p = sb_find_word(se->query, "WHERE");
+    if (p == NULL)
+        return;
+    p += strlen("WHERE");
+    while (se->term_count < SB_MAX_TERMS) {
+        sb_term *t = &se->terms[se->term_count];
+        const char *start;
+
+        p = sb_skip_space(p);
+        for (start = p; *p && (isalnum((unsigned char)*p) || *p == '_'); p++)
+            ;
+        if (p == start)
+            break;
+        t->property = sb_calloc(1, p - start + 1);
+        memcpy(t->property, start, p - start);
+
+        p = sb_skip_space(p);
+        size_t n = strspn(p, "=<>!");
+        if (n == 0 || n > 2) {
+            sb_free(t->property);
+            break;
+        }
+        memcpy(t->op, p, n);
+        p = sb_skip_space(p + n);
+
+        if (*p == '\'' || *p == '"') {
+            char quote = *p++;
+            for (start = p; *p && *p != quote; p++)
+                ;
+            t->quoted = true;
+        }
+        else {
+            for (start = p; *p && !isspace((unsigned char)*p); p++)
+                ;
+        }
+        t->literal = sb_calloc(1, p - start + 1);
+        memcpy(t->literal, start, p - start);
+        if (*p == '\'' || *p == '"')
+            p++;
+        se->term_count++;
+
+        p = sb_skip_space(p);
+        if (strncasecmp(p, "AND", 3) != 0)
+            break;
+        p += 3;
+    }
+}
+
+static CMPISelectExp *sb_selectexp_clone(const CMPISelectExp *s, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_ERR_NOT_SUPPORTED);
+    return NULL;
+}
+
+static bool sb_term_matches(const sb_term *t, const CMPIInstance *inst)
+{
+    char value[1024];
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    CMPIData data = CMGetProperty(inst, t->property, &status);
+    int cmp;
+
+    if (status.rc != CMPI_RC_OK)
+        return false;
+    sb_value_to_string(data, value, sizeof(value));
+    if (!t->quoted && data.type != CMPI_string && data.type != CMPI_boolean) {
+        double a = strtod(value, NULL), b = strtod(t->literal, NULL);
+        cmp = (a > b) - (a < b);
+    }
+    else
+        cmp = (data.type == CMPI_boolean) ? strcasecmp(value, t->literal) : strcmp(value, t->literal);
+
+    if (strcmp(t->op, "=") == 0)
+        return cmp == 0;
+    if (strcmp(t->op, "<>") == 0 || strcmp(t->op, "!=") == 0)
+        return cmp != 0;
+    if (strcmp(t->op, "<") == 0)
+        return cmp < 0;
+    if (strcmp(t->op, "<=") == 0)
+        return cmp <= 0;
+    if (strcmp(t->op, ">") == 0)
+        return cmp > 0;
+    if (strcmp(t->op, ">=") == 0)
+        return cmp >= 0;
+    return false;
+}
+
+static CMPIBoolean sb_selectexp_evaluate(const CMPISelectExp *s, const CMPIInstance *inst, CMPIStatus *rc)
+{
+    sb_selectexp *se = (sb_selectexp *)s->hdl;
+    int i;
+    SB_SET_RC(rc, CMPI_RC_OK);
+    for (i = 0; i < se->term_count; i++)
+        if (!sb_term_matches(&se->terms[i], inst))
+            return 0;
+    return 1;
+}
+
+static CMPIString *sb_selectexp_get_string(const CMPISelectExp *s, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(((sb_selectexp *)s->hdl)->query, true);
+}
+
+static CMPISelectExpFT sb_selectexp_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .release = (CMPIStatus (*)(CMPISelectExp *))sb_release,
+    .clone = sb_selectexp_clone,
+    .evaluate = sb_selectexp_evaluate,
+    .getString = sb_selectexp_get_string,
+};
+
+static CMPISelectExp *sb_new_selectexp(const char *query)
+{
+    sb_selectexp *se = sb_obj_new(sizeof(sb_selectexp), sb_type_selectexp, sb_selectexp_destroy, true);
+    se->enc.hdl = se;
+    se->enc.ft = &sb_selectexp_ft;
+    se->query = sb_strdup(query);
+    sb_selectexp_parse(se);
+    return &se->enc;
+}
+
+/******************************************************************************
+ * Class hierarchy, from the "class A : B" declarations in the MOFs
+ *****************************************************************************/
+typedef struct {
+    char *name;
+    char *parent;
+} sb_class;
+
+static sb_class *classes = NULL;
+static int class_count = 0;
+
+static const sb_class *sb_find_class(const char *name)
+{
+    int i;
+    for (i = 0; i < class_count; i++)
+        if (strcasecmp(classes[i].name, name) == 0)
+            return &classes[i];
+    return NULL;
+}
+
+static bool sb_class_is_a(const char *cn, const char *type)
+{
+    int depth;
+    for (depth = 0; cn && depth < 32; depth++) {
+        if (strcasecmp(cn, type) == 0)
+            return true;
+        const sb_class *c = sb_find_class(cn);
+        cn = c ? c->parent : NULL;
+    }
+    return false;
+}
+
+static void sb_read_mof(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f)) {
+        char name[256], parent[256];
+        const char *p = sb_skip_space(line);
+        if (strncasecmp(p, "class", 5) != 0 || !isspace((unsigned char)p[5]))
+            continue;
+        parent[0] = '\0';
+        if (sscanf(p + 5, " %255[A-Za-z0-9_] : %255[A-Za-z0-9_]", name, parent) < 1)
+            continue;
+        if (sb_find_class(name))
+            continue;
+        classes = sb_realloc(classes, (class_count + 1) * sizeof(sb_class));
+        classes[class_count].name = sb_strdup(name);
+        classes[class_count].parent = parent[0] ? sb_strdup(parent) : NULL;
+        class_count++;
+    }
+    fclose(f);
+}
+
+static void sb_read_schema(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[4096];
+    if (d == NULL) {
+        fprintf(stderr, "stub broker: cannot read the MOFs in %s\n", dir);
+        return;
+    }
+    while ((entry = readdir(d))) {
+        size_t len = strlen(entry->d_name);
+        if (len > 4 && strcasecmp(entry->d_name + len - 4, ".mof") == 0) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            sb_read_mof(path);
+        }
+    }
+    closedir(d);
+}
+
+/******************************************************************************
+ * Provider registrations, from the .regs file
+ *   Classname Namespace ProviderName ProviderModule ProviderTypes...
+ *****************************************************************************/
+typedef struct {
+    char *name;
+    char *module;
+    void *dl;
+    CMPIInstanceMI *instance_mi;
+    CMPIAssociationMI *association_mi;
+    CMPIMethodMI *method_mi;
+} sb_provider;
+
+typedef struct {
+    char *classname;
+    sb_provider *provider;
+    bool instance;
+    bool association;
+    bool method;
+} sb_registration;
+
+static sb_provider *providers = NULL;
+static int provider_count = 0;
+static sb_registration *registrations = NULL;
+static int registration_count = 0;
+static char *provider_libdir = NULL;
+static CMPIContext *provider_context = NULL;
+static pthread_mutex_t provider_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long indications = 0;
+
+static sb_provider *sb_get_provider(const char *name, const char *module)
+{
+    int i;
+    for (i = 0; i < provider_count; i++)
+        if (strcmp(providers[i].name, name) == 0)
+            return &providers[i];
+    return NULL;
+}
+
+static int sb_read_regs(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    int i;
+    if (f == NULL) {
+        fprintf(stderr, "stub broker: cannot read %s\n", path);
+        return 0;
+    }
+    /* two passes, so the provider array doesn't move under the registrations */
+    while (fgets(line, sizeof(line), f)) {
+        char cn[256], ns[256], name[256], module[256];
+        if (line[0] == '#' || sscanf(line, "%255s %255s %255s %255s", cn, ns, name, module) != 4)
+            continue;
+        if (sb_get_provider(name, module))
+            continue;
+        providers = sb_realloc(providers, (provider_count + 1) * sizeof(sb_provider));
+        memset(&providers[provider_count], 0, sizeof(sb_provider));
+        providers[provider_count].name = sb_strdup(name);
+        providers[provider_count].module = sb_strdup(module);
+        provider_count++;
+    }
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        char cn[256], ns[256], name[256], module[256];
+        int n = 0;
+        if (line[0] == '#' || sscanf(line, "%255s %255s %255s %255s%n", cn, ns, name, module, &n) != 4)
+            continue;
+        registrations = sb_realloc(registrations, (registration_count + 1) * sizeof(sb_registration));
+        sb_registration *reg = &registrations[registration_count++];
+        memset(reg, 0, sizeof(*reg));
+        reg->classname = sb_strdup(cn);
+        reg->provider = sb_get_provider(name, module);
+        reg->instance = (strstr(line + n, "instance") != NULL);
+        reg->association = (strstr(line + n, "association") != NULL);
+        reg->method = (strstr(line + n, "method") != NULL);
+        /* association providers serve the instances of their class as well */
+        if (reg->association)
+            reg->instance = true;
+    }
+    fclose(f);
+    for (i = 0; i < registration_count; i++)
+        if (sb_find_class(registrations[i].classname) == NULL)
+            fprintf(stderr, "stub broker: no MOF for %s\n", registrations[i].classname);
+    return 1;
+}
+
+static const sb_registration *sb_find_registration(const char *classname)
+{
+    int i;
+    for (i = 0; i < registration_count; i++)
+        if (strcasecmp(registrations[i].classname, classname) == 0)
+            return &registrations[i];
+    return NULL;
+}
+
+static void *sb_provider_entry(sb_provider *p, const char *type)
+{
+    char path[4096], symbol[512];
+    if (p->dl == NULL) {
+        snprintf(path, sizeof(path), "%s/lib%s.so", provider_libdir, p->module);
+        p->dl = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+        if (p->dl == NULL) {
+            fprintf(stderr, "stub broker: %s\n", dlerror());
+            return NULL;
+        }
+    }
+    snprintf(symbol, sizeof(symbol), "%s_Create_%sMI", p->name, type);
+    return dlsym(p->dl, symbol);
+}
+
+typedef CMPIInstanceMI *(*sb_create_instance_mi)(const CMPIBroker *, const CMPIContext *, CMPIStatus *);
+typedef CMPIAssociationMI *(*sb_create_association_mi)(const CMPIBroker *, const CMPIContext *, CMPIStatus *);
+typedef CMPIMethodMI *(*sb_create_method_mi)(const CMPIBroker *, const CMPIContext *, CMPIStatus *);
+
+CMPIInstanceMI *stub_broker_instance_mi(const char *classname)
+{
+    const sb_registration *reg = sb_find_registration(classname);
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    if (reg == NULL || !reg->instance)
+        return NULL;
+    pthread_mutex_lock(&provider_lock);
+    if (reg->provider->instance_mi == NULL) {
+        sb_create_instance_mi create = (sb_create_instance_mi)sb_provider_entry(reg->provider, "Instance");
+        if (create)
+            reg->provider->instance_mi = create(stub_broker(), provider_context, &status);
+    }
+    pthread_mutex_unlock(&provider_lock);
+    return reg->provider->instance_mi;
+}
+
+CMPIAssociationMI *stub_broker_association_mi(const char *classname)
+{
+    const sb_registration *reg = sb_find_registration(classname);
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    if (reg == NULL || !reg->association)
+        return NULL;
+    pthread_mutex_lock(&provider_lock);
+    if (reg->provider->association_mi == NULL) {
+        sb_create_association_mi create = (sb_create_association_mi)sb_provider_entry(reg->provider, "Association");
+        if (create)
+            reg->provider->association_mi = create(stub_broker(), provider_context, &status);
+    }
+    pthread_mutex_unlock(&provider_lock);
+    return reg->provider->association_mi;
+}
+
+CMPIMethodMI *stub_broker_method_mi(const char *classname)
+{
+    const sb_registration *reg = sb_find_registration(classname);
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    if (reg == NULL || !reg->method)
+        return NULL;
+    pthread_mutex_lock(&provider_lock);
+    if (reg->provider->method_mi == NULL) {
+        sb_create_method_mi create = (sb_create_method_mi)sb_provider_entry(reg->provider, "Method");
+        if (create)
+            reg->provider->method_mi = create(stub_broker(), provider_context, &status);
+    }
+    pthread_mutex_unlock(&provider_lock);
+    return reg->provider->method_mi;
+}
+
+unsigned long stub_broker_indications()
+{
+    return __atomic_load_n(&indications, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * Broker up-calls, routed to the providers of the class and its subclasses
+ *****************************************************************************/
+static const char *sb_classname(const CMPIObjectPath *op)
+{
+    return ((sb_objectpath *)op->hdl)->cn;
+}
+
+/* The same path, for a subclass of the one asked for */
+static CMPIObjectPath *sb_path_for(const CMPIObjectPath *op, const char *cn)
+{
+    CMPIObjectPath *path = CMClone(op, NULL);
+    CMSetClassName(path, cn);
+    return path;
+}
+
+static CMPIEnumeration *sb_enum_instances(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char **properties, bool names, CMPIStatus *rc)
+{
+    CMPIResult *result = stub_broker_result();
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    int i;
+
+    for (i = 0; i < registration_count; i++) {
+        const sb_registration *reg = &registrations[i];
+        if (!reg->instance || reg->association || !sb_class_is_a(reg->classname, sb_classname(op)))
+            continue;
+        CMPIInstanceMI *mi = stub_broker_instance_mi(reg->classname);
+        if (mi == NULL)
+            continue;
+        CMPIObjectPath *path = sb_path_for(op, reg->classname);
+        if (names)
+            status = mi->ft->enumerateInstanceNames(mi, ctx, result, path);
+        else
+            status = mi->ft->enumerateInstances(mi, ctx, result, path, properties);
+        if (status.rc != CMPI_RC_OK && status.rc != CMPI_RC_ERR_NOT_FOUND)
+            break;
+        status.rc = CMPI_RC_OK;
+    }
+    if (rc)
+        *rc = status;
+    return sb_new_enumeration(result);
+}
+
+static CMPIEnumeration *sb_mb_enumerate_instance_names(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, CMPIStatus *rc)
+{
+    return sb_enum_instances(mb, ctx, op, NULL, true, rc);
+}
+
+static CMPIEnumeration *sb_mb_enumerate_instances(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char **properties, CMPIStatus *rc)
+{
+    return sb_enum_instances(mb, ctx, op, properties, false, rc);
+}
+
+static CMPIInstance *sb_mb_get_instance(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char **properties, CMPIStatus *rc)
+{
+    CMPIInstanceMI *mi = stub_broker_instance_mi(sb_classname(op));
+    CMPIResult *result = stub_broker_result();
+    CMPIStatus status = {CMPI_RC_ERR_INVALID_CLASS, NULL};
+    if (mi)
+        status = mi->ft->getInstance(mi, ctx, result, op, properties);
+    if (rc)
+        *rc = status;
+    if (status.rc != CMPI_RC_OK || stub_broker_result_count(result) == 0)
+        return NULL;
+    return stub_broker_result_at(result, 0).value.inst;
+}
+
+static CMPIObjectPath *sb_mb_create_instance(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const CMPIInstance *inst, CMPIStatus *rc)
+{
+    CMPIInstanceMI *mi = stub_broker_instance_mi(sb_classname(op));
+    CMPIResult *result = stub_broker_result();
+    CMPIStatus status = {CMPI_RC_ERR_INVALID_CLASS, NULL};
+    if (mi)
+        status = mi->ft->createInstance(mi, ctx, result, op, inst);
+    if (rc)
+        *rc = status;
+    if (status.rc != CMPI_RC_OK || stub_broker_result_count(result) == 0)
+        return NULL;
+    return stub_broker_result_at(result, 0).value.ref;
+}
+
+static CMPIStatus sb_mb_modify_instance(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const CMPIInstance *inst, const char **properties)
+{
+    CMPIInstanceMI *mi = stub_broker_instance_mi(sb_classname(op));
+    if (mi == NULL)
+        SB_RETURN(CMPI_RC_ERR_INVALID_CLASS);
+    return mi->ft->modifyInstance(mi, ctx, stub_broker_result(), op, inst, properties);
+}
+
+static CMPIStatus sb_mb_delete_instance(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op)
+{
+    CMPIInstanceMI *mi = stub_broker_instance_mi(sb_classname(op));
+    if (mi == NULL)
+        SB_RETURN(CMPI_RC_ERR_INVALID_CLASS);
+    return mi->ft->deleteInstance(mi, ctx, stub_broker_result(), op);
+}
+
+static CMPIEnumeration *sb_mb_exec_query(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char *query, const char *lang, CMPIStatus *rc)
+{
+    CMPIResult *result = stub_broker_result();
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    int i;
+
+    for (i = 0; i < registration_count; i++) {
+        const sb_registration *reg = &registrations[i];
+        if (!reg->instance || reg->association || !sb_class_is_a(reg->classname, sb_classname(op)))
+            continue;
+        CMPIInstanceMI *mi = stub_broker_instance_mi(reg->classname);
+        if (mi == NULL)
+            continue;
+        status = mi->ft->execQuery(mi, ctx, result, sb_path_for(op, reg->classname), query, lang);
+        if (status.rc != CMPI_RC_OK && status.rc != CMPI_RC_ERR_NOT_FOUND)
+            break;
+        status.rc = CMPI_RC_OK;
+    }
+    if (rc)
+        *rc = status;
+    return sb_new_enumeration(result);
+}
+
+typedef enum { sb_assoc_associators, sb_assoc_associator_names, sb_assoc_references, sb_assoc_reference_names } sb_assoc_op;
+
+/* Asks every association provider when no association class is given */
+static CMPIEnumeration *sb_assoc_call(const CMPIContext *ctx, const CMPIObjectPath *op, sb_assoc_op which,
+    const char *assoc_class, const char *result_class, const char *role, const char *result_role,
+    const char **properties, CMPIStatus *rc)
+{
+    CMPIResult *result = stub_broker_result();
+    CMPIStatus status = {CMPI_RC_OK, NULL};
+    int i;
+
+    for (i = 0; i < registration_count; i++) {
+        const sb_registration *reg = &registrations[i];
+        if (!reg->association || (assoc_class && !sb_class_is_a(reg->classname, assoc_class)))
+            continue;
+        CMPIAssociationMI *mi = stub_broker_association_mi(reg->classname);
+        if (mi == NULL)
+            continue;
+        switch (which) {
+        case sb_assoc_associators:
+            status = mi->ft->associators(mi, ctx, result, op, reg->classname, result_class, role, result_role, properties);
+            break;
+        case sb_assoc_associator_names:
+            status = mi->ft->associatorNames(mi, ctx, result, op, reg->classname, result_class, role, result_role);
+            break;
+        case sb_assoc_references:
+            status = mi->ft->references(mi, ctx, result, op, reg->classname, role, properties);
+            break;
+        case sb_assoc_reference_names:
+            status = mi->ft->referenceNames(mi, ctx, result, op, reg->classname, role);
+            break;
+        }
+        if (status.rc != CMPI_RC_OK && status.rc != CMPI_RC_ERR_NOT_FOUND)
+            break;
+        status.rc = CMPI_RC_OK;
+    }
+    if (rc)
+        *rc = status;
+    return sb_new_enumeration(result);
+}
+
+static CMPIEnumeration *sb_mb_associators(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char *assoc_class, const char *result_class,
+    const char *role, const char *result_role, const char **properties, CMPIStatus *rc)
+{
+    return sb_assoc_call(ctx, op, sb_assoc_associators, assoc_class, result_class, role, result_role, properties, rc);
+}
+
+static CMPIEnumeration *sb_mb_associator_names(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char *assoc_class, const char *result_class,
+    const char *role, const char *result_role, CMPIStatus *rc)
+{
+    return sb_assoc_call(ctx, op, sb_assoc_associator_names, assoc_class, result_class, role, result_role, NULL, rc);
+}
+
+static CMPIEnumeration *sb_mb_references(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char *result_class, const char *role,
+    const char **properties, CMPIStatus *rc)
+{
+    return sb_assoc_call(ctx, op, sb_assoc_references, result_class, NULL, role, NULL, properties, rc);
+}
+
+static CMPIEnumeration *sb_mb_reference_names(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char *result_class, const char *role, CMPIStatus *rc)
+{
+    return sb_assoc_call(ctx, op, sb_assoc_reference_names, result_class, NULL, role, NULL, NULL, rc);
+}
+
+static CMPIData sb_mb_invoke_method(const CMPIBroker *mb, const CMPIContext *ctx,
+    const CMPIObjectPath *op, const char *method, const CMPIArgs *in, CMPIArgs *out, CMPIStatus *rc)
+{
+    CMPIMethodMI *mi = stub_broker_method_mi(sb_classname(op));
+    CMPIResult *result = stub_broker_result();
+    CMPIStatus status = {CMPI_RC_ERR_INVALID_CLASS, NULL};
+    if (mi)
+        status = mi->ft->invokeMethod(mi, ctx, result, op, method, in, out);
+    if (rc)
+        *rc = status;
+    return stub_broker_result_at(result, 0);
+}
+
+static CMPIContext *sb_mb_prepare_attach_thread(const CMPIBroker *mb, const CMPIContext *ctx)
+{
+    /* outlives the call that made it, freed by detachThread() */
+    return sb_context_copy(ctx, false);
+}
+
+static CMPIStatus sb_mb_attach_thread(const CMPIBroker *mb, const CMPIContext *ctx)
+{
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static void sb_context_free(CMPIContext *ctx)
+{
+    sb_context *c = (sb_context *)ctx->hdl;
+    CMPICount n;
+    for (n = 0; n < c->entries.count; n++)
+        if (c->entries.values[n].type == CMPI_string && !(c->entries.values[n].state & CMPI_nullValue))
+            sb_obj_free(sb_obj_of(c->entries.values[n].value.string));
+    sb_obj_free(&c->obj);
+}
+
+static CMPIStatus sb_mb_detach_thread(const CMPIBroker *mb, const CMPIContext *ctx)
+{
+    stub_broker_release_all();
+    sb_context_free((CMPIContext *)ctx);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIStatus sb_mb_deliver_indication(const CMPIBroker *mb, const CMPIContext *ctx,
+    const char *ns, const CMPIInstance *ind)
+{
+    __atomic_add_fetch(&indications, 1, __ATOMIC_RELAXED);
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIBrokerFT sb_broker_ft = {
+    .brokerCapabilities = 0,
+    .brokerVersion = CMPICurrentVersion,
+    .brokerName = "xs-cim stub broker",
+    .prepareAttachThread = sb_mb_prepare_attach_thread,
+    .attachThread = sb_mb_attach_thread,
+    .detachThread = sb_mb_detach_thread,
+    .deliverIndication = sb_mb_deliver_indication,
+    .enumerateInstanceNames = sb_mb_enumerate_instance_names,
+    .getInstance = sb_mb_get_instance,
+    .createInstance = sb_mb_create_instance,
+    .modifyInstance = sb_mb_modify_instance,
+    .deleteInstance = sb_mb_delete_instance,
+    .execQuery = sb_mb_exec_query,
+    .enumerateInstances = sb_mb_enumerate_instances,
+    .associators = sb_mb_associators,
+    .associatorNames = sb_mb_associator_names,
+    .references = sb_mb_references,
+    .referenceNames = sb_mb_reference_names,
+    .invokeMethod = sb_mb_invoke_method,
+};
+
+/******************************************************************************
+ * Broker encapsulated data type factory
+ *****************************************************************************/
+static CMPIInstance *sb_mb_new_instance(const CMPIBroker *mb, const CMPIObjectPath *op, CMPIStatus *rc)
+{
+    CMPIInstance *inst = sb_new_instance(((sb_objectpath *)op->hdl)->ns, sb_classname(op));
+    sb_instance_set_objectpath(inst, op);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return inst;
+}
+
+static CMPIObjectPath *sb_mb_new_objectpath(const CMPIBroker *mb, const char *ns, const char *cn, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_objectpath(ns, cn);
+}
+
+static CMPIArgs *sb_mb_new_args(const CMPIBroker *mb, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_args();
+}
+
+static CMPIString *sb_mb_new_string(const CMPIBroker *mb, const char *str, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(str, true);
+}
+
+static CMPIArray *sb_mb_new_array(const CMPIBroker *mb, CMPICount size, CMPIType type, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_array(size, type);
+}
+
+static CMPIDateTime *sb_mb_new_datetime(const CMPIBroker *mb, CMPIStatus *rc)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_datetime((CMPIUint64)tv.tv_sec * 1000000 + tv.tv_usec, 0);
+}
+
+static CMPIDateTime *sb_mb_new_datetime_from_binary(const CMPIBroker *mb, CMPIUint64 time,
+    CMPIBoolean interval, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_datetime(time, interval);
+}
+
+/* yyyymmddhhmmss.mmmmmmsutc, or ddddddddhhmmss.mmmmmm:000 for intervals */
+static CMPIDateTime *sb_mb_new_datetime_from_chars(const CMPIBroker *mb, const char *str, CMPIStatus *rc)
+{
+    unsigned long long days;
+    struct tm tm;
+    unsigned int usecs = 0;
+
+    memset(&tm, 0, sizeof(tm));
+    if (str == NULL || strlen(str) != 25) {
+        SB_SET_RC(rc, CMPI_RC_ERR_INVALID_PARAMETER);
+        return NULL;
+    }
+    SB_SET_RC(rc, CMPI_RC_OK);
+    if (str[21] == ':') {
+        sscanf(str, "%8llu%2d%2d%2d.%6u", &days, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &usecs);
+        return sb_new_datetime((((days * 24 + tm.tm_hour) * 60 + tm.tm_min) * 60 + tm.tm_sec) * 1000000ULL + usecs, 1);
+    }
+    sscanf(str, "%4d%2d%2d%2d%2d%2d.%6u", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+           &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &usecs);
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    int offset = atoi(str + 22) * ((str[21] == '-') ? -1 : 1);
+    CMPIUint64 secs = (CMPIUint64)(timegm(&tm) - offset * 60);
+    return sb_new_datetime(secs * 1000000ULL + usecs, 0);
+}
+
+static CMPISelectExp *sb_mb_new_selectexp(const CMPIBroker *mb, const char *query, const char *lang,
+    CMPIArray **projection, CMPIStatus *rc)
+{
+    if (projection)
+        *projection = NULL;
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_selectexp(query);
+}
+
+static CMPIBoolean sb_mb_class_path_is_a(const CMPIBroker *mb, const CMPIObjectPath *op,
+    const char *type, CMPIStatus *rc)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_class_is_a(sb_classname(op), type);
+}
+
+static CMPIString *sb_mb_to_string(const CMPIBroker *mb, const void *object, CMPIStatus *rc)
+{
+    sb_obj *obj = sb_obj_of(object);
+    char buf[64];
+    if (obj && obj->type == sb_type_objectpath)
+        return sb_objectpath_to_string(object, rc);
+    if (obj && obj->type == sb_type_instance)
+        return sb_objectpath_to_string(sb_instance_get_objectpath(object, NULL), rc);
+    if (obj && obj->type == sb_type_string)
+        return sb_string_clone(object, rc);
+    snprintf(buf, sizeof(buf), "%s@%p", obj ? sb_type_names[obj->type] : "NULL", object);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(buf, true);
+}
+
+static CMPIBoolean sb_mb_is_of_type(const CMPIBroker *mb, const void *object, const char *type, CMPIStatus *rc)
+{
+    sb_obj *obj = sb_obj_of(object);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return obj && strcmp(sb_type_names[obj->type], type) == 0;
+}
+
+static CMPIString *sb_mb_get_type(const CMPIBroker *mb, const void *object, CMPIStatus *rc)
+{
+    sb_obj *obj = sb_obj_of(object);
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(obj ? sb_type_names[obj->type] : "", true);
+}
+
+static CMPIString *sb_mb_get_message(const CMPIBroker *mb, const char *id, const char *def,
+    CMPIStatus *rc, CMPICount count, ...)
+{
+    SB_SET_RC(rc, CMPI_RC_OK);
+    return sb_new_string(def, true);
+}
+
+static CMPIStatus sb_mb_log_message(const CMPIBroker *mb, int severity, const char *id,
+    const char *text, const CMPIString *string)
+{
+    if (getenv("STUB_BROKER_VERBOSE"))
+        fprintf(stderr, "log %d %s: %s\n", severity, id ? id : "", text ? text : CMGetCharPtr(string));
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIStatus sb_mb_trace(const CMPIBroker *mb, int level, const char *component,
+    const char *text, const CMPIString *string)
+{
+    if (getenv("STUB_BROKER_VERBOSE"))
+        fprintf(stderr, "trace %d %s: %s\n", level, component ? component : "", text ? text : CMGetCharPtr(string));
+    SB_RETURN(CMPI_RC_OK);
+}
+
+static CMPIBrokerEncFT sb_broker_enc_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .newInstance = sb_mb_new_instance,
+    .newObjectPath = sb_mb_new_objectpath,
+    .newArgs = sb_mb_new_args,
+    .newString = sb_mb_new_string,
+    .newArray = sb_mb_new_array,
+    .newDateTime = sb_mb_new_datetime,
+    .newDateTimeFromBinary = sb_mb_new_datetime_from_binary,
+    .newDateTimeFromChars = sb_mb_new_datetime_from_chars,
+    .newSelectExp = sb_mb_new_selectexp,
+    .classPathIsA = sb_mb_class_path_is_a,
+    .toString = sb_mb_to_string,
+    .isOfType = sb_mb_is_of_type,
+    .getType = sb_mb_get_type,
+    .getMessage = sb_mb_get_message,
+    .logMessage = sb_mb_log_message,
+    .trace = sb_mb_trace,
+};
+
+/******************************************************************************
+ * Broker extension functions, plain pthreads
+ *****************************************************************************/
+typedef struct {
+    CMPI_THREAD_RETURN (CMPI_THREAD_CDECL *start)(void *);
+    void *parm;
+} sb_thread_start;
+
+static void *sb_thread_main(void *arg)
+{
+    sb_thread_start start = *(sb_thread_start *)arg;
+    sb_free(arg);
+    return (void *)start.start(start.parm);
+}
+
+static CMPI_THREAD_TYPE sb_new_thread(CMPI_THREAD_RETURN (CMPI_THREAD_CDECL *start)(void *), void *parm, int detached)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    sb_thread_start *arg = sb_calloc(1, sizeof(sb_thread_start));
+    arg->start = start;
+    arg->parm = parm;
+    pthread_attr_init(&attr);
+    if (detached)
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, sb_thread_main, arg) != 0) {
+        sb_free(arg);
+        thread = 0;
+    }
+    pthread_attr_destroy(&attr);
+    return (CMPI_THREAD_TYPE)thread;
+}
+
+static int sb_join_thread(CMPI_THREAD_TYPE thread, CMPI_THREAD_RETURN *retval)
+{
+    return pthread_join((pthread_t)thread, (void **)retval);
+}
+
+static int sb_exit_thread(CMPI_THREAD_RETURN retval)
+{
+    pthread_exit((void *)retval);
+    return 0;
+}
+
+static int sb_cancel_thread(CMPI_THREAD_TYPE thread)
+{
+    return pthread_cancel((pthread_t)thread);
+}
+
+static int sb_thread_sleep(CMPIUint32 msec)
+{
+    return usleep(msec * 1000);
+}
+
+static pthread_mutex_t once_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sb_thread_once(int *once, void (*init)(void))
+{
+    pthread_mutex_lock(&once_lock);
+    if (*once == 0) {
+        init();
+        *once = 1;
+    }
+    pthread_mutex_unlock(&once_lock);
+    return 0;
+}
+
+static int sb_create_thread_key(CMPI_THREAD_KEY_TYPE *key, void (*cleanup)(void *))
+{
+    return pthread_key_create(key, cleanup);
+}
+
+static int sb_destroy_thread_key(CMPI_THREAD_KEY_TYPE key)
+{
+    return pthread_key_delete(key);
+}
+
+static void *sb_get_thread_specific(CMPI_THREAD_KEY_TYPE key)
+{
+    return pthread_getspecific(key);
+}
+
+static int sb_set_thread_specific(CMPI_THREAD_KEY_TYPE key, void *value)
+{
+    return pthread_setspecific(key, value);
+}
+
+static CMPI_MUTEX_TYPE sb_new_mutex(int opt)
+{
+    pthread_mutex_t *mutex = sb_calloc(1, sizeof(pthread_mutex_t));
+    pthread_mutex_init(mutex, NULL);
+    return (CMPI_MUTEX_TYPE)mutex;
+}
+
+static void sb_destroy_mutex(CMPI_MUTEX_TYPE mutex)
+{
+    pthread_mutex_destroy((pthread_mutex_t *)mutex);
+    sb_free(mutex);
+}
+
+static void sb_lock_mutex(CMPI_MUTEX_TYPE mutex)
+{
+    pthread_mutex_lock((pthread_mutex_t *)mutex);
+}
+
+static void sb_unlock_mutex(CMPI_MUTEX_TYPE mutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+
+static CMPI_COND_TYPE sb_new_condition(int opt)
+{
+    pthread_cond_t *cond = sb_calloc(1, sizeof(pthread_cond_t));
+    pthread_cond_init(cond, NULL);
+    return (CMPI_COND_TYPE)cond;
+}
+
+static void sb_destroy_condition(CMPI_COND_TYPE cond)
+{
+    pthread_cond_destroy((pthread_cond_t *)cond);
+    sb_free(cond);
+}
+
+static int sb_cond_wait(CMPI_COND_TYPE cond, CMPI_MUTEX_TYPE mutex)
+{
+    return pthread_cond_wait((pthread_cond_t *)cond, (pthread_mutex_t *)mutex);
+}
+
+static int sb_timed_cond_wait(CMPI_COND_TYPE cond, CMPI_MUTEX_TYPE mutex, struct timespec *wait)
+{
+    return pthread_cond_timedwait((pthread_cond_t *)cond, (pthread_mutex_t *)mutex, wait);
+}
+
+static int sb_signal_condition(CMPI_COND_TYPE cond)
+{
+    return pthread_cond_signal((pthread_cond_t *)cond);
+}
+
+static CMPIBrokerExtFT sb_broker_ext_ft = {
+    .ftVersion = CMPICurrentVersion,
+    .newThread = sb_new_thread,
+    .joinThread = sb_join_thread,
+    .exitThread = sb_exit_thread,
+    .cancelThread = sb_cancel_thread,
+    .threadSleep = sb_thread_sleep,
+    .threadOnce = sb_thread_once,
+    .createThreadKey = sb_create_thread_key,
+    .destroyThreadKey = sb_destroy_thread_key,
+    .getThreadSpecific = sb_get_thread_specific,
+    .setThreadSpecific = sb_set_thread_specific,
+    .newMutex = sb_new_mutex,
+    .destroyMutex = sb_destroy_mutex,
+    .lockMutex = sb_lock_mutex,
+    .unlockMutex = sb_unlock_mutex,
+    .newCondition = sb_new_condition,
+    .destroyCondition = sb_destroy_condition,
+    .condWait = sb_cond_wait,
+    .timedCondWait = sb_timed_cond_wait,
+    .signalCondition = sb_signal_condition,
+};
+
+static CMPIBroker sb_broker = {
+    .hdl = NULL,
+    .bft = &sb_broker_ft,
+    .eft = &sb_broker_enc_ft,
+    .xft = &sb_broker_ext_ft,
+};
+
+const CMPIBroker *stub_broker()
+{
+    return &sb_broker;
+}
+
+/******************************************************************************
+ * Setup and teardown
+ *****************************************************************************/
+int stub_broker_init(
+    const char *libdir,
+    const char *regs_file,
+    const char *schema_dir)
+{
+    provider_libdir = sb_strdup(libdir);
+    sb_read_schema(schema_dir);
+    if (!sb_read_regs(regs_file))
+        return 0;
+    provider_context = stub_broker_context("", "");
+    return 1;
+}
+
+void stub_broker_cleanup()
+{
+    int i;
+    CMPIContext *ctx = stub_broker_context("", "");
+
+    for (i = 0; i < provider_count; i++) {
+        sb_provider *p = &providers[i];
+        if (p->instance_mi)
+            p->instance_mi->ft->cleanup(p->instance_mi, ctx, 1);
+        if (p->association_mi)
+            p->association_mi->ft->cleanup(p->association_mi, ctx, 1);
+        if (p->method_mi)
+            p->method_mi->ft->cleanup(p->method_mi, ctx, 1);
+        /* the modules stay loaded, the providers may have threads still winding down */
+        sb_free(p->name);
+        sb_free(p->module);
+    }
+    stub_broker_release_all();
+    sb_context_free(ctx);
+    sb_context_free(provider_context);
+    for (i = 0; i < registration_count; i++)
+        sb_free(registrations[i].classname);
+    for (i = 0; i < class_count; i++) {
+        sb_free(classes[i].name);
+        sb_free(classes[i].parent);
+    }
+    sb_free(registrations);
+    sb_free(providers);
+    sb_free(classes);
+    sb_free(provider_libdir);
+    registrations = NULL;
+    providers = NULL;
+    classes = NULL;
+    registration_count = provider_count = class_count = 0;
+}
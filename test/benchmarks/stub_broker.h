@@ -0,0 +1,68 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef __STUB_BROKER_H__
+#define __STUB_BROKER_H__
+
+#include <cmpidt.h>
+#include <cmpift.h>
+
+/*
+ * Just enough of a CIMOM to load the providers and call into them without
+ * one. Providers are found through the .regs file and loaded from their
+ * modules with dlopen(), the same way a CIMOM would, and the calls they
+ * make back into the broker (CBEnumInstanceNames() and friends from the
+ * association providers) are routed to the registered providers, including
+ * the ones for subclasses. The class hierarchy comes from the class
+ * declarations in the MOFs.
+ *
+ * Everything the broker hands out lives until stub_broker_release_all() is
+ * called on the same thread, like a CIMOM releasing the objects of a call
+ * once it is done. Clones of instances are the exception, they live until
+ * the provider releases them. The broker allocates with the __libc_*
+ * functions so that its own memory doesn't show up if the caller counts
+ * allocations.
+ */
+#define STUB_BROKER_NAMESPACE "root/cimv2"
+
+int stub_broker_init(
+    const char *libdir,             /* where the provider modules are */
+    const char *regs_file,          /* Xen_DefaultNamespace.regs */
+    const char *schema_dir);        /* the MOFs, for the class hierarchy */
+void stub_broker_cleanup();
+
+const CMPIBroker *stub_broker();
+CMPIContext *stub_broker_context(const char *user, const char *password);
+void stub_broker_release_all();
+
+/* The provider registered for a class, NULL if there is none */
+CMPIInstanceMI *stub_broker_instance_mi(const char *classname);
+CMPIAssociationMI *stub_broker_association_mi(const char *classname);
+CMPIMethodMI *stub_broker_method_mi(const char *classname);
+
+/* What a provider returned through a CMPIResult */
+CMPIResult *stub_broker_result();
+CMPICount stub_broker_result_count(const CMPIResult *result);
+CMPIData stub_broker_result_at(const CMPIResult *result, CMPICount index);
+
+/* Turns "name=value,name:u16=value" into method arguments, strings unless
+ * typed with one of u8, u16, u32, u64, s32, s64 or bool */
+CMPIArgs *stub_broker_args(const char *str);
+
+/* Number of indications delivered so far */
+unsigned long stub_broker_indications();
+
+#endif /*__STUB_BROKER_H__*/
@@ -0,0 +1,83 @@
+// Copyright (C) 2008-2009 Citrix Systems Inc
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+/*
+ * Trace throughput benchmark.
+ * Runs a number of threads that each log a burst of messages shaped like
+ * the ones the providers log per instance, and reports the number of
+ * messages per second seen by the callers.
+ *
+ * usage: trace_bench [threads] [messages per thread]
+ *
+ * The usual trace environment applies, for example
+ *   SBLIM_TRACE=3 SBLIM_TRACE_FILE=/tmp/trace.log ./trace_bench 8 100000
+ *   SBLIM_TRACE=3 SBLIM_TRACE_FILE=/tmp/trace.log SBLIM_TRACE_SYNC=1 ./trace_bench 8 100000
+ *   SBLIM_TRACE=2 ./trace_bench 8 100000    (level check only, nothing formatted)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "cmpitrace.h"
+
+static int messages = 100000;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *bench_thread(void *arg)
+{
+    long id = (long)arg;
+    int i;
+    for (i = 0; i < messages; i++) {
+        _SBLIM_TRACE(_SBLIM_TRACE_LEVEL_INFO,
+                     ("--- thread %ld: Setting properties for Xen_ComputerSystem instance %d (%s)",
+                      id, i, "OpaqueRef:5b4ea3a5-0d7a-4c6e-8e2c-bb01b7a5b9d1"));
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = 4, i;
+    if (argc > 1)
+        threads = atoi(argv[1]);
+    if (argc > 2)
+        messages = atoi(argv[2]);
+    if (threads <= 0 || messages <= 0) {
+        fprintf(stderr, "usage: %s [threads] [messages per thread]\n", argv[0]);
+        return 1;
+    }
+
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    double start = now();
+    for (i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, bench_thread, (void *)(long)i);
+    for (i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    double elapsed = now() - start;
+
+    long total = (long)threads * messages;
+    printf("%d threads, %ld messages in %.3fs: %.0f messages/s, %.0f ns/message\n",
+           threads, total, elapsed, total / elapsed, elapsed * 1e9 / total);
+    free(tids);
+    return 0;
+}
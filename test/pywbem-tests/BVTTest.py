@@ -520,6 +520,65 @@ class BVTTest(TestSetUp):
             result = 1
         self.TestEnd(result)
 
+    def query_ComputerSystem(self):
+        # The key and simple equalities of a query are looked up in xapi
+        # rather than checked on every VM, the results must be the same
+        self.TestBegin()
+        result = 1
+        vms = self.conn.EnumerateInstances("Xen_ComputerSystem")
+        for vm in vms[:3]:
+            query_str = "SELECT * FROM Xen_ComputerSystem WHERE Name = '%s'" % vm["Name"]
+            found = self.conn.ExecQuery("WQL", query_str, "root/cimv2")
+            if len(found) != 1 or found[0]["Name"] != vm["Name"]:
+                print 'Query by key for %s returned %d VMs' % (vm["Name"], len(found))
+                result = 0
+            query_str = "SELECT * FROM Xen_ComputerSystem WHERE ElementName = '%s' AND EnabledState = %d" % \
+                        (vm["ElementName"].replace("'", "''"), vm["EnabledState"])
+            found = self.conn.ExecQuery("WQL", query_str, "root/cimv2")
+            expected = [v["Name"] for v in vms if v["ElementName"] == vm["ElementName"] and
+                        v["EnabledState"] == vm["EnabledState"]]
+            if sorted([v["Name"] for v in found]) != sorted(expected):
+                print 'Query by name and state for %s returned %d VMs, expected %d' % \
+                      (vm["ElementName"], len(found), len(expected))
+                result = 0
+        query_str = "SELECT * FROM Xen_ComputerSystem WHERE Name = 'no-such-vm'"
+        if len(self.conn.ExecQuery("WQL", query_str, "root/cimv2")) != 0:
+            print 'Query for a VM that does not exist returned something'
+            result = 0
+        # a template is no Xen_ComputerSystem, even looked up by its uuid
+        templates = self.conn.EnumerateInstanceNames("Xen_ComputerSystemTemplate")
+        for template in templates[:1]:
+            query_str = "SELECT * FROM Xen_ComputerSystem WHERE Name = '%s'" % \
+                        template["InstanceID"].split(':', 1)[-1]
+            if len(self.conn.ExecQuery("WQL", query_str, "root/cimv2")) != 0:
+                print 'Query by key for template %s returned a VM' % template["InstanceID"]
+                result = 0
+        self.TestEnd(result)
+
+    def query_DiskImage_by_pool(self):
+        # The disk images of a pool are looked up in just that SR, by a query
+        # on PoolID and through the pool's Xen_StoragePoolComponent, the
+        # results must be those of the whole enumeration
+        self.TestBegin()
+        result = 1
+        disks = self.conn.EnumerateInstanceNames("Xen_DiskImage")
+        pools = self.conn.EnumerateInstanceNames("Xen_StoragePool")
+        for pool in pools:
+            pool_id = self.conn.GetInstance(pool)["PoolID"]
+            expected = sorted([d["DeviceID"] for d in disks if d["SystemName"] == pool_id])
+            query_str = "SELECT * FROM Xen_DiskImage WHERE PoolID = '%s'" % pool_id
+            found = sorted([d["DeviceID"] for d in self.conn.ExecQuery("WQL", query_str, "root/cimv2")])
+            if found != expected:
+                print 'Query on PoolID %s returned %d disk images, expected %d' % (pool_id, len(found), len(expected))
+                result = 0
+            assoc = self.conn.AssociatorNames(pool, AssocClass="Xen_StoragePoolComponent", ResultClass="Xen_DiskImage")
+            found = sorted([d["DeviceID"] for d in assoc])
+            if found != expected:
+                print 'Pool %s has %d disk images through Xen_StoragePoolComponent, expected %d' % \
+                      (pool_id, len(found), len(expected))
+                result = 0
+        self.TestEnd(result)
+
     def get_enabledLogicalElementCapabilities_for_ComputerSystem(self):
         self.TestBegin()
         vms_refs = self.conn.EnumerateInstanceNames("Xen_ComputerSystem")
@@ -641,6 +700,8 @@ if __name__ == '__main__':
         cd.get_memoryPool_from_host()       # Get the memory pool to allocate memory for VMs out of
         cd.get_logicalDevice_from_host()    # get all devices associated with a host
         cd.get_VSSD_for_ComputerSystem()    # get the VSSD associated with a VM
+        cd.query_ComputerSystem()           # look VMs up by key, name and state with WQL
+        cd.query_DiskImage_by_pool()        # get the disk images of each storage pool by query and association
         cd.find_possible_hosts_to_boot_on() # find possible hosts that a VM can the boot on
         cd.get_enabledLogicalElementCapabilities_for_ComputerSystem() # get the virtualiation capabilities for a Host
         cd.get_vms_from_host()              # get VMs associated with a host
@@ -138,6 +138,55 @@ class MetricTests(TestSetUp):
             rc = 1
         self.TestEnd(rc)
 
+    def test_metric_alert_rules (self):
+        self.TestBegin()
+        rc = 0
+        rule = CIMInstance('Xen_MetricAlertRule')
+        rule['ElementName'] = 'TestHighCPU'
+        rule['DataSource'] = 'cpu*'
+        rule['SystemType'] = pywbem.Uint16(0)          # VMs
+        rule['Threshold'] = pywbem.Real64(0.9)
+        rule['ClearThreshold'] = pywbem.Real64(0.8)
+        rule['PerceivedSeverity'] = pywbem.Uint16(4)
+        print 'Creating alert rule %s' % rule['ElementName']
+        try:
+            rule_ref = self.conn.CreateInstance(rule)
+            rules = self.conn.EnumerateInstances('Xen_MetricAlertRule')
+            for r in rules:
+                print '    InstanceID: %s, DataSource:%s Threshold:%s Clear:%s' % (r['InstanceID'], r['DataSource'], r['Threshold'], r['ClearThreshold'])
+                if r['ElementName'] == 'TestHighCPU' and r['DataSource'] == 'cpu*':
+                    rc = 1
+            print 'Deleting alert rule %s' % rule_ref['InstanceID']
+            self.conn.DeleteInstance(rule_ref)
+            if len(self.conn.EnumerateInstanceNames('Xen_MetricAlertRule')) != len(rules) - 1:
+                print 'Alert rule was not deleted'
+                rc = 0
+        except pywbem.cim_operations.CIMError:
+            print 'Exception caught managing alert rules'
+            rc = 0
+        self.TestEnd(rc)
+
+    def test_provider_statistics (self):
+        self.TestBegin()
+        rc = 0
+        try:
+            vms = self.conn.EnumerateInstanceNames('Xen_ComputerSystem')
+            stats = self.conn.EnumerateInstances('Xen_ProviderStatistics')
+            for stat in stats:
+                print '    %s: calls:%d errors:%d xapi calls:%d mean:%dus p99:%dus' % (stat['InstanceID'], stat['Calls'], stat['Errors'], stat['XenAPICalls'], stat['MeanLatency'], stat['Latency99thPercentile'])
+                if stat['ClassName'] == 'Xen_ComputerSystem' and stat['Operation'] == 'EnumerateInstanceNames':
+                    if stat['Calls'] > 0 and stat['XenAPICalls'] > 0 and len(stat['LatencyHistogramCounts']) > 0:
+                        rc = 1
+            if rc == 1:
+                stat = self.conn.GetInstance(stats[0].path)
+                if stat['InstanceID'] != stats[0]['InstanceID']:
+                    print 'GetInstance returned the wrong statistics'
+                    rc = 0
+        except pywbem.cim_operations.CIMError:
+            print 'Exception caught getting the provider statistics'
+            rc = 0
+        self.TestEnd(rc)
+
     def LocalCleanup (self):
         in_params = {'RequestedState':'4'} 
         ChangeVMState(self.conn, self.pv_test_vm, in_params, True, '4')
@@ -153,6 +202,8 @@ if __name__ == '__main__':
         mt.get_historical_host_metrics()   # Get historical metrics for a Host, in Xport form
         mt.get_historical_vm_metrics()     # get historical metrics for a VM, in Xport form
         mt.test_instantaneous_metrics()   # Test all classes that represent instantaneous metrics (proc utilization, nic reads and writes/s etc)
+        mt.test_metric_alert_rules()      # Create, enumerate and delete a metric alert rule
+        mt.test_provider_statistics()     # Check the per operation statistics kept by the providers
     finally:
         mt.LocalCleanup()
         mt.TestCleanup()